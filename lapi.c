@@ -23,6 +23,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "llex.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -49,8 +50,97 @@ const char lua_ident[] =
 /* test for pseudo index */
 #define ispseudo(i)		((i) <= LUA_REGISTRYINDEX)
 
+/* test for the pseudo-indices of Lua 5.1 (see 'index2compat') */
+#define iscompat(i)		((i) <= LUA_ENVIRONINDEX)
+
 /* test for upvalue */
-#define isupvalue(i)		((i) < LUA_REGISTRYINDEX)
+#define isupvalue(i)		((i) < LUA_REGISTRYINDEX && !iscompat(i))
+
+
+/* a 'lua_Key' is the address of its (short) string */
+#define key2ts(k)	cast(TString *, (k))
+#define ts2key(ts)	cast(const lua_Key *, (ts))
+
+
+/*
+** Index of the '_ENV' upvalue of a Lua function, or -1 if it has none.
+** Without debug information, only a main chunk is known to have one
+** (its first upvalue).
+*/
+static int envindex (const Proto *p) {
+  int i;
+  for (i = 0; i < p->sizeupvalues; i++) {
+    TString *name = p->upvalues[i].name;
+    if (name == NULL ? (i == 0 && p->linedefined == 0)
+                     : strcmp(getstr(name), LUA_ENV) == 0)
+      return i;
+  }
+  return -1;
+}
+
+
+/*
+** Slot of the environment of the running function, as in Lua 5.1: the
+** '_ENV' of a Lua function (when called from a hook) or else the
+** environment of the thread. Returns NULL if that is the global table.
+*/
+static TValue *curenv (lua_State *L) {
+  const TValue *func = s2v(L->ci->func.p);
+  if (ttisLclosure(func)) {
+    LClosure *cl = clLvalue(func);
+    int i = envindex(cl->p);
+    if (i >= 0)
+      return cl->upvals[i]->v.p;
+  }
+  return (ttisnil(&L->env)) ? NULL : &L->env;
+}
+
+
+/*
+** Value of a pseudo-index of Lua 5.1: LUA_GLOBALSINDEX is the global
+** table; LUA_ENVIRONINDEX is the environment of the running function
+** (see 'curenv'). Values inside tables have no stable addresses, so the
+** global table is copied to 'L->pseudo', which the collector marks.
+*/
+static TValue *index2compat (lua_State *L, int idx) {
+  api_check(L, idx == LUA_GLOBALSINDEX || idx == LUA_ENVIRONINDEX,
+               "invalid index");
+  if (idx == LUA_ENVIRONINDEX) {
+    TValue *env = curenv(L);
+    if (env != NULL)
+      return env;
+  }
+  luaH_getint(hvalue(&G(L)->l_registry), LUA_RIDX_GLOBALS, &L->pseudo);
+  return &L->pseudo;
+}
+
+
+/*
+** Replace the value of a pseudo-index of Lua 5.1 by 'v'. Only
+** LUA_GLOBALSINDEX changes the global table in the registry;
+** LUA_ENVIRONINDEX changes the environment of the running function.
+*/
+static void setcompat (lua_State *L, int idx, const TValue *v) {
+  api_check(L, idx == LUA_GLOBALSINDEX || idx == LUA_ENVIRONINDEX,
+               "invalid index");
+  api_check(L, ttistable(v), "environment must be a table");
+  if (idx == LUA_GLOBALSINDEX) {
+    Table *reg = hvalue(&G(L)->l_registry);
+    luaH_setint(L, reg, LUA_RIDX_GLOBALS, cast(TValue *, v));
+    luaC_barrierback(L, obj2gco(reg), v);
+  }
+  else {
+    const TValue *func = s2v(L->ci->func.p);
+    int i = (ttisLclosure(func)) ? envindex(clLvalue(func)->p) : -1;
+    if (i >= 0) {  /* '_ENV' of a Lua function? */
+      UpVal *uv = clLvalue(func)->upvals[i];
+      setobj(L, uv->v.p, v);
+      luaC_barrier(L, uv, v);
+    }
+    else  /* like its stack, the thread needs no barrier */
+      setobj(L, &L->env, v);
+  }
+}
 
 
 /*
@@ -72,6 +162,8 @@ static TValue *index2value (lua_State *L, int idx) {
   }
   else if (idx == LUA_REGISTRYINDEX)
     return &G(L)->l_registry;
+  else if (iscompat(idx))
+    return index2compat(L, idx);
   else {  /* upvalues */
     idx = LUA_REGISTRYINDEX - idx;
     api_check(L, idx <= MAXUPVAL + 1, "upvalue index too large");
@@ -256,13 +348,17 @@ LUA_API void lua_copy (lua_State *L, int fromidx, int toidx) {
   TValue *fr, *to;
   lua_lock(L);
   fr = index2value(L, fromidx);
-  to = index2value(L, toidx);
-  api_check(L, isvalid(L, to), "invalid index");
-  setobj(L, to, fr);
-  if (isupvalue(toidx))  /* function upvalue? */
-    luaC_barrier(L, clCvalue(s2v(L->ci->func.p)), fr);
-  /* LUA_REGISTRYINDEX does not need gc barrier
-     (collector revisits it before finishing collection) */
+  if (iscompat(toidx))  /* replacing an environment? */
+    setcompat(L, toidx, fr);
+  else {
+    to = index2value(L, toidx);
+    api_check(L, isvalid(L, to), "invalid index");
+    setobj(L, to, fr);
+    if (isupvalue(toidx))  /* function upvalue? */
+      luaC_barrier(L, clCvalue(s2v(L->ci->func.p)), fr);
+    /* LUA_REGISTRYINDEX does not need gc barrier
+       (collector revisits it before finishing collection) */
+  }
   lua_unlock(L);
 }
 
@@ -594,6 +690,16 @@ LUA_API const char *lua_pushstring (lua_State *L, const char *s) {
 }
 
 
+LUA_API const char *lua_pushkey (lua_State *L, const lua_Key *k) {
+  TString *ts = key2ts(k);
+  lua_lock(L);
+  setsvalue2s(L, L->top.p, ts);
+  api_incr_top(L);
+  lua_unlock(L);
+  return getstr(ts);
+}
+
+
 LUA_API const char *lua_pushvfstring (lua_State *L, const char *fmt,
                                       va_list argp) {
   const char *ret;
@@ -677,10 +783,11 @@ LUA_API int lua_pushthread (lua_State *L) {
 */
 
 
-static int auxgetstr (lua_State *L, const TValue *t, const char *k) {
-  lu_byte tag;
-  TString *str = luaS_new(L, k);
-  luaV_fastget(t, str, s2v(L->top.p), luaH_getstr, tag);
+/*
+** Finish a get of t[str], after a fast get that returned 'tag'
+*/
+static int finishgetstr (lua_State *L, const TValue *t, TString *str,
+                                       lu_byte tag) {
   if (!tagisempty(tag))
     api_incr_top(L);
   else {
@@ -693,6 +800,14 @@ static int auxgetstr (lua_State *L, const TValue *t, const char *k) {
 }
 
 
+static int auxgetstr (lua_State *L, const TValue *t, const char *k) {
+  lu_byte tag;
+  TString *str = luaS_new(L, k);
+  luaV_fastget(t, str, s2v(L->top.p), luaH_getstr, tag);
+  return finishgetstr(L, t, str, tag);
+}
+
+
 /*
 ** The following function assumes that the registry cannot be a weak
 ** table; so, an emergency collection while using the global table
@@ -734,6 +849,17 @@ LUA_API int lua_getfield (lua_State *L, int idx, const char *k) {
 }
 
 
+LUA_API int lua_getfieldk (lua_State *L, int idx, const lua_Key *k) {
+  TString *str = key2ts(k);
+  const TValue *t;
+  lu_byte tag;
+  lua_lock(L);
+  t = index2value(L, idx);
+  luaV_fastget(t, str, s2v(L->top.p), luaH_getshortstr, tag);
+  return finishgetstr(L, t, str, tag);
+}
+
+
 LUA_API int lua_geti (lua_State *L, int idx, lua_Integer n) {
   TValue *t;
   lu_byte tag;
@@ -799,6 +925,19 @@ LUA_API int lua_rawgetp (lua_State *L, int idx, const void *p) {
 }
 
 
+LUA_API int lua_rawgetarray (lua_State *L, int idx, lua_Integer i,
+                                         lua_Number *v, int n) {
+  Table *t;
+  unsigned res;
+  lua_lock(L);
+  api_check(L, n >= 0, "negative count");
+  t = gettable(L, idx);
+  res = luaH_getnumbers(t, i, v, cast_uint(n));
+  lua_unlock(L);
+  return cast_int(res);
+}
+
+
 LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
   Table *t;
   lua_lock(L);
@@ -812,6 +951,19 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
 }
 
 
+LUA_API void lua_createarray (lua_State *L, const lua_Number *v, int n) {
+  Table *t;
+  lua_lock(L);
+  api_check(L, n >= 0, "negative count");
+  t = luaH_new(L);
+  sethvalue2s(L, L->top.p, t);
+  api_incr_top(L);
+  luaH_setnumbers(L, t, 1, v, cast_uint(n));
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
 LUA_API int lua_getmetatable (lua_State *L, int objindex) {
   const TValue *obj;
   Table *mt;
@@ -859,18 +1011,48 @@ LUA_API int lua_getiuservalue (lua_State *L, int idx, int n) {
 }
 
 
+/*
+** Environments of Lua 5.1: the environment of a Lua function is its
+** '_ENV' upvalue; a thread has its environment in 'L->env'. The global
+** table stands for missing environments.
+*/
+LUA_API int lua_getfenv (lua_State *L, int idx) {
+  const TValue *o;
+  const TValue *env = NULL;
+  int t;
+  lua_lock(L);
+  o = index2value(L, idx);
+  if (ttisLclosure(o)) {
+    LClosure *cl = clLvalue(o);
+    int i = envindex(cl->p);
+    if (i >= 0)
+      env = cl->upvals[i]->v.p;
+  }
+  else if (ttisthread(o) && !ttisnil(&thvalue(o)->env))
+    env = &thvalue(o)->env;
+  if (env != NULL) {
+    setobj2s(L, L->top.p, env);
+  }
+  else  /* use the global table */
+    luaH_getint(hvalue(&G(L)->l_registry), LUA_RIDX_GLOBALS,
+                s2v(L->top.p));
+  t = ttype(s2v(L->top.p));
+  api_incr_top(L);
+  lua_unlock(L);
+  return t;
+}
+
+
 /*
 ** set functions (stack -> Lua)
 */
 
 /*
-** t[k] = value at the top of the stack (where 'k' is a string)
+** Finish a set of t[str] = value at the top of the stack, after a fast
+** set that returned 'hres'
 */
-static void auxsetstr (lua_State *L, const TValue *t, const char *k) {
-  int hres;
-  TString *str = luaS_new(L, k);
-  api_checkpop(L, 1);
-  luaV_fastset(t, str, s2v(L->top.p - 1), hres, luaH_psetstr);
+static void finishsetstr (lua_State *L, const TValue *t, TString *str,
+                                        int hres) {
   if (hres == HOK) {
     luaV_finishfastset(L, t, s2v(L->top.p - 1));
     L->top.p--;  /* pop value */
@@ -885,6 +1067,18 @@ static void auxsetstr (lua_State *L, const TValue *t, const char *k) {
 }
 
 
+/*
+** t[k] = value at the top of the stack (where 'k' is a string)
+*/
+static void auxsetstr (lua_State *L, const TValue *t, const char *k) {
+  int hres;
+  TString *str = luaS_new(L, k);
+  api_checkpop(L, 1);
+  luaV_fastset(t, str, s2v(L->top.p - 1), hres, luaH_psetstr);
+  finishsetstr(L, t, str, hres);
+}
+
+
 LUA_API void lua_setglobal (lua_State *L, const char *name) {
   TValue gt;
   lua_lock(L);  /* unlock done in 'auxsetstr' */
@@ -915,6 +1109,18 @@ LUA_API void lua_setfield (lua_State *L, int idx, const char *k) {
 }
 
 
+LUA_API void lua_setfieldk (lua_State *L, int idx, const lua_Key *k) {
+  TString *str = key2ts(k);
+  const TValue *t;
+  int hres;
+  lua_lock(L);  /* unlock done in 'finishsetstr' */
+  api_checkpop(L, 1);
+  t = index2value(L, idx);
+  luaV_fastset(t, str, s2v(L->top.p - 1), hres, luaH_psetshortstr);
+  finishsetstr(L, t, str, hres);
+}
+
+
 LUA_API void lua_seti (lua_State *L, int idx, lua_Integer n) {
   TValue *t;
   int hres;
@@ -971,6 +1177,17 @@ LUA_API void lua_rawseti (lua_State *L, int idx, lua_Integer n) {
 }
 
 
+LUA_API void lua_rawsetarray (lua_State *L, int idx, lua_Integer i,
+                                          const lua_Number *v, int n) {
+  Table *t;
+  lua_lock(L);
+  api_check(L, n >= 0, "negative count");
+  t = gettable(L, idx);
+  luaH_setnumbers(L, t, i, v, cast_uint(n));  /* numbers need no barrier */
+  lua_unlock(L);
+}
+
+
 LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   TValue *obj;
   Table *mt;
@@ -1031,6 +1248,36 @@ LUA_API int lua_setiuservalue (lua_State *L, int idx, int n) {
 }
 
 
+LUA_API int lua_setfenv (lua_State *L, int idx) {
+  TValue *o;
+  TValue *env = s2v(L->top.p - 1);
+  int res = 1;
+  lua_lock(L);
+  api_checkpop(L, 1);
+  o = index2value(L, idx);
+  api_check(L, ttistable(env) || ttisnil(env), "table expected");
+  if (ttisLclosure(o)) {
+    LClosure *cl = clLvalue(o);
+    int i = envindex(cl->p);
+    if (i >= 0) {
+      UpVal *uv = cl->upvals[i];
+      setobj(L, uv->v.p, env);
+      luaC_barrier(L, uv, env);
+    }
+    else
+      res = 0;  /* function does not use an environment */
+  }
+  else if (ttisthread(o)) {  /* like its stack, needs no barrier */
+    setobj(L, &thvalue(o)->env, env);
+  }
+  else
+    res = 0;
+  L->top.p--;
+  lua_unlock(L);
+  return res;
+}
+
+
 /*
 ** 'load' and 'call' functions (run Lua code)
 */
@@ -1127,6 +1374,22 @@ LUA_API int lua_pcallk (lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
+/*
+** Set the global table as the first upvalue of a new main function
+*/
+static void setglobalenv (lua_State *L) {
+  LClosure *f = clLvalue(s2v(L->top.p - 1));  /* get new function */
+  if (f->nupvalues >= 1) {  /* does it have an upvalue? */
+    /* get global table from registry */
+    TValue gt;
+    getGlobalTable(L, &gt);
+    /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
+    setobj(L, f->upvals[0]->v.p, &gt);
+    luaC_barrier(L, f->upvals[0], &gt);
+  }
+}
+
+
 LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
                       const char *chunkname, const char *mode) {
   ZIO z;
@@ -1134,18 +1397,61 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
   lua_lock(L);
   if (!chunkname) chunkname = "?";
   luaZ_init(L, &z, reader, data);
-  status = luaD_protectedparser(L, &z, chunkname, mode);
-  if (status == LUA_OK) {  /* no errors? */
-    LClosure *f = clLvalue(s2v(L->top.p - 1));  /* get new function */
-    if (f->nupvalues >= 1) {  /* does it have an upvalue? */
-      /* get global table from registry */
-      TValue gt;
-      getGlobalTable(L, &gt);
-      /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
-      setobj(L, f->upvals[0]->v.p, &gt);
-      luaC_barrier(L, f->upvals[0], &gt);
-    }
+  status = luaD_protectedparser(L, &z, chunkname, mode, NULL);
+  if (status == LUA_OK)  /* no errors? */
+    setglobalenv(L);
+  lua_unlock(L);
+  return APIstatus(status);
+}
+
+
+typedef struct LoadFixed {
+  const char *buff;
+  size_t size;
+} LoadFixed;
+
+
+static const char *getfixed (lua_State *L, void *ud, size_t *size) {
+  LoadFixed *lf = cast(LoadFixed *, ud);
+  UNUSED(L);
+  *size = lf->size;  /* whole buffer in one piece */
+  lf->size = 0;
+  return lf->buff;
+}
+
+
+/*
+** Load a binary chunk in place from a buffer that Lua then owns. The
+** buffer is released when nothing loaded from it is in use, which may
+** be right after the load (e.g., if it fails). The reference held by
+** 'fb' during the load ensures it is not released before that.
+*/
+LUA_API int lua_loadfixed (lua_State *L, const char *buff, size_t size,
+                           const char *chunkname, lua_Alloc falloc,
+                           void *ud) {
+  ZIO z;
+  LoadFixed lf;
+  TStatus status;
+  global_State *g;
+  FixedBuff *fb;
+  lua_lock(L);
+  g = G(L);
+  if (!chunkname) chunkname = "?";
+  fb = cast(FixedBuff *, (*g->frealloc)(g->ud, NULL, 0, sizeof(FixedBuff)));
+  if (l_unlikely(fb == NULL)) {  /* memory error? */
+    (*falloc)(ud, cast_voidp(buff), size, 0);  /* release buffer */
+    luaM_error(L);
   }
+  fb->falloc = falloc; fb->ud = ud;
+  fb->buff = cast_voidp(buff); fb->size = size;
+  fb->frealloc = g->frealloc; fb->fud = g->ud;
+  fb->nrefs = 1;  /* reference from this function */
+  lf.buff = buff; lf.size = size;
+  luaZ_init(L, &z, getfixed, &lf);
+  status = luaD_protectedparser(L, &z, chunkname, "B", fb);
+  if (status == LUA_OK)  /* no errors? */
+    setglobalenv(L);
+  luaF_releasefixed(fb);  /* buffer may be released now */
   lua_unlock(L);
   return APIstatus(status);
 }
@@ -1227,6 +1533,45 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       g->gcstp = oldstp;  /* restore previous state */
       break;
     }
+    case LUA_GCDEADLINE: {
+      lu_byte oldstp = g->gcstp;
+      l_mem usec = cast(l_mem, va_arg(argp, int));
+      g->gcstp = 0;  /* allow GC to run (other bits must be zero here) */
+      res = luaC_stepdeadline(L, usec);
+      g->gcstp = oldstp;  /* restore previous state */
+      break;
+    }
+    case LUA_GCPOOL: {
+      lua_PoolStats *stats = va_arg(argp, lua_PoolStats *);
+      res = luaM_poolstats(g, stats);
+      break;
+    }
+    case LUA_GCBGFREE: {
+      int kbytes = va_arg(argp, int);
+      res = luaM_bglimit(g, kbytes);
+      break;
+    }
+    case LUA_GCTARGET: {
+      int usec = va_arg(argp, int);
+      int *overhead = va_arg(argp, int *);
+      api_check(L, usec < 0 || *overhead >= 0, "invalid heap overhead");
+      res = luaC_settarget(g, usec, overhead);
+      break;
+    }
+    case LUA_GCSTATS: {
+      lua_GCStats *stats = va_arg(argp, lua_GCStats *);
+      int reset = va_arg(argp, int);
+      *stats = g->gcstats;
+      if (reset)
+        memset(&g->gcstats, 0, sizeof(g->gcstats));
+      break;
+    }
+    case LUA_GCCENSUS: {
+      lua_Census *census = va_arg(argp, lua_Census *);
+      *census = g->census;
+      census->total = cast_sizet(gettotalbytes(g));
+      break;
+    }
     case LUA_GCISRUNNING: {
       res = gcrunning(g);
       break;
@@ -1258,6 +1603,76 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
 }
 
 
+/*
+** Quickening (see 'luaV_execute')
+*/
+LUA_API lua_Unsigned lua_quicken (lua_State *L, int what) {
+  global_State *g;
+  lua_Unsigned res = 0;
+  lua_lock(L);
+  g = G(L);
+  switch (what) {
+    case LUA_QUICKSTOP: g->quickening = 0; break;
+    case LUA_QUICKSTART: g->quickening = 1; break;
+    case LUA_QUICKRESET: {
+      g->qrewrites = g->qhits = g->qdeopts = 0;
+      break;
+    }
+    case LUA_QUICKISRUNNING: res = g->quickening; break;
+    case LUA_QUICKREWRITES: res = g->qrewrites; break;
+    case LUA_QUICKHITS: res = g->qhits; break;
+    case LUA_QUICKDEOPTS: res = g->qdeopts; break;
+    default: res = ~(lua_Unsigned)0;  /* invalid option */
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Pairs of instructions (see 'luaV_execute'). Pairs are numbered from 1
+** in the order of their opcodes; without LUAI_OPPAIRS there are none.
+*/
+#if defined(LUAI_OPPAIRS)
+
+#include "lopnames.h"
+
+LUA_API int lua_getoppair (lua_State *L, int n, const char **first,
+                           const char **second, lua_Unsigned *count) {
+  if (n < 1 || n > FIRST_QUICKOP * FIRST_QUICKOP)
+    return 0;
+  n--;
+  lua_lock(L);
+  *first = opnames[n / FIRST_QUICKOP];
+  *second = opnames[n % FIRST_QUICKOP];
+  *count = G(L)->oppairs[n / FIRST_QUICKOP][n % FIRST_QUICKOP];
+  lua_unlock(L);
+  return 1;
+}
+
+
+LUA_API void lua_resetoppairs (lua_State *L) {
+  lua_lock(L);
+  memset(G(L)->oppairs, 0, sizeof(G(L)->oppairs));
+  lua_unlock(L);
+}
+
+#else
+
+LUA_API int lua_getoppair (lua_State *L, int n, const char **first,
+                           const char **second, lua_Unsigned *count) {
+  UNUSED(L); UNUSED(n); UNUSED(first); UNUSED(second); UNUSED(count);
+  return 0;
+}
+
+
+LUA_API void lua_resetoppairs (lua_State *L) {
+  UNUSED(L);
+}
+
+#endif
+
+
 
 /*
 ** miscellaneous functions
@@ -1331,6 +1746,33 @@ LUA_API void lua_len (lua_State *L, int idx) {
 }
 
 
+/*
+** Intern 'name' as a key. The key's string is anchored in 'G(L)->keys',
+** so it is never collected and the key stays valid while the state is
+** open.
+*/
+LUA_API const lua_Key *lua_newkey (lua_State *L, const char *name) {
+  global_State *g = G(L);
+  TString *ts;
+  TValue k, v;
+  lua_lock(L);
+  ts = luaS_new(L, name);
+  api_check(L, strisshr(ts), "key name too long");
+  setsvalue2s(L, L->top.p, ts);  /* anchor string while creating table */
+  api_incr_top(L);
+  if (g->keys == NULL)
+    g->keys = luaH_new(L);
+  setsvalue(L, &k, ts);
+  setbtvalue(&v);
+  luaH_set(L, g->keys, &k, &v);
+  luaC_barrierback(L, obj2gco(g->keys), &k);
+  L->top.p--;  /* remove string */
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return ts2key(ts);
+}
+
+
 LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
   lua_Alloc f;
   lua_lock(L);
@@ -1343,6 +1785,7 @@ LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
 
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  luaM_bgwait(G(L));  /* pending blocks go to the old function */
   G(L)->ud = ud;
   G(L)->frealloc = f;
   lua_unlock(L);
@@ -1357,6 +1800,14 @@ void lua_setwarnf (lua_State *L, lua_WarnFunction f, void *ud) {
 }
 
 
+void lua_setgcf (lua_State *L, lua_GCFunction f, void *ud) {
+  lua_lock(L);
+  G(L)->ud_gcf = ud;
+  G(L)->gcf = f;
+  lua_unlock(L);
+}
+
+
 void lua_warning (lua_State *L, const char *msg, int tocont) {
   lua_lock(L);
   luaE_warning(L, msg, tocont);
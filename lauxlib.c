@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 
 /*
@@ -813,12 +814,236 @@ static int skipcomment (FILE *f, int *cp) {
 }
 
 
+/*
+** {------------------------------------------------------
+** Cache of compiled chunks
+** -------------------------------------------------------
+*/
+
+#if !defined(l_filetime)	/* { */
+
+#if defined(LUA_USE_POSIX)
+
+#include <sys/stat.h>
+
+static lua_Integer l_filetime (const char *fname) {
+  struct stat st;
+  return (stat(fname, &st) == 0) ? (lua_Integer)st.st_mtime : 0;
+}
+
+#else
+
+/* ISO C cannot get file times; cache keys rely on contents only */
+#define l_filetime(fname)	((void)(fname), 0)
+
+#endif
+
+#endif				/* } */
+
+
+/* FNV-1a hash of a block of memory */
+static lua_Unsigned hashblock (const char *s, size_t l) {
+  lua_Unsigned h = (lua_Unsigned)2166136261u;
+  for (; l > 0; l--)
+    h = (h ^ (unsigned char)*(s++)) * 16777619u;
+  return h;
+}
+
+
+/*
+** Read the whole file 'fname' and push its contents. Returns 0 (and
+** pushes nothing) if the file cannot be read.
+*/
+static int readwhole (lua_State *L, const char *fname) {
+  luaL_Buffer b;
+  size_t n;
+  int ok;
+  FILE *f = fopen(fname, "rb");
+  if (f == NULL)
+    return 0;
+  luaL_buffinit(L, &b);
+  do {
+    char *p = luaL_prepbuffer(&b);
+    n = fread(p, 1, LUAL_BUFFERSIZE, f);
+    luaL_addsize(&b, n);
+  } while (n == LUAL_BUFFERSIZE);
+  ok = !ferror(f);
+  fclose(f);
+  luaL_pushresult(&b);
+  if (!ok)
+    lua_pop(L, 1);
+  return ok;
+}
+
+
+static int filewriter (lua_State *L, const void *b, size_t size, void *f) {
+  UNUSED(L);
+  if (b == NULL)  /* finishing dump? */
+    return 0;
+  return (fwrite(b, 1, size, (FILE *)f) != size);
+}
+
+
+/* add 'delta' to the number in field 'k' of table at the top */
+static void addcounter (lua_State *L, const char *k, lua_Number delta) {
+  lua_getfield(L, -1, k);
+  if (lua_isinteger(L, -1) && delta == (lua_Number)(lua_Integer)delta)
+    lua_pushinteger(L, lua_tointeger(L, -1) + (lua_Integer)delta);
+  else
+    lua_pushnumber(L, lua_tonumber(L, -1) + delta);
+  lua_setfield(L, -3, k);
+  lua_pop(L, 1);
+}
+
+
+/*
+** Save the dump of the function on the top of the stack in the cache
+** file 'cpath', preceded by a line with the cache 'key' and the time
+** spent compiling it. Writes a temporary file and renames it, so that
+** a concurrent reader never sees a partial file. Failures are ignored:
+** the cache is only an optimization.
+*/
+static void savechunk (lua_State *L, const char *cpath, const char *key,
+                       double ctime, int strip) {
+  const char *tmp = lua_pushfstring(L, "%s.tmp", cpath);
+  FILE *f = fopen(tmp, "wb");
+  if (f != NULL) {
+    int err;
+    lua_pushvalue(L, -2);  /* function to be dumped */
+    err = (fprintf(f, "%s %.6f\n", key, ctime) < 0);
+    err |= lua_dump(L, filewriter, f, strip);
+    err |= (fclose(f) != 0);
+    lua_pop(L, 1);  /* function */
+    if (!err) {
+      remove(cpath);  /* ISO C 'rename' may fail if 'cpath' exists */
+      err = (rename(tmp, cpath) != 0);
+    }
+    if (err)
+      remove(tmp);
+  }
+  lua_pop(L, 1);  /* 'tmp' */
+}
+
+
+/*
+** Load text file 'filename' through the cache of compiled chunks, if
+** it is enabled. The cache file for 'filename' starts with a line with
+** its key: the Lua version, whether it is stripped, and the time,
+** size, and hash of the source; the dump follows that line. Returns -1
+** (and pushes nothing) when the cache is disabled or cannot handle the
+** file, so that the caller loads it as usual.
+*/
+static int cachedload (lua_State *L, const char *filename,
+                                     const char *mode) {
+  int top = lua_gettop(L);
+  int strip, status;
+  size_t len, clen;
+  const char *s, *c, *dir, *key, *cpath, *chunkname;
+  clock_t t0;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, LUA_CHUNKCACHE_KEY) != LUA_TTABLE ||
+      lua_getfield(L, top + 1, "dir") != LUA_TSTRING ||
+      !readwhole(L, filename)) {
+    lua_settop(L, top);
+    return -1;  /* no cache or no readable file */
+  }
+  dir = lua_tostring(L, top + 2);
+  s = lua_tolstring(L, top + 3, &len);
+  lua_getfield(L, top + 1, "strip");
+  strip = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  key = lua_pushfstring(L, "LUACACHE %d %d %I %I %I", LUA_VERSION_RELEASE_NUM,
+                        strip, l_filetime(filename), (lua_Integer)len,
+                        (lua_Integer)(hashblock(s, len) & LUA_MAXINTEGER));
+  cpath = lua_pushfstring(L, "%s/%I.luac", dir,
+          (lua_Integer)(hashblock(filename, strlen(filename)) & LUA_MAXINTEGER));
+  chunkname = lua_pushfstring(L, "@%s", filename);
+  if (len >= 3 && memcmp(s, "\xEF\xBB\xBF", 3) == 0) {  /* BOM? */
+    s += 3; len -= 3;
+  }
+  if (len > 0 && *s == '#') {  /* first line is a comment? */
+    do { s++; len--; } while (len > 0 && *s != '\n');
+  }  /* (keep newline to correct line numbers) */
+  if (len > 0 && *s == LUA_SIGNATURE[0]) {  /* binary file? */
+    lua_settop(L, top);
+    return -1;  /* nothing to cache */
+  }
+  lua_settop(L, top + 7);  /* 'top + 7' receives the result */
+  if (readwhole(L, cpath)) {  /* is there a cache file? */
+    size_t klen = strlen(key);
+    c = lua_tolstring(L, -1, &clen);
+    if (clen > klen && memcmp(c, key, klen) == 0 && c[klen] == ' ') {
+      char *end;
+      double ctime = strtod(c + klen + 1, &end);  /* saved compile time */
+      if (*end == '\n') {
+        t0 = clock();
+        end++;
+        status = luaL_loadbufferx(L, end, clen - (size_t)(end - c),
+                                  chunkname, "b");
+        if (status == LUA_OK) {
+          lua_pushvalue(L, top + 1);
+          addcounter(L, "hits", 1);
+          addcounter(L, "saved",
+                     ctime - (double)(clock() - t0) / CLOCKS_PER_SEC);
+          lua_pop(L, 1);
+          lua_replace(L, top + 7);
+          goto done;
+        }
+        lua_pop(L, 1);  /* error message; compile it again */
+      }
+    }
+    lua_pop(L, 1);  /* cache file contents */
+  }
+  t0 = clock();
+  status = luaL_loadbufferx(L, s, len, chunkname, mode);
+  lua_pushvalue(L, top + 1);
+  addcounter(L, "misses", 1);
+  lua_pop(L, 1);
+  if (status == LUA_OK)
+    savechunk(L, cpath, key,
+              (double)(clock() - t0) / CLOCKS_PER_SEC, strip);
+  lua_replace(L, top + 7);
+ done:
+  lua_copy(L, top + 7, top + 1);  /* put result in place */
+  lua_settop(L, top + 1);
+  return status;
+}
+
+
+LUALIB_API void luaL_chunkcache (lua_State *L, const char *dir, int strip) {
+  if (dir == NULL) {  /* disable cache? */
+    lua_pushnil(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, LUA_CHUNKCACHE_KEY);
+  }
+  else {
+    lua_createtable(L, 0, 5);
+    lua_pushstring(L, dir);
+    lua_setfield(L, -2, "dir");
+    lua_pushboolean(L, strip);
+    lua_setfield(L, -2, "strip");
+    lua_pushinteger(L, 0);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, 0);
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, 0);
+    lua_setfield(L, -2, "saved");
+    lua_setfield(L, LUA_REGISTRYINDEX, LUA_CHUNKCACHE_KEY);
+  }
+}
+
+/* }------------------------------------------------------ */
+
+
 LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
                                              const char *mode) {
   LoadF lf;
   int status, readstatus;
   int c;
   int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+  if (filename != NULL && (mode == NULL || strchr(mode, 't') != NULL)) {
+    status = cachedload(L, filename, mode);
+    if (status >= 0)  /* handled by the cache? */
+      return status;
+  }
   if (filename == NULL) {
     lua_pushliteral(L, "=stdin");
     lf.f = stdin;
@@ -885,6 +1110,109 @@ LUALIB_API int luaL_loadstring (lua_State *L, const char *s) {
   return luaL_loadbuffer(L, s, strlen(s), s);
 }
 
+
+/*
+** {------------------------------------------------------
+** Loading of memory-mapped files
+** -------------------------------------------------------
+*/
+
+#if !defined(l_mapfile)	/* { */
+
+#if defined(LUA_USE_POSIX)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+** Map file 'fname' for reading. Returns NULL if the file cannot be
+** mapped (e.g., it is empty or it cannot be opened).
+*/
+static void *l_mapfile (const char *fname, size_t *size) {
+  void *p = NULL;
+  struct stat st;
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    *size = (size_t)st.st_size;
+    p = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+      p = NULL;
+  }  /* else not a regular file or empty (or 'fstat' failed) */
+  close(fd);
+  return p;
+}
+
+#define l_unmapfile(p,size)	munmap(p, size)
+
+#else				/* }{ */
+
+/* ISO C has no mapped files; 'luaL_loadfilemapped' reads the file */
+#define l_mapfile(fname,size)	((void)(fname), (void)(size), NULL)
+#define l_unmapfile(p,size)	((void)(p), (void)(size))
+
+#endif				/* } */
+
+#endif				/* } */
+
+
+/*
+** Releases a mapping (as a deallocation function for 'lua_loadfixed')
+*/
+static void *unmapbuff (void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void)ud; (void)nsize;  /* not used */
+  l_unmapfile(ptr, osize);
+  return NULL;
+}
+
+
+/*
+** Binary chunks from a mapped file are loaded in place with
+** 'lua_loadfixed', so that code and long strings stay in the mapping,
+** which is released when nothing loaded from it is in use anymore.
+** Text chunks are copied by the parser, so their mappings are released
+** right after loading. Files that cannot be mapped are read as usual.
+*/
+LUALIB_API int luaL_loadfilemapped (lua_State *L, const char *filename,
+                                                  const char *mode) {
+  void *addr;
+  const char *s;
+  size_t size, msize;
+  int status;
+  if (filename == NULL)  /* standard input? */
+    return luaL_loadfilex(L, NULL, mode);
+  addr = l_mapfile(filename, &msize);
+  if (addr == NULL)  /* cannot map file? */
+    return luaL_loadfilex(L, filename, mode);  /* read it as usual */
+  lua_pushfstring(L, "@%s", filename);
+  s = (const char *)addr;
+  size = msize;
+  if (size >= 3 && memcmp(s, "\xEF\xBB\xBF", 3) == 0) {  /* BOM? */
+    s += 3; size -= 3;
+  }
+  if (size > 0 && *s == '#') {  /* first line is a comment? */
+    do { s++; size--; } while (size > 0 && *s != '\n');
+    if (size > 1 && s[1] == LUA_SIGNATURE[0]) {  /* a binary chunk next? */
+      s++; size--;  /* skip newline too */
+    }  /* else keep newline to correct line numbers */
+  }
+  if (size > 0 && *s == LUA_SIGNATURE[0] &&  /* binary chunk... */
+      s == (const char *)addr &&  /* ...aligned as dumped... */
+      (mode == NULL || strpbrk(mode, "bB") != NULL))  /* ...and allowed? */
+    status = lua_loadfixed(L, s, size, lua_tostring(L, -1), unmapbuff, NULL);
+  else {
+    status = luaL_loadbufferx(L, s, size, lua_tostring(L, -1), mode);
+    l_unmapfile(addr, msize);  /* not needed anymore */
+  }
+  lua_remove(L, -2);  /* remove chunk name */
+  return status;
+}
+
+/* }------------------------------------------------------ */
+
 /* }====================================================== */
 
 
@@ -35,6 +35,10 @@ typedef struct luaL_Buffer luaL_Buffer;
 #define LUA_PRELOAD_TABLE	"_PRELOAD"
 
 
+/* key, in the registry, for the state of the cache of compiled chunks */
+#define LUA_CHUNKCACHE_KEY	"_CHUNKCACHE"
+
+
 typedef struct luaL_Reg {
   const char *name;
   lua_CFunction func;
@@ -97,6 +101,10 @@ LUALIB_API int (luaL_loadfilex) (lua_State *L, const char *filename,
 
 #define luaL_loadfile(L,f)	luaL_loadfilex(L,f,NULL)
 
+LUALIB_API int (luaL_loadfilemapped) (lua_State *L, const char *filename,
+                                                    const char *mode);
+LUALIB_API void (luaL_chunkcache) (lua_State *L, const char *dir, int strip);
+
 LUALIB_API int (luaL_loadbufferx) (lua_State *L, const char *buff, size_t sz,
                                    const char *name, const char *mode);
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
@@ -193,6 +193,68 @@ static int pushmode (lua_State *L, int oldmode) {
 }
 
 
+static void setcount (lua_State *L, const char *k, size_t v) {
+  lua_pushinteger(L, (lua_Integer)v);
+  lua_setfield(L, -2, k);
+}
+
+
+/*
+** Pushes the statistics of the collector as a table
+*/
+static void pushgcstats (lua_State *L, const lua_GCStats *s) {
+  static const char *const phases[LUA_GCPHN] = {
+    "propagate", "atomic", "sweep", "callfin", "minor", "major"};
+  static const int types[] = {LUA_TTABLE, LUA_TFUNCTION, LUA_TUSERDATA,
+                              LUA_TTHREAD};
+  int i;
+  lua_createtable(L, 0, 6);
+  lua_createtable(L, 0, LUA_GCPHN);
+  for (i = 0; i < LUA_GCPHN; i++)
+    setcount(L, phases[i], s->time[i]);
+  lua_setfield(L, -2, "time");
+  lua_createtable(L, LUA_GCHISTN, 0);
+  for (i = 0; i < LUA_GCHISTN; i++) {
+    lua_pushinteger(L, (lua_Integer)s->pauses[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "pauses");
+  lua_createtable(L, 0, 5);
+  for (i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++)
+    setcount(L, lua_typename(L, types[i]), s->traversed[types[i]]);
+  setcount(L, "proto", s->traversed[LUA_NUMTYPES]);
+  lua_setfield(L, -2, "traversed");
+  setcount(L, "freed", s->freed);
+  setcount(L, "cycles", s->ncycles);
+  setcount(L, "minors", s->nminor);
+}
+
+
+/*
+** Pushes the census of the heap as a table, with a field for each kind
+** of block plus a field 'other' with the bytes not in any of them
+*/
+static void pushcensus (lua_State *L, const lua_Census *c) {
+  static const char *const kinds[LUA_MKN] = {
+    "table", "array", "node", "shape", "shortstring", "longstring",
+    "lclosure", "cclosure", "upvalue", "proto", "userdata", "thread",
+    "stack", "callinfo"};
+  size_t other = c->total;
+  int i;
+  lua_createtable(L, 0, LUA_MKN + 2);
+  for (i = 0; i < LUA_MKN; i++) {
+    lua_createtable(L, 0, 3);
+    setcount(L, "bytes", c->bytes[i]);
+    setcount(L, "count", c->nlive[i]);
+    setcount(L, "allocs", c->nalloc[i]);
+    lua_setfield(L, -2, kinds[i]);
+    other -= c->bytes[i];
+  }
+  setcount(L, "other", other);
+  setcount(L, "total", c->total);
+}
+
+
 /*
 ** check whether call to 'lua_gc' was valid (not inside a finalizer)
 */
@@ -201,10 +263,12 @@ static int pushmode (lua_State *L, int oldmode) {
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "isrunning", "generational", "incremental",
-    "param", NULL};
+    "param", "deadline", "pool", "bgfree", "target", "stats", "census",
+    NULL};
   static const char optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC,
-    LUA_GCPARAM};
+    LUA_GCPARAM, LUA_GCDEADLINE, LUA_GCPOOL, LUA_GCBGFREE, LUA_GCTARGET,
+    LUA_GCSTATS, LUA_GCCENSUS};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case LUA_GCCOUNT: {
@@ -221,6 +285,69 @@ static int luaB_collectgarbage (lua_State *L) {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCDEADLINE: {
+      lua_Integer usec = luaL_checkinteger(L, 2);
+      int res;
+      luaL_argcheck(L, 0 <= usec && usec <= INT_MAX, 2, "out of range");
+      res = lua_gc(L, o, (int)usec);
+      checkvalres(res);
+      lua_pushboolean(L, res == 2);  /* finished the cycle? */
+      lua_pushboolean(L, res >= 1);  /* went through the atomic phase? */
+      return 2;
+    }
+    case LUA_GCPOOL: {
+      lua_PoolStats stats;
+      int res = lua_gc(L, o, &stats);
+      checkvalres(res);
+      if (res == 0)  /* state does not use a pool? */
+        break;
+      lua_createtable(L, 0, 4);
+      lua_pushinteger(L, (lua_Integer)stats.reserved);
+      lua_setfield(L, -2, "reserved");
+      lua_pushinteger(L, (lua_Integer)stats.inuse);
+      lua_setfield(L, -2, "inuse");
+      lua_pushinteger(L, (lua_Integer)stats.nalloc);
+      lua_setfield(L, -2, "nalloc");
+      lua_pushinteger(L, (lua_Integer)stats.nfree);
+      lua_setfield(L, -2, "nfree");
+      return 1;
+    }
+    case LUA_GCBGFREE: {
+      lua_Integer kbytes = luaL_optinteger(L, 2, -1);
+      int res;
+      luaL_argcheck(L, kbytes <= INT_MAX, 2, "out of range");
+      res = lua_gc(L, o, (int)(kbytes < 0 ? -1 : kbytes));
+      checkvalres(res);
+      lua_pushinteger(L, res);
+      return 1;
+    }
+    case LUA_GCTARGET: {
+      lua_Integer usec = luaL_optinteger(L, 2, -1);
+      lua_Integer overhead = luaL_optinteger(L, 3, 100);
+      int heap = (int)overhead;
+      int res;
+      luaL_argcheck(L, usec <= INT_MAX, 2, "out of range");
+      luaL_argcheck(L, 0 <= overhead && overhead <= 10000, 3, "out of range");
+      res = lua_gc(L, o, (int)(usec < 0 ? -1 : usec), &heap);
+      checkvalres(res);
+      lua_pushinteger(L, res);
+      lua_pushinteger(L, heap);
+      return 2;
+    }
+    case LUA_GCSTATS: {
+      lua_GCStats stats;
+      int res = lua_gc(L, o, &stats, lua_toboolean(L, 2));
+      checkvalres(res);
+      pushgcstats(L, &stats);
+      return 1;
+    }
+    case LUA_GCCENSUS: {
+      lua_Census census;
+      int res = lua_gc(L, o, &census);
+      checkvalres(res);
+      pushcensus(L, &census);
+      return 1;
+    }
     case LUA_GCISRUNNING: {
       int res = lua_gc(L, o);
       checkvalres(res);
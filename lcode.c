@@ -31,6 +31,12 @@
 #include "lvm.h"
 
 
+/* build constant table constructors by cloning a template? */
+#if !defined(LUAI_TEMPLATES)
+#define LUAI_TEMPLATES		1
+#endif
+
+
 /* (note that expressions VJMP also have jumps.) */
 #define hasjumps(e)	((e)->t != (e)->f)
 
@@ -1341,6 +1347,57 @@ void luaK_self (FuncState *fs, expdesc *e, expdesc *key) {
 }
 
 
+#if LUA_USE_CMD == 1
+/*
+** Try to turn the code of a command in a 'cmd' list, from the OP_SELF
+** at 'pc' to the OP_CALL that ends the code, into an OP_CMD. That is
+** possible when each argument is a constant loaded into its register
+** by a single instruction; then each load becomes the OP_EXTRAARG
+** with the index of that constant, in place, and the call is removed.
+*/
+void luaK_cmd (FuncState *fs, int pc) {
+  Instruction *code = fs->f->code;
+  int last = fs->pc - 1;  /* the call */
+  int base = GETARG_A(code[pc]);
+  int j;
+  if (GET_OPCODE(code[pc]) != OP_SELF || GET_OPCODE(code[last]) != OP_CALL ||
+      GETARG_A(code[last]) != base || GETARG_B(code[last]) != last - pc + 1)
+    return;  /* not a call with a fixed number of arguments */
+  for (j = pc + 1; j < last; j++) {  /* check arguments */
+    Instruction i = code[j];
+    if (GETARG_A(i) != base + 1 + (j - pc))
+      return;  /* argument not in its own register */
+    switch (GET_OPCODE(i)) {
+      case OP_LOADI: case OP_LOADF: case OP_LOADK:
+      case OP_LOADFALSE: case OP_LOADTRUE:
+        break;
+      case OP_LOADNIL:
+        if (GETARG_B(i) == 0)  /* loads only one nil? */
+          break;
+        return;
+      default:
+        return;  /* not a constant argument */
+    }
+  }
+  for (j = pc + 1; j < last; j++) {  /* code arguments */
+    Instruction i = code[j];
+    int k;
+    switch (GET_OPCODE(i)) {
+      case OP_LOADI: k = luaK_intK(fs, GETARG_sBx(i)); break;
+      case OP_LOADF: k = luaK_numberK(fs, cast_num(GETARG_sBx(i))); break;
+      case OP_LOADK: k = GETARG_Bx(i); break;
+      case OP_LOADFALSE: k = boolF(fs); break;
+      case OP_LOADTRUE: k = boolT(fs); break;
+      default: lua_assert(GET_OPCODE(i) == OP_LOADNIL); k = nilK(fs); break;
+    }
+    code[j] = CREATE_Ax(OP_EXTRAARG, k);
+  }
+  SET_OPCODE(code[pc], OP_CMD);  /* same operands as OP_SELF */
+  removelastinstruction(fs);  /* remove the call */
+}
+#endif
+
+
 /* auxiliary function to define indexing expressions */
 static void fillidxk (expdesc *t, int idx, expkind k) {
   t->u.ind.idx = cast_byte(idx);
@@ -1882,6 +1939,162 @@ void luaK_settablesize (FuncState *fs, int pc, int ra, int asize, int hsize) {
 }
 
 
+/*
+** Maximum number of registers above the table that the code of a
+** constructor with a template can use. (That is more than the limit
+** given by 'maxtostore' in the parser.)
+*/
+#define MAXTREGS	64
+
+
+/*
+** Value loaded into register 'r' by the code of a constructor with the
+** table in register 'ra', or NULL if there is no such value.
+*/
+static const TValue *treg (const TValue *regs, int ra, int r) {
+  r -= ra + 1;
+  if (0 <= r && r < MAXTREGS && !isempty(&regs[r]))
+    return &regs[r];
+  else
+    return NULL;
+}
+
+
+/*
+** Run the code of a table constructor, from the OP_NEWTABLE (plus its
+** extra argument) at 'pc' to the end, over table 't', or only check
+** it, if 't' is NULL. That code can only load non-nil constants into
+** registers above the table (in 'ra') and store those values, with
+** constant keys, into the table. Return false if it does anything
+** else.
+*/
+static int runconstructor (FuncState *fs, int pc, int ra, Table *t) {
+  lua_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  TValue regs[MAXTREGS];
+  int j;
+  for (j = 0; j < MAXTREGS; j++)
+    setempty(&regs[j]);
+  for (j = pc + 2; j < fs->pc; j++) {
+    Instruction i = f->code[j];
+    int a = GETARG_A(i);
+    switch (GET_OPCODE(i)) {
+      case OP_LOADI: case OP_LOADF: case OP_LOADK:
+      case OP_LOADFALSE: case OP_LOADTRUE: {
+        TValue *r;
+        if (a <= ra || a - ra - 1 >= MAXTREGS)
+          return 0;  /* not a register for the values of the table */
+        r = &regs[a - ra - 1];
+        switch (GET_OPCODE(i)) {
+          case OP_LOADI: setivalue(r, GETARG_sBx(i)); break;
+          case OP_LOADF: setfltvalue(r, cast_num(GETARG_sBx(i))); break;
+          case OP_LOADK: setobj(L, r, &f->k[GETARG_Bx(i)]); break;
+          case OP_LOADFALSE: setbfvalue(r); break;
+          default: setbtvalue(r); break;
+        }
+        break;
+      }
+      case OP_SETTABLE: case OP_SETI: case OP_SETFIELD: {
+        TValue key;
+        const TValue *val = TESTARG_k(i) ? &f->k[GETARG_C(i)]
+                                         : treg(regs, ra, GETARG_C(i));
+        if (a != ra || val == NULL)
+          return 0;
+        switch (GET_OPCODE(i)) {
+          case OP_SETTABLE: {
+            const TValue *rb = treg(regs, ra, GETARG_B(i));
+            if (rb == NULL)
+              return 0;
+            setobj(L, &key, rb);
+            break;
+          }
+          case OP_SETI: setivalue(&key, GETARG_B(i)); break;
+          default: setobj(L, &key, &f->k[GETARG_B(i)]); break;
+        }
+        if (ttisnil(val))  /* not stored in a hash part */
+          return 0;
+        if (t != NULL) {
+          luaH_set(L, t, &key, cast(TValue *, val));
+          luaC_barrierback(L, obj2gco(t), val);
+        }
+        break;
+      }
+      case OP_SETLIST: {
+        int n = GETARG_vB(i);
+        int last = GETARG_vC(i);
+        if (a != ra || n == 0 || n > MAXTREGS)
+          return 0;  /* other table or unknown number of values */
+        if (TESTARG_k(i)) {
+          j++;  /* (not inside the macro, which may evaluate it twice) */
+          last += GETARG_Ax(f->code[j]) * (MAXARG_vC + 1);
+        }
+        for (; n > 0; n--) {
+          const TValue *val = treg(regs, ra, ra + n);
+          if (val == NULL)
+            return 0;
+          if (t != NULL) {
+            luaH_setint(L, t, last + n, cast(TValue *, val));
+            luaC_barrierback(L, obj2gco(t), val);
+          }
+        }
+        break;
+      }
+      default: return 0;  /* not a constant constructor */
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Remove all instructions from position 'pc' on. If any of them has
+** absolute line information, the next instruction will also have it,
+** so that 'previousline' does not need to be right.
+*/
+static void removeinstructions (FuncState *fs, int pc) {
+  int absolute = 0;
+  while (fs->pc > pc) {
+    if (fs->f->lineinfo[fs->pc - 1] == ABSLINEINFO)
+      absolute = 1;
+    removelastinstruction(fs);
+  }
+  if (absolute)
+    fs->iwthabs = MAXIWTHABS + 1;  /* force next line info to be absolute */
+}
+
+
+/*
+** Try to replace the code of a table constructor, from the OP_NEWTABLE
+** at 'pc' to the end, by an OP_NEWTABLEK that clones a template of
+** the table, kept in the constants of the function. That is possible
+** when the constructor only stores constants with constant keys.
+** 'ra' is the register of the table, and 'asize' and 'hsize' are the
+** sizes of its parts. Return true if it replaced the code.
+*/
+int luaK_tabletemplate (FuncState *fs, int pc, int ra, int asize,
+                                                       int hsize) {
+  lua_State *L = fs->ls->L;
+  TValue v;
+  Table *t;
+  int k;
+  if (!LUAI_TEMPLATES || fs->pc == pc + 2 ||  /* empty constructor? */
+      fs->nk > MAXARG_Bx || !runconstructor(fs, pc, ra, NULL))
+    return 0;
+  t = luaH_new(L);
+  sethvalue2s(L, L->top.p, t);  /* anchor it while 'addk' allocates */
+  luaD_inctop(L);
+  sethvalue(L, &v, t);
+  k = addk(fs, fs->f, &v);  /* keep the template in the constants */
+  L->top.p--;  /* remove table */
+  if (asize > 0 || hsize > 0)
+    luaH_resize(L, t, cast_uint(asize), cast_uint(hsize));
+  runconstructor(fs, pc, ra, t);
+  removeinstructions(fs, pc);
+  luaK_codeABx(fs, OP_NEWTABLEK, ra, k);
+  return 1;
+}
+
+
 /*
 ** Emit a SETLIST instruction.
 ** 'base' is register that keeps table;
@@ -32,21 +32,8 @@ static int lcompat_to_real_index(lua_State *L) {
   if (idx < INT_MIN || idx > INT_MAX)
     return luaL_error(L, "index out of integer range");
 
-  if (idx == LUA_GLOBALSINDEX) {
-    lua_pushglobaltable(L);
-    return 1;
-  }
-  else if (idx == LUA_ENVIRONINDEX) {
-    lua_Debug ar;
-    if (lua_getstack(L, 0, &ar) && lua_getinfo(L, "f", &ar)) {
-      const char *name = lua_getupvalue(L, -1, 1);
-      if (name != NULL && strcmp(name, "_ENV") == 0) {
-        lua_remove(L, -2);
-        return 1;
-      }
-      lua_pop(L, 2);
-    }
-    lua_pushglobaltable(L);
+  if (idx == LUA_GLOBALSINDEX || idx == LUA_ENVIRONINDEX) {
+    lua_pushvalue(L, (int)idx);
     return 1;
   }
 
@@ -349,94 +336,60 @@ static int compat_module(lua_State *L) {
 
 /* ==================== Environment Functions ==================== */
 
+/*
+** Push the function at stack 'level' (the thread for level 0). Returns
+** 0 (pushing nothing) if there is no Lua function at that level.
+*/
+static int compat_pushlevel(lua_State *L, int level) {
+  lua_Debug ar;
+  if (level == 0) {
+    lua_pushthread(L);
+    return 1;
+  }
+  if (level < 0 || lua_getstack(L, level, &ar) == 0)
+    return 0;
+  lua_getinfo(L, "f", &ar);
+  if (lua_iscfunction(L, -1)) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  return 1;
+}
+
 static int compat_setfenv(lua_State *L) {
   luaL_checktype(L, 2, LUA_TTABLE);
   lua_settop(L, 2);
 
   if (lua_isfunction(L, 1)) {
-    if (lua_setupvalue(L, 1, 1) == NULL) {
-      lua_pushstring(L, "unable to set environment");
-      return lua_error(L);
-    }
+    lua_pushvalue(L, 1);
   }
   else if (lua_isnumber(L, 1)) {
-    int level = (int)lua_tointeger(L, 1);
-    if (level == 0) {
-      lua_pushthread(L);
-      lua_pushvalue(L, 2);
-      lua_rawset(L, LUA_REGISTRYINDEX);
-    }
-    else {
-      lua_Debug ar;
-      if (lua_getstack(L, level, &ar) == 0 ||
-        lua_getinfo(L, "f", &ar) == 0 ||
-        lua_iscfunction(L, -1)) {
-        lua_pushstring(L, "invalid level");
-        return lua_error(L);
-      }
-      lua_pushvalue(L, 2);
-      lua_setupvalue(L, -2, 1);
-      lua_pop(L, 1);
-    }
+    if (!compat_pushlevel(L, (int)lua_tointeger(L, 1)))
+      return luaL_error(L, "invalid level");
   }
   else {
-    lua_pushstring(L, "invalid argument #1");
-    return lua_error(L);
+    return luaL_error(L, "invalid argument #1");
   }
 
+  lua_pushvalue(L, 2);
+  if (!lua_setfenv(L, -2))
+    return luaL_error(L, "unable to set environment");
   lua_pushvalue(L, 1);
   return 1;
 }
 
 static int compat_getfenv(lua_State *L) {
-  int narg = lua_gettop(L);
-
-  if (narg == 0) {
+  if (lua_isnone(L, 1))
     lua_pushthread(L);
-    lua_rawget(L, LUA_REGISTRYINDEX);
-    if (lua_isnil(L, -1)) {
-      lua_pop(L, 1);
-      lua_pushglobaltable(L);
-    }
-  }
-  else if (lua_isfunction(L, 1)) {
-    const char *name = lua_getupvalue(L, 1, 1);
-    if (name == NULL || strcmp(name, "_ENV") != 0) {
-      lua_pop(L, 1);
-      lua_pushglobaltable(L);
-    }
-  }
   else if (lua_isnumber(L, 1)) {
-    int level = (int)lua_tointeger(L, 1);
-    lua_Debug ar;
-    if (level == 0) {
-      lua_pushthread(L);
-      lua_rawget(L, LUA_REGISTRYINDEX);
-      if (lua_isnil(L, -1)) {
-        lua_pop(L, 1);
-        lua_pushglobaltable(L);
-      }
-    }
-    else if (lua_getstack(L, level, &ar) != 0 &&
-         lua_getinfo(L, "f", &ar) != 0 &&
-         !lua_iscfunction(L, -1)) {
-      const char *name = lua_getupvalue(L, -1, 1);
-      if (name == NULL || strcmp(name, "_ENV") != 0) {
-        lua_pop(L, 2);
-        lua_pushglobaltable(L);
-      }
-      else {
-        lua_remove(L, -2);
-      }
-    }
-    else {
+    if (!compat_pushlevel(L, (int)lua_tointeger(L, 1))) {
       lua_pushglobaltable(L);
+      return 1;
     }
   }
-  else {
-    lua_pushglobaltable(L);
-  }
-
+  else
+    lua_pushvalue(L, 1);
+  lua_getfenv(L, -1);  /* global table for values without environment */
   return 1;
 }
 
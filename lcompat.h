@@ -20,64 +20,15 @@ extern "C" {
   Pseudo-indices (Lua 5.1 compatibility)
 ==============================================================================*/
 
-#define LUA_GLOBALSINDEX (-10002)
-#define LUA_ENVIRONINDEX (-10001)
+/*
+** LUA_GLOBALSINDEX and LUA_ENVIRONINDEX are defined in lua.h and resolved
+** by the core API itself, so the table-access functions need no wrappers.
+*/
 
 /*==============================================================================
-  Global table access wrappers
+  Global variable access
 ==============================================================================*/
 
-/* Macro version for lua_settable */
-#define lua_settable(L, idx) \
-  ((idx) == LUA_GLOBALSINDEX ? (lua_pushglobaltable(L), lua_insert(L, -3), \
-    lua_settable(L, -3), lua_remove(L, -1)) : lua_settable(L, (idx)))
-
-/* Macro version for lua_gettable */
-#define lua_gettable(L, idx) \
-  ((idx) == LUA_GLOBALSINDEX ? (lua_pushglobaltable(L), lua_gettable(L, -1)) \
-    : lua_gettable(L, (idx)))
-
-/* Save original functions */
-#define lua_getfield_original lua_getfield
-#define lua_setfield_original lua_setfield
-
-/* Inline wrapper for lua_getfield */
-static inline void lua_getfield_wrapper(lua_State *L, int idx, const char *k) {
-  if (idx == LUA_GLOBALSINDEX) {
-    lua_pushglobaltable(L);
-    lua_getfield_original(L, -1, k);
-    lua_remove(L, -2);  /* remove global table */
-  } else {
-    lua_getfield_original(L, idx, k);
-  }
-}
-
-/* Inline wrapper for lua_setfield */
-static inline void lua_setfield_wrapper(lua_State *L, int idx, const char *k) {
-  if (idx == LUA_GLOBALSINDEX) {
-    lua_pushglobaltable(L);
-    lua_pushvalue(L, -2);  /* duplicate value */
-    lua_setfield_original(L, -2, k);
-    lua_pop(L, 2);  /* pop global table and value */
-  } else {
-    lua_setfield_original(L, idx, k);
-  }
-}
-
-/* Override the standard functions */
-#define lua_getfield lua_getfield_wrapper
-#define lua_setfield lua_setfield_wrapper
-
-/* Raw versions of table access */
-#define lua_rawset(L, idx) \
-  ((idx) == LUA_GLOBALSINDEX ? (lua_pushglobaltable(L), lua_insert(L, -3), \
-    lua_rawset(L, -3), lua_remove(L, -1)) : lua_rawset(L, (idx)))
-
-#define lua_rawget(L, idx) \
-  ((idx) == LUA_GLOBALSINDEX ? (lua_pushglobaltable(L), lua_rawget(L, -1)) \
-    : lua_rawget(L, (idx)))
-
-/* Global variable access */
 #define lua_setglobal(L, name) lcompat_setglobal(L, name)
 #define lua_getglobal(L, name) lcompat_getglobal(L, name)
 
@@ -85,8 +36,9 @@ static inline void lua_setfield_wrapper(lua_State *L, int idx, const char *k) {
   Environment handling (Lua 5.1 compatibility)
 ==============================================================================*/
 
-#define lua_getfenv(L, i) lcompat_getfenv(L, (i))
-#define lua_setfenv(L, i) lcompat_setfenv(L, (i))
+/*
+** lua_getfenv and lua_setfenv are part of the core API (see lua.h).
+*/
 
 /*==============================================================================
   Deprecated function replacements
@@ -161,8 +113,6 @@ inline void lcompat_pushnumber(lua_State *L, lua_Number num) {
   Compatibility API declarations
 ==============================================================================*/
 
-LUA_API int lcompat_getfenv(lua_State *L, int idx);
-LUA_API int lcompat_setfenv(lua_State *L, int idx);
 LUA_API int lcompat_cpcall(lua_State *L, lua_CFunction func, void *ud);
 LUA_API void lcompat_pushvalue_at_globalsindex(lua_State *L);
 LUA_API void lcompat_setglobal(lua_State *L, const char *name);
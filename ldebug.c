@@ -27,6 +27,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "ltrace.h"
 #include "lvm.h"
 
 
@@ -138,7 +139,7 @@ LUA_API void lua_sethook (lua_State *L, lua_Hook func, int mask, int count) {
   L->hook = func;
   L->basehookcount = count;
   resethookcount(L);
-  L->hookmask = cast_byte(mask);
+  L->hookmask = cast_byte(mask | istracing(L));  /* keep tracer on */
   if (mask)
     settraps(L->ci);  /* to trace inside 'luaV_execute' */
 }
@@ -150,7 +151,7 @@ LUA_API lua_Hook lua_gethook (lua_State *L) {
 
 
 LUA_API int lua_gethookmask (lua_State *L) {
-  return L->hookmask;
+  return L->hookmask & ~LUA_MASKTRACE;
 }
 
 
@@ -444,11 +445,11 @@ static int findsetreg (const Proto *p, int lastpc, int reg) {
   int pc;
   int setreg = -1;  /* keep last instruction that changed 'reg' */
   int jmptarget = 0;  /* any code before this address is conditional */
-  if (testMMMode(GET_OPCODE(p->code[lastpc])))
+  if (testMMMode(GET_GENOPCODE(p->code[lastpc])))
     lastpc--;  /* previous instruction was not actually executed */
   for (pc = 0; pc < lastpc; pc++) {
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_GENOPCODE(i);
     int a = GETARG_A(i);
     int change;  /* true if current instruction changed 'reg' */
     switch (op) {
@@ -462,7 +463,8 @@ static int findsetreg (const Proto *p, int lastpc, int reg) {
         break;
       }
       case OP_CALL:
-      case OP_TAILCALL: {  /* affect all registers above base */
+      case OP_TAILCALL:
+      case OP_CMD: {  /* affect all registers above base */
         change = (reg >= a);
         break;
       }
@@ -512,7 +514,7 @@ static const char *basicgetobjname (const Proto *p, int *ppc, int reg,
   *ppc = pc = findsetreg(p, pc, reg);
   if (pc != -1) {  /* could find instruction? */
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_GENOPCODE(i);
     switch (op) {
       case OP_MOVE: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
@@ -573,7 +575,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
     return kind;
   else if (lastpc != -1) {  /* could find instruction? */
     Instruction i = p->code[lastpc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_GENOPCODE(i);
     switch (op) {
       case OP_GETTABUP: {
         int k = GETARG_C(i);  /* key index */
@@ -616,7 +618,7 @@ static const char *funcnamefromcode (lua_State *L, const Proto *p,
                                      int pc, const char **name) {
   TMS tm = (TMS)0;  /* (initial value avoids warnings) */
   Instruction i = p->code[pc];  /* calling instruction */
-  switch (GET_OPCODE(i)) {
+  switch (GET_GENOPCODE(i)) {
     case OP_CALL:
     case OP_TAILCALL:
       return getobjname(p, pc, GETARG_A(i), name);  /* get function name */
@@ -624,6 +626,17 @@ static const char *funcnamefromcode (lua_State *L, const Proto *p,
       *name = "for iterator";
        return "for iterator";
     }
+    case OP_EXTRAARG: {  /* may be an argument of an OP_CMD */
+      while (GET_OPCODE(p->code[--pc]) == OP_EXTRAARG)
+        ;  /* go back to the instruction with the extra arguments */
+      i = p->code[pc];
+      if (GET_OPCODE(i) != OP_CMD)
+        return NULL;
+    }  /* FALLTHROUGH */
+    case OP_CMD: {  /* a command (also when getting the method) */
+      kname(p, GETARG_C(i), name);
+      return "method";
+    }
     /* other instructions can do calls through metamethods */
     case OP_SELF: case OP_GETTABUP: case OP_GETTABLE:
     case OP_GETI: case OP_GETFIELD:
@@ -29,6 +29,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "ltrace.h"
 #include "lundump.h"
 #include "lvm.h"
 #include "lzio.h"
@@ -347,6 +348,10 @@ int luaD_reallocstack (lua_State *L, int newsize, int raiseerror) {
   }
   L->stack.p = newstack;
   correctstack(L, oldstack);  /* change offsets back to pointers */
+  luaM_censusfree(G(L), LUA_MKSTACK,
+                  cast_sizet(oldsize + EXTRA_STACK) * sizeof(StackValue));
+  luaM_censusnew(G(L), LUA_MKSTACK,
+                 cast_sizet(newsize + EXTRA_STACK) * sizeof(StackValue));
   L->stack_last.p = L->stack.p + newsize;
   for (i = oldsize + EXTRA_STACK; i < newsize + EXTRA_STACK; i++)
     setnilvalue(s2v(newstack + i)); /* erase new segment */
@@ -491,6 +496,8 @@ void luaD_hookcall (lua_State *L, CallInfo *ci) {
     luaD_hook(L, event, -1, 1, p->numparams);
     ci->u.l.savedpc--;  /* correct 'pc' */
   }
+  if (istracing(L))  /* after the hook, to not count its time */
+    luaR_call(L, ci);
 }
 
 
@@ -500,6 +507,8 @@ void luaD_hookcall (lua_State *L, CallInfo *ci) {
 ** is done even when return hooks are off.)
 */
 static void rethook (lua_State *L, CallInfo *ci, int nres) {
+  if (istracing(L))
+    luaR_return(L, ci);
   if (L->hookmask & LUA_MASKRET) {  /* is return hook on? */
     StkId firstres = L->top.p - nres;  /* index of first result */
     int delta = 0;  /* correction for vararg functions */
@@ -655,9 +664,13 @@ l_sinline int precallC (lua_State *L, StkId func, unsigned status,
   L->ci = ci = prepCallInfo(L, func, status | CIST_C,
                                L->top.p + LUA_MINSTACK);
   lua_assert(ci->top.p <= L->stack_last.p);
-  if (l_unlikely(L->hookmask & LUA_MASKCALL)) {
-    int narg = cast_int(L->top.p - func) - 1;
-    luaD_hook(L, LUA_HOOKCALL, -1, 1, narg);
+  if (l_unlikely(L->hookmask)) {
+    if (L->hookmask & LUA_MASKCALL) {
+      int narg = cast_int(L->top.p - func) - 1;
+      luaD_hook(L, LUA_HOOKCALL, -1, 1, narg);
+    }
+    if (istracing(L))
+      luaR_call(L, ci);
   }
   lua_unlock(L);
   n = (*f)(L);  /* do the actual call */
@@ -974,6 +987,8 @@ static TStatus precover (lua_State *L, TStatus status) {
 LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs,
                                       int *nresults) {
   TStatus status;
+  int tracing;
+  lua_Unsigned tstart = 0;
   lua_lock(L);
   if (L->status == LUA_OK) {  /* may be starting a coroutine */
     if (L->ci != &L->base_ci)  /* not in base level? */
@@ -989,6 +1004,9 @@ LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs,
   L->nCcalls++;
   luai_userstateresume(L, nargs);
   api_checkpop(L, (L->status == LUA_OK) ? nargs + 1 : nargs);
+  tracing = istracing(L);
+  if (tracing)
+    tstart = luaR_resume(L);
   status = luaD_rawrunprotected(L, resume, &nargs);
    /* continue running after recoverable errors */
   status = precover(L, status);
@@ -999,6 +1017,8 @@ LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs,
     luaD_seterrorobj(L, status, L->top.p);  /* push error message */
     L->ci->top.p = L->top.p;
   }
+  if (tracing)
+    luaR_endresume(L, from, tstart, status == LUA_YIELD);
   *nresults = (status == LUA_YIELD) ? L->ci->u2.nyield
                                     : cast_int(L->top.p - (L->ci->func.p + 1));
   lua_unlock(L);
@@ -1116,6 +1136,7 @@ struct SParser {  /* data to 'f_parser' */
   Dyndata dyd;  /* dynamic structures used by the parser */
   const char *mode;
   const char *name;
+  FixedBuff *fb;  /* owner of a fixed buffer, if any */
 };
 
 
@@ -1139,7 +1160,7 @@ static void f_parser (lua_State *L, void *ud) {
       fixed = 1;
     else
       checkmode(L, mode, "binary");
-    cl = luaU_undump(L, p->z, p->name, fixed);
+    cl = luaU_undump(L, p->z, p->name, fixed, p->fb);
   }
   else {
     checkmode(L, mode, "text");
@@ -1151,11 +1172,11 @@ static void f_parser (lua_State *L, void *ud) {
 
 
 TStatus luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
-                                            const char *mode) {
+                                            const char *mode, FixedBuff *fb) {
   struct SParser p;
   TStatus status;
   incnny(L);  /* cannot yield during parsing */
-  p.z = z; p.name = name; p.mode = mode;
+  p.z = z; p.name = name; p.mode = mode; p.fb = fb;
   p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
   p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
   p.dyd.label.arr = NULL; p.dyd.label.size = 0;
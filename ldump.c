@@ -18,6 +18,7 @@
 #include "lapi.h"
 #include "lgc.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "ltable.h"
 #include "lundump.h"
@@ -172,35 +173,74 @@ static void dumpCode (DumpState *D, const Proto *f) {
   dumpInt(D, f->sizecode);
   dumpAlign(D, sizeof(f->code[0]));
   lua_assert(f->code != NULL);
-  dumpVector(D, f->code, cast_uint(f->sizecode));
+  if (!(f->flag & PF_QUICK))
+    dumpVector(D, f->code, cast_uint(f->sizecode));
+  else {  /* dump generic opcodes of quickened instructions */
+    int pc;
+    for (pc = 0; pc < f->sizecode; pc++) {
+      Instruction i = f->code[pc];
+      SET_OPCODE(i, GET_GENOPCODE(i));
+      dumpVar(D, i);
+    }
+  }
 }
 
 
 static void dumpFunction (DumpState *D, const Proto *f);
 
+static void dumpTemplate (DumpState *D, Table *t);
+
+static void dumpConstant (DumpState *D, const TValue *o) {
+  int tt = ttypetag(o);
+  dumpByte(D, tt);
+  switch (tt) {
+    case LUA_VNUMFLT:
+      dumpNumber(D, fltvalue(o));
+      break;
+    case LUA_VNUMINT:
+      dumpInteger(D, ivalue(o));
+      break;
+    case LUA_VSHRSTR:
+    case LUA_VLNGSTR:
+      dumpString(D, tsvalue(o));
+      break;
+    case LUA_VTABLE:
+      dumpTemplate(D, hvalue(o));
+      break;
+    default:
+      lua_assert(tt == LUA_VNIL || tt == LUA_VFALSE || tt == LUA_VTRUE);
+  }
+}
+
+
+/*
+** Dump a template for a table constructor (see 'luaK_tabletemplate'):
+** the sizes of its parts followed by its entries, whose keys and values
+** are constants other than tables.
+*/
+static void dumpTemplate (DumpState *D, Table *t) {
+  TValue key, val;
+  unsigned i = 0;
+  int n = 0;
+  while ((i = luaH_nextentry(D->L, t, i, &key, &val)) != 0)
+    n++;
+  dumpInt(D, cast_int(t->asize));
+  dumpInt(D, cast_int(allocsizenode(t)));
+  dumpInt(D, n);
+  while ((i = luaH_nextentry(D->L, t, i, &key, &val)) != 0) {
+    lua_assert(!ttistable(&key) && !ttistable(&val));
+    dumpConstant(D, &key);
+    dumpConstant(D, &val);
+  }
+}
+
+
 static void dumpConstants (DumpState *D, const Proto *f) {
   int i;
   int n = f->sizek;
   dumpInt(D, n);
-  for (i = 0; i < n; i++) {
-    const TValue *o = &f->k[i];
-    int tt = ttypetag(o);
-    dumpByte(D, tt);
-    switch (tt) {
-      case LUA_VNUMFLT:
-        dumpNumber(D, fltvalue(o));
-        break;
-      case LUA_VNUMINT:
-        dumpInteger(D, ivalue(o));
-        break;
-      case LUA_VSHRSTR:
-      case LUA_VLNGSTR:
-        dumpString(D, tsvalue(o));
-        break;
-      default:
-        lua_assert(tt == LUA_VNIL || tt == LUA_VFALSE || tt == LUA_VTRUE);
-    }
-  }
+  for (i = 0; i < n; i++)
+    dumpConstant(D, &f->k[i]);
 }
 
 
@@ -255,7 +295,7 @@ static void dumpFunction (DumpState *D, const Proto *f) {
   dumpInt(D, f->linedefined);
   dumpInt(D, f->lastlinedefined);
   dumpByte(D, f->numparams);
-  dumpByte(D, f->flag);
+  dumpByte(D, f->flag & ~(PF_QUICK | PF_CENSUS));  /* not persistent */
   dumpByte(D, f->maxstacksize);
   dumpCode(D, f);
   dumpConstants(D, f);
@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -245,6 +246,7 @@ Proto *luaF_newproto (lua_State *L) {
   Proto *f = gco2p(o);
   f->k = NULL;
   f->sizek = 0;
+  f->icache = NULL;
   f->p = NULL;
   f->sizep = 0;
   f->code = NULL;
@@ -257,20 +259,28 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizeupvalues = 0;
   f->numparams = 0;
   f->flag = 0;
+  f->ndeopt = 0;
+  f->jitcount = 0;
+  f->jit = NULL;
+  f->cache = NULL;
   f->maxstacksize = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+  f->fixed = NULL;
   return f;
 }
 
 
-lu_mem luaF_protosize (Proto *p) {
-  lu_mem sz = cast(lu_mem, sizeof(Proto))
-            + cast_uint(p->sizep) * sizeof(Proto*)
+/*
+** Size of the arrays of a prototype
+*/
+static lu_mem protoparts (Proto *p) {
+  lu_mem sz = cast_uint(p->sizep) * sizeof(Proto*)
             + cast_uint(p->sizek) * sizeof(TValue)
+            + ((p->icache) ? cast_uint(p->sizek) * sizeof(ICache) : 0)
             + cast_uint(p->sizelocvars) * sizeof(LocVar)
             + cast_uint(p->sizeupvalues) * sizeof(Upvaldesc);
   if (!(p->flag & PF_FIXED)) {
@@ -282,17 +292,63 @@ lu_mem luaF_protosize (Proto *p) {
 }
 
 
+/*
+** Create the inline caches of a prototype, after it is complete.
+** Zero is as good an initial hint as any other. As the arrays of the
+** prototype do not change after this point, they are accounted here
+** in the census of the heap (together with its header), and PF_CENSUS
+** tells 'luaF_freeproto' to take them out.
+*/
+void luaF_newicache (lua_State *L, Proto *f) {
+  int i;
+  f->icache = luaM_newvector(L, f->sizek, ICache);
+  for (i = 0; i < f->sizek; i++)
+    f->icache[i].node = f->icache[i].tm = f->icache[i].index = 0;
+  G(L)->census.bytes[LUA_MKPROTO] += protoparts(f);
+  f->flag |= PF_CENSUS;
+}
+
+
+lu_mem luaF_protosize (Proto *p) {
+  JitLoop *jl;
+  lu_mem sz = cast(lu_mem, sizeof(Proto)) + protoparts(p);
+  for (jl = p->jit; jl != NULL; jl = jl->next)
+    sz += sizeof(JitLoop);  /* (machine code is not in the Lua heap) */
+  return sz;
+}
+
+
+/*
+** Drops a reference to a fixed buffer. (This may run while the
+** collector frees a string, so it cannot use the Lua heap.)
+*/
+void luaF_releasefixed (FixedBuff *fb) {
+  lua_assert(fb->nrefs > 0);
+  if (--fb->nrefs == 0) {  /* last reference? */
+    (*fb->falloc)(fb->ud, fb->buff, fb->size, 0);
+    (*fb->frealloc)(fb->fud, fb, sizeof(FixedBuff), 0);
+  }
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
+  if (f->flag & PF_CENSUS)  /* complete prototype? */
+    G(L)->census.bytes[LUA_MKPROTO] -= protoparts(f);
   if (!(f->flag & PF_FIXED)) {
     luaM_freearray(L, f->code, cast_sizet(f->sizecode));
     luaM_freearray(L, f->lineinfo, cast_sizet(f->sizelineinfo));
     luaM_freearray(L, f->abslineinfo, cast_sizet(f->sizeabslineinfo));
   }
+  else if (f->fixed != NULL)
+    luaF_releasefixed(f->fixed);
   luaM_freearray(L, f->p, cast_sizet(f->sizep));
   luaM_freearray(L, f->k, cast_sizet(f->sizek));
+  if (f->icache)  /* may be absent in a prototype not fully built */
+    luaM_freearray(L, f->icache, cast_sizet(f->sizek));
+  luaJ_freeproto(L, f);
   luaM_freearray(L, f->locvars, cast_sizet(f->sizelocvars));
   luaM_freearray(L, f->upvalues, cast_sizet(f->sizeupvalues));
-  luaM_free(L, f);
+  luaM_freeobject(L, LUA_VPROTO, f, sizeof(Proto));
 }
 
 
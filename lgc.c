@@ -24,6 +24,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "ltrace.h"
 
 
 /*
@@ -40,6 +41,13 @@
 #define CWUFIN	10
 
 
+/*
+** Maximum number of rounds in the remark phase. (Each round traverses
+** again all objects in 'grayagain'.)
+*/
+#define GCMAXREMARK	4
+
+
 /* mask with all color bits */
 #define maskcolors	(bitmask(BLACKBIT) | WHITEBITS)
 
@@ -110,7 +118,7 @@ static void entersweep (lua_State *L);
 #define gnodelast(h)	gnode(h, cast_sizet(sizenode(h)))
 
 
-static l_mem objsize (GCObject *o) {
+l_mem luaC_objsize (GCObject *o) {
   lu_mem res;
   switch (o->tt) {
     case LUA_VTABLE: {
@@ -154,6 +162,10 @@ static l_mem objsize (GCObject *o) {
       res = sizeof(UpVal);
       break;
     }
+    case LUA_VSHAPE: {
+      res = luaH_shapesize(gco2sh(o));
+      break;
+    }
     default: res = 0; lua_assert(0);
   }
   return cast(l_mem, res);
@@ -167,6 +179,7 @@ static GCObject **getgclist (GCObject *o) {
     case LUA_VCCL: return &gco2ccl(o)->gclist;
     case LUA_VTHREAD: return &gco2th(o)->gclist;
     case LUA_VPROTO: return &gco2p(o)->gclist;
+    case LUA_VSHAPE: return &gco2sh(o)->gclist;
     case LUA_VUSERDATA: {
       Udata *u = gco2u(o);
       lua_assert(u->nuvalue > 0);
@@ -296,7 +309,7 @@ void luaC_fix (lua_State *L, GCObject *o) {
 */
 GCObject *luaC_newobjdt (lua_State *L, lu_byte tt, size_t sz, size_t offset) {
   global_State *g = G(L);
-  char *p = cast_charp(luaM_newobject(L, novariant(tt), sz));
+  char *p = cast_charp(luaM_newobject(L, tt, sz));
   GCObject *o = cast(GCObject *, p + offset);
   o->marked = luaC_white(g);
   o->tt = tt;
@@ -317,6 +330,110 @@ GCObject *luaC_newobj (lua_State *L, lu_byte tt, size_t sz) {
 
 
 
+/*
+** {======================================================
+** Telemetry
+** =======================================================
+*/
+
+/*
+** Calls the host function for collector events, if any. It runs
+** inside the collector, so it cannot call the API.
+*/
+#define gcevent(g,e)  \
+	{ if ((g)->gcf) (*(g)->gcf)((g)->ud_gcf, e); }
+
+
+/*
+** Phase of the collector (for its statistics) when in state 'state'
+** with kind 'kind'
+*/
+static int gcphase (lu_byte kind, lu_byte state) {
+  if (kind == KGC_GENMINOR)
+    return LUA_GCPHMINOR;
+  else if (kind == KGC_GENMAJOR)
+    return LUA_GCPHMAJOR;
+  else if (state <= GCSremark || state == GCSpause)
+    return LUA_GCPHPROPAGATE;
+  else if (state <= GCSatomic)
+    return LUA_GCPHATOMIC;
+  else if (state <= GCSswpend)
+    return LUA_GCPHSWEEP;
+  else
+    return LUA_GCPHCALLFIN;
+}
+
+
+/*
+** Accounts to phase 'ph' the time since the start of the current
+** accounting period and starts a new one. The clock is read only at
+** the ends of a pause and when the phase changes, so that single
+** steps stay cheap.
+*/
+static void statphase (global_State *g, int ph) {
+  if (g->gcstatmark >= 0) {  /* timing the collector? */
+    l_mem now = luaE_clock();
+    g->gcstats.time[ph] += cast_sizet(now - g->gcstatmark);
+    g->gcstatmark = now;
+  }
+}
+
+
+/*
+** Starts timing a pause. Returns its start time, or -1 if already
+** timing one (e.g., an emergency collection inside a finalizer), in
+** which case the outer pause accounts for everything.
+*/
+static l_mem statbegin (global_State *g) {
+  if (g->gcstatmark >= 0)
+    return -1;
+  return (g->gcstatmark = luaE_clock());
+}
+
+
+/*
+** Finishes timing a pause started at 't0' and returns its duration.
+** A pause of 't' microseconds goes to bucket 'ceil(log2(t + 1))', so
+** that bucket 'b' > 0 holds pauses from 2^(b-1) up to 2^b - 1
+** microseconds, with the last one holding all longer pauses.
+*/
+static l_mem statend (global_State *g, l_mem t0) {
+  l_mem t;
+  int b;
+  if (t0 < 0)  /* nested pause? */
+    return 0;
+  statphase(g, gcphase(g->gckind, g->gcstate));
+  t = g->gcstatmark - t0;
+  g->gcstatmark = -1;
+  if (t >= (l_mem)1 << (LUA_GCHISTN - 2))
+    b = LUA_GCHISTN - 1;
+  else
+    b = cast_int(luaO_ceillog2(cast_uint(t) + 1));
+  g->gcstats.pauses[b]++;
+  return t;
+}
+
+
+/*
+** A collection cycle (incremental or major) starts
+*/
+static void startcycle (global_State *g) {
+  gcevent(g, LUA_GCEVSTART);
+}
+
+
+/*
+** A collection cycle (incremental or major) ends
+*/
+static void endcycle (global_State *g) {
+  g->gcstats.ncycles++;
+  gcevent(g, LUA_GCEVEND);
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Mark functions
@@ -337,7 +454,7 @@ GCObject *luaC_newobj (lua_State *L, lu_byte tt, size_t sz) {
 ** (only closures can), and a userdata's metatable must be a table.
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
-  g->GCmarked += objsize(o);
+  g->GCmarked += luaC_objsize(o);
   switch (o->tt) {
     case LUA_VSHRSTR:
     case LUA_VLNGSTR: {
@@ -363,7 +480,7 @@ static void reallymarkobject (global_State *g, GCObject *o) {
       /* else... */
     }  /* FALLTHROUGH */
     case LUA_VLCL: case LUA_VCCL: case LUA_VTABLE:
-    case LUA_VTHREAD: case LUA_VPROTO: {
+    case LUA_VTHREAD: case LUA_VPROTO: case LUA_VSHAPE: {
       linkobjgclist(o, g->gray);  /* to be visited later */
       break;
     }
@@ -382,6 +499,23 @@ static void markmt (global_State *g) {
 }
 
 
+/*
+** mark prototypes of functions traced by the tracer, which keeps them
+** alive (and so keeps valid their addresses, used as keys) until it
+** is reset
+*/
+static void marktracer (global_State *g) {
+  Tracer *tr = g->tracer;
+  if (tr != NULL) {
+    int i;
+    for (i = 0; i < tr->nentries; i++) {
+      if (tr->entries[i].f == NULL)  /* a Lua function? */
+        markobject(g, cast(Proto *, tr->entries[i].key));
+    }
+  }
+}
+
+
 /*
 ** mark all objects in list of being-finalized
 */
@@ -429,6 +563,7 @@ static void remarkupvals (global_State *g) {
 static void cleargraylists (global_State *g) {
   g->gray = g->grayagain = NULL;
   g->weak = g->allweak = g->ephemeron = NULL;
+  g->gcremark = g->gcephmarked = 0;
 }
 
 
@@ -443,6 +578,8 @@ static void restartcollection (global_State *g) {
   markobject(g, mainthread(g));
   markvalue(g, &g->l_registry);
   markmt(g);
+  marktracer(g);
+  markobjectN(g, g->keys);
   markbeingfnz(g);  /* mark any finalizing object left from previous cycle */
 }
 
@@ -479,8 +616,8 @@ static void genlink (global_State *g, GCObject *o) {
 
 /*
 ** Traverse a table with weak values and link it to proper list. During
-** propagate phase, keep it in 'grayagain' list, to be revisited in the
-** atomic phase. In the atomic phase, if table has any white value,
+** propagate and remark phases, keep it in 'grayagain', to be revisited
+** in the atomic phase. In the atomic phase, if table has any white value,
 ** put it in 'weak' list, to be cleared; otherwise, call 'genlink'
 ** to check table age in generational mode.
 */
@@ -499,7 +636,7 @@ static void traverseweakvalue (global_State *g, Table *h) {
         hasclears = 1;  /* table will have to be cleared */
     }
   }
-  if (g->gcstate == GCSpropagate)
+  if (ispropagating(g))
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
   else if (hasclears)
       linkgclist(h, g->weak);  /* has to be cleared later */
@@ -529,8 +666,9 @@ static int traversearray (global_State *g, Table *h) {
 /*
 ** Traverse an ephemeron table and link it to proper list. Returns true
 ** iff any object was marked during this traversal (which implies that
-** convergence has to continue). During propagation phase, keep table
-** in 'grayagain' list, to be visited again in the atomic phase. In
+** convergence has to continue). During propagate and remark phases,
+** keep table in 'grayagain' list, to be visited again in the atomic
+** phase, and signal any progress in 'gcephmarked' (see 'remarkstep'). In
 ** the atomic phase, if table has any white->white entry, it has to
 ** be revisited during ephemeron convergence (as that key may turn
 ** black). Otherwise, if it has any white key, table has to be cleared
@@ -561,8 +699,11 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
     }
   }
   /* link table into proper list */
-  if (g->gcstate == GCSpropagate)
+  if (ispropagating(g)) {
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
+    if (marked)
+      g->gcephmarked = 1;  /* convergence not reached yet */
+  }
   else if (hasww)  /* table has white->white entries? */
     linkgclist(h, g->ephemeron);  /* have to propagate again */
   else if (hasclears)  /* table has white keys? */
@@ -592,7 +733,7 @@ static void traversestrongtable (global_State *g, Table *h) {
 /*
 ** (result & 1) iff weak values; (result & 2) iff weak keys.
 */
-static int getmode (global_State *g, Table *h) {
+int luaC_getmode (global_State *g, Table *h) {
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
   if (mode == NULL || !ttisstring(mode))
     return 0;  /* ignore non-string modes */
@@ -605,9 +746,45 @@ static int getmode (global_State *g, Table *h) {
 }
 
 
+/*
+** Traverse a table with a shape. Its keys are strings, which are never
+** cleared, so it is either strong or has only weak values. (A weak
+** table with a shape is handled like in 'traverseweakvalue'.)
+*/
+static void traverseshaped (global_State *g, Table *h, int weakvalues) {
+  Shape *s = getshape(h);
+  TValue *vals = shapevals(h);
+  unsigned i;
+  markobject(g, s);
+  if (!weakvalues) {
+    traversearray(g, h);
+    for (i = 0; i < s->nkeys; i++)
+      markvalue(g, vals + i);
+    genlink(g, obj2gco(h));
+  }
+  else {
+    int hasclears = (h->asize > 0);
+    for (i = 0; i < s->nkeys && !hasclears; i++) {
+      if (iscleared(g, gcvalueN(vals + i)))  /* a white value? */
+        hasclears = 1;  /* table will have to be cleared */
+    }
+    if (ispropagating(g))
+      linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
+    else if (hasclears)
+      linkgclist(h, g->weak);  /* has to be cleared later */
+    else
+      genlink(g, obj2gco(h));
+  }
+}
+
+
 static l_mem traversetable (global_State *g, Table *h) {
   markobjectN(g, h->metatable);
-  switch (getmode(g, h)) {
+  if (isshaped(h)) {
+    traverseshaped(g, h, luaC_getmode(g, h) & 1);
+    return cast(l_mem, 1 + sizenode(h) + h->asize);
+  }
+  switch (luaC_getmode(g, h)) {
     case 0:  /* not weak */
       traversestrongtable(g, h);
       break;
@@ -618,7 +795,7 @@ static l_mem traversetable (global_State *g, Table *h) {
       traverseephemeron(g, h, 0);
       break;
     case 3:  /* all weak; nothing to traverse */
-      if (g->gcstate == GCSpropagate)
+      if (ispropagating(g))
         linkgclist(h, g->grayagain);  /* must visit again its metatable */
       else
         linkgclist(h, g->allweak);  /* must clear collected entries */
@@ -628,6 +805,18 @@ static l_mem traversetable (global_State *g, Table *h) {
 }
 
 
+/*
+** A shape refers to its parent and to its last key; all other keys
+** are kept by the parent.
+*/
+static l_mem traverseshape (global_State *g, Shape *s) {
+  markobjectN(g, s->parent);
+  if (s->nkeys > 0)
+    markobject(g, s->keys[s->nkeys - 1]);
+  return 2;
+}
+
+
 static l_mem traverseudata (global_State *g, Udata *u) {
   int i;
   markobjectN(g, u->metatable);  /* mark its metatable */
@@ -654,6 +843,14 @@ static l_mem traverseproto (global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
+  if (f->cache != NULL) {
+    /* minor collections do not clear it, as 'f' may get old before it */
+    if (g->gckind == KGC_GENMINOR) {
+      markobject(g, f->cache);
+    }
+    else if (iswhite(f->cache))
+      f->cache = NULL;  /* allow cache to be collected */
+  }
   return 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars;
 }
 
@@ -690,13 +887,16 @@ static l_mem traverseLclosure (global_State *g, LClosure *cl) {
 ** and therefore it must be visited again in the atomic phase. To ensure
 ** these visits, threads must return to a gray list if they are not new
 ** (which can only happen in generational mode) or if the traverse is in
-** the propagate phase (which can only happen in incremental mode).
+** the propagate or remark phases (which can only happen in incremental
+** mode).
 */
 static l_mem traversethread (global_State *g, lua_State *th) {
   UpVal *uv;
   StkId o = th->stack.p;
-  if (isold(th) || g->gcstate == GCSpropagate)
+  if (isold(th) || ispropagating(g))
     linkgclist(th, g->grayagain);  /* insert into 'grayagain' list */
+  markvalue(g, &th->env);
+  markvalue(g, &th->pseudo);
   if (o == NULL)
     return 0;  /* stack not completely built yet */
   lua_assert(g->gcstate == GCSatomic ||
@@ -726,8 +926,12 @@ static l_mem traversethread (global_State *g, lua_State *th) {
 */
 static l_mem propagatemark (global_State *g) {
   GCObject *o = g->gray;
+  int t = novariant(o->tt);
   nw2black(o);
   g->gray = *getgclist(o);  /* remove from 'gray' list */
+  if (t == LUA_TSHAPE)  /* shapes are part of tables */
+    t = LUA_TTABLE;
+  g->gcstats.traversed[t < LUA_NUMTYPES ? t : LUA_NUMTYPES]++;
   switch (o->tt) {
     case LUA_VTABLE: return traversetable(g, gco2t(o));
     case LUA_VUSERDATA: return traverseudata(g, gco2u(o));
@@ -735,6 +939,7 @@ static l_mem propagatemark (global_State *g) {
     case LUA_VCCL: return traverseCclosure(g, gco2ccl(o));
     case LUA_VPROTO: return traverseproto(g, gco2p(o));
     case LUA_VTHREAD: return traversethread(g, gco2th(o));
+    case LUA_VSHAPE: return traverseshape(g, gco2sh(o));
     default: lua_assert(0); return 0;
   }
 }
@@ -791,6 +996,8 @@ static void clearbykeys (global_State *g, GCObject *l) {
     Table *h = gco2t(l);
     Node *limit = gnodelast(h);
     Node *n;
+    if (isshaped(h))
+      continue;  /* string keys are never cleared */
     for (n = gnode(h, 0); n < limit; n++) {
       if (iscleared(g, gckeyN(n)))  /* unmarked key? */
         setempty(gval(n));  /* remove entry */
@@ -816,6 +1023,14 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
       if (iscleared(g, o))  /* value was collected? */
         *getArrTag(h, i) = LUA_VEMPTY;  /* remove entry */
     }
+    if (isshaped(h)) {
+      TValue *vals = shapevals(h);
+      for (i = 0; i < getshape(h)->nkeys; i++) {
+        if (iscleared(g, gcvalueN(vals + i)))  /* unmarked value? */
+          setempty(vals + i);  /* remove entry */
+      }
+      continue;
+    }
     for (n = gnode(h, 0); n < limit; n++) {
       if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
         setempty(gval(n));  /* remove entry */
@@ -829,12 +1044,14 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
 static void freeupval (lua_State *L, UpVal *uv) {
   if (upisopen(uv))
     luaF_unlinkupval(uv);
-  luaM_free(L, uv);
+  luaM_freeobject(L, LUA_VUPVAL, uv, sizeof(UpVal));
 }
 
 
 static void freeobj (lua_State *L, GCObject *o) {
-  assert_code(l_mem newmem = gettotalbytes(G(L)) - objsize(o));
+  l_mem oldmem = gettotalbytes(G(L));
+  assert_code(l_mem newmem = oldmem - luaC_objsize(o));
+  G(L)->gcfreeing = 1;  /* its blocks may be freed in background */
   switch (o->tt) {
     case LUA_VPROTO:
       luaF_freeproto(L, gco2p(o));
@@ -844,40 +1061,46 @@ static void freeobj (lua_State *L, GCObject *o) {
       break;
     case LUA_VLCL: {
       LClosure *cl = gco2lcl(o);
-      luaM_freemem(L, cl, sizeLclosure(cl->nupvalues));
+      luaM_freeobject(L, LUA_VLCL, cl, sizeLclosure(cl->nupvalues));
       break;
     }
     case LUA_VCCL: {
       CClosure *cl = gco2ccl(o);
-      luaM_freemem(L, cl, sizeCclosure(cl->nupvalues));
+      luaM_freeobject(L, LUA_VCCL, cl, sizeCclosure(cl->nupvalues));
       break;
     }
     case LUA_VTABLE:
       luaH_free(L, gco2t(o));
       break;
+    case LUA_VSHAPE:
+      luaH_freeshape(L, gco2sh(o));
+      break;
     case LUA_VTHREAD:
       luaE_freethread(L, gco2th(o));
       break;
     case LUA_VUSERDATA: {
       Udata *u = gco2u(o);
-      luaM_freemem(L, o, sizeudata(u->nuvalue, u->len));
+      luaM_freeobject(L, LUA_VUSERDATA, o, sizeudata(u->nuvalue, u->len));
       break;
     }
     case LUA_VSHRSTR: {
       TString *ts = gco2ts(o);
       luaS_remove(L, ts);  /* remove it from hash table */
-      luaM_freemem(L, ts, sizestrshr(cast_uint(ts->shrlen)));
+      luaM_freeobject(L, LUA_VSHRSTR, ts, sizestrshr(cast_uint(ts->shrlen)));
       break;
     }
     case LUA_VLNGSTR: {
       TString *ts = gco2ts(o);
       if (ts->shrlen == LSTRMEM)  /* must free external string? */
         (*ts->falloc)(ts->ud, ts->contents, ts->u.lnglen + 1, 0);
-      luaM_freemem(L, ts, luaS_sizelngstr(ts->u.lnglen, ts->shrlen));
+      luaM_freeobject(L, LUA_VLNGSTR, ts,
+                         luaS_sizelngstr(ts->u.lnglen, ts->shrlen));
       break;
     }
     default: lua_assert(0);
   }
+  G(L)->gcfreeing = 0;
+  G(L)->gcstats.freed += cast_sizet(oldmem - gettotalbytes(G(L)));
   lua_assert(gettotalbytes(G(L)) == newmem);
 }
 
@@ -1200,7 +1423,7 @@ static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
         lua_assert(age != G_OLD1);  /* advanced in 'markold' */
         setage(curr, nextage[age]);
         if (getage(curr) == G_OLD1) {
-          addedold += objsize(curr);  /* bytes becoming old */
+          addedold += luaC_objsize(curr);  /* bytes becoming old */
           if (*pfirstold1 == NULL)
             *pfirstold1 = curr;  /* first OLD1 object in the list */
         }
@@ -1308,6 +1531,7 @@ static void minor2inc (lua_State *L, global_State *g, lu_byte kind) {
   g->gckind = kind;
   g->reallyold = g->old1 = g->survival = NULL;
   g->finobjrold = g->finobjold1 = g->finobjsur = NULL;
+  startcycle(g);
   entersweep(L);  /* continue as an incremental cycle */
   /* set a debt equal to the step size */
   luaE_setdebt(g, applygcparam(g, STEPSIZE, 100));
@@ -1338,6 +1562,7 @@ static void youngcollection (lua_State *L, global_State *g) {
   GCObject **psurvival;  /* to point to first non-dead survival object */
   GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
   lua_assert(g->gcstate == GCSpropagate);
+  gcevent(g, LUA_GCEVMINORSTART);
   if (g->firstold1) {  /* are there regular OLD1 objects? */
     markold(g, g->firstold1, g->reallyold);  /* mark them */
     g->firstold1 = NULL;  /* no more OLD1 objects (for now) */
@@ -1371,6 +1596,9 @@ static void youngcollection (lua_State *L, global_State *g) {
   g->GCmarked = marked + addedold1;
 
   /* decide whether to shift to major mode */
+  g->gcstats.nminor++;
+  statphase(g, LUA_GCPHMINOR);
+  gcevent(g, LUA_GCEVMINOREND);
   if (checkminormajor(g)) {
     minor2inc(L, g, KGC_GENMAJOR);  /* go to major mode */
     g->GCmarked = 0;  /* avoid pause in first major cycle (see 'setpause') */
@@ -1405,6 +1633,7 @@ static void atomic2gen (lua_State *L, global_State *g) {
   g->GCmajorminor = g->GCmarked;  /* "base" for number of bytes */
   g->GCmarked = 0;  /* to count the number of added old1 bytes */
   finishgencycle(L, g);
+  endcycle(g);
 }
 
 
@@ -1428,8 +1657,10 @@ static void setminordebt (global_State *g) {
 static void entergen (lua_State *L, global_State *g) {
   luaC_runtilstate(L, GCSpause, 1);  /* prepare to start a new cycle */
   luaC_runtilstate(L, GCSpropagate, 1);  /* start new cycle */
+  statphase(g, LUA_GCPHPROPAGATE);
   atomic(L);  /* propagates all and then do the atomic stuff */
   atomic2gen(L, g);
+  statphase(g, LUA_GCPHATOMIC);
   setminordebt(g);  /* set debt assuming next cycle will be minor */
 }
 
@@ -1552,6 +1783,8 @@ static void atomic (lua_State *L) {
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
+  marktracer(g);  /* tracer may have seen new functions */
+  markobjectN(g, g->keys);  /* API may have created the table */
   propagateall(g);  /* empties 'gray' list */
   /* remark occasional upvalues of (maybe) dead threads */
   remarkupvals(g);
@@ -1575,12 +1808,51 @@ static void atomic (lua_State *L) {
   /* clear values from resurrected weak tables */
   clearbyvalues(g, g->weak, origweak);
   clearbyvalues(g, g->allweak, origall);
+  luaH_clearshapes(L);
   luaS_clearcache(g);
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   lua_assert(g->gray == NULL);
 }
 
 
+/*
+** Start a remark round: objects collected in 'grayagain' during the
+** propagate phase (threads, weak tables, and objects caught in back
+** barriers) are moved to the 'gray' list, to be traversed again one
+** at a time. Those that must still be visited by the atomic phase go
+** back to 'grayagain'; the others turn black, and barriers will keep
+** track of any later change to them.
+*/
+static void enterremark (global_State *g) {
+  g->gray = g->grayagain;
+  g->grayagain = NULL;
+  g->gcephmarked = 0;
+  g->gcremark++;
+  g->gcstate = GCSremark;
+}
+
+
+/*
+** Do a remark step. Each step traverses one gray object. When a round
+** ends, start another one if traversing ephemeron tables marked some
+** value (so that convergence is not reached yet), up to GCMAXREMARK
+** rounds. This does incrementally most of the work otherwise done by
+** 'atomic' when propagating 'grayagain' and converging ephemerons, so
+** that the atomic phase has to revisit only what the mutator changed
+** after that. (Clearing weak tables cannot be done incrementally: the
+** mutator could retrieve collected objects from them.)
+*/
+static l_mem remarkstep (global_State *g, int fast) {
+  if (!fast && g->gray != NULL)
+    return propagatemark(g);  /* traverse one gray object */
+  else if (!fast && g->gcephmarked && g->gcremark < GCMAXREMARK)
+    enterremark(g);  /* start another round */
+  else
+    g->gcstate = GCSenteratomic;  /* finish remark phase */
+  return 1;
+}
+
+
 /*
 ** Do a sweep step. The normal case (not fast) sweeps at most GCSWEEPMAX
 ** elements. The fast case sweeps the whole list.
@@ -1599,13 +1871,13 @@ static void sweepstep (lua_State *L, global_State *g,
 /*
 ** Performs one incremental "step" in an incremental garbage collection.
 ** For indivisible work, a step goes to the next state. When marking
-** (propagating), a step traverses one object. When sweeping, a step
-** sweeps GCSWEEPMAX objects, to avoid a big overhead for sweeping
-** objects one by one. (Sweeping is inexpensive, no matter the
-** object.) When 'fast' is true, 'singlestep' tries to finish a state
-** "as fast as possible". In particular, it skips the propagation
-** phase and leaves all objects to be traversed by the atomic phase:
-** That avoids traversing twice some objects, such as threads and
+** (propagating or remarking), a step traverses one object. When
+** sweeping, a step sweeps GCSWEEPMAX objects, to avoid a big overhead
+** for sweeping objects one by one. (Sweeping is inexpensive, no matter
+** the object.) When 'fast' is true, 'singlestep' tries to finish a state
+** "as fast as possible". In particular, it skips the propagation and
+** remark phases and leaves all objects to be traversed by the atomic
+** phase: That avoids traversing twice some objects, such as threads and
 ** weak tables.
 */
 
@@ -1616,25 +1888,36 @@ static void sweepstep (lua_State *L, global_State *g,
 
 static l_mem singlestep (lua_State *L, int fast) {
   global_State *g = G(L);
+  lu_byte state = g->gcstate;
+  lu_byte kind = g->gckind;
   l_mem stepresult;
   lua_assert(!g->gcstopem);  /* collector is not reentrant */
   g->gcstopem = 1;  /* no emergency collections while collecting */
   switch (g->gcstate) {
     case GCSpause: {
+      startcycle(g);
       restartcollection(g);
       g->gcstate = GCSpropagate;
       stepresult = 1;
       break;
     }
     case GCSpropagate: {
-      if (fast || g->gray == NULL) {
-        g->gcstate = GCSenteratomic;  /* finish propagate phase */
+      if (fast) {
+        g->gcstate = GCSenteratomic;  /* skip propagate and remark */
+        stepresult = 1;
+      }
+      else if (g->gray == NULL) {
+        enterremark(g);  /* finish propagate phase */
         stepresult = 1;
       }
       else
         stepresult = propagatemark(g);  /* traverse one gray object */
       break;
     }
+    case GCSremark: {
+      stepresult = remarkstep(g, fast);
+      break;
+    }
     case GCSenteratomic: {
       atomic(L);
       if (checkmajorminor(L, g))
@@ -1675,6 +1958,7 @@ static l_mem singlestep (lua_State *L, int fast) {
       else {  /* no more finalizers or emergency mode or not enough stack
                  to run finalizers */
         g->gcstate = GCSpause;  /* finish collection */
+        endcycle(g);
         stepresult = step2pause;
       }
       break;
@@ -1682,6 +1966,8 @@ static l_mem singlestep (lua_State *L, int fast) {
     default: lua_assert(0); return 0;
   }
   g->gcstopem = 0;
+  if (g->gcstate != state)  /* changed phase? */
+    statphase(g, gcphase(kind, state));
   return stepresult;
 }
 
@@ -1728,6 +2014,143 @@ static void incstep (lua_State *L, global_State *g) {
 }
 
 
+/*
+** {======================================================
+** Pause-time controller
+** =======================================================
+*/
+
+/*
+** Number of steps in each window of the controller. At the end of a
+** window, if more than 1% of its steps overran the target (that is,
+** the 99th percentile of its pauses is over the target), the step size
+** is halved; if all of them took less than half the target, it grows
+** by a quarter.
+*/
+#if !defined(LUAI_GCTWINDOW)
+#define LUAI_GCTWINDOW	100
+#endif
+
+/* bounds for the step size chosen by the controller */
+#define GCTMINSTEP	1024
+#define GCTMAXSTEP	(16 * LUAI_GCSTEPSIZE)
+
+/* bounds for the minor multiplier chosen by the controller */
+#define GCTMINMINOR	5
+#define GCTMAXMINOR	100
+
+/* bounds for the step multiplier chosen by the controller */
+#define GCTMINMUL	100
+#define GCTMAXMUL	2000
+
+
+/*
+** Scales parameter 'p' by 'num'/'den', keeping it inside ['lo','hi'].
+*/
+static lu_byte scaleparam (lu_byte p, int num, int den, l_mem lo, l_mem hi) {
+  l_mem v = luaO_applyparam(p, 100) / den * num;
+  if (v < lo) v = lo;
+  else if (v > hi) v = hi;
+  return luaO_codeparam(cast_uint(v));
+}
+
+
+/*
+** End of a window: adjust the granularity of the collector to the
+** pauses seen in it. Young collections cannot be split, so in minor
+** mode the controller shrinks the young generation instead; if even
+** the smallest one misses the target, it changes to incremental mode.
+*/
+static void tunestep (lua_State *L, global_State *g) {
+  int shrink = (g->gctover * 100 > g->gctsteps);
+  if (shrink || g->gctwmax * 2 <= g->gctpause) {
+    int num = shrink ? 1 : 5;
+    int den = shrink ? 2 : 4;
+    if (g->gckind == KGC_GENMINOR) {
+      lu_byte p = g->gcparams[LUA_GCPMINORMUL];
+      g->gcparams[LUA_GCPMINORMUL] = scaleparam(p, num, den,
+                                                GCTMINMINOR, GCTMAXMINOR);
+      if (shrink && g->gcparams[LUA_GCPMINORMUL] == p)  /* at minimum? */
+        luaC_changemode(L, KGC_INC);
+    }
+    else
+      g->gcparams[LUA_GCPSTEPSIZE] = scaleparam(g->gcparams[LUA_GCPSTEPSIZE],
+                                        num, den, GCTMINSTEP, GCTMAXSTEP);
+  }
+  g->gctsteps = g->gctover = 0;
+  g->gctwmax = 0;
+}
+
+
+/*
+** End of an incremental cycle: adjust the speed of the collector to
+** the heap overhead seen in the cycle. A faster collector ends its
+** cycles sooner, so the heap grows less while a cycle runs. (The
+** pause was set to half the overhead, leaving the other half for the
+** growth during the cycle.)
+*/
+static void tuneheap (global_State *g) {
+  l_mem limit = g->GCmarked / 100 * g->gctheap;
+  l_mem over = g->gctpeak - g->GCmarked;
+  if (over > limit)
+    g->gcparams[LUA_GCPSTEPMUL] = scaleparam(g->gcparams[LUA_GCPSTEPMUL],
+                                             3, 2, GCTMINMUL, GCTMAXMUL);
+  else if (over < limit / 2)
+    g->gcparams[LUA_GCPSTEPMUL] = scaleparam(g->gcparams[LUA_GCPSTEPMUL],
+                                             3, 4, GCTMINMUL, GCTMAXMUL);
+  g->gctpeak = 0;
+}
+
+
+/*
+** Accounts a step that took 't' microseconds, started in state 'state'
+** and kind 'kind', with 'tb' bytes in use. The atomic phase cannot be
+** split, so a step that goes through it (or changes the kind of the
+** collector) is not counted against the target.
+*/
+static void gctsample (lua_State *L, global_State *g, lu_byte state,
+                       lu_byte kind, l_mem tb, l_mem t) {
+  if (tb > g->gctpeak)
+    g->gctpeak = tb;
+  if (kind == g->gckind &&
+      !(state <= GCSatomic && g->gcstate > GCSatomic)) {  /* not atomic? */
+    if (t > g->gctwmax)
+      g->gctwmax = t;
+    if (t > g->gctpause)
+      g->gctover++;
+    if (++g->gctsteps >= LUAI_GCTWINDOW)
+      tunestep(L, g);
+  }
+  if (g->gckind == KGC_INC && kind == KGC_INC &&
+      state != GCSpause && g->gcstate == GCSpause)
+    tuneheap(g);  /* end of a cycle */
+}
+
+
+/*
+** Sets the pause target to 'usec' microseconds and the heap overhead
+** to '*overhead' percent, or turns the controller off if 'usec' is
+** zero. Leaves everything unchanged if 'usec' is negative. Returns the
+** previous target, with the previous overhead in '*overhead'.
+*/
+int luaC_settarget (global_State *g, int usec, int *overhead) {
+  int res = cast_int(g->gctpause);
+  int oldheap = g->gctheap;
+  if (usec >= 0) {
+    g->gctpause = usec;
+    g->gctheap = (usec > 0) ? *overhead : 0;
+    g->gctsteps = g->gctover = 0;
+    g->gctwmax = g->gctpeak = 0;
+    if (usec > 0)  /* start cycles at half the overhead */
+      setgcparam(g, PAUSE, 100 + cast_uint(g->gctheap) / 2);
+  }
+  *overhead = oldheap;
+  return res;
+}
+
+/* }====================================================== */
+
+
 #if !defined(luai_tracegc)
 #define luai_tracegc(L,f)		((void)0)
 #endif
@@ -1745,6 +2168,12 @@ void luaC_step (lua_State *L) {
       luaE_setdebt(g, 20000);
   }
   else {
+    int timed = (g->gctpause > 0);  /* controller on? */
+    lu_byte state = g->gcstate;
+    lu_byte kind = g->gckind;
+    l_mem tb = gettotalbytes(g);
+    l_mem t0 = statbegin(g);
+    l_mem t;
     luai_tracegc(L, 1);  /* for internal debugging */
     switch (g->gckind) {
       case KGC_INC: case KGC_GENMAJOR:
@@ -1755,11 +2184,72 @@ void luaC_step (lua_State *L) {
         setminordebt(g);
         break;
     }
+    t = statend(g, t0);
+    if (timed && g->gctpause > 0)
+      gctsample(L, g, state, kind, tb, t);
+    luaM_bgflush(g);  /* pass freed blocks to the background thread */
     luai_tracegc(L, 0);  /* for internal debugging */
   }
 }
 
 
+/*
+** Number of work units done between two readings of the clock in
+** time-limited steps. (Single steps can be very cheap; reading the
+** clock after each one would add a significant overhead.)
+*/
+#define GCCLOCKUNITS	64
+
+
+/*
+** Performs incremental steps until the clock reaches 'usec'
+** microseconds from now or the cycle ends. Returns 2 if the cycle
+** finished, 1 if it has already gone through its atomic phase, and
+** 0 if the atomic phase is still pending. In generational mode, a
+** minor collection cannot be split, so it does one young collection.
+*/
+int luaC_stepdeadline (lua_State *L, l_mem usec) {
+  global_State *g = G(L);
+  l_mem t0 = statbegin(g);
+  l_mem deadline = luaE_clock() + usec;
+  l_mem work = 0;
+  int res;
+  lua_assert(!g->gcemergency);
+  luai_tracegc(L, 1);  /* for internal debugging */
+  if (g->gckind == KGC_GENMINOR) {
+    youngcollection(L, g);
+    setminordebt(g);
+    res = 2;
+  }
+  else {
+    for (;;) {
+      l_mem stres = singlestep(L, 0);  /* perform one single step */
+      if (stres == step2pause || stres == step2minor)
+        break;  /* end of cycle */
+      else if (stres == atomicstep || (work += stres) >= GCCLOCKUNITS) {
+        work = 0;
+        if (luaE_clock() >= deadline)
+          break;  /* out of time */
+      }
+    }
+    if (g->gckind == KGC_GENMINOR)  /* returned to minor collections? */
+      res = 2;  /* (debt already set when changing mode) */
+    else if (g->gcstate == GCSpause) {
+      setpause(g);  /* pause until next cycle */
+      res = 2;
+    }
+    else {
+      luaE_setdebt(g, applygcparam(g, STEPSIZE, 100));
+      res = !keepinvariant(g);  /* already past the atomic phase? */
+    }
+  }
+  statend(g, t0);
+  luaM_bgflush(g);  /* pass freed blocks to the background thread */
+  luai_tracegc(L, 0);  /* for internal debugging */
+  return res;
+}
+
+
 /*
 ** Perform a full collection in incremental mode.
 ** Before running the collection, check 'keepinvariant'; if it is true,
@@ -1785,6 +2275,7 @@ static void fullinc (lua_State *L, global_State *g) {
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
+  l_mem t0 = statbegin(g);
   lua_assert(!g->gcemergency);
   g->gcemergency = cast_byte(isemergency);  /* set flag */
   switch (g->gckind) {
@@ -1797,6 +2288,8 @@ void luaC_fullgc (lua_State *L, int isemergency) {
       break;
   }
   g->gcemergency = 0;
+  statend(g, t0);
+  luaM_bgflush(g);  /* pass freed blocks to the background thread */
 }
 
 /* }====================================================== */
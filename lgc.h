@@ -33,19 +33,26 @@
 ** Possible states of the Garbage Collector
 */
 #define GCSpropagate	0
-#define GCSenteratomic	1
-#define GCSatomic	2
-#define GCSswpallgc	3
-#define GCSswpfinobj	4
-#define GCSswptobefnz	5
-#define GCSswpend	6
-#define GCScallfin	7
-#define GCSpause	8
+#define GCSremark	1
+#define GCSenteratomic	2
+#define GCSatomic	3
+#define GCSswpallgc	4
+#define GCSswpfinobj	5
+#define GCSswptobefnz	6
+#define GCSswpend	7
+#define GCScallfin	8
+#define GCSpause	9
 
 
 #define issweepphase(g)  \
 	(GCSswpallgc <= (g)->gcstate && (g)->gcstate <= GCSswpend)
 
+/*
+** true while the collector is marking incrementally (before the
+** atomic phase)
+*/
+#define ispropagating(g)	((g)->gcstate <= GCSremark)
+
 
 /*
 ** macro to tell when main invariant (white objects cannot point to black
@@ -254,6 +261,8 @@
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
+LUAI_FUNC int luaC_stepdeadline (lua_State *L, l_mem usec);
+LUAI_FUNC int luaC_settarget (global_State *g, int usec, int *overhead);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int state, int fast);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, lu_byte tt, size_t sz);
@@ -263,6 +272,8 @@ LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+LUAI_FUNC l_mem luaC_objsize (GCObject *o);
+LUAI_FUNC int luaC_getmode (global_State *g, Table *h);
 
 
 #endif
@@ -0,0 +1,330 @@
+/*
+** $Id: lheap.c $
+** Heap snapshots
+** See Copyright Notice in lua.h
+*/
+
+#define lheap_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lheap.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltrace.h"
+
+
+/* size of the buffer for the output */
+#define HEAPBUFFSIZE	1024
+
+
+typedef struct HeapState {
+  lua_State *L;
+  lua_Writer writer;
+  void *data;
+  int status;
+  size_t n;  /* number of bytes in 'buff' */
+  lu_byte buff[HEAPBUFFSIZE];
+} HeapState;
+
+
+#define objid(o)	cast(lua_Unsigned, cast(L_P2I, (o)))
+
+
+/*
+** {======================================================
+** Output
+** =======================================================
+*/
+
+static void flush (HeapState *H) {
+  if (H->n > 0 && H->status == 0) {
+    lua_unlock(H->L);
+    H->status = (*H->writer)(H->L, H->buff, H->n, H->data);
+    lua_lock(H->L);
+  }
+  H->n = 0;
+}
+
+
+static void writebytes (HeapState *H, const void *b, size_t size) {
+  lua_assert(size <= HEAPBUFFSIZE);
+  if (H->n + size > HEAPBUFFSIZE)
+    flush(H);
+  memcpy(H->buff + H->n, b, size);
+  H->n += size;
+}
+
+
+static void writebyte (HeapState *H, int b) {
+  lu_byte x = cast_byte(b);
+  writebytes(H, &x, 1);
+}
+
+
+/* size for 'writevarint' buffer (see 'dumpVarint') */
+#define DIBS    ((l_numbits(lua_Unsigned) + 6) / 7)
+
+/*
+** Writes an unsigned integer using the MSB Varint encoding
+*/
+static void writevarint (HeapState *H, lua_Unsigned x) {
+  lu_byte buff[DIBS];
+  unsigned n = 1;
+  buff[DIBS - 1] = x & 0x7f;  /* fill least-significant byte */
+  while ((x >>= 7) != 0)  /* fill other bytes in reverse order */
+    buff[DIBS - (++n)] = cast_byte((x & 0x7f) | 0x80);
+  writebytes(H, buff + DIBS - n, n);
+}
+
+
+static void edge (HeapState *H, int kind, lua_Unsigned label,
+                                GCObject *o) {
+  writebyte(H, kind);
+  writevarint(H, label);
+  writevarint(H, objid(o));
+}
+
+
+#define edgeobj(H,k,l,t)	edge(H, k, l, obj2gco(t))
+
+#define edgeobjN(H,k,l,t)	{ if (t) edgeobj(H,k,l,t); }
+
+
+static void edgevalue (HeapState *H, int kind, lua_Unsigned label,
+                                     const TValue *v) {
+  if (iscollectable(v))
+    edge(H, kind, label, gcvalue(v));
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Edges of each kind of object. They follow the traversal functions
+** of the collector, so that an edge exists iff the collector would
+** mark its target through the object. Weak references have no edges.
+** =======================================================
+*/
+
+static void tableedges (HeapState *H, Table *h) {
+  int mode = luaC_getmode(G(H->L), h);
+  int strongvalues = !(mode & 1);
+  unsigned i;
+  edgeobjN(H, HE_METATABLE, 0, h->metatable);
+  if (isshaped(h)) {  /* keys are kept by the shape */
+    Shape *s = getshape(h);
+    TValue *vals = shapevals(h);
+    edgeobj(H, HE_INTERNAL, 0, s);
+    for (i = 0; i < s->nkeys && strongvalues; i++)
+      edgevalue(H, HE_FIELD, objid(s->keys[i]), vals + i);
+  }
+  else {
+    Node *n, *limit = gnode(h, cast_sizet(sizenode(h)));
+    for (n = gnode(h, 0); n < limit; n++) {
+      if (isempty(gval(n)))
+        continue;
+      if (keyiscollectable(n) && !(mode & 2))  /* strong key? */
+        edge(H, HE_KEY, 0, gckey(n));
+      if (!strongvalues)
+        continue;
+      else if (keyisinteger(n))
+        edgevalue(H, HE_INDEX, l_castS2U(keyival(n)), gval(n));
+      else if (keyiscollectable(n) && novariant(keytt(n)) == LUA_TSTRING)
+        edgevalue(H, HE_FIELD, objid(gckey(n)), gval(n));
+      else
+        edgevalue(H, HE_VALUE, keyiscollectable(n) ? objid(gckey(n)) : 0,
+                               gval(n));
+    }
+  }
+  for (i = 0; i < h->asize && strongvalues; i++) {  /* array part */
+    if (*getArrTag(h, i) & BIT_ISCOLLECTABLE)
+      edge(H, HE_INDEX, cast(lua_Unsigned, i) + 1, getArrVal(h, i)->gc);
+  }
+}
+
+
+static void protoedges (HeapState *H, Proto *f) {
+  int i;
+  edgeobjN(H, HE_INTERNAL, 0, f->source);
+  for (i = 0; i < f->sizek; i++)
+    edgevalue(H, HE_INTERNAL, 0, &f->k[i]);
+  for (i = 0; i < f->sizeupvalues; i++)
+    edgeobjN(H, HE_INTERNAL, 0, f->upvalues[i].name);
+  for (i = 0; i < f->sizep; i++)
+    edgeobjN(H, HE_INTERNAL, 0, f->p[i]);
+  for (i = 0; i < f->sizelocvars; i++)
+    edgeobjN(H, HE_INTERNAL, 0, f->locvars[i].varname);
+  /* 'cache' is a weak reference */
+}
+
+
+static void Lclosureedges (HeapState *H, LClosure *cl) {
+  Proto *p = cl->p;
+  int i;
+  edgeobjN(H, HE_INTERNAL, 0, p);
+  for (i = 0; i < cl->nupvalues; i++) {
+    UpVal *uv = cl->upvals[i];
+    TString *name = (p != NULL && i < p->sizeupvalues)
+                  ? p->upvalues[i].name : NULL;
+    if (uv == NULL)  /* closure being created? */
+      continue;
+    else if (name != NULL)
+      edgeobj(H, HE_UPNAME, objid(name), uv);
+    else
+      edgeobj(H, HE_UPVALUE, cast(lua_Unsigned, i) + 1, uv);
+  }
+}
+
+
+static void threadedges (HeapState *H, lua_State *th) {
+  StkId o = th->stack.p;
+  UpVal *uv;
+  edgevalue(H, HE_ENV, 0, &th->env);
+  edgevalue(H, HE_INTERNAL, 0, &th->pseudo);
+  if (o == NULL)
+    return;  /* stack not completely built yet */
+  for (; o < th->top.p; o++)
+    edgevalue(H, HE_STACK, cast(lua_Unsigned, o - th->stack.p) + 1, s2v(o));
+  for (uv = th->openupval; uv != NULL; uv = uv->u.open.next)
+    edgeobj(H, HE_INTERNAL, 0, uv);
+}
+
+
+static void objedges (HeapState *H, GCObject *o) {
+  switch (o->tt) {
+    case LUA_VTABLE: tableedges(H, gco2t(o)); break;
+    case LUA_VLCL: Lclosureedges(H, gco2lcl(o)); break;
+    case LUA_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      int i;
+      for (i = 0; i < cl->nupvalues; i++)
+        edgevalue(H, HE_UPVALUE, cast(lua_Unsigned, i) + 1, &cl->upvalue[i]);
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      int i;
+      edgeobjN(H, HE_METATABLE, 0, u->metatable);
+      for (i = 0; i < u->nuvalue; i++)
+        edgevalue(H, HE_USERVALUE, cast(lua_Unsigned, i) + 1, &u->uv[i].uv);
+      break;
+    }
+    case LUA_VUPVAL: edgevalue(H, HE_INTERNAL, 0, gco2upv(o)->v.p); break;
+    case LUA_VPROTO: protoedges(H, gco2p(o)); break;
+    case LUA_VTHREAD: threadedges(H, gco2th(o)); break;
+    case LUA_VSHAPE: {
+      Shape *s = gco2sh(o);
+      edgeobjN(H, HE_INTERNAL, 0, s->parent);
+      if (s->nkeys > 0)  /* other keys are kept by the parent */
+        edgeobj(H, HE_INTERNAL, 0, s->keys[s->nkeys - 1]);
+      break;
+    }
+    default: lua_assert(o->tt == LUA_VSHRSTR || o->tt == LUA_VLNGSTR);
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** Roots are the objects marked by 'restartcollection'. (The registry
+** comes first, as tools may prefer the first paths they find.)
+*/
+static void roots (HeapState *H) {
+  global_State *g = G(H->L);
+  Tracer *tr = g->tracer;
+  GCObject *o;
+  int i;
+  edgevalue(H, HE_REGISTRY, 0, &g->l_registry);
+  edgeobj(H, HE_MAINTHREAD, 0, mainthread(g));
+  for (i = 0; i < LUA_NUMTYPES; i++)
+    edgeobjN(H, HE_TYPEMT, cast(lua_Unsigned, i), g->mt[i]);
+  if (tr != NULL) {
+    for (i = 0; i < tr->nentries; i++) {
+      if (tr->entries[i].f == NULL)  /* a Lua function? */
+        edgeobj(H, HE_INTERNAL, 0, cast(Proto *, tr->entries[i].key));
+    }
+  }
+  edgeobjN(H, HE_INTERNAL, 0, g->keys);
+  for (o = g->tobefnz; o != NULL; o = o->next)
+    edge(H, HE_FINALIZING, 0, o);
+  writebyte(H, 0);
+}
+
+
+static void object (HeapState *H, GCObject *o) {
+  writebyte(H, o->tt);
+  writevarint(H, objid(o));
+  writevarint(H, cast(lua_Unsigned, luaC_objsize(o)));
+  if (novariant(o->tt) == LUA_TSTRING) {
+    size_t len;
+    const char *s = getlstr(gco2ts(o), len);
+    writevarint(H, len);
+    writebytes(H, s, (len < HEAPSTRLEN) ? len : HEAPSTRLEN);
+  }
+  objedges(H, o);
+  writebyte(H, 0);
+}
+
+
+static void dumpheap (lua_State *L, void *ud) {
+  HeapState *H = cast(HeapState *, ud);
+  global_State *g = G(L);
+  GCObject *lists[4];
+  int i;
+  lists[0] = g->allgc; lists[1] = g->finobj;
+  lists[2] = g->tobefnz; lists[3] = g->fixedgc;
+  writebytes(H, HEAPSIGNATURE, sizeof(HEAPSIGNATURE) - sizeof(char));
+  writebyte(H, HEAPVERSION);
+  roots(H);
+  for (i = 0; i < 4; i++) {
+    GCObject *o;
+    for (o = lists[i]; o != NULL; o = o->next) {
+      if (!isdead(g, o))  /* (dead objects may refer to freed ones) */
+        object(H, o);
+    }
+  }
+  writebyte(H, 0);
+  flush(H);
+}
+
+
+LUA_API int lua_heapsnapshot (lua_State *L, lua_Writer writer, void *data) {
+  global_State *g;
+  HeapState H;
+  lu_byte oldgcstp, oldgcstopem;
+  TStatus status;
+  lua_lock(L);
+  g = G(L);
+  H.L = L;
+  H.writer = writer;
+  H.data = data;
+  H.status = 0;
+  H.n = 0;
+  /* the writer must not run the collector while the lists are walked */
+  oldgcstp = g->gcstp;
+  oldgcstopem = g->gcstopem;
+  g->gcstp |= GCSTPGC;
+  g->gcstopem = 1;
+  status = luaD_rawrunprotected(L, dumpheap, &H);
+  g->gcstp = oldgcstp;
+  g->gcstopem = oldgcstopem;
+  if (l_unlikely(status != LUA_OK))  /* error in the writer? */
+    luaD_throw(L, status);  /* propagate it */
+  lua_unlock(L);
+  return H.status;
+}
@@ -0,0 +1,57 @@
+/*
+** $Id: lheap.h $
+** Heap snapshots
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lheap_h
+#define lheap_h
+
+
+/*
+** Format of a heap snapshot. All numbers are unsigned varints, as in
+** precompiled chunks. A snapshot is
+**
+**   HEAPSIGNATURE HEAPVERSION root* 0 object* 0
+**
+** where a root is an edge from no object and an object is
+**
+**   tag id size [len contents] edge* 0
+**
+** 'tag' is the variant tag of the object (a byte, never zero); 'len'
+** and 'contents' only appear in strings, with at most HEAPSTRLEN bytes
+** of contents. An edge is
+**
+**   kind label target
+**
+** where 'kind' is a byte (never zero), 'target' is the id of the
+** referenced object, and the meaning of 'label' depends on the kind.
+** Ids are the addresses of the objects.
+*/
+
+#define HEAPSIGNATURE	"\x1bLuaH"
+#define HEAPVERSION	1
+
+/* maximum number of bytes kept from the contents of a string */
+#define HEAPSTRLEN	64
+
+
+/* kinds of edges */
+#define HE_INTERNAL	1	/* internal reference (label is 0) */
+#define HE_FIELD	2	/* value of a string key (label: id of key) */
+#define HE_INDEX	3	/* value of an integer key (label: the key) */
+#define HE_VALUE	4	/* value of other key (label: its id or 0) */
+#define HE_KEY		5	/* key of a table */
+#define HE_METATABLE	6
+#define HE_UPVALUE	7	/* upvalue (label: its index) */
+#define HE_UPNAME	8	/* upvalue (label: id of its name) */
+#define HE_USERVALUE	9	/* user value (label: its index) */
+#define HE_STACK	10	/* stack slot (label: its index) */
+#define HE_ENV		11	/* environment of a thread */
+/* kinds of roots */
+#define HE_REGISTRY	12
+#define HE_MAINTHREAD	13
+#define HE_TYPEMT	14	/* metatable of a basic type (label: type) */
+#define HE_FINALIZING	15	/* object being finalized */
+
+#endif
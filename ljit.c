@@ -0,0 +1,1105 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler of loops to machine code
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "ldebug.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+
+
+#if LUA_USE_JIT		/* { */
+
+#include <sys/mman.h>
+
+/* not declared in strict POSIX mode; this is its value in x86-64 Linux */
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS	0x20
+#endif
+
+
+/*
+** The compiler translates a hot 'for' loop into x86-64 code, one
+** template per instruction. Each template handles only the common case
+** of its instruction (numbers, the array part of tables, etc.); in any
+** other case, the code leaves the loop ("exits") just before that
+** instruction, and the interpreter goes on from there. So, the code
+** never calls the rest of the system: it cannot raise errors, call
+** metamethods, or allocate memory. At each iteration, the code also
+** exits if there is a trap in its CallInfo, so that hooks (and signals)
+** see every instruction.
+**
+** The compiled function receives the base of its frame, its constants,
+** the address of the trap of its CallInfo, and the upvalues of its
+** closure. It returns the address of the next instruction for the
+** interpreter to execute.
+*/
+typedef const Instruction *(*JitFunction) (StkId base, const TValue *k,
+                                           volatile l_signalT *trap,
+                                           UpVal **upvals);
+
+
+/* x86-64 registers */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3
+#define RSP	4
+#define RSI	6
+#define R8	8
+#define R12	12
+#define R13	13
+#define R14	14
+
+/* registers with the arguments of the compiled function */
+#define RBASE	RBX
+#define RKST	R12
+#define RTRAP	R13
+#define RUPVALS	R14
+
+/* condition codes */
+#define CC_ALWAYS	(-1)
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_NS	0x9
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+
+#define negcc(cc)	((cc) ^ 1)
+
+
+/* offsets in the stack, in the constants, and in TValues */
+#define SLOT(r)		(cast_int(r) * cast_int(sizeof(StackValue)))
+#define KST(r)		(cast_int(r) * cast_int(sizeof(TValue)))
+#define VAL		cast_int(offsetof(TValue, value_))
+#define TT		cast_int(offsetof(TValue, tt_))
+
+
+#define MAXJUMPS	(2 * LUAI_JITMAXLOOP)
+#define MAXEXITS	(8 * LUAI_JITMAXLOOP)
+
+
+/* a jump waiting for the position of its target */
+typedef struct Patch {
+  size_t pos;  /* position of the displacement of the jump */
+  int target;  /* index of target instruction */
+} Patch;
+
+
+typedef struct JitState {
+  lu_byte *code;  /* buffer for the machine code */
+  size_t size;  /* size of 'code' */
+  size_t n;  /* number of bytes generated (may exceed 'size') */
+  const Proto *p;
+  int first;  /* first instruction in the loop */
+  int last;  /* last instruction in the loop (its OP_FORLOOP) */
+  int fail;  /* true if loop cannot be compiled */
+  int njumps;  /* number of jumps to instructions inside the loop */
+  int nexits;  /* number of jumps to instructions outside the loop */
+  size_t label[LUAI_JITMAXLOOP];  /* position of each instruction */
+  Patch jumps[MAXJUMPS];
+  Patch exits[MAXEXITS];
+} JitState;
+
+
+/*
+** {======================================================
+** Encoding of x86-64 instructions
+** =======================================================
+*/
+
+static void b_ (JitState *J, int b) {
+  if (J->n < J->size)
+    J->code[J->n] = cast_byte(b);
+  J->n++;
+}
+
+
+static void d_ (JitState *J, unsigned int d) {
+  int i;
+  for (i = 0; i < 4; i++) {
+    b_(J, cast_int(d & 0xffu));
+    d >>= 8;
+  }
+}
+
+
+static void q_ (JitState *J, lua_Unsigned q) {
+  int i;
+  for (i = 0; i < 8; i++) {
+    b_(J, cast_int(q & 0xffu));
+    q >>= 8;
+  }
+}
+
+
+/* REX prefix, when needed */
+static void rex (JitState *J, int w, int r, int x, int b) {
+  int v = 0x40 | (w << 3) | ((r >> 3) << 2) | ((x >> 3) << 1) | (b >> 3);
+  if (v != 0x40)
+    b_(J, v);
+}
+
+
+/* ModRM for register operands */
+static void modreg (JitState *J, int r, int rm) {
+  b_(J, 0xC0 | ((r & 7) << 3) | (rm & 7));
+}
+
+
+/* ModRM (and SIB) for memory operand '[base + disp]' */
+static void modmem (JitState *J, int r, int base, int disp) {
+  b_(J, 0x80 | ((r & 7) << 3) | (base & 7));  /* mod 10 (disp32) */
+  if ((base & 7) == RSP)
+    b_(J, 0x24);  /* SIB without index */
+  d_(J, cast_uint(disp));
+}
+
+
+/* ModRM and SIB for memory operand '[base + index * 2^scale + disp]' */
+static void modidx (JitState *J, int r, int base, int index, int scale,
+                    int disp) {
+  b_(J, 0x84 | ((r & 7) << 3));  /* mod 10 (disp32), SIB follows */
+  b_(J, (scale << 6) | ((index & 7) << 3) | (base & 7));
+  d_(J, cast_uint(disp));
+}
+
+
+/* mov r64, [base + disp] */
+static void loadq (JitState *J, int r, int base, int disp) {
+  rex(J, 1, r, 0, base); b_(J, 0x8B); modmem(J, r, base, disp);
+}
+
+
+/* mov [base + disp], r64 */
+static void storeq (JitState *J, int base, int disp, int r) {
+  rex(J, 1, r, 0, base); b_(J, 0x89); modmem(J, r, base, disp);
+}
+
+
+/* mov r32, [base + disp] */
+static void loadd (JitState *J, int r, int base, int disp) {
+  rex(J, 0, r, 0, base); b_(J, 0x8B); modmem(J, r, base, disp);
+}
+
+
+/* movzx r32, byte [base + disp] */
+static void loadb (JitState *J, int r, int base, int disp) {
+  rex(J, 0, r, 0, base); b_(J, 0x0F); b_(J, 0xB6); modmem(J, r, base, disp);
+}
+
+
+/* mov [base + disp], r8 (for RAX or RCX) */
+static void storeb (JitState *J, int base, int disp, int r) {
+  rex(J, 0, r, 0, base); b_(J, 0x88); modmem(J, r, base, disp);
+}
+
+
+/* mov byte [base + disp], imm8 */
+static void storebi (JitState *J, int base, int disp, int v) {
+  rex(J, 0, 0, 0, base); b_(J, 0xC6); modmem(J, 0, base, disp); b_(J, v);
+}
+
+
+/* cmp byte [base + disp], imm8 */
+static void cmpbi (JitState *J, int base, int disp, int v) {
+  rex(J, 0, 0, 0, base); b_(J, 0x80); modmem(J, 7, base, disp); b_(J, v);
+}
+
+
+/* mov r64, imm64 */
+static void movqi (JitState *J, int r, lua_Unsigned v) {
+  rex(J, 1, 0, 0, r); b_(J, 0xB8 + (r & 7)); q_(J, v);
+}
+
+
+/* 'op r64a, r64b', for 'op r/m64, r64' (add, sub, cmp, test) */
+#define ALU_ADD		0x01
+#define ALU_SUB		0x29
+#define ALU_CMP		0x39
+#define ALU_TEST	0x85
+
+static void alu (JitState *J, int op, int a, int b) {
+  rex(J, 1, b, 0, a); b_(J, op); modreg(J, b, a);
+}
+
+
+/* imul r64a, r64b */
+static void imul (JitState *J, int a, int b) {
+  rex(J, 1, a, 0, b); b_(J, 0x0F); b_(J, 0xAF); modreg(J, a, b);
+}
+
+
+/* cmp r64, imm32 */
+static void cmpqi (JitState *J, int r, int v) {
+  rex(J, 1, 0, 0, r); b_(J, 0x81); modreg(J, 7, r); d_(J, cast_uint(v));
+}
+
+
+/* sub r64, imm8 */
+static void subqi (JitState *J, int r, int v) {
+  rex(J, 1, 0, 0, r); b_(J, 0x83); modreg(J, 5, r); b_(J, v);
+}
+
+
+/* neg r64 */
+static void negq (JitState *J, int r) {
+  rex(J, 1, 0, 0, r); b_(J, 0xF7); modreg(J, 3, r);
+}
+
+
+/* test r8, imm8 (for RAX or RCX) */
+static void testbi (JitState *J, int r, int v) {
+  b_(J, 0xF6); modreg(J, 0, r); b_(J, v);
+}
+
+
+/* SSE2 instructions */
+#define SSE_MOVLD	0xF2, 0, 0x10	/* movsd xmm, m64 */
+#define SSE_MOVST	0xF2, 0, 0x11	/* movsd m64, xmm */
+#define SSE_CVTI	0xF2, 1, 0x2A	/* cvtsi2sd xmm, r/m64 */
+#define SSE_ADD		0xF2, 0, 0x58	/* addsd xmm, xmm */
+#define SSE_MUL		0xF2, 0, 0x59	/* mulsd xmm, xmm */
+#define SSE_SUB		0xF2, 0, 0x5C	/* subsd xmm, xmm */
+#define SSE_DIV		0xF2, 0, 0x5E	/* divsd xmm, xmm */
+#define SSE_UCOMI	0x66, 0, 0x2E	/* ucomisd xmm, xmm */
+#define SSE_MOVQ	0x66, 1, 0x6E	/* movq xmm, r64 */
+
+static void ssemem (JitState *J, int pre, int w, int op, int x, int base,
+                    int disp) {
+  b_(J, pre); rex(J, w, x, 0, base); b_(J, 0x0F); b_(J, op);
+  modmem(J, x, base, disp);
+}
+
+
+static void ssereg (JitState *J, int pre, int w, int op, int x, int rm) {
+  b_(J, pre); rex(J, w, x, 0, rm); b_(J, 0x0F); b_(J, op);
+  modreg(J, x, rm);
+}
+
+
+/*
+** Emit a jump (conditional or not) with a 32-bit displacement still to
+** be filled; returns the position of that displacement.
+*/
+static size_t jump (JitState *J, int cc) {
+  if (cc == CC_ALWAYS)
+    b_(J, 0xE9);
+  else {
+    b_(J, 0x0F); b_(J, 0x80 + cc);
+  }
+  d_(J, 0);
+  return J->n - 4;
+}
+
+
+/* make the jump with displacement at 'pos' go to position 'target' */
+static void patch (JitState *J, size_t pos, size_t target) {
+  if (pos + 4 <= J->size) {
+    ptrdiff_t d = cast(ptrdiff_t, target) - cast(ptrdiff_t, pos + 4);
+    size_t n = J->n;
+    J->n = pos;
+    d_(J, cast_uint(d));
+    J->n = n;
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+/* jump to instruction 'target', which may be outside the loop */
+static void jumpto (JitState *J, int cc, int target) {
+  Patch *pt;
+  if (J->first <= target && target <= J->last) {
+    if (J->njumps == MAXJUMPS) { J->fail = 1; return; }
+    pt = &J->jumps[J->njumps++];
+  }
+  else {
+    if (J->nexits == MAXEXITS) { J->fail = 1; return; }
+    pt = &J->exits[J->nexits++];
+  }
+  pt->pos = jump(J, cc);
+  pt->target = target;
+}
+
+
+/* exit to the interpreter at instruction 'pc' if condition 'cc' holds */
+static void exitif (JitState *J, int cc, int pc) {
+  if (J->nexits == MAXEXITS) { J->fail = 1; return; }
+  J->exits[J->nexits].pos = jump(J, cc);
+  J->exits[J->nexits++].target = pc;
+}
+
+
+/* check that value at 'base + disp' has tag 'tt', or else exit */
+static void guardtag (JitState *J, int base, int disp, int tt, int pc) {
+  cmpbi(J, base, disp + TT, tt);
+  exitif(J, CC_NE, pc);
+}
+
+
+static lua_Unsigned fltbits (lua_Number n) {
+  lua_Unsigned u;
+  memcpy(&u, &n, sizeof(u));
+  return u;
+}
+
+
+/* R[a] := value at 'base + disp' */
+static void emitcopy (JitState *J, int a, int base, int disp) {
+  loadq(J, RAX, base, disp + VAL);
+  storeq(J, RBASE, SLOT(a) + VAL, RAX);
+  loadb(J, RAX, base, disp + TT);
+  storeb(J, RBASE, SLOT(a) + TT, RAX);
+}
+
+
+/* R[a] := numeric value with bits 'v' and tag 'tt' */
+static void emitsetnum (JitState *J, int a, lua_Unsigned v, int tt) {
+  movqi(J, RAX, v);
+  storeq(J, RBASE, SLOT(a) + VAL, RAX);
+  storebi(J, RBASE, SLOT(a) + TT, tt);
+}
+
+
+/*
+** Operand of an arithmetic instruction: a register (at 'base + disp')
+** or a number known at compile time ('known').
+*/
+typedef struct Operand {
+  int known;
+  TValue v;  /* value, if known */
+  int base, disp;
+} Operand;
+
+
+static void setregop (Operand *o, int r) {
+  o->known = 0;
+  o->base = RBASE; o->disp = SLOT(r);
+}
+
+
+static void setintop (Operand *o, lua_Integer i) {
+  o->known = 1;
+  setivalue(&o->v, i);
+}
+
+
+/* operand from constant 'c'; returns false if it is not a number */
+static int setkop (JitState *J, Operand *o, int c) {
+  const TValue *k = &J->p->k[c];
+  o->known = 1;
+  if (ttisinteger(k)) {
+    setivalue(&o->v, ivalue(k));
+  }
+  else if (ttisfloat(k)) {
+    setfltvalue(&o->v, fltvalue(k));
+  }
+  else
+    return 0;
+  return 1;
+}
+
+
+/* load operand 'o' as an integer into register 'r' (it must be one) */
+static void loadint (JitState *J, int r, const Operand *o) {
+  if (o->known)
+    movqi(J, r, l_castS2U(ivalue(&o->v)));
+  else
+    loadq(J, r, o->base, o->disp + VAL);
+}
+
+
+/* load operand 'o' as a float into register 'x', or else exit */
+static void loadflt (JitState *J, int x, const Operand *o, int pc) {
+  if (o->known) {
+    lua_Number n = ttisinteger(&o->v) ? cast_num(ivalue(&o->v))
+                                      : fltvalue(&o->v);
+    movqi(J, RDX, fltbits(n));
+    ssereg(J, SSE_MOVQ, x, RDX);
+  }
+  else {
+    size_t notflt, done;
+    cmpbi(J, o->base, o->disp + TT, LUA_VNUMFLT);
+    notflt = jump(J, CC_NE);
+    ssemem(J, SSE_MOVLD, x, o->base, o->disp + VAL);
+    done = jump(J, CC_ALWAYS);
+    patch(J, notflt, J->n);
+    guardtag(J, o->base, o->disp, LUA_VNUMINT, pc);
+    ssemem(J, SSE_CVTI, x, o->base, o->disp + VAL);
+    patch(J, done, J->n);
+  }
+}
+
+
+#define isknownflt(o)	((o)->known && ttisfloat(&(o)->v))
+
+/*
+** R[a] := x op y, for OP_ADD, OP_SUB, OP_MUL, and OP_DIV. Two integers
+** give an integer (except for OP_DIV); other numbers are converted to
+** floats.
+*/
+static void emitarith (JitState *J, OpCode op, int a, const Operand *x,
+                   const Operand *y, int pc) {
+  int intpath = (op != OP_DIV && !isknownflt(x) && !isknownflt(y));
+  size_t tofloat[2];
+  int ntofloat = 0;
+  size_t done = 0;
+  if (intpath) {
+    int i;
+    if (!x->known) {
+      cmpbi(J, x->base, x->disp + TT, LUA_VNUMINT);
+      tofloat[ntofloat++] = jump(J, CC_NE);
+    }
+    if (!y->known) {
+      cmpbi(J, y->base, y->disp + TT, LUA_VNUMINT);
+      tofloat[ntofloat++] = jump(J, CC_NE);
+    }
+    loadint(J, RAX, x);
+    loadint(J, RCX, y);
+    switch (op) {
+      case OP_ADD: alu(J, ALU_ADD, RAX, RCX); break;
+      case OP_SUB: alu(J, ALU_SUB, RAX, RCX); break;
+      default: lua_assert(op == OP_MUL); imul(J, RAX, RCX); break;
+    }
+    storeq(J, RBASE, SLOT(a) + VAL, RAX);
+    storebi(J, RBASE, SLOT(a) + TT, LUA_VNUMINT);
+    done = jump(J, CC_ALWAYS);
+    for (i = 0; i < ntofloat; i++)
+      patch(J, tofloat[i], J->n);
+  }
+  loadflt(J, 0, x, pc);
+  loadflt(J, 1, y, pc);
+  switch (op) {
+    case OP_ADD: ssereg(J, SSE_ADD, 0, 1); break;
+    case OP_SUB: ssereg(J, SSE_SUB, 0, 1); break;
+    case OP_MUL: ssereg(J, SSE_MUL, 0, 1); break;
+    default: lua_assert(op == OP_DIV); ssereg(J, SSE_DIV, 0, 1); break;
+  }
+  ssemem(J, SSE_MOVST, 0, RBASE, SLOT(a) + VAL);
+  storebi(J, RBASE, SLOT(a) + TT, LUA_VNUMFLT);
+  if (intpath)
+    patch(J, done, J->n);
+}
+
+
+/*
+** R[a] := R[b] % c, for integers and a positive constant 'c' (so, the
+** result must have the sign of 'c', and there are no overflows).
+*/
+static void emitmodk (JitState *J, int a, int b, lua_Integer c, int pc) {
+  size_t done;
+  guardtag(J, RBASE, SLOT(b), LUA_VNUMINT, pc);
+  loadq(J, RAX, RBASE, SLOT(b) + VAL);
+  movqi(J, RCX, l_castS2U(c));
+  b_(J, 0x48); b_(J, 0x99);  /* cqo */
+  rex(J, 1, 0, 0, RCX); b_(J, 0xF7); modreg(J, 7, RCX);  /* idiv rcx */
+  alu(J, ALU_TEST, RDX, RDX);
+  done = jump(J, CC_NS);
+  alu(J, ALU_ADD, RDX, RCX);  /* negative remainder: correct it */
+  patch(J, done, J->n);
+  storeq(J, RBASE, SLOT(a) + VAL, RDX);
+  storebi(J, RBASE, SLOT(a) + TT, LUA_VNUMINT);
+}
+
+
+/* R[a] := -R[b] */
+static void emitunm (JitState *J, int a, int b, int pc) {
+  size_t notint, done;
+  cmpbi(J, RBASE, SLOT(b) + TT, LUA_VNUMINT);
+  notint = jump(J, CC_NE);
+  loadq(J, RAX, RBASE, SLOT(b) + VAL);
+  negq(J, RAX);
+  storeq(J, RBASE, SLOT(a) + VAL, RAX);
+  storebi(J, RBASE, SLOT(a) + TT, LUA_VNUMINT);
+  done = jump(J, CC_ALWAYS);
+  patch(J, notint, J->n);
+  guardtag(J, RBASE, SLOT(b), LUA_VNUMFLT, pc);
+  loadq(J, RAX, RBASE, SLOT(b) + VAL);
+  movqi(J, RCX, fltbits(-0.0));  /* sign bit */
+  rex(J, 1, RCX, 0, RAX); b_(J, 0x31); modreg(J, RCX, RAX);  /* xor */
+  storeq(J, RBASE, SLOT(a) + VAL, RAX);
+  storebi(J, RBASE, SLOT(a) + TT, LUA_VNUMFLT);
+  patch(J, done, J->n);
+}
+
+
+/*
+** Conditional skip of the next instruction (a jump): skip it if the
+** condition (true when 'cc' holds after a comparison) is different
+** from 'k'.
+*/
+static void emitskip (JitState *J, int cc, int k, int pc) {
+  jumpto(J, k ? negcc(cc) : cc, pc + 2);
+}
+
+
+/*
+** Order comparisons 'x op y'. 'icc' is the condition for 'op' after
+** 'cmp x, y' with integers; 'strict' tells whether 'op' excludes
+** equality. Mixed integers and floats exit.
+*/
+static void emitorder (JitState *J, const Operand *x, const Operand *y,
+                   int icc, int strict, int k, int pc) {
+  size_t notint, done;
+  lua_assert(!x->known);
+  cmpbi(J, x->base, x->disp + TT, LUA_VNUMINT);
+  notint = jump(J, CC_NE);
+  if (!y->known)
+    guardtag(J, y->base, y->disp, LUA_VNUMINT, pc);
+  loadq(J, RAX, x->base, x->disp + VAL);
+  if (y->known)
+    cmpqi(J, RAX, cast_int(ivalue(&y->v)));
+  else {
+    loadq(J, RCX, y->base, y->disp + VAL);
+    alu(J, ALU_CMP, RAX, RCX);
+  }
+  emitskip(J, icc, k, pc);
+  done = jump(J, CC_ALWAYS);
+  patch(J, notint, J->n);
+  guardtag(J, x->base, x->disp, LUA_VNUMFLT, pc);
+  if (!y->known)
+    guardtag(J, y->base, y->disp, LUA_VNUMFLT, pc);
+  ssemem(J, SSE_MOVLD, 0, x->base, x->disp + VAL);
+  loadflt(J, 1, y, pc);
+  /* 'ucomisd' has only "above" conditions, false for NaNs */
+  if (icc == CC_L || icc == CC_LE)
+    ssereg(J, SSE_UCOMI, 1, 0);
+  else
+    ssereg(J, SSE_UCOMI, 0, 1);
+  emitskip(J, strict ? CC_A : CC_AE, k, pc);
+  patch(J, done, J->n);
+}
+
+
+/* equality of integers; anything else exits */
+static void emiteq (JitState *J, int a, const Operand *y, int k, int pc) {
+  guardtag(J, RBASE, SLOT(a), LUA_VNUMINT, pc);
+  if (!y->known)
+    guardtag(J, y->base, y->disp, LUA_VNUMINT, pc);
+  loadq(J, RAX, RBASE, SLOT(a) + VAL);
+  if (y->known)
+    cmpqi(J, RAX, cast_int(ivalue(&y->v)));
+  else {
+    loadq(J, RCX, y->base, y->disp + VAL);
+    alu(J, ALU_CMP, RAX, RCX);
+  }
+  emitskip(J, CC_E, k, pc);
+}
+
+
+/* skip next instruction if 'l_isfalse(R[a]) == k' */
+static void emittest (JitState *J, int a, int k, int pc) {
+  size_t f1, f2, t = 0;
+  loadb(J, RAX, RBASE, SLOT(a) + TT);
+  testbi(J, RAX, 0x0F);  /* nil? */
+  f1 = jump(J, CC_E);
+  b_(J, 0x3C); b_(J, LUA_VFALSE);  /* cmp al, LUA_VFALSE */
+  f2 = jump(J, CC_E);
+  /* value is true */
+  if (k == 0)
+    jumpto(J, CC_ALWAYS, pc + 2);
+  else
+    t = jump(J, CC_ALWAYS);
+  patch(J, f1, J->n);
+  patch(J, f2, J->n);
+  /* value is false */
+  if (k != 0) {
+    jumpto(J, CC_ALWAYS, pc + 2);
+    patch(J, t, J->n);
+  }
+}
+
+
+/*
+** Find array slot for table in R[t] and integer key 'key': leaves the
+** table array in RSI and the key minus one in RAX, or else exits.
+*/
+static void emitarrayslot (JitState *J, int t, const Operand *key, int pc) {
+  guardtag(J, RBASE, SLOT(t), ctb(LUA_VTABLE), pc);
+  loadq(J, RDX, RBASE, SLOT(t) + VAL);
+  if (key->known)
+    movqi(J, RAX, l_castS2U(ivalue(&key->v)) - 1u);
+  else {
+    guardtag(J, key->base, key->disp, LUA_VNUMINT, pc);
+    loadq(J, RAX, key->base, key->disp + VAL);
+    subqi(J, RAX, 1);
+  }
+  loadd(J, RCX, RDX, cast_int(offsetof(Table, asize)));
+  alu(J, ALU_CMP, RAX, RCX);
+  exitif(J, CC_AE, pc);  /* not in the array part */
+  loadq(J, RSI, RDX, cast_int(offsetof(Table, array)));
+  /* movzx ecx, byte [rsi + rax + sizeof(unsigned)] (its tag) */
+  rex(J, 0, RCX, RAX, RSI); b_(J, 0x0F); b_(J, 0xB6);
+  modidx(J, RCX, RSI, RAX, 0, cast_int(sizeof(unsigned)));
+  testbi(J, RCX, 0x0F);
+  exitif(J, CC_E, pc);  /* empty slot */
+}
+
+
+/* R[a] := R[t][key] */
+static void emitgettable (JitState *J, int a, int t, const Operand *key,
+                      int pc) {
+  emitarrayslot(J, t, key, pc);
+  negq(J, RAX);
+  /* mov r8, [rsi - rax * 8 - 8] (see 'getArrVal') */
+  rex(J, 1, R8, RAX, RSI); b_(J, 0x8B);
+  modidx(J, R8, RSI, RAX, 3, -cast_int(sizeof(Value)));
+  storeq(J, RBASE, SLOT(a) + VAL, R8);
+  storeb(J, RBASE, SLOT(a) + TT, RCX);
+}
+
+
+/*
+** R[t][key] := value, when 'key' is already in the array part. Values
+** that are collectable could need a barrier, so they exit.
+*/
+static void emitsettable (JitState *J, int t, const Operand *key,
+                      const TValue *kv, int vr, int pc) {
+  if (kv != NULL && iscollectable(kv)) {
+    J->fail = 1;
+    return;
+  }
+  if (kv == NULL) {
+    loadb(J, RCX, RBASE, SLOT(vr) + TT);
+    testbi(J, RCX, BIT_ISCOLLECTABLE);
+    exitif(J, CC_NE, pc);
+  }
+  emitarrayslot(J, t, key, pc);
+  if (kv == NULL) {
+    loadb(J, RCX, RBASE, SLOT(vr) + TT);
+    loadq(J, R8, RBASE, SLOT(vr) + VAL);
+    /* mov [rsi + rax + sizeof(unsigned)], cl */
+    rex(J, 0, RCX, RAX, RSI); b_(J, 0x88);
+    modidx(J, RCX, RSI, RAX, 0, cast_int(sizeof(unsigned)));
+  }
+  else {
+    movqi(J, R8, l_castS2U(ivalue(kv)));  /* (copies any 'Value') */
+    /* mov byte [rsi + rax + sizeof(unsigned)], tag */
+    rex(J, 0, 0, RAX, RSI); b_(J, 0xC6);
+    modidx(J, 0, RSI, RAX, 0, cast_int(sizeof(unsigned)));
+    b_(J, rawtt(kv));
+  }
+  negq(J, RAX);
+  /* mov [rsi - rax * 8 - 8], r8 */
+  rex(J, 1, R8, RAX, RSI); b_(J, 0x89);
+  modidx(J, R8, RSI, RAX, 3, -cast_int(sizeof(Value)));
+}
+
+
+/* integer 'for' prep, only for integer values and a step of 1 */
+static void emitforprep (JitState *J, int a, int bx, int pc) {
+  guardtag(J, RBASE, SLOT(a), LUA_VNUMINT, pc);
+  guardtag(J, RBASE, SLOT(a + 1), LUA_VNUMINT, pc);
+  guardtag(J, RBASE, SLOT(a + 2), LUA_VNUMINT, pc);
+  loadq(J, RCX, RBASE, SLOT(a + 2) + VAL);  /* step */
+  cmpqi(J, RCX, 1);
+  exitif(J, CC_NE, pc);
+  loadq(J, RAX, RBASE, SLOT(a) + VAL);  /* init */
+  loadq(J, RDX, RBASE, SLOT(a + 1) + VAL);  /* limit */
+  alu(J, ALU_CMP, RDX, RAX);
+  jumpto(J, CC_L, pc + bx + 2);  /* skip the loop */
+  alu(J, ALU_SUB, RDX, RAX);
+  storeq(J, RBASE, SLOT(a) + VAL, RDX);  /* count */
+  storeq(J, RBASE, SLOT(a + 1) + VAL, RCX);  /* step */
+  storeq(J, RBASE, SLOT(a + 2) + VAL, RAX);  /* control variable */
+}
+
+
+/* exit at instruction 'pc' if there is a trap */
+static void checktrap (JitState *J, int pc) {
+  /* cmp dword [trap], 0 */
+  rex(J, 0, 0, 0, RTRAP); b_(J, 0x83); modmem(J, 7, RTRAP, 0); b_(J, 0);
+  exitif(J, CC_NE, pc);
+}
+
+
+/* integer 'for' loop; float loops and traps exit */
+static void emitforloop (JitState *J, int a, int bx, int pc) {
+  checktrap(J, pc);
+  guardtag(J, RBASE, SLOT(a + 1), LUA_VNUMINT, pc);
+  loadq(J, RAX, RBASE, SLOT(a) + VAL);  /* count */
+  alu(J, ALU_TEST, RAX, RAX);
+  jumpto(J, CC_E, pc + 1);  /* end of the loop */
+  subqi(J, RAX, 1);
+  storeq(J, RBASE, SLOT(a) + VAL, RAX);
+  loadq(J, RCX, RBASE, SLOT(a + 2) + VAL);
+  loadq(J, RDX, RBASE, SLOT(a + 1) + VAL);
+  alu(J, ALU_ADD, RCX, RDX);
+  storeq(J, RBASE, SLOT(a + 2) + VAL, RCX);
+  jumpto(J, CC_ALWAYS, pc + 1 - bx);
+}
+
+
+static void emit (JitState *J, int pc) {
+  Instruction i = J->p->code[pc];
+  OpCode op = genericop(GET_OPCODE(i));
+  int a = GETARG_A(i);
+  Operand x, y;
+  switch (op) {
+    case OP_MOVE:
+      emitcopy(J, a, RBASE, SLOT(GETARG_B(i)));
+      break;
+    case OP_LOADI:
+      emitsetnum(J, a, l_castS2U(GETARG_sBx(i)), LUA_VNUMINT);
+      break;
+    case OP_LOADF:
+      emitsetnum(J, a, fltbits(cast_num(GETARG_sBx(i))), LUA_VNUMFLT);
+      break;
+    case OP_LOADK:
+      emitcopy(J, a, RKST, KST(GETARG_Bx(i)));
+      break;
+    case OP_LOADFALSE:
+      storebi(J, RBASE, SLOT(a) + TT, LUA_VFALSE);
+      break;
+    case OP_LOADTRUE:
+      storebi(J, RBASE, SLOT(a) + TT, LUA_VTRUE);
+      break;
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        storebi(J, RBASE, SLOT(a++) + TT, LUA_VNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL:
+      loadq(J, RDX, RUPVALS, GETARG_B(i) * cast_int(sizeof(UpVal *)));
+      loadq(J, RDX, RDX, cast_int(offsetof(UpVal, v)));
+      emitcopy(J, a, RDX, 0);
+      break;
+    case OP_GETTABLE:
+      setregop(&y, GETARG_C(i));
+      emitgettable(J, a, GETARG_B(i), &y, pc);
+      break;
+    case OP_GETI:
+      setintop(&y, GETARG_C(i));
+      emitgettable(J, a, GETARG_B(i), &y, pc);
+      break;
+    case OP_SETTABLE: case OP_SETI: {
+      const TValue *kv = TESTARG_k(i) ? &J->p->k[GETARG_C(i)] : NULL;
+      if (op == OP_SETTABLE)
+        setregop(&y, GETARG_B(i));
+      else
+        setintop(&y, GETARG_B(i));
+      emitsettable(J, a, &y, kv, GETARG_C(i), pc);
+      break;
+    }
+    case OP_ADDI:
+      setregop(&x, GETARG_B(i));
+      setintop(&y, GETARG_sC(i));
+      emitarith(J, OP_ADD, a, &x, &y, pc);
+      break;
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_DIVK:
+      setregop(&x, GETARG_B(i));
+      if (!setkop(J, &y, GETARG_C(i))) { J->fail = 1; break; }
+      emitarith(J, cast(OpCode, op - OP_ADDK + OP_ADD), a, &x, &y, pc);
+      break;
+    case OP_MODK: {
+      const TValue *kc = &J->p->k[GETARG_C(i)];
+      if (ttisinteger(kc) && ivalue(kc) > 0)
+        emitmodk(J, a, GETARG_B(i), ivalue(kc), pc);
+      else
+        J->fail = 1;
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+      setregop(&x, GETARG_B(i));
+      setregop(&y, GETARG_C(i));
+      emitarith(J, op, a, &x, &y, pc);
+      break;
+    case OP_UNM:
+      emitunm(J, a, GETARG_B(i), pc);
+      break;
+    case OP_MMBIN: case OP_MMBINI: case OP_MMBINK:
+      break;  /* only reached when the operation fails, which exits */
+    case OP_JMP: {
+      int sj = GETARG_sJ(i);
+      if (sj < 0)  /* backward jump? (an inner loop) */
+        checktrap(J, pc);
+      jumpto(J, CC_ALWAYS, pc + 1 + sj);
+      break;
+    }
+    case OP_EQ:
+      setregop(&y, GETARG_B(i));
+      emiteq(J, a, &y, GETARG_k(i), pc);
+      break;
+    case OP_EQI:
+      setintop(&y, GETARG_sB(i));
+      emiteq(J, a, &y, GETARG_k(i), pc);
+      break;
+    case OP_LT: case OP_LE:
+      setregop(&x, a);
+      setregop(&y, GETARG_B(i));
+      emitorder(J, &x, &y, (op == OP_LT) ? CC_L : CC_LE, op == OP_LT,
+               GETARG_k(i), pc);
+      break;
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
+      static const int ccs[] = {CC_L, CC_LE, CC_G, CC_GE};
+      setregop(&x, a);
+      setintop(&y, GETARG_sB(i));
+      emitorder(J, &x, &y, ccs[op - OP_LTI], op == OP_LTI || op == OP_GTI,
+               GETARG_k(i), pc);
+      break;
+    }
+    case OP_TEST:
+      emittest(J, a, GETARG_k(i), pc);
+      break;
+    case OP_FORPREP:
+      emitforprep(J, a, GETARG_Bx(i), pc);
+      break;
+    case OP_FORLOOP:
+      emitforloop(J, a, GETARG_Bx(i), pc);
+      break;
+    default:
+      J->fail = 1;  /* instruction not supported */
+      break;
+  }
+}
+
+/* }====================================================== */
+
+
+/* size of the code for 'ni' instructions */
+#define codesize(ni)	(256 + cast_sizet(ni) * 384)
+
+
+/*
+** Generate the code for the loop of 'jl' into 'J->code'. Returns the
+** number of bytes generated, or 0 if the loop cannot be compiled.
+*/
+static size_t generate (JitState *J) {
+  int i;
+  size_t epilogue;
+  /* prologue: save callee-saved registers and get arguments */
+  b_(J, 0x53);  /* push rbx */
+  b_(J, 0x41); b_(J, 0x54);  /* push r12 */
+  b_(J, 0x41); b_(J, 0x55);  /* push r13 */
+  b_(J, 0x41); b_(J, 0x56);  /* push r14 */
+  b_(J, 0x50);  /* push rax (to keep stack aligned) */
+  rex(J, 1, 7, 0, RBASE); b_(J, 0x89); modreg(J, 7, RBASE);  /* rdi */
+  rex(J, 1, 6, 0, RKST); b_(J, 0x89); modreg(J, 6, RKST);  /* rsi */
+  rex(J, 1, 2, 0, RTRAP); b_(J, 0x89); modreg(J, 2, RTRAP);  /* rdx */
+  rex(J, 1, 1, 0, RUPVALS); b_(J, 0x89); modreg(J, 1, RUPVALS);  /* rcx */
+  jumpto(J, CC_ALWAYS, J->last);  /* start with the OP_FORLOOP */
+  for (i = J->first; i <= J->last && !J->fail; i++) {
+    J->label[i - J->first] = J->n;
+    emit(J, i);
+  }
+  if (J->fail)
+    return 0;
+  /* epilogue: restore registers and return RAX */
+  epilogue = J->n;
+  b_(J, 0x59);  /* pop rcx */
+  b_(J, 0x41); b_(J, 0x5E);  /* pop r14 */
+  b_(J, 0x41); b_(J, 0x5D);  /* pop r13 */
+  b_(J, 0x41); b_(J, 0x5C);  /* pop r12 */
+  b_(J, 0x5B);  /* pop rbx */
+  b_(J, 0xC3);  /* ret */
+  /* exits: return address of the instruction where the loop exited */
+  for (i = 0; i < J->nexits; i++) {
+    int j;
+    for (j = 0; j < i; j++) {  /* same exit already generated? */
+      if (J->exits[j].target == J->exits[i].target) {
+        patch(J, J->exits[i].pos, J->exits[j].pos);
+        break;
+      }
+    }
+    if (j == i) {
+      size_t exit = J->n;
+      patch(J, J->exits[i].pos, exit);
+      movqi(J, RAX, cast(lua_Unsigned,
+                         cast_sizet(J->p->code + J->exits[i].target)));
+      patch(J, jump(J, CC_ALWAYS), epilogue);
+      J->exits[i].pos = exit;  /* now it is where the exit starts */
+    }
+  }
+  for (i = 0; i < J->njumps; i++)
+    patch(J, J->jumps[i].pos, J->label[J->jumps[i].target - J->first]);
+  return (J->n <= J->size) ? J->n : 0;
+}
+
+
+static void *newpages (size_t size) {
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return (mem == MAP_FAILED) ? NULL : mem;
+}
+
+
+/*
+** Compile the 'for' loop of 'jl'. The code goes into memory obtained
+** directly with 'mmap', as it must be executable. So does the (large)
+** compiler state, so that compiling never raises memory errors nor
+** runs emergency collections.
+*/
+static void compile (Proto *p, JitLoop *jl) {
+  int last = jl->pc;
+  int first = last + 1 - GETARG_Bx(p->code[last]);
+  int ni = last - first + 1;
+  JitState *J;
+  void *mem;
+  size_t size;
+  if (first < 0 || ni > LUAI_JITMAXLOOP)
+    return;  /* loop too large */
+  size = codesize(ni);
+  J = cast(JitState *, newpages(sizeof(JitState)));
+  if (J == NULL)
+    return;
+  mem = newpages(size);
+  if (mem != NULL) {
+    J->code = cast(lu_byte *, mem);
+    J->size = size;
+    J->n = 0;
+    J->p = p;
+    J->first = first;
+    J->last = last;
+    J->fail = J->njumps = J->nexits = 0;
+    if (generate(J) > 0 && mprotect(mem, size, PROT_READ | PROT_EXEC) == 0) {
+      jl->mcode = mem;
+      jl->size = size;
+    }
+    else
+      munmap(mem, size);
+  }
+  munmap(J, sizeof(JitState));
+}
+
+
+void luaJ_hotloop (lua_State *L, Proto *p, int pc) {
+  JitLoop *jl;
+  for (jl = p->jit; jl != NULL; jl = jl->next) {
+    if (jl->pc == pc)
+      return;  /* loop already compiled (or tried) */
+  }
+  if (sizeof(lua_Integer) != 8 || sizeof(lua_Number) != 8 ||
+      sizeof(l_signalT) != 4)
+    return;  /* configuration not supported */
+  jl = cast(JitLoop *, luaM_realloc_(L, NULL, 0, sizeof(JitLoop)));
+  if (jl == NULL)
+    return;  /* no memory; try again some other time */
+  jl->mcode = NULL;
+  jl->size = 0;
+  jl->pc = pc;
+  jl->next = p->jit;
+  p->jit = jl;
+  compile(p, jl);
+  if (jl->mcode != NULL) {
+    SET_OPCODE(p->code[pc], OP_FORLOOP_JIT);
+    p->flag |= PF_QUICK;  /* code has rewritten instructions */
+    G(L)->jitloops++;
+  }
+}
+
+
+const Instruction *luaJ_run (lua_State *L, CallInfo *ci,
+                             const Instruction *pc) {
+  LClosure *cl = ci_func(ci);
+  int n = cast_int(pc - cl->p->code);
+  JitLoop *jl;
+  if (!G(L)->jiton)
+    return pc;
+  for (jl = cl->p->jit; jl != NULL; jl = jl->next) {
+    if (jl->pc == n) {
+      union { void *p; JitFunction f; } u;
+      lua_assert(jl->mcode != NULL);
+      u.p = jl->mcode;
+      return u.f(ci->func.p + 1, cl->p->k, &ci->u.l.trap, cl->upvals);
+    }
+  }
+  return pc;
+}
+
+
+static void freecode (JitLoop *jl) {
+  if (jl->mcode != NULL)
+    munmap(jl->mcode, jl->size);
+}
+
+#else				/* }{ */
+
+void luaJ_hotloop (lua_State *L, Proto *p, int pc) {
+  UNUSED(L); UNUSED(p); UNUSED(pc);
+}
+
+
+const Instruction *luaJ_run (lua_State *L, CallInfo *ci,
+                             const Instruction *pc) {
+  UNUSED(L); UNUSED(ci);
+  return pc;
+}
+
+
+#define freecode(jl)	((void)(jl))
+
+#endif				/* } */
+
+
+void luaJ_freeproto (lua_State *L, Proto *p) {
+  JitLoop *jl = p->jit;
+  while (jl != NULL) {
+    JitLoop *next = jl->next;
+    freecode(jl);
+    luaM_free(L, jl);
+    jl = next;
+  }
+  p->jit = NULL;
+}
+
+
+LUA_API int lua_jit (lua_State *L, int what) {
+  global_State *g;
+  int res = 0;
+  lua_lock(L);
+  g = G(L);
+  switch (what) {
+    case LUA_JITOFF: {
+      g->jiton = 0;
+      break;
+    }
+    case LUA_JITON: {
+      g->jiton = LUA_USE_JIT;
+      res = LUA_USE_JIT;
+      break;
+    }
+    case LUA_JITISON: {
+      res = g->jiton;
+      break;
+    }
+    case LUA_JITCOUNT: {
+      res = g->jitloops;
+      break;
+    }
+    default: res = -1;  /* invalid option */
+  }
+  lua_unlock(L);
+  return res;
+}
@@ -0,0 +1,58 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler of loops to machine code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** The compiler generates x86-64 code, and it needs 'mmap' to get
+** executable memory.
+*/
+#if !defined(LUA_USE_JIT)
+#if defined(__x86_64__) && defined(__linux__)
+#define LUA_USE_JIT	1
+#else
+#define LUA_USE_JIT	0
+#endif
+#endif
+
+
+/* number of backward jumps in a function before it compiles a loop */
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT	64
+#endif
+
+
+/* maximum number of instructions in a compiled loop */
+#if !defined(LUAI_JITMAXLOOP)
+#define LUAI_JITMAXLOOP	256
+#endif
+
+
+/*
+** Machine code for a 'for' loop of a prototype. Loops that could not be
+** compiled are also kept (with 'mcode' NULL), so that the compiler does
+** not try them again.
+*/
+typedef struct JitLoop {
+  struct JitLoop *next;
+  void *mcode;  /* machine code */
+  size_t size;  /* size of 'mcode' */
+  int pc;  /* index of the loop's OP_FORLOOP instruction */
+} JitLoop;
+
+
+LUAI_FUNC void luaJ_hotloop (lua_State *L, Proto *p, int pc);
+LUAI_FUNC const Instruction *luaJ_run (lua_State *L, CallInfo *ci,
+                                       const Instruction *pc);
+LUAI_FUNC void luaJ_freeproto (lua_State *L, Proto *p);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+** $Id: ljitlib.c $
+** Switch for the compiler of hot loops
+** See Copyright Notice in lua.h
+*/
+
+#define ljitlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+#include "llimits.h"
+
+
+/* turns the compiler on; returns whether it is available */
+static int jit_on (lua_State *L) {
+  lua_pushboolean(L, lua_jit(L, LUA_JITON));
+  return 1;
+}
+
+
+static int jit_off (lua_State *L) {
+  lua_jit(L, LUA_JITOFF);
+  return 0;
+}
+
+
+/* returns whether the compiler is on and the number of loops compiled */
+static int jit_status (lua_State *L) {
+  lua_pushboolean(L, lua_jit(L, LUA_JITISON));
+  lua_pushinteger(L, lua_jit(L, LUA_JITCOUNT));
+  return 2;
+}
+
+
+static const luaL_Reg jit_funcs[] = {
+  {"on", jit_on},
+  {"off", jit_off},
+  {"status", jit_status},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_jit (lua_State *L) {
+  luaL_newlib(L, jit_funcs);
+  return 1;
+}
+
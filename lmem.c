@@ -11,6 +11,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -47,6 +48,483 @@
 #define callfrealloc(g,block,os,ns)    ((*g->frealloc)(g->ud, block, os, ns))
 
 
+
+/*
+** {==================================================================
+** Pool allocator for small blocks
+** ===================================================================
+*/
+
+/*
+** When a state is created with option LUA_NSPOOL, all blocks with
+** at most POOLMAX bytes (object headers, short strings, small arrays)
+** come from a pool: their sizes are rounded up to a multiple of
+** POOLALIGN, and each of these size classes keeps a list of free
+** blocks. New blocks are carved from slabs of POOLSLAB bytes obtained
+** from 'frealloc'. As the size of a block is always known when it is
+** freed or reallocated, the pool needs no per-block header; the only
+** requirement is that, in a state using a pool, every block with at
+** most POOLMAX bytes comes from the pool. Slabs are only given back
+** to 'frealloc' when the state is closed.
+*/
+
+#if !defined(POOLMAX)
+#define POOLMAX		256
+#endif
+
+#if !defined(POOLSLAB)
+#define POOLSLAB	(16 * 1024)
+#endif
+
+
+/* a free block; also defines the alignment of all blocks */
+typedef union PoolBlock {
+  union PoolBlock *next;  /* next free block in its list */
+  LUAI_MAXALIGN;  /* ensures maximum alignment for blocks */
+} PoolBlock;
+
+
+/* header of a slab; the blocks follow it */
+typedef union PoolSlab {
+  union PoolSlab *next;  /* list of all slabs */
+  PoolBlock b;  /* ensures proper alignment for blocks */
+} PoolSlab;
+
+
+#define POOLALIGN	sizeof(PoolBlock)
+
+/* number of size classes */
+#define POOLNCLASSES	((POOLMAX + POOLALIGN - 1) / POOLALIGN)
+
+/* size class of a (non zero) size and size of a class */
+#define sizeclass(sz)	(((sz) - 1) / POOLALIGN)
+#define classsize(c)	(((c) + 1) * POOLALIGN)
+
+
+struct MemPool {
+  PoolBlock *free[POOLNCLASSES];  /* lists of free blocks */
+  PoolSlab *slabs;  /* list of all slabs */
+  char *top;  /* first free byte in current slab */
+  char *limit;  /* end of current slab */
+  lua_PoolStats stats;
+};
+
+
+/*
+** Put the unused tail of the current slab in the free list of its
+** class, so that no memory is lost when starting a new slab. (The
+** tail is always smaller than the block being allocated, so it fits
+** in some class.)
+*/
+static void pooltail (MemPool *p) {
+  size_t tail = cast_sizet(p->limit - p->top);
+  if (tail > 0) {
+    PoolBlock *b = cast(PoolBlock *, p->top);
+    unsigned int c = cast_uint(sizeclass(tail));
+    lua_assert(tail % POOLALIGN == 0 && c < POOLNCLASSES);
+    b->next = p->free[c];
+    p->free[c] = b;
+    p->top = p->limit;
+  }
+}
+
+
+/*
+** Start a new slab. Returns 0 if it cannot allocate it.
+*/
+static int poolnewslab (global_State *g, MemPool *p) {
+  PoolSlab *slab = cast(PoolSlab *, callfrealloc(g, NULL, 0, POOLSLAB));
+  if (slab == NULL)
+    return 0;
+  slab->next = p->slabs;
+  p->slabs = slab;
+  p->top = cast_charp(slab + 1);
+  p->limit = cast_charp(slab) + POOLSLAB;
+  p->stats.reserved += POOLSLAB;
+  return 1;
+}
+
+
+/*
+** Get a block of (non zero) size 'size' from the pool, first from
+** the free list of its class, then from the current slab. Returns
+** NULL if it needs and cannot create a new slab.
+*/
+static void *poolget (global_State *g, size_t size) {
+  MemPool *p = g->pool;
+  unsigned int c = cast_uint(sizeclass(size));
+  size_t bsize = classsize(c);
+  PoolBlock *b = p->free[c];
+  if (b == NULL && bsize > cast_sizet(p->limit - p->top)) {  /* no space? */
+    pooltail(p);  /* tail may become a free block of this class */
+    b = p->free[c];
+    if (b == NULL && !poolnewslab(g, p))
+      return NULL;
+  }
+  if (b != NULL)  /* got a free block? */
+    p->free[c] = b->next;
+  else {  /* carve a new block from the current slab */
+    b = cast(PoolBlock *, p->top);
+    p->top += bsize;
+  }
+  p->stats.inuse += bsize;
+  p->stats.nalloc++;
+  return b;
+}
+
+
+/*
+** Return a block of (non zero) size 'size' to the pool.
+*/
+static void poolput (global_State *g, void *block, size_t size) {
+  MemPool *p = g->pool;
+  unsigned int c = cast_uint(sizeclass(size));
+  PoolBlock *b = cast(PoolBlock *, block);
+  b->next = p->free[c];
+  p->free[c] = b;
+  p->stats.inuse -= classsize(c);
+  p->stats.nfree++;
+}
+
+
+/*
+** Reallocation for states using a pool, with the same protocol as
+** 'frealloc'. Blocks with at most POOLMAX bytes go to or come from
+** the pool; larger ones go directly to 'frealloc'. Moving a block
+** between these two "worlds" is done by allocating the new block,
+** copying the contents, and freeing the old one. (If 'block' is NULL,
+** 'osize' is a tag, which is passed along to 'frealloc'.)
+*/
+static void *poolrealloc (global_State *g, void *block, size_t osize,
+                                                         size_t nsize) {
+  size_t oldsize = (block == NULL) ? 0 : osize;
+  void *newblock;
+  if (oldsize > POOLMAX && (nsize > POOLMAX || nsize == 0))
+    return callfrealloc(g, block, osize, nsize);  /* not a pool affair */
+  else if (nsize == 0) {  /* freeing a block from the pool? */
+    if (block != NULL)
+      poolput(g, block, oldsize);
+    return NULL;
+  }
+  else if (oldsize > 0 && oldsize <= POOLMAX && nsize <= POOLMAX &&
+           sizeclass(oldsize) == sizeclass(nsize))
+    return block;  /* same size class; nothing to be done */
+  else if (nsize <= POOLMAX)
+    newblock = poolget(g, nsize);
+  else  /* new block does not fit in the pool */
+    newblock = callfrealloc(g, NULL, (block == NULL) ? osize : 0, nsize);
+  if (newblock != NULL && block != NULL) {  /* must move old block? */
+    memcpy(newblock, block, (oldsize < nsize) ? oldsize : nsize);
+    if (oldsize <= POOLMAX)
+      poolput(g, block, oldsize);
+    else
+      callfrealloc(g, block, oldsize, 0);
+  }
+  return newblock;
+}
+
+
+/*
+** Create the pool of a new state. As the state is still being built,
+** it only uses 'frealloc'.
+*/
+int luaM_newpool (global_State *g) {
+  MemPool *p = cast(MemPool *, callfrealloc(g, NULL, 0, sizeof(MemPool)));
+  if (p == NULL)
+    return 0;
+  memset(p, 0, sizeof(MemPool));
+  g->pool = p;
+  return 1;
+}
+
+
+/*
+** Free all slabs of a pool. Should be called only when all blocks
+** from the pool have been freed.
+*/
+void luaM_freepool (global_State *g) {
+  MemPool *p = g->pool;
+  if (p != NULL) {
+    PoolSlab *slab = p->slabs;
+    while (slab != NULL) {
+      PoolSlab *next = slab->next;
+      callfrealloc(g, slab, POOLSLAB, 0);
+      slab = next;
+    }
+    g->pool = NULL;
+    callfrealloc(g, p, sizeof(MemPool), 0);
+  }
+}
+
+
+/*
+** Get the statistics of the pool of a state; returns 0 if the state
+** does not use a pool.
+*/
+int luaM_poolstats (global_State *g, lua_PoolStats *stats) {
+  if (g->pool == NULL)
+    return 0;
+  else {
+    *stats = g->pool->stats;
+    return 1;
+  }
+}
+
+
+/*
+** Macro to call the allocation function, through the pool if the
+** state uses one.
+*/
+#define callalloc(g,block,os,ns)  \
+	((g)->pool == NULL ? callfrealloc(g, block, os, ns)  \
+	                   : poolrealloc(g, block, os, ns))
+
+/* }================================================================== */
+
+
+
+/*
+** {==================================================================
+** Background freeing
+** ===================================================================
+*/
+
+/*
+** When a state is created with option LUA_NSBGFREE, the blocks of dead
+** objects with at least LUAI_BGFREEMIN bytes (and that do not come from
+** the pool) are not given back to 'frealloc' by the collector. Each
+** one is linked, using its own memory, into a batch; full batches go
+** to a queue drained by a background thread, which calls 'frealloc'
+** for each block. (So, 'frealloc' must work when called from that
+** thread while the state is running.) The queue is a lock-free stack:
+** the collector pushes a whole batch with a compare-and-swap, and the
+** thread takes all blocks at once with an exchange, so there is no
+** ABA problem. A semaphore wakes the thread.
+** A block counts as freed for 'GCtotalbytes' and 'GCdebt' when it
+** enters the batch, so the accounting does not depend on the thread.
+** Blocks are freed synchronously in emergency collections and when the
+** bytes not yet freed would go above a limit (set with LUA_GCBGFREE),
+** which bounds the memory kept in the queue under memory pressure.
+*/
+
+#if !defined(LUA_USE_BGFREE)
+#if defined(LUA_USE_LINUX) && defined(__GNUC__)
+#define LUA_USE_BGFREE	1
+#else
+#define LUA_USE_BGFREE	0
+#endif
+#endif
+
+/* minimum size of a block freed in the background */
+#if !defined(LUAI_BGFREEMIN)
+#define LUAI_BGFREEMIN	64
+#endif
+
+/* number of blocks in a full batch */
+#if !defined(LUAI_BGBATCH)
+#define LUAI_BGBATCH	64
+#endif
+
+/* default limit for the bytes not yet freed */
+#if !defined(LUAI_BGLIMIT)
+#define LUAI_BGLIMIT	(32 * 1024 * 1024)
+#endif
+
+
+#define canbgfree(g,os)  ((g)->gcfreeing && (g)->bgfree != NULL &&  \
+	(os) >= LUAI_BGFREEMIN && ((g)->pool == NULL || (os) > POOLMAX))
+
+
+#if LUA_USE_BGFREE
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+
+/* a block waiting to be freed (in the block's own memory) */
+typedef struct FreeBlock {
+  struct FreeBlock *next;
+  size_t size;
+} FreeBlock;
+
+
+struct BgFree {
+  global_State *g;
+  FreeBlock *batch;  /* blocks not yet in the queue */
+  FreeBlock *last;  /* last block in 'batch' */
+  int nbatch;  /* number of blocks in 'batch' */
+  size_t limit;  /* maximum number of bytes not yet freed */
+  FreeBlock *queue;  /* (shared) blocks for the thread */
+  size_t pending;  /* (shared) number of bytes not yet freed */
+  int stop;  /* (shared) true when the thread must finish */
+  sem_t wakeup;
+  pthread_t thread;
+};
+
+
+static void freeblocks (BgFree *q, FreeBlock *b) {
+  global_State *g = q->g;
+  while (b != NULL) {
+    FreeBlock *next = b->next;
+    size_t size = b->size;
+    callfrealloc(g, b, size, 0);
+    __atomic_sub_fetch(&q->pending, size, __ATOMIC_RELEASE);
+    b = next;
+  }
+}
+
+
+static void *bgfreethread (void *ud) {
+  BgFree *q = cast(BgFree *, ud);
+  for (;;) {
+    FreeBlock *b = __atomic_exchange_n(&q->queue, NULL, __ATOMIC_ACQUIRE);
+    if (b != NULL)
+      freeblocks(q, b);
+    else if (__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE))
+      return NULL;
+    else
+      sem_wait(&q->wakeup);
+  }
+}
+
+
+/*
+** Create the background thread of a new state. If that is not
+** possible, the state just frees all its blocks synchronously.
+*/
+void luaM_newbgfree (global_State *g) {
+  BgFree *q = cast(BgFree *, callfrealloc(g, NULL, 0, sizeof(BgFree)));
+  if (q == NULL)
+    return;
+  memset(q, 0, sizeof(BgFree));
+  q->g = g;
+  q->limit = LUAI_BGLIMIT;
+  if (sem_init(&q->wakeup, 0, 0) != 0) {
+    callfrealloc(g, q, sizeof(BgFree), 0);
+    return;
+  }
+  if (pthread_create(&q->thread, NULL, bgfreethread, q) != 0) {
+    sem_destroy(&q->wakeup);
+    callfrealloc(g, q, sizeof(BgFree), 0);
+    return;
+  }
+  g->bgfree = q;
+}
+
+
+/*
+** Stop the background thread, after it frees all pending blocks.
+*/
+void luaM_freebgfree (global_State *g) {
+  BgFree *q = g->bgfree;
+  if (q != NULL) {
+    luaM_bgflush(g);
+    __atomic_store_n(&q->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&q->wakeup);
+    pthread_join(q->thread, NULL);
+    /* the thread may have stopped before seeing the last batch */
+    freeblocks(q, __atomic_exchange_n(&q->queue, NULL, __ATOMIC_ACQUIRE));
+    lua_assert(q->pending == 0);
+    sem_destroy(&q->wakeup);
+    g->bgfree = NULL;
+    callfrealloc(g, q, sizeof(BgFree), 0);
+  }
+}
+
+
+/*
+** Push the current batch into the queue of the background thread.
+*/
+void luaM_bgflush (global_State *g) {
+  BgFree *q = g->bgfree;
+  if (q != NULL && q->batch != NULL) {
+    FreeBlock *old = __atomic_load_n(&q->queue, __ATOMIC_RELAXED);
+    do {
+      q->last->next = old;
+    } while (!__atomic_compare_exchange_n(&q->queue, &old, q->batch, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    q->batch = NULL;
+    q->nbatch = 0;
+    sem_post(&q->wakeup);
+  }
+}
+
+
+/*
+** Free all pending blocks now, including the ones being freed by the
+** background thread.
+*/
+void luaM_bgwait (global_State *g) {
+  BgFree *q = g->bgfree;
+  if (q != NULL) {
+    freeblocks(q, q->batch);
+    q->batch = NULL;
+    q->nbatch = 0;
+    freeblocks(q, __atomic_exchange_n(&q->queue, NULL, __ATOMIC_ACQUIRE));
+    while (__atomic_load_n(&q->pending, __ATOMIC_ACQUIRE) != 0)
+      sched_yield();  /* wait for the blocks being freed by the thread */
+  }
+}
+
+
+/*
+** Set the limit for the bytes not yet freed to 'kbytes' Kbytes (if
+** not negative); return the previous limit, or 0 if the state does not
+** have a background thread.
+*/
+int luaM_bglimit (global_State *g, int kbytes) {
+  BgFree *q = g->bgfree;
+  if (q == NULL)
+    return 0;
+  else {
+    int old = cast_int(q->limit / 1024);
+    if (kbytes >= 0)
+      q->limit = cast_sizet(kbytes) * 1024;
+    return old;
+  }
+}
+
+
+/*
+** Pass a block freed by the collector to the background thread, unless
+** it must be freed now; return true if it did so.
+*/
+static int bgfree (global_State *g, void *block, size_t osize) {
+  BgFree *q = g->bgfree;
+  FreeBlock *b = cast(FreeBlock *, block);
+  lua_assert(osize >= sizeof(FreeBlock));
+  if (g->gcemergency ||
+      __atomic_load_n(&q->pending, __ATOMIC_RELAXED) + osize > q->limit)
+    return 0;  /* free it now */
+  b->size = osize;
+  b->next = q->batch;
+  if (q->batch == NULL)
+    q->last = b;
+  q->batch = b;
+  __atomic_add_fetch(&q->pending, osize, __ATOMIC_RELAXED);
+  if (++q->nbatch >= LUAI_BGBATCH)
+    luaM_bgflush(g);
+  return 1;
+}
+
+#else
+
+void luaM_newbgfree (global_State *g) { UNUSED(g); }
+void luaM_freebgfree (global_State *g) { UNUSED(g); }
+void luaM_bgflush (global_State *g) { UNUSED(g); }
+void luaM_bgwait (global_State *g) { UNUSED(g); }
+int luaM_bglimit (global_State *g, int kbytes) {
+  UNUSED(g); UNUSED(kbytes);
+  return 0;
+}
+#define bgfree(g,block,osize)	0
+
+#endif
+
+/* }================================================================== */
+
+
 /*
 ** When an allocation fails, it will try again after an emergency
 ** collection, except when it cannot run a collection.  The GC should
@@ -70,10 +548,10 @@ static void *firsttry (global_State *g, void *block, size_t os, size_t ns) {
   if (ns > 0 && cantryagain(g))
     return NULL;  /* fail */
   else  /* normal allocation */
-    return callfrealloc(g, block, os, ns);
+    return callalloc(g, block, os, ns);
 }
 #else
-#define firsttry(g,block,os,ns)    callfrealloc(g, block, os, ns)
+#define firsttry(g,block,os,ns)    callalloc(g, block, os, ns)
 #endif
 
 
@@ -150,11 +628,42 @@ l_noret luaM_toobig (lua_State *L) {
 void luaM_free_ (lua_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
-  callfrealloc(g, block, osize, 0);
+  if (!(canbgfree(g, osize) && bgfree(g, block, osize)))
+    callalloc(g, block, osize, 0);
   g->GCdebt += cast(l_mem, osize);
 }
 
 
+/*
+** Kind in the census of the heap of a collectable object with the
+** given tag
+*/
+static int censuskind (int tag) {
+  switch (tag) {
+    case LUA_VTABLE: return LUA_MKTABLE;
+    case LUA_VSHAPE: return LUA_MKSHAPE;
+    case LUA_VSHRSTR: return LUA_MKSHRSTR;
+    case LUA_VLNGSTR: return LUA_MKLNGSTR;
+    case LUA_VLCL: return LUA_MKLCL;
+    case LUA_VCCL: return LUA_MKCCL;
+    case LUA_VUPVAL: return LUA_MKUPVAL;
+    case LUA_VPROTO: return LUA_MKPROTO;
+    case LUA_VUSERDATA: return LUA_MKUDATA;
+    default: lua_assert(tag == LUA_VTHREAD); return LUA_MKTHREAD;
+  }
+}
+
+
+/*
+** Free a collectable object with the given tag
+*/
+void luaM_freeobject_ (lua_State *L, void *block, size_t osize, int tag) {
+  global_State *g = G(L);
+  luaM_censusfree(g, censuskind(tag), osize);
+  luaM_free_(L, block, osize);
+}
+
+
 /*
 ** In case of allocation fail, this function will do an emergency
 ** collection to free some memory and then try the allocation again.
@@ -164,7 +673,8 @@ static void *tryagain (lua_State *L, void *block,
   global_State *g = G(L);
   if (cantryagain(g)) {
     luaC_fullgc(L, 1);  /* try to free some memory... */
-    return callfrealloc(g, block, osize, nsize);  /* try again */
+    luaM_bgwait(g);  /* ...including blocks still to be freed */
+    return callalloc(g, block, osize, nsize);  /* try again */
   }
   else return NULL;  /* cannot run an emergency collection */
 }
@@ -198,18 +708,26 @@ void *luaM_saferealloc_ (lua_State *L, void *block, size_t osize,
 }
 
 
+/*
+** Allocates a new block. A non-zero 'tag' is the tag of the collectable
+** object being created; the allocation function gets only its basic
+** type.
+*/
 void *luaM_malloc_ (lua_State *L, size_t size, int tag) {
   if (size == 0)
     return NULL;  /* that's all */
   else {
     global_State *g = G(L);
-    void *newblock = firsttry(g, NULL, cast_sizet(tag), size);
+    size_t type = cast_sizet(novariant(tag));
+    void *newblock = firsttry(g, NULL, type, size);
     if (l_unlikely(newblock == NULL)) {
-      newblock = tryagain(L, NULL, cast_sizet(tag), size);
+      newblock = tryagain(L, NULL, type, size);
       if (newblock == NULL)
         luaM_error(L);
     }
     g->GCdebt -= cast(l_mem, size);
+    if (tag != 0)
+      luaM_censusnew(g, censuskind(tag), size);
     return newblock;
   }
 }
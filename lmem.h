@@ -63,6 +63,20 @@
   (luaM_checksize(L,n,sizeof(t)), luaM_newvector(L,n,t))
 
 #define luaM_newobject(L,tag,s)	luaM_malloc_(L, (s), tag)
+#define luaM_freeobject(L,tag,b,s)	luaM_freeobject_(L, (b), (s), tag)
+
+
+/*
+** Census of the heap: accounts a new or a freed block of kind 'k' with
+** 'n' bytes. Collectable objects are accounted by 'luaM_newobject' and
+** 'luaM_freeobject', according to their tags; other blocks (parts of
+** tables, stacks, etc.) are accounted where they are allocated.
+*/
+#define luaM_censusnew(g,k,n)  \
+	((g)->census.bytes[k] += (n), (g)->census.nlive[k]++, \
+	 (g)->census.nalloc[k]++)
+#define luaM_censusfree(g,k,n)  \
+	((g)->census.bytes[k] -= (n), (g)->census.nlive[k]--)
 
 #define luaM_newblock(L, size)	luaM_newvector(L, size, char)
 
@@ -85,6 +99,8 @@ LUAI_FUNC void *luaM_realloc_ (lua_State *L, void *block, size_t oldsize,
 LUAI_FUNC void *luaM_saferealloc_ (lua_State *L, void *block, size_t oldsize,
                                                               size_t size);
 LUAI_FUNC void luaM_free_ (lua_State *L, void *block, size_t osize);
+LUAI_FUNC void luaM_freeobject_ (lua_State *L, void *block, size_t osize,
+                                                            int tag);
 LUAI_FUNC void *luaM_growaux_ (lua_State *L, void *block, int nelems,
                                int *size, unsigned size_elem, int limit,
                                const char *what);
@@ -92,5 +108,15 @@ LUAI_FUNC void *luaM_shrinkvector_ (lua_State *L, void *block, int *nelem,
                                     int final_n, unsigned size_elem);
 LUAI_FUNC void *luaM_malloc_ (lua_State *L, size_t size, int tag);
 
+struct global_State;  /* defined in lstate.h */
+LUAI_FUNC int luaM_newpool (struct global_State *g);
+LUAI_FUNC void luaM_freepool (struct global_State *g);
+LUAI_FUNC int luaM_poolstats (struct global_State *g, lua_PoolStats *stats);
+LUAI_FUNC void luaM_newbgfree (struct global_State *g);
+LUAI_FUNC void luaM_freebgfree (struct global_State *g);
+LUAI_FUNC void luaM_bgflush (struct global_State *g);
+LUAI_FUNC void luaM_bgwait (struct global_State *g);
+LUAI_FUNC int luaM_bglimit (struct global_State *g, int kbytes);
+
 #endif
 
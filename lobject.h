@@ -21,14 +21,15 @@
 */
 #define LUA_TUPVAL	LUA_NUMTYPES  /* upvalues */
 #define LUA_TPROTO	(LUA_NUMTYPES+1)  /* function prototypes */
-#define LUA_TDEADKEY	(LUA_NUMTYPES+2)  /* removed keys in tables */
+#define LUA_TSHAPE	(LUA_NUMTYPES+2)  /* table shapes */
+#define LUA_TDEADKEY	(LUA_NUMTYPES+3)  /* removed keys in tables */
 
 
 
 /*
 ** number of all possible types (including LUA_TNONE but excluding DEADKEY)
 */
-#define LUA_TOTALTYPES		(LUA_TPROTO + 2)
+#define LUA_TOTALTYPES		(LUA_TSHAPE + 2)
 
 
 /*
@@ -580,12 +581,28 @@ typedef struct AbsLineInfo {
 } AbsLineInfo;
 
 
+/*
+** Inline cache for accesses with a constant short-string key (one per
+** constant of a prototype; see 'getfieldic' in lvm.c). Each field is
+** the index of the node where the key was last found in the
+** corresponding table; it is only a hint, checked before each use.
+*/
+typedef struct ICache {
+  unsigned int node;  /* key in the table itself */
+  unsigned int tm;  /* '__index' in the metatable */
+  unsigned int index;  /* key in the '__index' table */
+} ICache;
+
+
 /*
 ** Flags in Prototypes
 */
 #define PF_VAHID	1  /* function has hidden vararg arguments */
 #define PF_VATAB	2  /* function has vararg table */
 #define PF_FIXED	4  /* prototype has parts in fixed memory */
+#define PF_QUICK	8  /* code has quickened instructions */
+#define PF_CACHE	16  /* closures can be reused (read-only upvalues) */
+#define PF_CENSUS	32  /* arrays are in the census of the heap */
 
 /* a vararg function either has hidden args. or a vararg table */
 #define isvararg(p)	((p)->flag & (PF_VAHID | PF_VATAB))
@@ -596,6 +613,22 @@ typedef struct AbsLineInfo {
 */
 #define needvatab(p)	((p)->flag |= PF_VATAB)
 
+/*
+** A buffer used in place by prototypes and long strings loaded from it
+** (see 'lua_loadfixed'). It is released by 'falloc' when the last of
+** them is collected.
+*/
+typedef struct FixedBuff {
+  lua_Alloc falloc;  /* function to release the buffer */
+  void *ud;  /* auxiliary data to 'falloc' */
+  void *buff;
+  size_t size;
+  lua_Alloc frealloc;  /* function that allocated this structure */
+  void *fud;  /* auxiliary data to 'frealloc' */
+  size_t nrefs;  /* number of objects using the buffer */
+} FixedBuff;
+
+
 /*
 ** Function Prototypes
 */
@@ -604,6 +637,8 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed (named) parameters */
   lu_byte flag;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte ndeopt;  /* number of deoptimized quickened instructions */
+  lu_byte jitcount;  /* backward jumps of 'for' loops (see 'ljit.c') */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -614,6 +649,7 @@ typedef struct Proto {
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
+  ICache *icache;  /* inline caches for constant keys (size 'sizek') */
   Instruction *code;  /* opcodes */
   struct Proto **p;  /* functions defined inside the function */
   Upvaldesc *upvalues;  /* upvalue information */
@@ -621,6 +657,9 @@ typedef struct Proto {
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
   TString  *source;  /* used for debug information */
+  FixedBuff *fixed;  /* owner of fixed parts, if any (see PF_FIXED) */
+  struct JitLoop *jit;  /* list of compiled loops */
+  struct LClosure *cache;  /* last closure created (weak reference) */
   GCObject *gclist;
 } Proto;
 
@@ -785,6 +824,42 @@ typedef struct Table {
 } Table;
 
 
+/*
+** {==================================================================
+** Shapes
+** ===================================================================
+*/
+
+#define LUA_VSHAPE	makevariant(LUA_TSHAPE, 0)
+
+
+/*
+** A shape lists, in insertion order, the keys of the hash part of
+** tables whose keys there are all short strings. Tables that got the
+** same keys in the same order share a shape, and their hash parts keep
+** only values, in the order of the keys. Shapes are immutable; adding
+** a key to a table moves it to a shape that extends its current one.
+** The shapes extending a shape are kept in its list 'child' (see
+** 'clearshapes' in lgc.c about that list). The array 'keys' is followed
+** by an index, with '2^lsizeindex' bytes, mapping hashes of keys to
+** their positions plus one.
+*/
+typedef struct Shape {
+  CommonHeader;
+  lu_byte nkeys;  /* number of keys */
+  lu_byte lsizeindex;  /* log2 of size of the index */
+  unsigned short nchildren;  /* number of shapes in list 'child' */
+  struct Shape *parent;  /* shape without the last key */
+  struct Shape *child;  /* list of shapes extending this one */
+  struct Shape *sibling;  /* next shape in the list of 'parent' */
+  struct Shape **previous;  /* pointer to this shape in that list */
+  GCObject *gclist;
+  TString *keys[1];  /* keys in insertion order */
+} Shape;
+
+/* }================================================================== */
+
+
 /*
 ** Macros to manipulate keys inserted in nodes
 */
@@ -106,6 +106,40 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, 0, 0, 0, iABx)		/* OP_ERRNNIL */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_CMD */
+ ,opmode(0, 0, 0, 0, 1, iABx)		/* OP_NEWTABLEK */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADD_II */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADD_FF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUB_II */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUB_FF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MUL_II */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MUL_FF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_DIV_FF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LT_II */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LT_FF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LE_II */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LE_FF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABLE_A */
+ ,opmode(0, 0, 0, 0, 0, iABC)		/* OP_SETTABLE_A */
+ ,opmode(0, 0, 0, 0, 1, iABx)		/* OP_FORLOOP_JIT */
+};
+
+
+LUAI_DDEF const lu_byte luaP_genericop[NUM_OPCODES - FIRST_QUICKOP] = {
+  OP_ADD		/* OP_ADD_II */
+ ,OP_ADD		/* OP_ADD_FF */
+ ,OP_SUB		/* OP_SUB_II */
+ ,OP_SUB		/* OP_SUB_FF */
+ ,OP_MUL		/* OP_MUL_II */
+ ,OP_MUL		/* OP_MUL_FF */
+ ,OP_DIV		/* OP_DIV_FF */
+ ,OP_LT		/* OP_LT_II */
+ ,OP_LT		/* OP_LT_FF */
+ ,OP_LE		/* OP_LE_II */
+ ,OP_LE		/* OP_LE_FF */
+ ,OP_GETTABLE	/* OP_GETTABLE_A */
+ ,OP_SETTABLE	/* OP_SETTABLE_A */
+ ,OP_FORLOOP	/* OP_FORLOOP_JIT */
 };
 
 
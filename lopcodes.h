@@ -344,11 +344,50 @@ OP_ERRNNIL,/*	A Bx	raise error if R[A] ~= nil (K[Bx - 1] is global name)*/
 
 OP_VARARGPREP,/* 	(adjust varargs)				*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+OP_CMD,/*	A B C	R[A+1] := R[B]; R[A] := R[B][K[C]:shortstring];
+			R[A](R[A+1], K[EXTRAARG]...)			*/
+
+OP_NEWTABLEK,/*	A Bx	R[A] := clone(K[Bx]:table)			*/
+
+/* quickened variants of generic opcodes (never generated by the parser) */
+OP_ADD_II,/*	A B C	R[A] := R[B] + R[C] (integers)	*/
+OP_ADD_FF,/*	A B C	R[A] := R[B] + R[C] (floats)	*/
+OP_SUB_II,/*	A B C	R[A] := R[B] - R[C] (integers)	*/
+OP_SUB_FF,/*	A B C	R[A] := R[B] - R[C] (floats)	*/
+OP_MUL_II,/*	A B C	R[A] := R[B] * R[C] (integers)	*/
+OP_MUL_FF,/*	A B C	R[A] := R[B] * R[C] (floats)	*/
+OP_DIV_FF,/*	A B C	R[A] := R[B] / R[C] (floats)	*/
+OP_LT_II,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++ (integers)	*/
+OP_LT_FF,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++ (floats)	*/
+OP_LE_II,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (integers)	*/
+OP_LE_FF,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (floats)	*/
+OP_GETTABLE_A,/*	A B C	R[A] := R[B][R[C]] (array part)	*/
+OP_SETTABLE_A,/*	A B C	R[A][R[B]] := RK(C) (array part)	*/
+OP_FORLOOP_JIT/*	A Bx	OP_FORLOOP with compiled code (see 'ljit.c')	*/
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_OPCODES	((int)(OP_FORLOOP_JIT) + 1)
+
+
+/*
+** Quickened opcodes come after all others. Each one is a variant of a
+** generic opcode, with the same arguments and properties, for operands
+** of given types (see 'lvm.c').
+*/
+#define FIRST_QUICKOP	OP_ADD_II
+
+#define isquickop(o)	((o) >= FIRST_QUICKOP)
+
+LUAI_DDEC(const lu_byte luaP_genericop[NUM_OPCODES - FIRST_QUICKOP];)
+
+/* generic opcode of an opcode */
+#define genericop(o)  \
+	(isquickop(o) ? cast(OpCode, luaP_genericop[(o) - FIRST_QUICKOP]) : (o))
+
+#define GET_GENOPCODE(i)	genericop(GET_OPCODE(i))
 
 
 
@@ -387,6 +426,20 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   power of 2) plus 1, or zero for size zero. If not k, the array size
   is vC. Otherwise, the array size is EXTRAARG _ vC.
 
+  (*) OP_NEWTABLEK creates a copy of a template table, for a
+  constructor that only stores constants with constant keys.
+
+  (*) OP_CMD is a method call with constant arguments, as generated
+  for each command of a 'cmd' list. It is followed by one OP_EXTRAARG
+  per argument, holding the index of that constant. The call has no
+  results. A run of OP_CMD calling C functions is executed in a single
+  dispatch.
+
+  (*) Quickened opcodes (OP_ADD_II etc.) replace their generic opcodes
+  at run time, when enabled. They are never dumped: 'lua_dump' and the
+  debug interface see their generic opcodes (GET_GENOPCODE). Likewise,
+  OP_FORLOOP_JIT replaces an OP_FORLOOP whose loop was compiled.
+
   (*) In OP_ERRNNIL, (Bx == 0) means index of global name doesn't
   fit in Bx. (So, that name is not available for the error message.)
 
@@ -98,6 +98,22 @@ static const char *const opnames[] = {
   "ERRNNIL",
   "VARARGPREP",
   "EXTRAARG",
+  "CMD",
+  "NEWTABLEK",
+  "ADD_II",
+  "ADD_FF",
+  "SUB_II",
+  "SUB_FF",
+  "MUL_II",
+  "MUL_FF",
+  "DIV_FF",
+  "LT_II",
+  "LT_FF",
+  "LE_II",
+  "LE_FF",
+  "GETTABLE_A",
+  "SETTABLE_A",
+  "FORLOOP_JIT",
   NULL
 };
 
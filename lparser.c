@@ -827,6 +827,21 @@ static void open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
 }
 
 
+/*
+** Check whether all upvalues of a function are read-only variables, so
+** that its closures with equal upvalues cannot be told apart.
+*/
+static int readonlyupvals (Proto *f) {
+  int i;
+  for (i = 0; i < f->sizeupvalues; i++) {
+    lu_byte kind = f->upvalues[i].kind;
+    if (kind != RDKCONST && kind != RDKTOCLOSE)
+      return 0;
+  }
+  return 1;
+}
+
+
 static void close_func (LexState *ls) {
   lua_State *L = ls->L;
   FuncState *fs = ls->fs;
@@ -843,6 +858,9 @@ static void close_func (LexState *ls) {
   luaM_shrinkvector(L, f->p, f->sizep, fs->np, Proto *);
   luaM_shrinkvector(L, f->locvars, f->sizelocvars, fs->ndebugvars, LocVar);
   luaM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
+  luaF_newicache(L, f);
+  if (readonlyupvals(f))
+    f->flag |= PF_CACHE;  /* its closures can be reused (see 'lvm.c') */
   ls->fs = fs->prev;
   L->top.p--;  /* pop kcache table */
   luaC_checkGC(L);
@@ -1050,7 +1068,10 @@ static void constructor (LexState *ls, expdesc *t) {
   } while (testnext(ls, ',') || testnext(ls, ';'));
   check_match(ls, /*{*/ '}', '{' /*}*/, line);
   lastlistfield(fs, &cc);
-  luaK_settablesize(fs, pc, t->u.info, cc.na, cc.nh);
+  if (luaK_tabletemplate(fs, pc, t->u.info, cc.na, cc.nh))
+    luaK_fixline(fs, line);
+  else
+    luaK_settablesize(fs, pc, t->u.info, cc.na, cc.nh);
 }
 
 /* }====================================================================== */
@@ -1178,12 +1199,16 @@ static void cmd_body (LexState *ls, expdesc *e) {
         continue;
       default: {
         expdesc key;
+        int pc = fs->pc;  /* where the command code starts */
         init_exp(e, VLOCAL, 0);
         codename(ls, &key);
         luaK_self(fs, e, &key);
         cmd_funcargs(ls, e);
-        if (e->k == VCALL)
+        if (e->k == VCALL) {
           SETARG_C(fs->f->code[e->u.info], 1);
+          luaK_cmd(fs, pc);  /* try to use OP_CMD */
+        }
+        fs->freereg = luaY_nvarstack(fs);  /* free registers */
       }
     }
   }
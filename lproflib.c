@@ -0,0 +1,1130 @@
+/*
+** $Id: lproflib.c $
+** Sampling profiler
+** See Copyright Notice in lua.h
+*/
+
+#define lproflib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <ctype.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lheap.h"
+#include "llimits.h"
+
+
+/*
+** Maximum number of frames recorded for each sample. Deeper stacks
+** keep their innermost frames and are marked as truncated.
+*/
+#if !defined(LUAI_PROFDEPTH)
+#define LUAI_PROFDEPTH		32
+#endif
+
+/* default sampling interval (in microseconds of CPU time) */
+#define DEFINTERVAL	1000
+
+/* default size of the ring buffer (in samples) */
+#define DEFNSAMPLES	10000
+
+/* each sample is a depth followed by the ids of its frames */
+#define SAMPLESIZE	(LUAI_PROFDEPTH + 1)
+
+
+/*
+** {======================================================
+** Timer: 'l_settimer(us,h)' makes the system call 'h' every 'us'
+** microseconds of CPU time; 'l_settimer(0,NULL)' cancels it.
+** Both return 0 on success.
+** =======================================================
+*/
+#if !defined(l_settimer)	/* { */
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <sys/time.h>
+
+static int l_settimer (lua_Integer us, void (*h)(int)) {
+  struct itimerval it;
+  struct sigaction sa;
+  sa.sa_handler = (h != NULL) ? h : SIG_DFL;
+  sa.sa_flags = SA_RESTART;  /* do not disturb ongoing I/O */
+  sigemptyset(&sa.sa_mask);
+  it.it_interval.tv_sec = (time_t)(us / 1000000);
+  it.it_interval.tv_usec = (suseconds_t)(us % 1000000);
+  it.it_value = it.it_interval;
+  if (h != NULL && sigaction(SIGPROF, &sa, NULL) != 0)
+    return -1;
+  if (setitimer(ITIMER_PROF, &it, NULL) != 0)
+    return -1;
+  if (h == NULL)  /* timer cancelled? */
+    sigaction(SIGPROF, &sa, NULL);  /* now it is safe to reset handler */
+  return 0;
+}
+
+#else				/* }{ */
+
+/* ISO C has no way to get periodic signals */
+#define l_settimer(us,h)	((void)(us), (void)(h), -1)
+
+#endif				/* } */
+
+#endif				/* } */
+/* }====================================================== */
+
+
+/*
+** State of the profiler. Signals are process-wide, so there can be
+** only one profiler running at a time.
+*/
+static struct {
+  lua_State *L;  /* (main) thread being sampled */
+  int *ring;  /* buffer of samples (memory of the anchor userdata) */
+  int size;  /* size of 'ring' (in samples) */
+  int next;  /* next slot to be written */
+  lua_Integer count;  /* number of samples taken */
+  volatile sig_atomic_t running;
+  volatile sig_atomic_t lost;  /* signals that could not take a sample */
+} prof;
+
+
+/*
+** The anchor is a full userdata, kept in the registry, whose memory
+** is the ring buffer; its first user value maps functions to ids and
+** its second one maps ids to the names of the functions.
+*/
+#define pushanchor(L)	lua_rawgetp(L, LUA_REGISTRYINDEX, &prof)
+
+
+/*
+** Give a new id to the function on the top of the stack, computing
+** its name from the activation record 'ar'. Removes the function.
+** (Functions keep their first-seen name; in particular, a function
+** called through different names is reported under the first one.)
+*/
+static int newid (lua_State *L, int anchor, lua_Debug *ar) {
+  int id;
+  lua_getiuservalue(L, anchor, 2);  /* names */
+  id = cast_int(lua_rawlen(L, -1)) + 1;
+  lua_getinfo(L, "Sn", ar);
+  if (*ar->what == 'C')
+    lua_pushfstring(L, "%s@[C]", (ar->name) ? ar->name : "?");
+  else if (*ar->what == 'm')
+    lua_pushfstring(L, "main chunk@%s", ar->short_src);
+  else
+    lua_pushfstring(L, "%s@%s:%d", (ar->name) ? ar->name : "?",
+                                  ar->short_src, ar->linedefined);
+  lua_rawseti(L, -2, id);  /* names[id] = name */
+  lua_pop(L, 1);  /* remove names */
+  lua_pushinteger(L, id);
+  lua_rawset(L, anchor + 1);  /* ids[function] = id */
+  return id;
+}
+
+
+/*
+** Hook set by the signal handler: records the current stack, leaf
+** first, in the next slot of the ring buffer. The hook is a one-shot:
+** it removes itself before doing anything else. Only functions never
+** seen before allocate memory.
+*/
+static void samplehook (lua_State *L, lua_Debug *ar) {
+  lua_Debug fr;
+  int *s;
+  int n, anchor;
+  (void)ar;  /* unused arg. */
+  lua_sethook(L, NULL, 0, 0);
+  if (!prof.running || !lua_checkstack(L, 6))
+    return;
+  s = prof.ring + prof.next * SAMPLESIZE;
+  pushanchor(L);
+  anchor = lua_gettop(L);
+  lua_getiuservalue(L, anchor, 1);  /* ids */
+  for (n = 0; n < LUAI_PROFDEPTH && lua_getstack(L, n, &fr); n++) {
+    lua_getinfo(L, "f", &fr);  /* push function */
+    lua_pushvalue(L, -1);
+    if (lua_rawget(L, anchor + 1) == LUA_TNUMBER) {  /* old function? */
+      s[n + 1] = cast_int(lua_tointeger(L, -1));
+      lua_pop(L, 2);  /* remove function and id */
+    }
+    else {
+      lua_pop(L, 1);  /* remove nil */
+      s[n + 1] = newid(L, anchor, &fr);
+    }
+  }
+  lua_pop(L, 2);  /* remove anchor and ids */
+  /* a negative depth signals a truncated stack */
+  s[0] = (n == LUAI_PROFDEPTH && lua_getstack(L, n, &fr)) ? -n : n;
+  prof.next = (prof.next + 1) % prof.size;
+  prof.count++;
+}
+
+
+/*
+** C-signal handler. As a C signal cannot change a Lua state, it only
+** sets the hook that will take the sample (as 'laction' in lua.c).
+** A signal arriving while another hook is active is counted as lost.
+*/
+static void sigprof (int i) {
+  (void)i;  /* unused arg. */
+  if (prof.running && lua_gethook(prof.L) == NULL)
+    lua_sethook(prof.L, samplehook,
+                LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+  else
+    prof.lost++;
+}
+
+
+static void stopprof (void) {
+  if (prof.running) {
+    l_settimer(0, NULL);
+    prof.running = 0;
+    if (lua_gethook(prof.L) == samplehook)  /* sample still pending? */
+      lua_sethook(prof.L, NULL, 0, 0);
+  }
+}
+
+
+/*
+** Finalizer of the anchor: a state closed while being sampled must
+** stop the timer before its memory goes away.
+*/
+static int anchor_gc (lua_State *L) {
+  if (prof.ring == cast(int *, lua_touserdata(L, 1)))
+    stopprof();
+  return 0;
+}
+
+
+static int prof_start (lua_State *L) {
+  lua_Integer us = luaL_optinteger(L, 1, DEFINTERVAL);
+  lua_Integer size = luaL_optinteger(L, 2, DEFNSAMPLES);
+  luaL_argcheck(L, us > 0, 1, "interval must be positive");
+  luaL_argcheck(L, 0 < size &&
+      size <= cast(lua_Integer, MAX_SIZE / sizeof(int) / SAMPLESIZE) &&
+      size <= INT_MAX, 2, "invalid number of samples");
+  if (prof.running)
+    return luaL_error(L, "profiler already running");
+  prof.ring = cast(int *, lua_newuserdatauv(L,
+                cast_sizet(size) * SAMPLESIZE * sizeof(int), 2));
+  if (luaL_newmetatable(L, "_PROFILER")) {
+    lua_pushcfunction(L, anchor_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, 1);  /* ids */
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, 2);  /* names */
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &prof);  /* replace old anchor */
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  prof.L = lua_tothread(L, -1);
+  prof.size = cast_int(size);
+  prof.next = 0;
+  prof.count = 0;
+  prof.lost = 0;
+  prof.running = 1;
+  if (l_settimer(us, sigprof) != 0) {
+    prof.running = 0;
+    return luaL_error(L, "cannot start profiler timer");
+  }
+  return 0;
+}
+
+
+/*
+** Stops the profiler, returning the number of samples taken and the
+** number of signals that could not take a sample.
+*/
+static int prof_stop (lua_State *L) {
+  stopprof();
+  lua_pushinteger(L, prof.count);
+  lua_pushinteger(L, prof.lost);
+  return 2;
+}
+
+
+/*
+** Adds to buffer 'b' the stack of sample 's', root first, in the
+** folded format ("f1;f2;...;fn").
+*/
+static void addstack (lua_State *L, luaL_Buffer *b, int names,
+                      const int *s) {
+  int n = (s[0] < 0) ? -s[0] : s[0];
+  if (s[0] < 0)  /* truncated? */
+    luaL_addstring(b, "...;");
+  while (n > 0) {
+    lua_rawgeti(L, names, s[n--]);
+    luaL_addvalue(b);
+    if (n > 0)
+      luaL_addchar(b, ';');
+  }
+}
+
+
+/*
+** Returns the samples in the ring buffer as folded stacks: one line
+** per distinct stack, with the stack followed by a space and the
+** number of samples with that stack.
+*/
+static int prof_dump (lua_State *L) {
+  sig_atomic_t running = prof.running;
+  int i, n, names, list;
+  int k = 0;  /* number of distinct stacks */
+  luaL_Buffer b;
+  if (pushanchor(L) != LUA_TUSERDATA ||  /* never started? */
+      lua_touserdata(L, -1) != cast(void *, prof.ring)) {  /* other state? */
+    lua_pushliteral(L, "");
+    return 1;
+  }
+  prof.running = 0;  /* do not disturb the ring buffer while reading it */
+  lua_getiuservalue(L, -1, 2);
+  names = lua_gettop(L);
+  lua_newtable(L);  /* stack -> position in 'list' */
+  lua_newtable(L);  /* list: stack1, count1, stack2, count2, ... */
+  list = names + 2;
+  n = (prof.count < prof.size) ? cast_int(prof.count) : prof.size;
+  for (i = 0; i < n; i++) {
+    luaL_buffinit(L, &b);
+    addstack(L, &b, names, prof.ring + i * SAMPLESIZE);
+    luaL_pushresult(&b);
+    lua_pushvalue(L, -1);
+    if (lua_rawget(L, names + 1) == LUA_TNUMBER) {  /* old stack? */
+      int p = cast_int(lua_tointeger(L, -1));
+      lua_rawgeti(L, list, p + 1);
+      lua_pushinteger(L, lua_tointeger(L, -1) + 1);
+      lua_rawseti(L, list, p + 1);  /* increment its count */
+      lua_pop(L, 3);  /* remove stack, position, and old count */
+    }
+    else {  /* new stack */
+      lua_pop(L, 1);  /* remove nil */
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, list, 2 * k + 1);
+      lua_pushinteger(L, 1);
+      lua_rawseti(L, list, 2 * k + 2);
+      lua_pushinteger(L, 2 * k + 1);
+      lua_rawset(L, names + 1);  /* stack -> its position */
+      k++;
+    }
+  }
+  luaL_buffinit(L, &b);
+  for (i = 1; i <= 2 * k; i += 2) {
+    lua_rawgeti(L, list, i);
+    luaL_addvalue(&b);  /* stack */
+    luaL_addchar(&b, ' ');
+    lua_rawgeti(L, list, i + 1);
+    luaL_addvalue(&b);  /* count */
+    luaL_addchar(&b, '\n');
+  }
+  luaL_pushresult(&b);
+  prof.running = running;
+  return 1;
+}
+
+
+/*
+** {======================================================
+** Tracer
+** =======================================================
+*/
+
+static int prof_trace (lua_State *L) {
+  static const char *const opts[] = {"stop", "start", "reset",
+    "isrunning", NULL};
+  static const int optsnum[] = {LUA_TRACESTOP, LUA_TRACESTART,
+    LUA_TRACERESET, LUA_TRACEISRUNNING};
+  int o = optsnum[luaL_checkoption(L, 1, "start", opts)];
+  int res = lua_trace(L, o);
+  if (o == LUA_TRACEISRUNNING) {
+    lua_pushboolean(L, res);
+    return 1;
+  }
+  return 0;
+}
+
+
+/* orders for the report (all of them decreasing) */
+static int byself (const void *a, const void *b) {
+  lua_Number x = ((const lua_TraceStat *)a)->self;
+  lua_Number y = ((const lua_TraceStat *)b)->self;
+  return (x < y) - (x > y);
+}
+
+static int bytotal (const void *a, const void *b) {
+  lua_Number x = ((const lua_TraceStat *)a)->total;
+  lua_Number y = ((const lua_TraceStat *)b)->total;
+  return (x < y) - (x > y);
+}
+
+static int bycalls (const void *a, const void *b) {
+  lua_Unsigned x = ((const lua_TraceStat *)a)->calls;
+  lua_Unsigned y = ((const lua_TraceStat *)b)->calls;
+  return (x < y) - (x > y);
+}
+
+
+/*
+** Pushes a table mapping the C functions exported by loaded modules
+** to their names (as "module.function", or just "function" for the
+** basic library).
+*/
+static void pushcnames (lua_State *L) {
+  int names;
+  lua_newtable(L);
+  names = lua_gettop(L);
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {  /* for each module */
+    if (lua_type(L, -2) == LUA_TSTRING && lua_type(L, -1) == LUA_TTABLE) {
+      const char *mod = lua_tostring(L, -2);
+      int isG = (strcmp(mod, LUA_GNAME) == 0);
+      lua_pushnil(L);
+      while (lua_next(L, -2)) {  /* for each field */
+        if (lua_type(L, -2) != LUA_TSTRING || !lua_iscfunction(L, -1)) {
+          lua_pop(L, 1);  /* remove value */
+          continue;
+        }
+        if (!isG) {  /* names from the basic library take precedence */
+          lua_pushvalue(L, -1);
+          if (lua_rawget(L, names) != LUA_TNIL) {  /* already named? */
+            lua_pop(L, 2);  /* remove name and value */
+            continue;
+          }
+          lua_pop(L, 1);  /* remove nil */
+        }
+        if (isG)
+          lua_pushvalue(L, -2);
+        else
+          lua_pushfstring(L, "%s.%s", mod, lua_tostring(L, -2));
+        lua_rawset(L, names);  /* names[function] = name */
+      }
+    }
+    lua_pop(L, 1);  /* remove module */
+  }
+  lua_pop(L, 1);  /* remove loaded table */
+}
+
+
+static void setnumfield (lua_State *L, const char *k, lua_Number n) {
+  lua_pushnumber(L, n);
+  lua_setfield(L, -2, k);
+}
+
+
+/*
+** Returns a list with the statistics of all traced functions, sorted
+** by the given field (default is self time).
+*/
+static int prof_report (lua_State *L) {
+  static const char *const keys[] = {"self", "total", "calls", NULL};
+  static int (*const cmps[])(const void *, const void *) =
+    {byself, bytotal, bycalls};
+  int o = luaL_checkoption(L, 1, "self", keys);
+  int n = lua_trace(L, LUA_TRACECOUNT);
+  int names, i;
+  lua_TraceStat *st = (lua_TraceStat *)lua_newuserdatauv(L,
+                                          (size_t)n * sizeof(lua_TraceStat), 0);
+  for (i = 0; i < n; i++)
+    lua_gettracestat(L, i + 1, &st[i]);
+  qsort(st, (size_t)n, sizeof(lua_TraceStat), cmps[o]);
+  pushcnames(L);
+  names = lua_gettop(L);
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    const lua_TraceStat *t = &st[i];
+    lua_createtable(L, 0, 7);
+    if (t->func != NULL) {  /* C function? */
+      lua_pushcfunction(L, t->func);
+      if (lua_rawget(L, names) == LUA_TNIL) {
+        lua_pop(L, 1);
+        lua_pushliteral(L, "?");
+      }
+    }
+    else if (*t->what == 'm')
+      lua_pushfstring(L, "main chunk <%s>", t->short_src);
+    else
+      lua_pushfstring(L, "function <%s:%d>", t->short_src, t->linedefined);
+    lua_setfield(L, -2, "name");
+    lua_pushstring(L, t->what);
+    lua_setfield(L, -2, "what");
+    lua_pushstring(L, t->short_src);
+    lua_setfield(L, -2, "source");
+    lua_pushinteger(L, t->linedefined);
+    lua_setfield(L, -2, "line");
+    lua_pushinteger(L, (lua_Integer)t->calls);
+    lua_setfield(L, -2, "calls");
+    setnumfield(L, "total", t->total);
+    setnumfield(L, "self", t->self);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Quickening
+** =======================================================
+*/
+
+static void setcountfield (lua_State *L, const char *k, int what) {
+  lua_pushinteger(L, l_castU2S(lua_quicken(L, what)));
+  lua_setfield(L, -2, k);
+}
+
+
+static int prof_quicken (lua_State *L) {
+  static const char *const opts[] = {"stop", "start", "reset",
+    "isrunning", "stats", NULL};
+  static const int optsnum[] = {LUA_QUICKSTOP, LUA_QUICKSTART,
+    LUA_QUICKRESET, LUA_QUICKISRUNNING, -1};
+  int o = optsnum[luaL_checkoption(L, 1, "start", opts)];
+  switch (o) {
+    case LUA_QUICKISRUNNING: {
+      lua_pushboolean(L, lua_quicken(L, o) != 0);
+      return 1;
+    }
+    case -1: {  /* stats */
+      lua_createtable(L, 0, 3);
+      setcountfield(L, "rewrites", LUA_QUICKREWRITES);
+      setcountfield(L, "hits", LUA_QUICKHITS);
+      setcountfield(L, "deopts", LUA_QUICKDEOPTS);
+      return 1;
+    }
+    default: {
+      lua_quicken(L, o);
+      return 0;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Pairs of instructions
+** =======================================================
+*/
+
+typedef struct OpPair {
+  const char *first;
+  const char *second;
+  lua_Unsigned count;
+} OpPair;
+
+
+/* most frequent pairs first */
+static int bycount (const void *a, const void *b) {
+  lua_Unsigned x = ((const OpPair *)a)->count;
+  lua_Unsigned y = ((const OpPair *)b)->count;
+  return (x < y) - (x > y);
+}
+
+
+/*
+** With "reset", zeroes all counts. Otherwise, returns a list with the
+** 'n' (default 20) pairs of opcodes run most often one after the other,
+** or fail if the interpreter was built without LUAI_OPPAIRS.
+*/
+static int prof_oppairs (lua_State *L) {
+  OpPair p, *pairs;
+  int n, np, i;
+  lua_Integer max;
+  if (lua_type(L, 1) == LUA_TSTRING) {
+    static const char *const opts[] = {"reset", NULL};
+    luaL_checkoption(L, 1, NULL, opts);
+    lua_resetoppairs(L);
+    return 0;
+  }
+  max = luaL_optinteger(L, 1, 20);
+  for (n = 0; lua_getoppair(L, n + 1, &p.first, &p.second, &p.count); n++)
+    ;  /* count pairs */
+  if (n == 0) {
+    luaL_pushfail(L);
+    lua_pushliteral(L, "pairs of instructions are not counted");
+    return 2;
+  }
+  pairs = (OpPair *)lua_newuserdatauv(L, (size_t)n * sizeof(OpPair), 0);
+  for (i = np = 0; i < n; i++) {
+    OpPair *pp = &pairs[np];
+    lua_getoppair(L, i + 1, &pp->first, &pp->second, &pp->count);
+    if (pp->count > 0)  /* keep only pairs that ran */
+      np++;
+  }
+  qsort(pairs, (size_t)np, sizeof(OpPair), bycount);
+  if (max < np)
+    np = (max < 0) ? 0 : (int)max;
+  lua_createtable(L, np, 0);
+  for (i = 0; i < np; i++) {
+    lua_createtable(L, 0, 3);
+    lua_pushstring(L, pairs[i].first);
+    lua_setfield(L, -2, "first");
+    lua_pushstring(L, pairs[i].second);
+    lua_setfield(L, -2, "second");
+    lua_pushinteger(L, l_castU2S(pairs[i].count));
+    lua_setfield(L, -2, "count");
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Heap snapshots
+** =======================================================
+*/
+
+/* an object in a snapshot */
+typedef struct HObj {
+  lua_Unsigned id;
+  lua_Unsigned size;
+  lua_Unsigned retained;  /* size of the objects first reached through it */
+  lua_Unsigned count;  /* number of those objects (including itself) */
+  const char *str;  /* (prefix of) contents of a string */
+  size_t len;  /* length of 'str' */
+  int tag;
+  int first;  /* index of its first edge */
+  int nedges;  /* number of its edges */
+  int parent;  /* previous object in its path (-1 for roots) */
+  int via;  /* edge that reaches it in its path */
+  int rec;  /* index of the record of its path */
+} HObj;
+
+
+typedef struct HEdge {
+  lua_Unsigned label;
+  lua_Unsigned id;  /* id of its target */
+  int to;  /* index of its target (-1 if not in the snapshot) */
+  int kind;
+} HEdge;
+
+
+/* a retaining path and what it retains */
+typedef struct HRec {
+  lua_Unsigned size;
+  lua_Unsigned count;
+  int parent;  /* record of the path it extends (-1 for roots) */
+} HRec;
+
+
+typedef struct Snapshot {
+  const char *fname;
+  const unsigned char *p;  /* current position while reading */
+  const unsigned char *end;
+  HObj *objs;
+  HEdge *edges;  /* first 'nroots' edges are the roots */
+  HRec *recs;
+  int nobjs;
+  int nedges;
+  int nroots;
+  int nrecs;
+  int paths;  /* stack index of the list of paths */
+  int map;  /* stack index of the table mapping paths to records */
+} Snapshot;
+
+
+static int badsnapshot (lua_State *L, Snapshot *S) {
+  return luaL_error(L, "'%s' is not a valid heap snapshot", S->fname);
+}
+
+
+static int readbyte (lua_State *L, Snapshot *S) {
+  if (S->p >= S->end)
+    return badsnapshot(L, S);
+  return *S->p++;
+}
+
+
+static lua_Unsigned readvarint (lua_State *L, Snapshot *S) {
+  lua_Unsigned x = 0;
+  int b;
+  do {
+    b = readbyte(L, S);
+    x = (x << 7) | (lua_Unsigned)(b & 0x7f);
+  } while (b & 0x80);
+  return x;
+}
+
+
+/*
+** Reads a list of edges. Without arrays (first pass), only counts
+** them.
+*/
+static int readedges (lua_State *L, Snapshot *S) {
+  int n = 0;
+  int kind;
+  while ((kind = readbyte(L, S)) != 0) {
+    lua_Unsigned label = readvarint(L, S);
+    lua_Unsigned id = readvarint(L, S);
+    if (S->edges != NULL) {
+      HEdge *e = &S->edges[S->nedges];
+      e->kind = kind;
+      e->label = label;
+      e->id = id;
+    }
+    if (S->nedges == INT_MAX)
+      luaL_error(L, "heap snapshot too large");
+    S->nedges++;
+    n++;
+  }
+  return n;
+}
+
+
+static void readobjs (lua_State *L, Snapshot *S, const char *data) {
+  int tag;
+  S->p = (const unsigned char *)data + sizeof(HEAPSIGNATURE);
+  S->nobjs = S->nedges = 0;
+  S->nroots = readedges(L, S);
+  while ((tag = readbyte(L, S)) != 0) {
+    HObj aux;
+    HObj *o = (S->objs != NULL) ? &S->objs[S->nobjs] : &aux;
+    o->tag = tag;
+    o->id = readvarint(L, S);
+    o->size = readvarint(L, S);
+    o->str = NULL;
+    o->len = 0;
+    if ((tag & 0x0f) == LUA_TSTRING) {
+      lua_Unsigned len = readvarint(L, S);
+      o->len = (len < HEAPSTRLEN) ? (size_t)len : HEAPSTRLEN;
+      if ((size_t)(S->end - S->p) < o->len)
+        badsnapshot(L, S);
+      o->str = (const char *)S->p;
+      S->p += o->len;
+    }
+    o->first = S->nedges;
+    o->nedges = readedges(L, S);
+    if (S->nobjs == INT_MAX)
+      luaL_error(L, "heap snapshot too large");
+    S->nobjs++;
+  }
+}
+
+
+static int byid (const void *a, const void *b) {
+  lua_Unsigned x = ((const HObj *)a)->id;
+  lua_Unsigned y = ((const HObj *)b)->id;
+  return (x > y) - (x < y);
+}
+
+
+static int findobj (const Snapshot *S, lua_Unsigned id) {
+  int lo = 0, hi = S->nobjs - 1;
+  while (lo <= hi) {
+    int m = lo + (hi - lo) / 2;
+    if (S->objs[m].id == id) return m;
+    else if (S->objs[m].id < id) lo = m + 1;
+    else hi = m - 1;
+  }
+  return -1;
+}
+
+
+static int readaux (lua_State *L) {
+  FILE *f = (FILE *)lua_touserdata(L, 1);
+  luaL_Buffer b;
+  size_t n;
+  luaL_buffinit(L, &b);
+  do {
+    char *p = luaL_prepbuffer(&b);
+    n = fread(p, sizeof(char), LUAL_BUFFERSIZE, f);
+    luaL_addsize(&b, n);
+  } while (n == LUAL_BUFFERSIZE);
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+/*
+** Pushes the contents of a file. (The file is read in protected mode,
+** so that it is closed even after memory errors.)
+*/
+static const char *readfile (lua_State *L, const char *fname,
+                                           size_t *size) {
+  int status, err;
+  FILE *f = fopen(fname, "rb");
+  if (f == NULL)
+    luaL_error(L, "cannot open '%s'", fname);
+  lua_pushcfunction(L, readaux);
+  lua_pushlightuserdata(L, f);
+  status = lua_pcall(L, 1, 1, 0);
+  err = ferror(f);
+  fclose(f);
+  if (status != LUA_OK)
+    lua_error(L);
+  else if (err)
+    luaL_error(L, "cannot read '%s'", fname);
+  return lua_tolstring(L, -1, size);
+}
+
+
+static void reach (Snapshot *S, int *order, int *n, int from, int e) {
+  int to = S->edges[e].to;
+  if (to >= 0 && S->objs[to].parent == -2) {  /* not reached yet? */
+    HObj *o = &S->objs[to];
+    o->parent = from;
+    o->via = e;
+    o->retained = o->size;
+    o->count = 1;
+    order[(*n)++] = to;
+  }
+}
+
+
+/* which edges 'expand' follows */
+#define NOSTACK		0
+#define ONLYSTACK	1
+#define ALLEDGES	2
+
+
+/* reach the targets of the edges of the object 'order[i]' */
+static void expand (Snapshot *S, int *order, int *n, int i, int which) {
+  const HObj *o = &S->objs[order[i]];
+  int e;
+  for (e = o->first; e < o->first + o->nedges; e++) {
+    int isstack = (S->edges[e].kind == HE_STACK);
+    if (which == ALLEDGES || isstack == (which == ONLYSTACK))
+      reach(S, order, n, order[i], e);
+  }
+}
+
+
+/*
+** Finds the first path to each object in a breadth-first walk from the
+** roots, and charges each object to all objects in its path. Returns
+** the number of objects reached, which 'order' gets in the order they
+** were reached. (Objects not reached were already dead.) Stack slots
+** are followed only after all other references, so that an object
+** that a stack shares with a variable (e.g., a local that holds a
+** global table) is charged to the variable: otherwise, the stack of
+** the main thread, one step from a root, would take most of them.
+*/
+static int walk (Snapshot *S, int *order) {
+  int n = 0;
+  int n1;
+  int i;
+  for (i = 0; i < S->nobjs; i++)
+    S->objs[i].parent = -2;  /* not reached */
+  for (i = 0; i < S->nedges; i++)
+    S->edges[i].to = findobj(S, S->edges[i].id);
+  for (i = 0; i < S->nroots; i++)
+    reach(S, order, &n, -1, i);
+  for (i = 0; i < n; i++)  /* 'n' grows while objects are reached */
+    expand(S, order, &n, i, NOSTACK);
+  n1 = n;
+  for (i = 0; i < n; i++)  /* now the stacks */
+    expand(S, order, &n, i, (i < n1) ? ONLYSTACK : ALLEDGES);
+  for (i = n - 1; i >= 0; i--) {  /* children come after their parents */
+    const HObj *o = &S->objs[order[i]];
+    if (o->parent >= 0) {
+      S->objs[o->parent].retained += o->retained;
+      S->objs[o->parent].count += o->count;
+    }
+  }
+  return n;
+}
+
+
+static int isname (const char *s, size_t len) {
+  size_t i;
+  if (len == 0 || !(isalpha((unsigned char)s[0]) || s[0] == '_'))
+    return 0;
+  for (i = 1; i < len; i++) {
+    if (!(isalnum((unsigned char)s[i]) || s[i] == '_'))
+      return 0;
+  }
+  return 1;
+}
+
+
+static const char *tagname (lua_State *L, int tag) {
+  return ((tag & 0x0f) < LUA_NUMTYPES) ? lua_typename(L, tag & 0x0f) : "?";
+}
+
+
+/*
+** Pushes the path of an object: the path of its parent followed by
+** the label of the edge that reaches it.
+*/
+static void pushpath (lua_State *L, const Snapshot *S, const HObj *o) {
+  const HEdge *e = &S->edges[o->via];
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  if (o->parent < 0) {  /* a root? */
+    switch (e->kind) {
+      case HE_REGISTRY: luaL_addstring(&b, "registry"); break;
+      case HE_MAINTHREAD: luaL_addstring(&b, "mainthread"); break;
+      case HE_TYPEMT:
+        lua_pushfstring(L, "metatable(%s)", tagname(L, (int)e->label));
+        luaL_addvalue(&b);
+        break;
+      case HE_FINALIZING: luaL_addstring(&b, "finalizing"); break;
+      default: luaL_addstring(&b, "internal"); break;
+    }
+    luaL_pushresult(&b);
+    return;
+  }
+  lua_rawgeti(L, S->paths, S->objs[o->parent].rec + 1);
+  luaL_addvalue(&b);
+  switch (e->kind) {
+    case HE_FIELD: {
+      int k = findobj(S, e->label);
+      const HObj *key = (k >= 0) ? &S->objs[k] : NULL;
+      if (key != NULL && isname(key->str, key->len)) {
+        luaL_addchar(&b, '.');
+        luaL_addlstring(&b, key->str, key->len);
+      }
+      else if (key != NULL) {
+        luaL_addstring(&b, "[\"");
+        luaL_addlstring(&b, key->str, key->len);
+        luaL_addstring(&b, "\"]");
+      }
+      else
+        luaL_addstring(&b, "[?]");
+      break;
+    }
+    case HE_INDEX:
+      lua_pushfstring(L, "[%I]", l_castU2S(e->label));
+      luaL_addvalue(&b);
+      break;
+    case HE_VALUE: {
+      int k = (e->label != 0) ? findobj(S, e->label) : -1;
+      lua_pushfstring(L, "[%s]", (k >= 0) ? tagname(L, S->objs[k].tag)
+                                          : "?");
+      luaL_addvalue(&b);
+      break;
+    }
+    case HE_KEY: luaL_addstring(&b, ".<key>"); break;
+    case HE_METATABLE: luaL_addstring(&b, ".<metatable>"); break;
+    case HE_UPNAME: {
+      int k = findobj(S, e->label);
+      luaL_addstring(&b, ".<upvalue ");
+      if (k >= 0)
+        luaL_addlstring(&b, S->objs[k].str, S->objs[k].len);
+      luaL_addchar(&b, '>');
+      break;
+    }
+    case HE_UPVALUE: case HE_USERVALUE: case HE_STACK: {
+      const char *what = (e->kind == HE_UPVALUE) ? "upvalue"
+                       : (e->kind == HE_USERVALUE) ? "uservalue" : "stack";
+      lua_pushfstring(L, ".<%s %I>", what, l_castU2S(e->label));
+      luaL_addvalue(&b);
+      break;
+    }
+    case HE_ENV: luaL_addstring(&b, ".<env>"); break;
+    default: break;
+  }
+  luaL_pushresult(&b);
+}
+
+
+/*
+** Groups the reached objects by their paths. An object reached through
+** an internal reference (e.g., the prototype of a closure) belongs to
+** the record of its parent, which already retains it.
+*/
+static void makerecs (lua_State *L, Snapshot *S, const int *order, int n) {
+  int i;
+  S->nrecs = 0;
+  for (i = 0; i < n; i++) {
+    HObj *o = &S->objs[order[i]];
+    int r;
+    if (o->parent >= 0 && S->edges[o->via].kind == HE_INTERNAL) {
+      o->rec = S->objs[o->parent].rec;
+      continue;
+    }
+    pushpath(L, S, o);
+    lua_pushvalue(L, -1);
+    if (lua_rawget(L, S->map) == LUA_TNUMBER) {  /* path already seen? */
+      r = (int)lua_tointeger(L, -1);
+      S->recs[r].size += o->retained;
+      S->recs[r].count += o->count;
+      lua_pop(L, 2);  /* remove record and path */
+    }
+    else {  /* new record */
+      r = S->nrecs++;
+      S->recs[r].size = o->retained;
+      S->recs[r].count = o->count;
+      S->recs[r].parent = (o->parent >= 0) ? S->objs[o->parent].rec : -1;
+      lua_pop(L, 1);  /* remove nil */
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, S->paths, r + 1);
+      lua_pushinteger(L, r);
+      lua_rawset(L, S->map);  /* map[path] = r */
+    }
+    o->rec = r;
+  }
+}
+
+
+/*
+** Reads a snapshot and finds the paths that retain its objects. Leaves
+** on the stack the contents of the file, the arrays used by 'S', the
+** list of paths, and the table mapping paths to records.
+*/
+static void loadsnapshot (lua_State *L, const char *fname, Snapshot *S) {
+  size_t size;
+  const char *data = readfile(L, fname, &size);
+  int *order;
+  int n;
+  S->fname = fname;
+  S->end = (const unsigned char *)data + size;
+  if (size <= sizeof(HEAPSIGNATURE) ||
+      memcmp(data, HEAPSIGNATURE, sizeof(HEAPSIGNATURE) - 1) != 0 ||
+      data[sizeof(HEAPSIGNATURE) - 1] != HEAPVERSION)
+    badsnapshot(L, S);
+  S->objs = NULL;
+  S->edges = NULL;
+  readobjs(L, S, data);  /* count objects and edges */
+  S->objs = (HObj *)lua_newuserdatauv(L,
+                                 (size_t)S->nobjs * sizeof(HObj), 0);
+  S->edges = (HEdge *)lua_newuserdatauv(L,
+                                 (size_t)S->nedges * sizeof(HEdge), 0);
+  readobjs(L, S, data);  /* fill arrays */
+  qsort(S->objs, (size_t)S->nobjs, sizeof(HObj), byid);
+  order = (int *)lua_newuserdatauv(L, (size_t)S->nobjs * sizeof(int), 0);
+  n = walk(S, order);
+  S->recs = (HRec *)lua_newuserdatauv(L, (size_t)n * sizeof(HRec), 0);
+  lua_newtable(L);
+  S->paths = lua_gettop(L);
+  lua_newtable(L);
+  S->map = lua_gettop(L);
+  makerecs(L, S, order, n);
+}
+
+
+static int heapwriter (lua_State *L, const void *p, size_t sz, void *ud) {
+  (void)L;
+  return (fwrite(p, 1, sz, (FILE *)ud) != sz);
+}
+
+
+static int prof_snapshot (lua_State *L) {
+  const char *fname = luaL_checkstring(L, 1);
+  FILE *f;
+  int ok;
+  lua_gc(L, LUA_GCCOLLECT);  /* keep only live objects */
+  f = fopen(fname, "wb");
+  if (f == NULL)
+    return luaL_fileresult(L, 0, fname);
+  ok = (lua_heapsnapshot(L, heapwriter, f) == 0);
+  ok = (fclose(f) == 0) && ok;
+  return luaL_fileresult(L, ok, fname);
+}
+
+
+/* growth of a path between two snapshots */
+typedef struct HGrowth {
+  lua_Integer size;  /* growth not explained by the paths it retains */
+  lua_Integer count;  /* idem, in number of objects */
+  int rec;  /* record in the second snapshot */
+  int old;  /* record in the first snapshot */
+} HGrowth;
+
+
+static int bygrowth (const void *a, const void *b) {
+  lua_Integer x = ((const HGrowth *)a)->size;
+  lua_Integer y = ((const HGrowth *)b)->size;
+  return (x < y) - (x > y);
+}
+
+
+/*
+** Compares two snapshots and returns the paths present in both whose
+** retained size grew the most. The growth of a path discounts the
+** growth of the paths that extend it and are present in both
+** snapshots, so that growth is reported where new objects hang.
+*/
+static int prof_heapdiff (lua_State *L) {
+  const char *f1 = luaL_checkstring(L, 1);
+  const char *f2 = luaL_checkstring(L, 2);
+  lua_Integer max = luaL_optinteger(L, 3, 10);
+  Snapshot A, B;
+  HGrowth *g;
+  int i, n;
+  loadsnapshot(L, f1, &A);
+  loadsnapshot(L, f2, &B);
+  g = (HGrowth *)lua_newuserdatauv(L, (size_t)B.nrecs * sizeof(HGrowth), 0);
+  for (i = 0; i < B.nrecs; i++) {
+    lua_rawgeti(L, B.paths, i + 1);
+    g[i].rec = i;
+    g[i].old = (lua_rawget(L, A.map) == LUA_TNUMBER)
+             ? (int)lua_tointeger(L, -1) : -1;
+    lua_pop(L, 1);
+    g[i].size = g[i].count = 0;
+    if (g[i].old >= 0) {
+      g[i].size = l_castU2S(B.recs[i].size - A.recs[g[i].old].size);
+      g[i].count = l_castU2S(B.recs[i].count - A.recs[g[i].old].count);
+    }
+  }
+  for (i = 0; i < B.nrecs; i++) {  /* discount growth from parents */
+    int p = B.recs[i].parent;
+    if (g[i].old >= 0 && p >= 0 && g[p].old >= 0) {
+      const HRec *old = &A.recs[g[i].old];
+      g[p].size -= l_castU2S(B.recs[i].size - old->size);
+      g[p].count -= l_castU2S(B.recs[i].count - old->count);
+    }
+  }
+  for (i = n = 0; i < B.nrecs; i++) {  /* keep paths that grew */
+    if (g[i].old >= 0 && g[i].size > 0)
+      g[n++] = g[i];
+  }
+  qsort(g, (size_t)n, sizeof(HGrowth), bygrowth);
+  if (max < n)
+    n = (max < 0) ? 0 : (int)max;
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    lua_createtable(L, 0, 4);
+    lua_rawgeti(L, B.paths, g[i].rec + 1);
+    lua_setfield(L, -2, "path");
+    lua_pushinteger(L, g[i].size);
+    lua_setfield(L, -2, "growth");
+    lua_pushinteger(L, g[i].count);
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, l_castU2S(B.recs[g[i].rec].size));
+    lua_setfield(L, -2, "size");
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static const luaL_Reg prof_funcs[] = {
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {"dump", prof_dump},
+  {"heapdiff", prof_heapdiff},
+  {"snapshot", prof_snapshot},
+  {"trace", prof_trace},
+  {"report", prof_report},
+  {"quicken", prof_quicken},
+  {"oppairs", prof_oppairs},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_profiler (lua_State *L) {
+  luaL_newlib(L, prof_funcs);
+  return 1;
+}
+
@@ -26,6 +26,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "ltrace.h"
 
 
 
@@ -53,6 +54,33 @@
 #endif
 
 
+/*
+** 'luai_clock' returns a monotonic time in microseconds. The collector
+** uses it to bound the duration of time-limited steps.
+*/
+#if !defined(luai_clock)
+
+#include <time.h>
+
+#if defined(LUA_USE_POSIX) && defined(CLOCK_MONOTONIC)
+static l_mem luai_clock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(l_mem, ts.tv_sec) * 1000000 + cast(l_mem, ts.tv_nsec / 1000);
+}
+#else
+#define luai_clock()  \
+	cast(l_mem, cast(double, clock()) * 1e6 / CLOCKS_PER_SEC)
+#endif
+
+#endif
+
+
+l_mem luaE_clock (void) {
+  return luai_clock();
+}
+
+
 /*
 ** set GCdebt to a new value keeping the real number of allocated
 ** objects (GCtotalobjs - GCdebt) invariant and avoiding overflows in
@@ -76,6 +104,7 @@ CallInfo *luaE_extendCI (lua_State *L, int err) {
       luaM_error(L);  /* raise the error */
     return NULL;  /* else only report it */
   }
+  luaM_censusnew(G(L), LUA_MKCI, sizeof(CallInfo));
   ci->next = L->ci->next;
   ci->previous = L->ci;
   L->ci->next = ci;
@@ -96,6 +125,7 @@ static void freeCI (lua_State *L) {
   ci->next = NULL;
   while ((ci = next) != NULL) {
     next = ci->next;
+    luaM_censusfree(G(L), LUA_MKCI, sizeof(CallInfo));
     luaM_free(L, ci);
     L->nci--;
   }
@@ -115,6 +145,7 @@ void luaE_shrinkCI (lua_State *L) {
     CallInfo *next2 = next->next;  /* next's next */
     ci->next = next2;  /* remove next from the list */
     L->nci--;
+    luaM_censusfree(G(L), LUA_MKCI, sizeof(CallInfo));
     luaM_free(L, next);  /* free next */
     if (next2 == NULL)
       break;  /* no more elements */
@@ -164,6 +195,8 @@ static void stack_init (lua_State *L1, lua_State *L) {
   int i;
   /* initialize stack array */
   L1->stack.p = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
+  luaM_censusnew(G(L), LUA_MKSTACK,
+                 (BASIC_STACK_SIZE + EXTRA_STACK) * sizeof(StackValue));
   L1->tbclist.p = L1->stack.p;
   for (i = 0; i < BASIC_STACK_SIZE + EXTRA_STACK; i++)
     setnilvalue(s2v(L1->stack.p + i));  /* erase new stack */
@@ -181,6 +214,8 @@ static void freestack (lua_State *L) {
   freeCI(L);
   lua_assert(L->nci == 0);
   /* free stack */
+  luaM_censusfree(G(L), LUA_MKSTACK,
+                  cast_sizet(stacksize(L) + EXTRA_STACK) * sizeof(StackValue));
   luaM_freearray(L, L->stack.p, cast_sizet(stacksize(L) + EXTRA_STACK));
 }
 
@@ -214,6 +249,7 @@ static void f_luaopen (lua_State *L, void *ud) {
   UNUSED(ud);
   stack_init(L, L);  /* init stack */
   init_registry(L, g);
+  luaH_init(L);
   luaS_init(L);
   luaT_init(L);
   luaX_init(L);
@@ -237,6 +273,9 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->errorJmp = NULL;
   L->hook = NULL;
   L->hookmask = 0;
+  L->trace = NULL;
+  setnilvalue(&L->env);
+  setnilvalue(&L->pseudo);
   L->basehookcount = 0;
   L->allowhook = 1;
   resethookcount(L);
@@ -269,8 +308,12 @@ static void close_state (lua_State *L) {
     luai_userstateclose(L);
   }
   luaM_freearray(L, G(L)->strt.hash, cast_sizet(G(L)->strt.size));
+  luaR_freethread(L, L);
+  luaR_free(L);
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(global_State));
+  luaM_freebgfree(g);  /* waits for the blocks still to be freed */
+  luaM_freepool(g);
   (*g->frealloc)(g->ud, g, sizeof(global_State), 0);  /* free main block */
 }
 
@@ -307,8 +350,9 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
   luaF_closeupval(L1, L1->stack.p);  /* close all upvalues */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
+  luaR_freethread(L, L1);
   freestack(L1);
-  luaM_free(L, l);
+  luaM_freeobject(L, LUA_VTHREAD, l, sizeof(LX));
 }
 
 
@@ -339,6 +383,12 @@ LUA_API int lua_closethread (lua_State *L, lua_State *from) {
 
 
 LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
+  return lua_newstatex(f, ud, seed, 0);
+}
+
+
+LUA_API lua_State *lua_newstatex (lua_Alloc f, void *ud, unsigned seed,
+                                  int opts) {
   int i;
   lua_State *L;
   global_State *g = cast(global_State*,
@@ -354,6 +404,14 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   incnny(L);  /* main thread is always non yieldable */
   g->frealloc = f;
   g->ud = ud;
+  g->pool = NULL;
+  if ((opts & LUA_NSPOOL) && !luaM_newpool(g)) {
+    (*f)(ud, g, sizeof(global_State), 0);
+    return NULL;
+  }
+  g->bgfree = NULL;
+  if (opts & LUA_NSBGFREE)
+    luaM_newbgfree(g);  /* (without a thread, frees are synchronous) */
   g->warnf = NULL;
   g->ud_warn = NULL;
   g->seed = seed;
@@ -366,6 +424,8 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
+  g->gcfreeing = 0;
+  g->gcremark = g->gcephmarked = 0;
   g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
@@ -383,7 +443,24 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   setgcparam(g, MINORMUL, LUAI_GENMINORMUL);
   setgcparam(g, MINORMAJOR, LUAI_MINORMAJOR);
   setgcparam(g, MAJORMINOR, LUAI_MAJORMINOR);
+  g->gctpause = g->gctwmax = g->gctpeak = 0;
+  g->gctheap = g->gctsteps = g->gctover = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  memset(&g->census, 0, sizeof(g->census));
+  g->gcstatmark = -1;
+  g->gcf = NULL;
+  g->ud_gcf = NULL;
   for (i=0; i < LUA_NUMTYPES; i++) g->mt[i] = NULL;
+  g->rootshape = NULL;
+  g->tracer = NULL;
+  g->keys = NULL;
+  g->quickening = 0;
+  g->qrewrites = g->qhits = g->qdeopts = 0;
+  g->jiton = 0;
+  g->jitloops = 0;
+#if defined(LUAI_OPPAIRS)
+  memset(g->oppairs, 0, sizeof(g->oppairs));
+#endif
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
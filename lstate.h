@@ -18,6 +18,10 @@ typedef struct CallInfo CallInfo;
 #include "ltm.h"
 #include "lzio.h"
 
+#if defined(LUAI_OPPAIRS)
+#include "lopcodes.h"
+#endif
+
 
 /*
 ** Some notes about garbage-collected objects: All objects in Lua must
@@ -164,6 +168,13 @@ struct lua_longjmp;  /* defined in ldo.c */
 #define KGC_GENMAJOR	2	/* generational in major mode */
 
 
+/* pool for small blocks (defined in lmem.c) */
+typedef struct MemPool MemPool;
+
+/* queue of blocks for the background freeing thread (defined in lmem.c) */
+typedef struct BgFree BgFree;
+
+
 typedef struct stringtable {
   TString **hash;  /* array of buckets (linked lists of strings) */
   int nuse;  /* number of elements */
@@ -249,6 +260,8 @@ struct CallInfo {
 #define CIST_HOOKYIELD	(CIST_TAIL << 1)
 /* function "called" a finalizer */
 #define CIST_FIN	(CIST_HOOKYIELD << 1)
+/* an OP_CMD is getting its method */
+#define CIST_CMD	(CIST_FIN << 1)
 
 
 #define get_nresults(cs)  (cast_int((cs) & CIST_NRESULTS) - 1)
@@ -305,6 +318,9 @@ struct lua_State {
   int basehookcount;
   int hookcount;
   volatile l_signalT hookmask;
+  struct TraceStack *trace;  /* calls being traced (NULL if none) */
+  TValue env;  /* environment of the thread (nil for the global table) */
+  TValue pseudo;  /* value of a 5.1 pseudo-index (see 'index2compat') */
   struct {  /* info about transferred values (for call/return hooks) */
     int ftransfer;  /* offset of first value transferred */
     int ntransfer;  /* number of values transferred */
@@ -327,6 +343,8 @@ typedef struct LX {
 typedef struct global_State {
   lua_Alloc frealloc;  /* function to reallocate memory */
   void *ud;         /* auxiliary data to 'frealloc' */
+  MemPool *pool;  /* pool for small blocks (NULL if not used) */
+  BgFree *bgfree;  /* background freeing (NULL if not used) */
   l_mem GCtotalbytes;  /* number of bytes currently allocated + debt */
   l_mem GCdebt;  /* bytes counted but not yet allocated */
   l_mem GCmarked;  /* number of objects marked in a GC cycle */
@@ -336,12 +354,26 @@ typedef struct global_State {
   TValue nilvalue;  /* a nil value */
   unsigned int seed;  /* randomized seed for hashes */
   lu_byte gcparams[LUA_GCPN];
+  l_mem gctpause;  /* target for step durations in microseconds (0: none) */
+  l_mem gctwmax;  /* longest step in current window of the controller */
+  l_mem gctpeak;  /* peak number of bytes in current cycle */
+  int gctheap;  /* target for heap overhead, in percentage of live data */
+  int gctsteps;  /* number of steps in current window */
+  int gctover;  /* number of steps in current window over the target */
+  lua_GCStats gcstats;  /* statistics of the collector */
+  lua_Census census;  /* blocks in use by kind (see 'lmem.h') */
+  l_mem gcstatmark;  /* start of current accounting period (-1 if none) */
+  lua_GCFunction gcf;  /* function called on collector events */
+  void *ud_gcf;         /* auxiliary data to 'gcf' */
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
   lu_byte gcstopem;  /* stops emergency collections */
   lu_byte gcstp;  /* control whether GC is running */
   lu_byte gcemergency;  /* true if this is an emergency collection */
+  lu_byte gcfreeing;  /* true while freeing a dead object */
+  lu_byte gcremark;  /* number of remark rounds done in current cycle */
+  lu_byte gcephmarked;  /* true if a remark round marked ephemeron values */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -365,6 +397,19 @@ typedef struct global_State {
   TString *memerrmsg;  /* message for memory-allocation errors */
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTYPES];  /* metatables for basic types */
+  struct Shape *rootshape;  /* shape with no keys */
+  struct Tracer *tracer;  /* call tracer (NULL if never started) */
+  struct Table *keys;  /* anchors strings of 'lua_Key's (or NULL) */
+  lu_byte quickening;  /* true if the VM quickens instructions */
+  lu_mem qrewrites;  /* number of instructions quickened */
+  lu_mem qhits;  /* executions of quickened instructions */
+  lu_mem qdeopts;  /* quickened instructions that failed their types */
+  lu_byte jiton;  /* true if the VM compiles hot loops */
+  int jitloops;  /* number of loops compiled */
+#if defined(LUAI_OPPAIRS)
+  /* runs of pairs of consecutive instructions (see 'luaV_execute') */
+  lu_mem oppairs[FIRST_QUICKOP][FIRST_QUICKOP];
+#endif
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
   lua_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
@@ -398,6 +443,7 @@ union GCUnion {
   union Closure cl;
   struct Table h;
   struct Proto p;
+  struct Shape sh;
   struct lua_State th;  /* thread */
   struct UpVal upv;
 };
@@ -420,6 +466,7 @@ union GCUnion {
 	check_exp(novariant((o)->tt) == LUA_TFUNCTION, &((cast_u(o))->cl))
 #define gco2t(o)  check_exp((o)->tt == LUA_VTABLE, &((cast_u(o))->h))
 #define gco2p(o)  check_exp((o)->tt == LUA_VPROTO, &((cast_u(o))->p))
+#define gco2sh(o)  check_exp((o)->tt == LUA_VSHAPE, &((cast_u(o))->sh))
 #define gco2th(o)  check_exp((o)->tt == LUA_VTHREAD, &((cast_u(o))->th))
 #define gco2upv(o)	check_exp((o)->tt == LUA_VUPVAL, &((cast_u(o))->upv))
 
@@ -436,6 +483,7 @@ union GCUnion {
 
 
 LUAI_FUNC void luaE_setdebt (global_State *g, l_mem debt);
+LUAI_FUNC l_mem luaE_clock (void);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
 LUAI_FUNC lu_mem luaE_threadsize (lua_State *L);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L, int err);
@@ -21,6 +21,8 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** A hash part with only short-string keys can also use a shape (see
+** lobject.h), keeping only its values.
 */
 
 #include <math.h>
@@ -136,6 +138,165 @@ static const Node dummynode_ = {
 static const TValue absentkey = {ABSTKEYCONSTANT};
 
 
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+/* size of a shape with 'n' keys and an index with 2^lsize entries */
+#define sizeshape(n,lsize)  \
+	(offsetof(Shape, keys) + (n) * sizeof(TString *) + twoto(lsize))
+
+/* index of a shape, mapping hashes of keys to their positions plus 1 */
+#define shapeindex(s)	cast(lu_byte *, &(s)->keys[(s)->nkeys])
+
+
+/*
+** Position of short string 'key' in shape 's', or -1 if it is absent.
+*/
+static int shapeslot (const Shape *s, const TString *key) {
+  const lu_byte *index = shapeindex(s);
+  unsigned size = twoto(s->lsizeindex);
+  unsigned h = lmod(key->hash, size);
+  int i;
+  while ((i = index[h]) != 0) {
+    if (s->keys[i - 1] == key)
+      return i - 1;
+    h = lmod(h + 1, size);
+  }
+  return -1;
+}
+
+
+static void unlinkshape (Shape *s) {
+  *s->previous = s->sibling;
+  if (s->sibling != NULL)
+    s->sibling->previous = s->previous;
+}
+
+
+static void linkshape (Shape *s, Shape *parent) {
+  s->sibling = parent->child;
+  if (s->sibling != NULL)
+    s->sibling->previous = &s->sibling;
+  s->previous = &parent->child;
+  parent->child = s;
+}
+
+
+/*
+** Find the shape extending 's' with 'key', moving it to the front of
+** the list of 's' to speed up the next search.
+*/
+static Shape *getchild (Shape *s, TString *key) {
+  Shape *c;
+  for (c = s->child; c != NULL; c = c->sibling) {
+    if (c->keys[c->nkeys - 1] == key) {
+      if (c != s->child) {
+        unlinkshape(c);
+        linkshape(c, s);
+      }
+      return c;
+    }
+  }
+  return NULL;
+}
+
+
+/*
+** Create a shape extending 'parent' with 'key'; with no 'parent',
+** create the shape with no keys.
+*/
+static Shape *newshape (lua_State *L, Shape *parent, TString *key) {
+  unsigned n = (parent == NULL) ? 0 : parent->nkeys + 1u;
+  int lsize = (n == 0) ? 0 : luaO_ceillog2(2 * n);
+  GCObject *o = luaC_newobj(L, LUA_VSHAPE, sizeshape(n, lsize));
+  Shape *s = gco2sh(o);
+  lu_byte *index;
+  unsigned i;
+  s->nkeys = cast_byte(n);
+  s->lsizeindex = cast_byte(lsize);
+  s->nchildren = 0;
+  s->parent = parent;
+  s->child = NULL;
+  s->sibling = NULL;
+  s->previous = NULL;
+  index = shapeindex(s);
+  memset(index, 0, twoto(lsize));
+  for (i = 0; i < n; i++) {
+    TString *k = (i < n - 1) ? parent->keys[i] : key;
+    unsigned h = lmod(k->hash, twoto(lsize));
+    while (index[h] != 0)  /* find a free entry */
+      h = lmod(h + 1, twoto(lsize));
+    s->keys[i] = k;
+    index[h] = cast_byte(i + 1);
+  }
+  if (parent != NULL) {
+    linkshape(s, parent);
+    parent->nchildren++;
+  }
+  return s;
+}
+
+
+void luaH_init (lua_State *L) {
+  Shape *s = newshape(L, NULL, NULL);
+  luaC_fix(L, obj2gco(s));  /* never collect the root */
+  G(L)->rootshape = s;
+}
+
+
+size_t luaH_shapesize (Shape *s) {
+  return sizeshape(s->nkeys, s->lsizeindex);
+}
+
+
+void luaH_freeshape (lua_State *L, Shape *s) {
+  Shape *c;
+  if (s->previous != NULL) {  /* still in the list of its parent? */
+    unlinkshape(s);
+    s->parent->nchildren--;
+  }
+  for (c = s->child; c != NULL; c = c->sibling)
+    c->previous = NULL;  /* that list is gone */
+  luaM_freeobject(L, LUA_VSHAPE, s, luaH_shapesize(s));
+}
+
+
+/*
+** Remove the dead children of live shape 's' from its list, so that
+** they cannot be found anymore. (All descendants of a dead shape are
+** dead too, as each shape keeps its parent alive.)
+*/
+static void clearchildren (global_State *g, Shape *s) {
+  Shape *c = s->child;
+  while (c != NULL) {
+    Shape *next = c->sibling;
+    if (iswhite(c)) {  /* dead? */
+      unlinkshape(c);
+      c->previous = NULL;
+      s->nchildren--;
+    }
+    else
+      clearchildren(g, c);
+    c = next;
+  }
+}
+
+
+/*
+** Called in the atomic phase of a collection: after it, all shapes
+** reachable from the root are alive.
+*/
+void luaH_clearshapes (lua_State *L) {
+  global_State *g = G(L);
+  clearchildren(g, g->rootshape);
+}
+
+/* }============================================================= */
+
+
 /*
 ** Hash for integers. To allow a good hash, use the remainder operator
 ** ('%'). If integer fits as a non-negative int, compute an int
@@ -289,7 +450,24 @@ static int equalkey (const TValue *k1, const Node *n2, int deadok) {
 ** See explanation about 'deadok' in function 'equalkey'.
 */
 static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
-  Node *n = mainpositionTV(t, key);
+  Node *n;
+  if (isshaped(t)) {  /* keys are short strings */
+    Shape *s = getshape(t);
+    if (ttisshrstring(key)) {
+      int i = shapeslot(s, tsvalue(key));
+      if (i >= 0)
+        return shapevals(t) + i;
+    }
+    else if (ttisstring(key)) {  /* an external string? */
+      unsigned i;
+      for (i = 0; i < s->nkeys; i++) {
+        if (luaS_eqstr(tsvalue(key), s->keys[i]))
+          return shapevals(t) + i;
+      }
+    }
+    return &absentkey;
+  }
+  n = mainpositionTV(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (equalkey(key, n, deadok))
       return gval(n);  /* that's it */
@@ -351,49 +529,78 @@ static unsigned findindex (lua_State *L, Table *t, TValue *key,
     const TValue *n = getgeneric(t, key, 1);
     if (l_unlikely(isabstkey(n)))
       luaG_runerror(L, "invalid key to 'next'");  /* key not found */
-    i = cast_uint(nodefromval(n) - gnode(t, 0));  /* key index in hash table */
+    i = slotindex(t, n);  /* key index in hash table */
     /* hash elements are numbered after array ones */
     return (i + 1) + asize;
   }
 }
 
 
-int luaH_next (lua_State *L, Table *t, StkId key) {
+/*
+** Look for the first non-empty entry of table 't' at traversal index
+** 'i' or after it, and fill 'key' and 'val' with that entry. Return
+** the traversal index after that entry, or zero if there are no more
+** entries. (Unlike 'luaH_next', this function does not use the stack.)
+*/
+unsigned luaH_nextentry (lua_State *L, Table *t, unsigned i,
+                                       TValue *key, TValue *val) {
   unsigned int asize = t->asize;
-  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
   for (; i < asize; i++) {  /* try first array part */
     lu_byte tag = *getArrTag(t, i);
     if (!tagisempty(tag)) {  /* a non-empty entry? */
-      setivalue(s2v(key), cast_int(i) + 1);
-      farr2val(t, i, tag, s2v(key + 1));
-      return 1;
+      setivalue(key, cast_int(i) + 1);
+      farr2val(t, i, tag, val);
+      return i + 1;
     }
   }
-  for (i -= asize; i < sizenode(t); i++) {  /* hash part */
+  i -= asize;
+  if (isshaped(t)) {  /* hash part with a shape? */
+    Shape *s = getshape(t);
+    for (; i < s->nkeys; i++) {
+      if (!isempty(shapevals(t) + i)) {  /* a non-empty entry? */
+        setsvalue(L, key, s->keys[i]);
+        setobj(L, val, shapevals(t) + i);
+        return (i + 1) + asize;
+      }
+    }
+    return 0;  /* no more elements */
+  }
+  for (; i < sizenode(t); i++) {  /* hash part */
     if (!isempty(gval(gnode(t, i)))) {  /* a non-empty entry? */
       Node *n = gnode(t, i);
-      getnodekey(L, s2v(key), n);
-      setobj2s(L, key + 1, gval(n));
-      return 1;
+      getnodekey(L, key, n);
+      setobj(L, val, gval(n));
+      return (i + 1) + asize;
     }
   }
   return 0;  /* no more elements */
 }
 
 
+int luaH_next (lua_State *L, Table *t, StkId key) {
+  unsigned int i = findindex(L, t, s2v(key), t->asize);  /* find original key */
+  return luaH_nextentry(L, t, i, s2v(key), s2v(key + 1)) != 0;
+}
+
+
 /* Extra space in Node array if it has a lastfree entry */
 #define extraLastfree(t)	(haslastfree(t) ? sizeof(Limbox) : 0)
 
+/* Extra space before the hash part of a table */
+#define extrahash(t)	(isshaped(t) ? sizeof(ShapeBox) : extraLastfree(t))
+
 /* 'node' size in bytes */
 static size_t sizehash (Table *t) {
-  return cast_sizet(sizenode(t)) * sizeof(Node) + extraLastfree(t);
+  size_t slot = isshaped(t) ? sizeof(TValue) : sizeof(Node);
+  return cast_sizet(sizenode(t)) * slot + extrahash(t);
 }
 
 
 static void freehash (lua_State *L, Table *t) {
   if (!isdummy(t)) {
-    /* get pointer to the beginning of Node array */
-    char *arr = cast_charp(t->node) - extraLastfree(t);
+    /* get pointer to the beginning of the block */
+    char *arr = cast_charp(t->node) - extrahash(t);
+    luaM_censusfree(G(L), LUA_MKNODE, sizehash(t));
     luaM_freearray(L, arr, sizehash(t));
   }
 }
@@ -521,6 +728,16 @@ static void numusearray (const Table *t, Counters *ct) {
 static void numusehash (const Table *t, Counters *ct) {
   unsigned i = sizenode(t);
   unsigned total = 0;
+  if (isshaped(t)) {  /* no integer keys to count */
+    for (i = 0; i < getshape(t)->nkeys; i++) {
+      if (isempty(shapevals(t) + i))
+        ct->deleted = 1;
+      else
+        total++;
+    }
+    ct->total += total;
+    return;
+  }
   while (i--) {
     Node *n = &t->node[i];
     if (isempty(gval(n))) {
@@ -567,6 +784,7 @@ static Value *resizearray (lua_State *L , Table *t,
     return t->array;  /* nothing to be done */
   else if (newasize == 0) {  /* erasing array? */
     Value *op = t->array - oldasize;  /* original array's real address */
+    luaM_censusfree(G(L), LUA_MKARRAY, concretesize(oldasize));
     luaM_freemem(L, op, concretesize(oldasize));  /* free it */
     return NULL;
   }
@@ -576,6 +794,7 @@ static Value *resizearray (lua_State *L , Table *t,
                   luaM_reallocvector(L, NULL, 0, newasizeb, lu_byte));
     if (np == NULL)  /* allocation error? */
       return NULL;
+    luaM_censusnew(G(L), LUA_MKARRAY, newasizeb);
     np += newasize;  /* shift pointer to the end of value segment */
     if (oldasize > 0) {
       /* move common elements to new position */
@@ -585,6 +804,7 @@ static Value *resizearray (lua_State *L , Table *t,
       size_t tomoveb = (oldasize < newasize) ? oldasizeb : newasizeb;
       lua_assert(tomoveb > 0);
       memcpy(np - tomove, op - tomove, tomoveb);
+      luaM_censusfree(G(L), LUA_MKARRAY, oldasizeb);
       luaM_freemem(L, op - oldasize, oldasizeb);  /* free old block */
     }
     return np;
@@ -621,6 +841,7 @@ static void setnodevector (lua_State *L, Table *t, unsigned size) {
     }
     t->lsizenode = cast_byte(lsize);
     setnodummy(t);
+    luaM_censusnew(G(L), LUA_MKNODE, sizehash(t));
     for (i = 0; i < cast_int(size); i++) {
       Node *n = gnode(t, i);
       gnext(n) = 0;
@@ -652,19 +873,84 @@ static void reinserthash (lua_State *L, Table *ot, Table *t) {
 
 /*
 ** Exchange the hash part of 't1' and 't2'. (In 'flags', only the dummy
-** bit must be exchanged:  The metamethod bits do not change during a
-** resize, so the "real" table can keep their values.)
+** and shape bits must be exchanged:  The metamethod bits do not change
+** during a resize, so the "real" table can keep their values.)
 */
+#define HASHBITS	(BITDUMMY | BITSHAPE)
+
 static void exchangehashpart (Table *t1, Table *t2) {
   lu_byte lsizenode = t1->lsizenode;
   Node *node = t1->node;
-  int bitdummy1 = t1->flags & BITDUMMY;
+  int bits1 = t1->flags & HASHBITS;
   t1->lsizenode = t2->lsizenode;
   t1->node = t2->node;
-  t1->flags = cast_byte((t1->flags & NOTBITDUMMY) | (t2->flags & BITDUMMY));
+  t1->flags = cast_byte((t1->flags & ~HASHBITS) | (t2->flags & HASHBITS));
   t2->lsizenode = lsizenode;
   t2->node = node;
-  t2->flags = cast_byte((t2->flags & NOTBITDUMMY) | bitdummy1);
+  t2->flags = cast_byte((t2->flags & ~HASHBITS) | bits1);
+}
+
+
+/*
+** Creates an array for the hash part of a table with the given size
+** and the shape with no keys.
+*/
+static void setshapevector (lua_State *L, Table *t, unsigned size) {
+  int lsize = luaO_ceillog2(size);
+  size_t bsize = sizeof(ShapeBox) + twoto(lsize) * sizeof(TValue);
+  char *block = luaM_newblock(L, bsize);
+  lua_assert(0 < size && size <= LUAI_MAXSHAPE);
+  t->node = cast(Node *, block + sizeof(ShapeBox));
+  t->lsizenode = cast_byte(lsize);
+  t->flags = cast_byte((t->flags & ~HASHBITS) | BITSHAPE);
+  shapebox(t)->shape = G(L)->rootshape;
+  luaM_censusnew(G(L), LUA_MKNODE, bsize);
+}
+
+
+/*
+** Double the size of the array of values of a table with a shape.
+*/
+static void growshapevector (lua_State *L, Table *t) {
+  Shape *s = getshape(t);
+  int lsize = t->lsizenode + 1;
+  size_t bsize = sizeof(ShapeBox) + twoto(lsize) * sizeof(TValue);
+  char *block = luaM_newblock(L, bsize);
+  TValue *vals = cast(TValue *, block + sizeof(ShapeBox));
+  memcpy(vals, shapevals(t), s->nkeys * sizeof(TValue));
+  freehash(L, t);
+  t->node = cast(Node *, vals);
+  t->lsizenode = cast_byte(lsize);
+  shapebox(t)->shape = s;
+  luaM_censusnew(G(L), LUA_MKNODE, bsize);
+}
+
+
+/*
+** Move the entries of a table with a shape to a usual hash part, with
+** space for 'extra' more keys.
+*/
+static void unshape (lua_State *L, Table *t, unsigned extra) {
+  Table newt;
+  Shape *s = getshape(t);
+  TValue *vals = shapevals(t);
+  unsigned i;
+  unsigned size = 0;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!isempty(vals + i))
+      size++;
+  }
+  newt.flags = 0;
+  setnodevector(L, &newt, size + extra);
+  for (i = 0; i < s->nkeys; i++) {
+    if (!isempty(vals + i)) {
+      TValue k;
+      setsvalue(L, &k, s->keys[i]);
+      insertkey(&newt, &k, vals + i);
+    }
+  }
+  exchangehashpart(t, &newt);  /* 'newt' now has the shape */
+  freehash(L, &newt);
 }
 
 
@@ -696,6 +982,23 @@ static void clearNewSlice (Table *t, unsigned oldasize, unsigned newasize) {
 }
 
 
+/*
+** Set a new array part for a table 't' with a shape, which keeps its
+** hash part.
+*/
+static void resizeshapedarray (lua_State *L, Table *t, unsigned oldasize,
+                                                       unsigned newasize) {
+  Value *newarray = resizearray(L, t, oldasize, newasize);
+  if (l_unlikely(newarray == NULL && newasize > 0))  /* allocation failed? */
+    luaM_error(L);  /* raise error (with array unchanged) */
+  t->array = newarray;
+  t->asize = newasize;
+  if (newarray != NULL)
+    *lenhint(t) = newasize / 2u;
+  clearNewSlice(t, oldasize, newasize);
+}
+
+
 /*
 ** Resize table 't' for the new given sizes. Both allocations (for
 ** the hash part and for the array part) can fail, which creates some
@@ -711,17 +1014,32 @@ static void clearNewSlice (Table *t, unsigned oldasize, unsigned newasize) {
 ** Note that if the new size for the array part ('newasize') is equal to
 ** the old one ('oldasize'), this function will do nothing with that
 ** part.
+** A table with a shape keeps it while its array part does not shrink
+** and its hash part stays within the limit for shapes. Otherwise, the
+** new hash part uses a shape only when 'shape' is true, the table has
+** no hash part yet, and 'nhsize' is within that limit.
 */
-void luaH_resize (lua_State *L, Table *t, unsigned newasize,
-                                          unsigned nhsize) {
+static void resize (lua_State *L, Table *t, unsigned newasize,
+                                            unsigned nhsize, int shape) {
   Table newt;  /* to keep the new hash part */
   unsigned oldasize = t->asize;
   Value *newarray;
   if (newasize > MAXASIZE)
     luaG_runerror(L, "table overflow");
+  if (isshaped(t)) {
+    if (newasize >= oldasize && nhsize <= LUAI_MAXSHAPE) {
+      resizeshapedarray(L, t, oldasize, newasize);
+      return;
+    }
+    unshape(L, t, 0);
+  }
   /* create new hash part with appropriate size into 'newt' */
   newt.flags = 0;
-  setnodevector(L, &newt, nhsize);
+  if (shape && isdummy(t) && newasize >= oldasize &&
+      0 < nhsize && nhsize <= LUAI_MAXSHAPE)
+    setshapevector(L, &newt, nhsize);
+  else
+    setnodevector(L, &newt, nhsize);
   if (newasize < oldasize) {  /* will array shrink? */
     /* re-insert into the new hash the elements from vanishing slice */
     exchangehashpart(t, &newt);  /* pretend table has new hash */
@@ -747,6 +1065,12 @@ void luaH_resize (lua_State *L, Table *t, unsigned newasize,
 }
 
 
+void luaH_resize (lua_State *L, Table *t, unsigned newasize,
+                                          unsigned nhsize) {
+  resize(L, t, newasize, nhsize, 1);
+}
+
+
 void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
   unsigned nsize = allocsizenode(t);
   luaH_resize(L, t, nasize, nsize);
@@ -787,7 +1111,7 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
     nsize += nsize >> 2;
   }
   /* resize the table to new computed sizes */
-  luaH_resize(L, t, asize, nsize);
+  resize(L, t, asize, nsize, 0);
 }
 
 /*
@@ -807,6 +1131,39 @@ Table *luaH_new (lua_State *L) {
 }
 
 
+/*
+** Fill the new (empty) table 't' with a copy of table 'src', which has
+** no metatable, with parts of the same sizes. Both parts are copied
+** as blocks. (The table is filled in place so that the caller can
+** anchor it before these allocations.) The metamethod bits in 'flags'
+** are cleared, as 'src' may have keys like "__index".
+*/
+void luaH_clone (lua_State *L, Table *t, Table *src) {
+  unsigned asize = src->asize;
+  lua_assert(t->asize == 0 && isdummy(t) && src->metatable == NULL);
+  if (!isdummy(src)) {
+    size_t extra = extrahash(src);
+    size_t bsize = sizehash(src);
+    char *block = luaM_newblock(L, bsize);
+    memcpy(block, cast_charp(src->node) - extra, bsize);
+    t->node = cast(Node *, block + extra);
+    t->lsizenode = src->lsizenode;
+    t->flags = cast_byte(src->flags & ~maskflags);  /* dummy/shape bits */
+    if (!isshaped(t) && haslastfree(t))  /* 'lastfree' is a pointer */
+      getlastfree(t) = t->node + (getlastfree(src) - src->node);
+    luaM_censusnew(G(L), LUA_MKNODE, bsize);
+  }
+  if (asize > 0) {
+    size_t bsize = concretesize(asize);
+    char *block = luaM_newblock(L, bsize);
+    memcpy(block, src->array - asize, bsize);
+    t->array = cast(Value *, block) + asize;
+    t->asize = asize;
+    luaM_censusnew(G(L), LUA_MKARRAY, bsize);
+  }
+}
+
+
 lu_mem luaH_size (Table *t) {
   lu_mem sz = cast(lu_mem, sizeof(Table)) + concretesize(t->asize);
   if (!isdummy(t))
@@ -821,7 +1178,7 @@ lu_mem luaH_size (Table *t) {
 void luaH_free (lua_State *L, Table *t) {
   freehash(L, t);
   resizearray(L, t, t->asize, 0);
-  luaM_free(L, t);
+  luaM_freeobject(L, LUA_VTABLE, t, sizeof(Table));
 }
 
 
@@ -856,7 +1213,9 @@ static Node *getfreepos (Table *t) {
 ** could not insert key (could not find a free space).
 */
 static int insertkey (Table *t, const TValue *key, TValue *value) {
-  Node *mp = mainpositionTV(t, key);
+  Node *mp;
+  lua_assert(!isshaped(t));
+  mp = mainpositionTV(t, key);
   /* table cannot already contain the key */
   lua_assert(isabstkey(getgeneric(t, key, 0)));
   if (!isempty(gval(mp)) || isdummy(t)) {  /* main position is taken? */
@@ -910,10 +1269,64 @@ static void newcheckedkey (Table *t, const TValue *key, TValue *value) {
 }
 
 
+/*
+** Add short string 'key' to the shape of table 't', with value 'value'.
+** Returns 0 if the shape cannot grow (then the table should change to
+** the usual layout).
+*/
+static int addshapekey (lua_State *L, Table *t, TString *key,
+                                      TValue *value) {
+  Shape *s = getshape(t);
+  Shape *ns;
+  int n = s->nkeys;
+  if (n >= LUAI_MAXSHAPE)
+    return 0;  /* too many keys for a shape */
+  if (getchild(s, key) == NULL && s->nchildren >= LUAI_MAXSHAPECHILD)
+    return 0;  /* too many different shapes after 's' */
+  if (cast_uint(n) >= sizenode(t))  /* no space for another value? */
+    growshapevector(L, t);
+  /* search again, as a collection may have removed an unused child */
+  ns = getchild(s, key);
+  if (ns == NULL)  /* no shape yet for this sequence of keys? */
+    ns = newshape(L, s, key);  /* (last allocation in this function) */
+  shapebox(t)->shape = ns;
+  luaC_objbarrier(L, t, ns);
+  setobj2t(L, shapevals(t) + n, value);
+  return 1;
+}
+
+
+/*
+** Try to insert a new key into table 't' using a shape for its hash
+** part. A table with no hash part gets a shape for its first short-string
+** key. Returns 0 if the key must go to a usual hash part (which the
+** table then has).
+*/
+static int shapenewkey (lua_State *L, Table *t, const TValue *key,
+                                      TValue *value) {
+  if (!isshaped(t)) {
+    if (LUAI_MAXSHAPE == 0 || !isdummy(t) || !ttisshrstring(key))
+      return 0;  /* keep the usual layout */
+    setshapevector(L, t, 1);  /* start with the empty shape */
+  }
+  if (ttisshrstring(key) && addshapekey(L, t, tsvalue(key), value))
+    return 1;
+  else if (ttisinteger(key)) {  /* key may go to the array part */
+    rehash(L, t, key);
+    if (!isshaped(t) || keyinarray(t, key)) {
+      newcheckedkey(t, key, value);
+      return 1;
+    }
+  }
+  unshape(L, t, 1);
+  return 0;
+}
+
+
 static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
                                                  TValue *value) {
   if (!ttisnil(value)) {  /* do not insert nil values */
-    int done = insertkey(t, key, value);
+    int done = shapenewkey(L, t, key, value) || insertkey(t, key, value);
     if (!done) {  /* could not find a free place? */
       rehash(L, t, key);  /* grow table */
       newcheckedkey(t, key, value);  /* insert key in grown table */
@@ -926,8 +1339,11 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
 
 
 static const TValue *getintfromhash (Table *t, lua_Integer key) {
-  Node *n = hashint(t, key);
+  Node *n;
   lua_assert(!ikeyinarray(t, key));
+  if (isshaped(t))
+    return &absentkey;  /* no integer keys in a shape */
+  n = hashint(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (keyisinteger(n) && keyival(n) == key)
       return gval(n);  /* that's it */
@@ -972,8 +1388,13 @@ lu_byte luaH_getint (Table *t, lua_Integer key, TValue *res) {
 ** search function for short strings
 */
 const TValue *luaH_Hgetshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  Node *n;
   lua_assert(strisshr(key));
+  if (isshaped(t)) {
+    int i = shapeslot(getshape(t), key);
+    return (i >= 0) ? shapevals(t) + i : &absentkey;
+  }
+  n = hashstr(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
       return gval(n);  /* that's it */
@@ -1049,7 +1470,7 @@ static int retpsetcode (Table *t, const TValue *slot) {
   if (isabstkey(slot))
     return HNOTFOUND;  /* no slot with that key */
   else  /* return node encoded */
-    return cast_int((cast(Node*, slot) - t->node)) + HFIRSTNODE;
+    return cast_int(slotindex(t, slot)) + HFIRSTNODE;
 }
 
 
@@ -1103,8 +1524,20 @@ int luaH_psetshortstr (Table *t, TString *key, TValue *val) {
   else if (checknoTM(t->metatable, TM_NEWINDEX)) {  /* no metamethod? */
     if (ttisnil(val))  /* new value is nil? */
       return HOK;  /* done (value is already nil/absent) */
-    if (isabstkey(slot) &&  /* key is absent? */
-       !(isblack(t) && iswhite(key))) {  /* and don't need barrier? */
+    if (!isabstkey(slot))  /* key has an empty slot? */
+      return retpsetcode(t, slot);
+    if (isshaped(t)) {  /* key must extend the shape */
+      Shape *s = getshape(t);
+      Shape *c = getchild(s, key);
+      if (c != NULL && s->nkeys < sizenode(t) &&  /* cheap transition? */
+          !(isblack(t) && iswhite(c))) {  /* and don't need barrier? */
+        shapebox(t)->shape = c;
+        setobj2t(cast(lua_State *, NULL), shapevals(t) + s->nkeys, val);
+        invalidateTMcache(t);
+        return HOK;
+      }
+    }
+    else if (!(isblack(t) && iswhite(key))) {  /* don't need barrier? */
       TValue tk;  /* key as a TValue */
       setsvalue(cast(lua_State *, NULL), &tk, key);
       if (insertkey(t, &tk, val)) {  /* insert key, if there is space */
@@ -1179,7 +1612,7 @@ void luaH_finishset (lua_State *L, Table *t, const TValue *key,
     luaH_newkey(L, t, actk, value);
   }
   else if (hres > 0) {  /* regular Node? */
-    setobj2t(L, gval(gnode(t, hres - HFIRSTNODE)), value);
+    setobj2t(L, gslot(t, hres - HFIRSTNODE), value);
   }
   else {  /* array entry */
     hres = ~hres;  /* real index */
@@ -1218,6 +1651,57 @@ void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
 }
 
 
+/*
+** Set 't[i + k] = v[k]' for 'k' in [0, n). If the range starts inside
+** the array part or just after it, the array part first grows to hold
+** the entire range, so that the values go directly into it. (Numbers
+** need no barriers.)
+*/
+void luaH_setnumbers (lua_State *L, Table *t, lua_Integer i,
+                      const lua_Number *v, unsigned n) {
+  lua_Unsigned first = l_castS2U(i) - 1u;  /* C index of 't[i]' */
+  unsigned k;
+  if (first <= t->asize && n <= MAXASIZE - first) {
+    unsigned f = cast_uint(first);
+    if (f + n > t->asize)
+      luaH_resizearray(L, t, f + n);
+    for (k = 0; k < n; k++) {
+      *getArrTag(t, f + k) = LUA_VNUMFLT;
+      getArrVal(t, f + k)->n = v[k];
+    }
+  }
+  else {
+    for (k = 0; k < n; k++) {
+      TValue val;
+      setfltvalue(&val, v[k]);
+      luaH_setint(L, t, l_castU2S(l_castS2U(i) + k), &val);
+    }
+  }
+}
+
+
+/*
+** Copy 't[i + k]' into 'v[k]' for 'k' in [0, n), stopping at the first
+** value that is not a number. Returns how many values were copied.
+*/
+unsigned luaH_getnumbers (Table *t, lua_Integer i, lua_Number *v,
+                                                   unsigned n) {
+  unsigned k;
+  for (k = 0; k < n; k++) {
+    TValue aux;
+    lu_byte tag;
+    luaH_fastgeti(t, l_castU2S(l_castS2U(i) + k), &aux, tag);
+    if (tag == LUA_VNUMFLT)
+      v[k] = fltvalue(&aux);
+    else if (tag == LUA_VNUMINT)
+      v[k] = cast_num(ivalue(&aux));
+    else
+      break;
+  }
+  return k;
+}
+
+
 /*
 ** Try to find a boundary in the hash part of table 't'. From the
 ** caller, we know that 'asize + 1' is present. We want to find a larger
@@ -45,6 +45,66 @@
 #define nodefromval(v)	cast(Node *, (v))
 
 
+/*
+** LUAI_MAXSHAPE is the maximum number of keys in the hash part of a
+** table with a shape. Tables that outgrow that limit, or that get
+** keys other than short strings in their hash parts, go back to the
+** usual hash layout. (It must be smaller than 255; 0 disables shapes.)
+*/
+#if !defined(LUAI_MAXSHAPE)
+#define LUAI_MAXSHAPE		32
+#endif
+
+
+/*
+** LUAI_MAXSHAPECHILD is the maximum number of different shapes
+** extending a shape. (It limits the time to find a transition.)
+*/
+#if !defined(LUAI_MAXSHAPECHILD)
+#define LUAI_MAXSHAPECHILD	64
+#endif
+
+
+/*
+** Bit BITSHAPE set in 'flags' means the table has a shape. Then, 'node'
+** points to an array of '2^lsizenode' values, the first 'nkeys' of
+** them holding the values for the keys of the shape; the shape itself
+** is stored just before that array, in the same block.
+*/
+
+#define BITSHAPE		(1 << 7)
+#define isshaped(t)		((t)->flags & BITSHAPE)
+
+/* the union 'ShapeBox' keeps the values after it properly aligned */
+typedef union {
+  Shape *shape;
+  TValue padding;
+} ShapeBox;
+
+#define shapebox(t)	(cast(ShapeBox *, (t)->node) - 1)
+#define getshape(t)	(check_exp(isshaped(t), shapebox(t)->shape))
+#define shapevals(t)	cast(TValue *, (t)->node)
+
+
+/*
+** Access to the hash part of a table by the position of its entries,
+** for both layouts: 'gslot' gives the value in position 'i', 'slotkeyis'
+** checks whether position 'i' has the short string 'key' as its key,
+** and 'slotindex' gives the position of value 'v'.
+*/
+#define gslot(t,i)	(isshaped(t) ? shapevals(t) + (i) : gval(gnode(t, i)))
+
+#define slotkeyis(t,i,key)  \
+	(isshaped(t) \
+	   ? ((i) < getshape(t)->nkeys && getshape(t)->keys[i] == (key)) \
+	   : ((i) < sizenode(t) && keyisshrstr(gnode(t, i)) && \
+	      keystrval(gnode(t, i)) == (key)))
+
+#define slotindex(t,v)  \
+	(isshaped(t) ? cast_uint(cast(const TValue *, (v)) - shapevals(t)) \
+	             : cast_uint(nodefromval(v) - gnode(t, 0)))
+
+
 
 #define luaH_fastgeti(t,k,res,tag) \
   { Table *h = t; lua_Unsigned u = l_castS2U(k) - 1u; \
@@ -163,17 +223,28 @@ LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
 LUAI_FUNC void luaH_set (lua_State *L, Table *t, const TValue *key,
                                                  TValue *value);
+LUAI_FUNC void luaH_setnumbers (lua_State *L, Table *t, lua_Integer i,
+                                const lua_Number *v, unsigned n);
+LUAI_FUNC unsigned luaH_getnumbers (Table *t, lua_Integer i,
+                                    lua_Number *v, unsigned n);
 
 LUAI_FUNC void luaH_finishset (lua_State *L, Table *t, const TValue *key,
                                               TValue *value, int hres);
+LUAI_FUNC void luaH_init (lua_State *L);
 LUAI_FUNC Table *luaH_new (lua_State *L);
+LUAI_FUNC void luaH_clone (lua_State *L, Table *t, Table *src);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned nasize,
                                                     unsigned nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned nasize);
 LUAI_FUNC lu_mem luaH_size (Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC unsigned luaH_nextentry (lua_State *L, Table *t, unsigned i,
+                                                 TValue *key, TValue *val);
 LUAI_FUNC lua_Unsigned luaH_getn (lua_State *L, Table *t);
+LUAI_FUNC size_t luaH_shapesize (Shape *s);
+LUAI_FUNC void luaH_freeshape (lua_State *L, Shape *s);
+LUAI_FUNC void luaH_clearshapes (lua_State *L);
 
 
 #if defined(LUA_DEBUG)
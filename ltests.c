@@ -25,6 +25,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lopcodes.h"
 #include "lopnames.h"
@@ -408,6 +409,14 @@ static void checktable (global_State *g, Table *h) {
     arr2obj(h, i, &aux);
     checkvalref(g, hgc, &aux);
   }
+  if (isshaped(h)) {
+    Shape *s = getshape(h);
+    checkobjref(g, hgc, obj2gco(s));
+    assert(s->nkeys <= sizenode(h));
+    for (i = 0; i < s->nkeys; i++)
+      checkvalref(g, hgc, shapevals(h) + i);
+    return;
+  }
   for (n = gnode(h, 0); n < limit; n++) {
     if (!isempty(gval(n))) {
       TValue k;
@@ -443,6 +452,7 @@ static void checkproto (global_State *g, Proto *f) {
     checkobjrefN(g, fgc, f->p[i]);
   for (i=0; i<f->sizelocvars; i++)
     checkobjrefN(g, fgc, f->locvars[i].varname);
+  checkobjrefN(g, fgc, f->cache);
 }
 
 
@@ -502,6 +512,14 @@ static void check_stack (global_State *g, lua_State *L1) {
 }
 
 
+static void checkshape (global_State *g, Shape *s) {
+  GCObject *sgc = obj2gco(s);
+  checkobjrefN(g, sgc, s->parent);
+  if (s->nkeys > 0)
+    checkobjref(g, sgc, obj2gco(s->keys[s->nkeys - 1]));
+}
+
+
 static void checkrefs (global_State *g, GCObject *o) {
   switch (o->tt) {
     case LUA_VUSERDATA: {
@@ -532,6 +550,10 @@ static void checkrefs (global_State *g, GCObject *o) {
       checkproto(g, gco2p(o));
       break;
     }
+    case LUA_VSHAPE: {
+      checkshape(g, gco2sh(o));
+      break;
+    }
     case LUA_VSHRSTR:
     case LUA_VLNGSTR: {
       assert(!isgray(o));  /* strings are never gray */
@@ -592,6 +614,7 @@ static l_mem checkgraylist (global_State *g, GCObject *o) {
       case LUA_VCCL: o = gco2ccl(o)->gclist; break;
       case LUA_VTHREAD: o = gco2th(o)->gclist; break;
       case LUA_VPROTO: o = gco2p(o)->gclist; break;
+      case LUA_VSHAPE: o = gco2sh(o)->gclist; break;
       case LUA_VUSERDATA:
         assert(gco2u(o)->nuvalue > 0);
         o = gco2u(o)->gclist;
@@ -668,6 +691,71 @@ static l_mem checklist (global_State *g, int maybedead, int tof,
 }
 
 
+/*
+** Size of a prototype in the census of the heap: only its header until
+** it is complete (see 'luaF_newicache'), and never its compiled loops
+*/
+static lu_mem censusproto (Proto *p) {
+  lu_mem sz = sizeof(Proto);
+  if (p->flag & PF_CENSUS) {
+    JitLoop *jl;
+    sz = luaF_protosize(p);
+    for (jl = p->jit; jl != NULL; jl = jl->next)
+      sz -= sizeof(JitLoop);
+  }
+  return sz;
+}
+
+
+/*
+** Check the census of the heap against the objects in all lists
+*/
+static void checkcensus (global_State *g) {
+  GCObject *lists[4];
+  size_t n[LUA_MKN];
+  lu_mem tbytes = 0;
+  lu_mem pbytes = 0;
+  int i, k;
+  lists[0] = g->allgc; lists[1] = g->finobj;
+  lists[2] = g->tobefnz; lists[3] = g->fixedgc;
+  for (k = 0; k < LUA_MKN; k++) n[k] = 0;
+  for (i = 0; i < 4; i++) {
+    GCObject *o;
+    for (o = lists[i]; o != NULL; o = o->next) {
+      switch (o->tt) {
+        case LUA_VTABLE:
+          k = LUA_MKTABLE;
+          tbytes += luaH_size(gco2t(o));
+          break;
+        case LUA_VSHAPE: k = LUA_MKSHAPE; break;
+        case LUA_VSHRSTR: k = LUA_MKSHRSTR; break;
+        case LUA_VLNGSTR: k = LUA_MKLNGSTR; break;
+        case LUA_VLCL: k = LUA_MKLCL; break;
+        case LUA_VCCL: k = LUA_MKCCL; break;
+        case LUA_VUPVAL: k = LUA_MKUPVAL; break;
+        case LUA_VPROTO:
+          k = LUA_MKPROTO;
+          pbytes += censusproto(gco2p(o));
+          break;
+        case LUA_VUSERDATA: k = LUA_MKUDATA; break;
+        default: assert(o->tt == LUA_VTHREAD); k = LUA_MKTHREAD;
+      }
+      if (o != obj2gco(mainthread(g)))  /* main thread is in 'g' */
+        n[k]++;
+    }
+  }
+  for (k = 0; k < LUA_MKN; k++) {
+    if (k != LUA_MKARRAY && k != LUA_MKNODE && k != LUA_MKSTACK &&
+        k != LUA_MKCI)
+      assert(n[k] == g->census.nlive[k]);
+  }
+  assert(tbytes == g->census.bytes[LUA_MKTABLE] +
+                   g->census.bytes[LUA_MKARRAY] +
+                   g->census.bytes[LUA_MKNODE]);
+  assert(pbytes == g->census.bytes[LUA_MKPROTO]);
+}
+
+
 int lua_checkmemory (lua_State *L) {
   global_State *g = G(L);
   GCObject *o;
@@ -684,7 +772,8 @@ int lua_checkmemory (lua_State *L) {
 
   /* check 'fixedgc' list */
   for (o = g->fixedgc; o != NULL; o = o->next) {
-    assert(o->tt == LUA_VSHRSTR && isgray(o) && getage(o) == G_OLD);
+    assert((o->tt == LUA_VSHRSTR || o->tt == LUA_VSHAPE) &&
+           isgray(o) && getage(o) == G_OLD);
   }
 
   /* check 'allgc' list */
@@ -705,6 +794,7 @@ int lua_checkmemory (lua_State *L) {
   }
   if (keepinvariant(g))
     assert(totalin == totalshould);
+  checkcensus(g);
   return 0;
 }
 
@@ -1019,13 +1109,13 @@ static int gc_printobj (lua_State *L) {
 
 
 static const char *const statenames[] = {
-  "propagate", "enteratomic", "atomic", "sweepallgc", "sweepfinobj",
-  "sweeptobefnz", "sweepend", "callfin", "pause", ""};
+  "propagate", "remark", "enteratomic", "atomic", "sweepallgc",
+  "sweepfinobj", "sweeptobefnz", "sweepend", "callfin", "pause", ""};
 
 static int gc_state (lua_State *L) {
   static const int states[] = {
-    GCSpropagate, GCSenteratomic, GCSatomic, GCSswpallgc, GCSswpfinobj,
-    GCSswptobefnz, GCSswpend, GCScallfin, GCSpause, -1};
+    GCSpropagate, GCSremark, GCSenteratomic, GCSatomic, GCSswpallgc,
+    GCSswpfinobj, GCSswptobefnz, GCSswpend, GCScallfin, GCSpause, -1};
   int option = states[luaL_checkoption(L, 1, "", statenames)];
   global_State *g = G(L);
   if (option == -1) {
@@ -1047,6 +1137,32 @@ static int gc_state (lua_State *L) {
 }
 
 
+/*
+** Counts the events of the collector (see 'lua_setgcf'). 'gcevents(true)'
+** starts counting from zero, 'gcevents(false)' stops; both return the
+** counts so far.
+*/
+static size_t gcevcount[LUA_GCEVMINOREND + 1];
+
+static void countgcev (void *ud, int event) {
+  UNUSED(ud);
+  gcevcount[event]++;
+}
+
+static int gc_events (lua_State *L) {
+  int i;
+  for (i = 0; i <= LUA_GCEVMINOREND; i++)
+    lua_pushinteger(L, cast(lua_Integer, gcevcount[i]));
+  if (lua_toboolean(L, 1)) {
+    memset(gcevcount, 0, sizeof(gcevcount));
+    lua_setgcf(L, countgcev, NULL);
+  }
+  else
+    lua_setgcf(L, NULL, NULL);
+  return LUA_GCEVMINOREND + 1;
+}
+
+
 static int tracinggc = 0;
 void luai_tracegctest (lua_State *L, int first) {
   if (!tracinggc) return;
@@ -1089,6 +1205,7 @@ static int hash_query (lua_State *L) {
     Table *t;
     luaL_checktype(L, 2, LUA_TTABLE);
     t = hvalue(obj_at(L, 2));
+    luaL_argcheck(L, !isshaped(t), 2, "table with a shape");
     lua_pushinteger(L, cast_Integer(luaH_mainposition(t, o) - t->node));
   }
   return 1;
@@ -1138,7 +1255,11 @@ static int table_query (lua_State *L) {
     lua_pushinteger(L, cast_Integer(asize));
     lua_pushinteger(L, cast_Integer(allocsizenode(t)));
     lua_pushinteger(L, cast_Integer(asize > 0 ? *lenhint(t) : 0));
-    return 3;
+    if (isshaped(t))  /* number of keys in its shape */
+      lua_pushinteger(L, getshape(t)->nkeys);
+    else
+      lua_pushnil(L);
+    return 4;
   }
   else if (cast_uint(i) < asize) {
     lua_pushinteger(L, i);
@@ -1149,6 +1270,22 @@ static int table_query (lua_State *L) {
     api_incr_top(L);
     lua_pushnil(L);
   }
+  else if (isshaped(t)) {  /* keys in the order of the shape */
+    const Shape *s = getshape(t);
+    if (cast_uint(i -= cast_int(asize)) < s->nkeys) {
+      setsvalue(L, s2v(L->top.p), s->keys[i]);
+      api_incr_top(L);
+      if (!isempty(shapevals(t) + i))
+        pushobject(L, shapevals(t) + i);
+      else
+        lua_pushnil(L);
+    }
+    else {
+      lua_pushnil(L);
+      lua_pushnil(L);
+    }
+    lua_pushinteger(L, 0);
+  }
   else if (cast_uint(i -= cast_int(asize)) < sizenode(t)) {
     TValue k;
     getnodekey(L, &k, gnode(t, i));
@@ -1338,7 +1475,13 @@ static int makeseed (lua_State *L) {
 static int newstate (lua_State *L) {
   void *ud;
   lua_Alloc f = lua_getallocf(L, &ud);
-  lua_State *L1 = lua_newstate(f, ud, 0);
+  int opts = cast_int(luaL_optinteger(L, 1, 0));
+  lua_State *L1;
+  if (opts & LUA_NSBGFREE) {  /* needs a thread-safe allocator */
+    f = luaL_alloc;
+    ud = NULL;
+  }
+  L1 = lua_newstatex(f, ud, 0, opts);
   if (L1) {
     lua_atpanic(L1, tpanic);
     lua_pushlightuserdata(L, L1);
@@ -1566,6 +1709,8 @@ static int getindex_aux (lua_State *L, lua_State *L1, const char **pc) {
   skip(pc);
   switch (*(*pc)++) {
     case 'R': return LUA_REGISTRYINDEX;
+    case 'G': return LUA_GLOBALSINDEX;
+    case 'E': return LUA_ENVIRONINDEX;
     case 'U': return lua_upvalueindex(getnum_aux(L, L1, pc));
     default: {
       int n;
@@ -1601,6 +1746,12 @@ static void regcodes (lua_State *L) {
 #define getindex	(getindex_aux(L, L1, &pc))
 
 
+/* keys created by instruction 'newkey' (valid only for their state) */
+static const lua_Key *testkeys[10];
+
+#define getkey		(testkeys[getnum_aux(L, L1, &pc) % 10])
+
+
 static int testC (lua_State *L);
 static int Cfunck (lua_State *L, int status, lua_KContext ctx);
 
@@ -1614,6 +1765,19 @@ static int Cfunck (lua_State *L, int status, lua_KContext ctx);
 */
 static const char ops[] = "+-*%^/\\&|~<>_!";
 
+/* size of the buffers for the bulk array functions */
+#define NUMBUFF		100
+
+/* fill buffer 'v' with 'n' test values: 0.5, 1.5, 2.5, ... */
+static int fillnumbers (lua_Number *v, int n) {
+  int i;
+  lua_assert(0 <= n && n <= NUMBUFF);
+  for (i = 0; i < n; i++)
+    v[i] = cast_num(i) + 0.5;
+  return n;
+}
+
+
 static int runC (lua_State *L, lua_State *L1, const char *pc) {
   char buff[300];
   int status = 0;
@@ -1672,6 +1836,11 @@ static int runC (lua_State *L, lua_State *L1, const char *pc) {
       int f = getindex;
       lua_copy(L1, f, getindex);
     }
+    else if EQ("createarray") {
+      lua_Number v[NUMBUFF];
+      int n = fillnumbers(v, getnum);
+      lua_createarray(L1, v, n);
+    }
     else if EQ("func2num") {
       lua_CFunction func = lua_tocfunction(L1, getindex);
       lua_pushinteger(L1, cast_st2S(cast_sizet(func)));
@@ -1681,6 +1850,15 @@ static int runC (lua_State *L, lua_State *L1, const char *pc) {
       int tp = lua_getfield(L1, t, getstring);
       lua_assert(tp == lua_type(L1, -1));
     }
+    else if EQ("getfieldk") {
+      int t = getindex;
+      const lua_Key *k = getkey;
+      int tp = lua_getfieldk(L1, t, k);
+      lua_assert(tp == lua_type(L1, -1));
+    }
+    else if EQ("getfenv") {
+      lua_getfenv(L1, getindex);
+    }
     else if EQ("getglobal") {
       lua_getglobal(L1, getstring);
     }
@@ -1740,6 +1918,14 @@ static int runC (lua_State *L, lua_State *L1, const char *pc) {
     else if EQ("loadfile") {
       luaL_loadfile(L1, luaL_checkstring(L1, getnum));
     }
+    else if EQ("chunkcache") {
+      const char *dir = lua_tostring(L1, getindex);
+      luaL_chunkcache(L1, dir, getnum);
+    }
+    else if EQ("loadfilemapped") {
+      const char *fname = luaL_checkstring(L1, getnum);
+      luaL_loadfilemapped(L1, fname, getstring);
+    }
     else if EQ("loadstring") {
       size_t slen;
       const char *s = luaL_checklstring(L1, getnum, &slen);
@@ -1753,6 +1939,10 @@ static int runC (lua_State *L, lua_State *L1, const char *pc) {
     else if EQ("newtable") {
       lua_newtable(L1);
     }
+    else if EQ("newkey") {
+      int n = getnum;
+      testkeys[n % 10] = lua_newkey(L1, getstring);
+    }
     else if EQ("newthread") {
       lua_newthread(L1);
     }
@@ -1811,6 +2001,9 @@ static int runC (lua_State *L, lua_State *L1, const char *pc) {
     else if EQ("pushint") {
       lua_pushinteger(L1, getnum);
     }
+    else if EQ("pushkey") {
+      lua_pushkey(L1, getkey);
+    }
     else if EQ("pushnil") {
       lua_pushnil(L1);
     }
@@ -1846,6 +2039,19 @@ static int runC (lua_State *L, lua_State *L1, const char *pc) {
       int t = getindex;
       lua_rawgeti(L1, t, getnum);
     }
+    else if EQ("rawgetarray") {
+      lua_Number v[NUMBUFF];
+      int t = getindex;
+      lua_Integer i = getnum;
+      int n = getnum;
+      int k;
+      lua_assert(0 <= n && n <= NUMBUFF);
+      n = lua_rawgetarray(L1, t, i, v, n);
+      luaL_checkstack(L1, n + 1, "too many results");
+      lua_pushinteger(L1, n);
+      for (k = 0; k < n; k++)
+        lua_pushnumber(L1, v[k]);
+    }
     else if EQ("rawgetp") {
       int t = getindex;
       lua_rawgetp(L1, t, cast_voidp(cast_sizet(getnum)));
@@ -1858,6 +2064,13 @@ static int runC (lua_State *L, lua_State *L1, const char *pc) {
       int t = getindex;
       lua_rawseti(L1, t, getnum);
     }
+    else if EQ("rawsetarray") {
+      lua_Number v[NUMBUFF];
+      int t = getindex;
+      lua_Integer i = getnum;
+      int n = fillnumbers(v, getnum);
+      lua_rawsetarray(L1, t, i, v, n);
+    }
     else if EQ("rawsetp") {
       int t = getindex;
       lua_rawsetp(L1, t, cast_voidp(cast_sizet(getnum)));
@@ -1911,6 +2124,14 @@ static int runC (lua_State *L, lua_State *L1, const char *pc) {
       const char *s = getstring;
       lua_setfield(L1, t, s);
     }
+    else if EQ("setfenv") {
+      int t = getindex;
+      lua_pushinteger(L1, lua_setfenv(L1, t));
+    }
+    else if EQ("setfieldk") {
+      int t = getindex;
+      lua_setfieldk(L1, t, getkey);
+    }
     else if EQ("seti") {
       int t = getindex;
       lua_seti(L1, t, getnum);
@@ -2174,6 +2395,7 @@ static const struct luaL_Reg tests_funcs[] = {
   {"gccolor", gc_color},
   {"gcage", gc_age},
   {"gcstate", gc_state},
+  {"gcevents", gc_events},
   {"tracegc", tracegc},
   {"pobj", gc_printobj},
   {"getref", getref},
@@ -2237,7 +2459,8 @@ int luaB_opentests (lua_State *L) {
   lua_setglobal(L, "_WARN");  /* _WARN = false */
   regcodes(L);
   atexit(checkfinalmem);
-  lua_assert(f == debug_realloc && ud == cast_voidp(&l_memcontrol));
+  lua_assert((f == debug_realloc && ud == cast_voidp(&l_memcontrol)) ||
+             (f == luaL_alloc && ud == NULL));  /* see 'newstate' */
   lua_setallocf(L, f, ud);  /* exercise this function */
   luaL_newlib(L, tests_funcs);
   return 1;
@@ -22,6 +22,9 @@
 /* turn on assertions */
 #define LUAI_ASSERT
 
+/* count pairs of instructions */
+#define LUAI_OPPAIRS
+
 
 /* to avoid warnings, and to make sure value is really unused */
 #define UNUSED(x)       (x=0, (void)(x))
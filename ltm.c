@@ -31,7 +31,7 @@ LUAI_DDEF const char *const luaT_typenames_[LUA_TOTALTYPES] = {
   "no value",
   "nil", "boolean", udatatypename, "number",
   "string", "table", "function", udatatypename, "thread",
-  "upvalue", "proto" /* these last cases are used for tests only */
+  "upvalue", "proto", "shape" /* these last cases are used for tests only */
 };
 
 
@@ -235,11 +235,12 @@ static void createvarargtab (lua_State *L, StkId f, int n) {
   sethvalue(L, s2v(L->top.p), t);
   L->top.p++;
   luaH_resize(L, t, cast_uint(n), 1);
-  setsvalue(L, &key, luaS_new(L, "n"));  /* key is "n" */
+  setsvalue2s(L, L->top.p, luaS_new(L, "n"));  /* key is "n" */
+  L->top.p++;  /* anchor it (EXTRA_STACK); a new shape may need memory */
+  setobj(L, &key, s2v(L->top.p - 1));
   setivalue(&value, n);  /* value is n */
-  /* No need to anchor the key: Due to the resize, the next operation
-     cannot trigger a garbage collection */
   luaH_set(L, t, &key, &value);  /* t.n = n */
+  L->top.p--;
   for (i = 0; i < n; i++)
     luaH_setint(L, t, i + 1, s2v(f + i));
   luaC_checkGC(L);
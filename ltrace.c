@@ -0,0 +1,435 @@
+/*
+** $Id: ltrace.c $
+** Deterministic tracer of function calls
+** See Copyright Notice in lua.h
+*/
+
+#define ltrace_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "ldebug.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "ltrace.h"
+
+
+/*
+** {======================================================
+** Clocks: 'l_traceclock()' returns the current time as a
+** 'lua_Unsigned', in some fixed unit; it is read twice for each call,
+** so it should be as cheap as possible. 'l_tracesecs()' returns the
+** current time in seconds, and is used only to find out the unit of
+** 'l_traceclock'.
+** =======================================================
+*/
+#if !defined(l_traceclock)	/* { */
+
+#if defined(LUA_USE_POSIX) && defined(CLOCK_MONOTONIC)	/* { */
+
+static lua_Unsigned l_nanosecs (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lua_Unsigned, ts.tv_sec) * 1000000000u
+         + cast(lua_Unsigned, ts.tv_nsec);
+}
+
+#define l_tracesecs()	(cast_num(l_nanosecs()) * 1e-9)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/* the time-stamp counter is several times cheaper than system clocks */
+#define l_traceclock()	cast(lua_Unsigned, __builtin_ia32_rdtsc())
+#else
+#define l_traceclock()	l_nanosecs()
+#endif
+
+#else				/* }{ */
+
+/* ISO C only has 'clock' */
+#define l_traceclock()	cast(lua_Unsigned, clock())
+#define l_tracesecs()	(cast_num(clock()) / CLOCKS_PER_SEC)
+
+#endif				/* } */
+
+#endif				/* } */
+/* }====================================================== */
+
+
+/* minimum size for the hash part of the tracer */
+#define MINHASH		32
+
+
+/*
+** Returns the stack of frames of a thread, creating it if needed.
+*/
+static TraceStack *getstack (lua_State *L) {
+  TraceStack *ts = L->trace;
+  if (l_unlikely(ts == NULL)) {
+    ts = luaM_new(L, TraceStack);
+    ts->frames = NULL;
+    ts->n = ts->size = 0;
+    ts->suspended = 0;
+    L->trace = ts;
+  }
+  return ts;
+}
+
+
+static unsigned hashkey (const void *key) {
+  return point2uint(key) ^ (point2uint(key) >> 9);
+}
+
+
+static void inserthash (Tracer *tr, const void *key, int i) {
+  unsigned mask = cast_uint(tr->sizehash - 1);
+  unsigned h = hashkey(key) & mask;
+  while (tr->hash[h] != 0)
+    h = (h + 1) & mask;
+  tr->hash[h] = i + 1;
+}
+
+
+/*
+** Rebuilds the hash part with twice the number of slots as there
+** are entries.
+*/
+static void resizehash (lua_State *L, Tracer *tr) {
+  int size = MINHASH;
+  int *hash;
+  int i;
+  while (size < 2 * tr->sizeentries)
+    size *= 2;
+  hash = luaM_newvector(L, size, int);
+  memset(hash, 0, cast_sizet(size) * sizeof(int));
+  luaM_freearray(L, tr->hash, cast_sizet(tr->sizehash));
+  tr->hash = hash;
+  tr->sizehash = size;
+  for (i = 0; i < tr->nentries; i++)
+    inserthash(tr, tr->entries[i].key, i);
+}
+
+
+/*
+** Returns the index of the entry for a function, creating it if
+** needed.
+*/
+static int getentry (lua_State *L, Tracer *tr, const void *key,
+                                   lua_CFunction f) {
+  TraceEntry *e;
+  if (tr->sizehash > 0) {
+    unsigned mask = cast_uint(tr->sizehash - 1);
+    unsigned h = hashkey(key) & mask;
+    int i;
+    while ((i = tr->hash[h]) != 0) {
+      if (tr->entries[i - 1].key == key)
+        return i - 1;
+      h = (h + 1) & mask;
+    }
+  }
+  /* new entry */
+  if (tr->nentries >= tr->sizeentries) {
+    luaM_growvector(L, tr->entries, tr->nentries, tr->sizeentries,
+                       TraceEntry, INT_MAX, "traced functions");
+    resizehash(L, tr);  /* keep hash part at most half full */
+  }
+  e = &tr->entries[tr->nentries++];
+  e->key = key;
+  e->f = f;
+  e->calls = e->total = e->self = 0;
+  e->active = 0;
+  inserthash(tr, key, tr->nentries - 1);
+  return tr->nentries - 1;
+}
+
+
+/*
+** Pops the top frame of 'ts', charging its time to its entry and to
+** its caller.
+*/
+static void endframe (Tracer *tr, TraceStack *ts, lua_Unsigned now) {
+  TraceFrame *f = &ts->frames[--ts->n];
+  TraceEntry *e = &tr->entries[f->e];
+  lua_Unsigned dt = now - f->start;
+  e->self += dt - f->child;
+  if (--e->active == 0)  /* outermost activation? */
+    e->total += dt;  /* (recursive calls are already included) */
+  if (ts->n > 0)
+    ts->frames[ts->n - 1].child += dt;
+}
+
+
+/*
+** Call event for the function of 'ci'. Frames above the caller of
+** 'ci' belong to calls that were interrupted by errors or replaced by
+** tail calls, so they finish now.
+*/
+void luaR_call (lua_State *L, CallInfo *ci) {
+  Tracer *tr = G(L)->tracer;
+  TraceStack *ts = getstack(L);
+  const TValue *func = s2v(ci->func.p);
+  const void *key;
+  lua_CFunction f;
+  TraceFrame *fr;
+  int e;
+  lua_assert(tr != NULL && tr->running);
+  switch (ttypetag(func)) {
+    case LUA_VLCL: key = clLvalue(func)->p; f = NULL; break;
+    case LUA_VLCF: f = fvalue(func); key = cast_voidp(cast_sizet(f)); break;
+    default: lua_assert(ttisCclosure(func));
+      f = clCvalue(func)->f; key = cast_voidp(cast_sizet(f)); break;
+  }
+  if (ts->n > 0 && ts->frames[ts->n - 1].ci != ci->previous) {
+    lua_Unsigned now = l_traceclock();
+    do {
+      endframe(tr, ts, now);
+    } while (ts->n > 0 && ts->frames[ts->n - 1].ci != ci->previous);
+  }
+  e = getentry(L, tr, key, f);
+  if (ts->n >= ts->size)
+    luaM_growvector(L, ts->frames, ts->n, ts->size, TraceFrame,
+                       INT_MAX, "traced calls");
+  tr->entries[e].calls++;
+  tr->entries[e].active++;
+  fr = &ts->frames[ts->n++];
+  fr->ci = ci;
+  fr->e = e;
+  fr->child = 0;
+  fr->start = l_traceclock();  /* last, so that the call pays no overhead */
+}
+
+
+/*
+** Return event for the function of 'ci'. If the thread has no frame
+** for 'ci', the call started before the tracer.
+*/
+void luaR_return (lua_State *L, CallInfo *ci) {
+  TraceStack *ts = L->trace;
+  if (ts != NULL && ts->n > 0) {
+    Tracer *tr = G(L)->tracer;
+    lua_Unsigned now = l_traceclock();
+    while (ts->n > 0) {
+      int found = (ts->frames[ts->n - 1].ci == ci);
+      endframe(tr, ts, now);
+      if (found) break;
+    }
+  }
+}
+
+
+/*
+** A thread that yields keeps its calls open; the time it stays
+** suspended is discounted from them when it resumes. Returns the time
+** when the resume started (see 'luaR_endresume').
+*/
+lua_Unsigned luaR_resume (lua_State *L) {
+  TraceStack *ts = L->trace;
+  lua_Unsigned now = l_traceclock();
+  if (ts != NULL && ts->n > 0) {
+    lua_Unsigned delta = now - ts->suspended;
+    int i;
+    for (i = 0; i < ts->n; i++)
+      ts->frames[i].start += delta;
+  }
+  return now;
+}
+
+
+/*
+** End of a resume of 'L' by 'from' that started at 'start'. The time
+** 'L' ran goes to its own frames, so, for the frame of 'from' that
+** resumed it, it counts as time spent in a callee, not as self time.
+*/
+void luaR_endresume (lua_State *L, lua_State *from, lua_Unsigned start,
+                                   int yielded) {
+  lua_Unsigned now = l_traceclock();
+  if (yielded && L->trace != NULL)
+    L->trace->suspended = now;
+  if (from != NULL && from->trace != NULL && from->trace->n > 0)
+    from->trace->frames[from->trace->n - 1].child += now - start;
+}
+
+
+void luaR_freethread (lua_State *L, lua_State *L1) {
+  TraceStack *ts = L1->trace;
+  if (ts != NULL) {
+    luaM_freearray(L, ts->frames, cast_sizet(ts->size));
+    luaM_free(L, ts);
+    L1->trace = NULL;
+  }
+}
+
+
+void luaR_free (lua_State *L) {
+  Tracer *tr = G(L)->tracer;
+  if (tr != NULL) {
+    luaM_freearray(L, tr->entries, cast_sizet(tr->sizeentries));
+    luaM_freearray(L, tr->hash, cast_sizet(tr->sizehash));
+    luaM_free(L, tr);
+    G(L)->tracer = NULL;
+  }
+}
+
+
+/*
+** Turns tracing on or off for thread 'L1'. Turning it off finishes
+** all calls still running in the thread.
+*/
+static void tracethread (lua_State *L, lua_State *L1, int on) {
+  if (on)
+    L1->hookmask |= LUA_MASKTRACE;
+  else {
+    L1->hookmask &= ~LUA_MASKTRACE;
+    if (L1->trace != NULL) {
+      /* a suspended thread stopped running when it yielded */
+      lua_Unsigned now = (L1->status == LUA_YIELD) ? L1->trace->suspended
+                                                   : l_traceclock();
+      while (L1->trace->n > 0)
+        endframe(G(L)->tracer, L1->trace, now);
+      luaR_freethread(L, L1);
+    }
+  }
+}
+
+
+/*
+** Turns tracing on or off for all threads.
+*/
+static void traceall (lua_State *L, int on) {
+  global_State *g = G(L);
+  GCObject *lists[3];
+  int i;
+  lists[0] = g->allgc; lists[1] = g->finobj; lists[2] = g->tobefnz;
+  tracethread(L, mainthread(g), on);
+  for (i = 0; i < 3; i++) {
+    GCObject *o;
+    for (o = lists[i]; o != NULL; o = o->next) {
+      if (o->tt == LUA_VTHREAD)
+        tracethread(L, gco2th(o), on);
+    }
+  }
+  g->tracer->running = cast_byte(on);
+}
+
+
+static void starttracer (lua_State *L) {
+  global_State *g = G(L);
+  if (g->tracer == NULL) {
+    Tracer *tr = luaM_new(L, Tracer);
+    tr->entries = NULL;
+    tr->hash = NULL;
+    tr->nentries = tr->sizeentries = tr->sizehash = 0;
+    tr->running = 0;
+    tr->clock0 = l_traceclock();
+    tr->secs0 = l_tracesecs();
+    g->tracer = tr;
+  }
+  if (!g->tracer->running)
+    traceall(L, 1);
+}
+
+
+LUA_API int lua_trace (lua_State *L, int what) {
+  global_State *g;
+  int res = 0;
+  lua_lock(L);
+  g = G(L);
+  switch (what) {
+    case LUA_TRACESTART: {
+      starttracer(L);
+      break;
+    }
+    case LUA_TRACESTOP: {
+      if (g->tracer != NULL && g->tracer->running)
+        traceall(L, 0);
+      break;
+    }
+    case LUA_TRACERESET: {
+      if (g->tracer != NULL) {
+        int running = g->tracer->running;
+        if (running)
+          traceall(L, 0);
+        luaR_free(L);  /* also releases its prototypes */
+        if (running)
+          starttracer(L);
+      }
+      break;
+    }
+    case LUA_TRACECOUNT: {
+      if (g->tracer != NULL)
+        res = g->tracer->nentries;
+      break;
+    }
+    case LUA_TRACEISRUNNING: {
+      res = (g->tracer != NULL && g->tracer->running);
+      break;
+    }
+    default: res = -1;  /* invalid option */
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Length in seconds of a unit of 'l_traceclock', measured along the
+** whole life of the tracer.
+*/
+static lua_Number clockunit (Tracer *tr) {
+  lua_Unsigned ticks = l_traceclock() - tr->clock0;
+  return (ticks == 0) ? 0 : (l_tracesecs() - tr->secs0) / cast_num(ticks);
+}
+
+
+/*
+** Fills 'ts' with the statistics of the n-th traced function. Returns
+** 0 if there is no such function.
+*/
+LUA_API int lua_gettracestat (lua_State *L, int n, lua_TraceStat *ts) {
+  Tracer *tr;
+  const TraceEntry *e;
+  lua_Number unit;
+  lua_lock(L);
+  tr = G(L)->tracer;
+  if (tr == NULL || n < 1 || n > tr->nentries) {
+    lua_unlock(L);
+    return 0;
+  }
+  e = &tr->entries[n - 1];
+  ts->func = e->f;
+  ts->calls = e->calls;
+  unit = clockunit(tr);
+  ts->total = cast_num(e->total) * unit;
+  ts->self = cast_num(e->self) * unit;
+  if (e->f != NULL) {
+    ts->what = "C";
+    ts->linedefined = -1;
+    luaO_chunkid(ts->short_src, "=[C]", LL("=[C]"));
+  }
+  else {
+    const Proto *p = cast(const Proto *, e->key);
+    ts->linedefined = p->linedefined;
+    ts->what = (p->linedefined == 0) ? "main" : "Lua";
+    if (p->source) {
+      size_t len;
+      const char *src = getlstr(p->source, len);
+      luaO_chunkid(ts->short_src, src, len);
+    }
+    else
+      luaO_chunkid(ts->short_src, "=?", LL("=?"));
+  }
+  lua_unlock(L);
+  return 1;
+}
+
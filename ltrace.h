@@ -0,0 +1,78 @@
+/*
+** $Id: ltrace.h $
+** Deterministic tracer of function calls
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ltrace_h
+#define ltrace_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** Bit in 'hookmask' of threads being traced. (It is not visible to
+** hooks: 'lua_sethook' keeps it and 'lua_gethookmask' hides it.)
+*/
+#define LUA_MASKTRACE	(LUA_MASKCOUNT << 1)
+
+
+/*
+** Statistics of a traced function. Entries live in a dense array, so
+** that their indices stay valid when the hash part is rebuilt.
+*/
+typedef struct TraceEntry {
+  const void *key;  /* 'Proto *' or C function */
+  lua_CFunction f;  /* C function (NULL for Lua functions) */
+  lua_Unsigned calls;  /* number of calls */
+  lua_Unsigned total;  /* inclusive time (in clock units) */
+  lua_Unsigned self;  /* exclusive time (in clock units) */
+  int active;  /* number of activations currently running */
+} TraceEntry;
+
+
+typedef struct Tracer {
+  TraceEntry *entries;
+  int *hash;  /* indices (plus one) into 'entries'; 0 is empty */
+  int nentries;  /* number of entries in use */
+  int sizeentries;  /* size of 'entries' */
+  int sizehash;  /* size of 'hash' (a power of 2) */
+  lua_Unsigned clock0;  /* clock when tracer was created */
+  lua_Number secs0;  /* idem, in seconds */
+  lu_byte running;
+} Tracer;
+
+
+/*
+** A call being traced. A thread keeps a stack of these frames, which
+** mirrors its stack of CallInfo's.
+*/
+typedef struct TraceFrame {
+  CallInfo *ci;
+  int e;  /* index of its entry */
+  lua_Unsigned start;  /* time when call started */
+  lua_Unsigned child;  /* time spent in traced callees */
+} TraceFrame;
+
+
+typedef struct TraceStack {
+  TraceFrame *frames;
+  int n;  /* number of frames in use */
+  int size;  /* size of 'frames' */
+  lua_Unsigned suspended;  /* time when thread last yielded */
+} TraceStack;
+
+
+#define istracing(L)	((L)->hookmask & LUA_MASKTRACE)
+
+LUAI_FUNC void luaR_call (lua_State *L, CallInfo *ci);
+LUAI_FUNC void luaR_return (lua_State *L, CallInfo *ci);
+LUAI_FUNC lua_Unsigned luaR_resume (lua_State *L);
+LUAI_FUNC void luaR_endresume (lua_State *L, lua_State *from,
+                               lua_Unsigned start, int yielded);
+LUAI_FUNC void luaR_freethread (lua_State *L, lua_State *L1);
+LUAI_FUNC void luaR_free (lua_State *L);
+
+#endif
@@ -720,6 +720,10 @@ static int pmain (lua_State *L) {
     lua_setfield(L, LUA_REGISTRYINDEX, "LUA_NOENV");
   }
   luai_openlibs(L);  /* open standard libraries */
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+  lua_pushcfunction(L, luaopen_profiler);  /* can be required */
+  lua_setfield(L, -2, LUA_PROFLIBNAME);
+  lua_pop(L, 1);  /* remove PRELOAD table */
 
   luaL_requiref(L, "compat", luaopen_compat, 1);
   lua_pop(L, 1);
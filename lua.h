@@ -48,6 +48,10 @@
 #define LUA_REGISTRYINDEX	(-(INT_MAX/2 + 1000))
 #define lua_upvalueindex(i)	(LUA_REGISTRYINDEX - (i))
 
+/* pseudo-indices of Lua 5.1: the global table and the environment */
+#define LUA_ENVIRONINDEX	(LUA_REGISTRYINDEX - 1000)
+#define LUA_GLOBALSINDEX	(LUA_REGISTRYINDEX - 1001)
+
 
 /* thread status */
 #define LUA_OK		0
@@ -136,12 +140,30 @@ typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 typedef void (*lua_WarnFunction) (void *ud, const char *msg, int tocont);
 
 
+/*
+** Type for functions called on events of the garbage collector
+*/
+typedef void (*lua_GCFunction) (void *ud, int event);
+
+
 /*
 ** Type used by the debug API to collect debug information
 */
 typedef struct lua_Debug lua_Debug;
 
 
+/*
+** Type for pre-interned keys (see 'lua_newkey')
+*/
+typedef struct lua_Key lua_Key;
+
+
+/*
+** Type used by the tracer to report statistics about a function
+*/
+typedef struct lua_TraceStat lua_TraceStat;
+
+
 /*
 ** Functions to be called by the debugger in specific events
 */
@@ -156,6 +178,76 @@ typedef void (*lua_Hook) (lua_State *L, lua_Debug *ar);
 #endif
 
 
+/* options for 'lua_newstatex' */
+#define LUA_NSPOOL	1	/* use a pool for small blocks */
+#define LUA_NSBGFREE	2	/* free dead objects in a background thread */
+
+
+/*
+** Statistics of the pool for small blocks (see 'lua_newstatex')
+*/
+typedef struct lua_PoolStats {
+  size_t reserved;  /* bytes in slabs got from the allocator function */
+  size_t inuse;  /* bytes in blocks currently in use */
+  size_t nalloc;  /* number of blocks given by the pool */
+  size_t nfree;  /* number of blocks returned to the pool */
+} lua_PoolStats;
+
+
+/*
+** Statistics of the garbage collector (see 'lua_gc')
+*/
+#define LUA_GCPHPROPAGATE	0  /* marking (incremental mode) */
+#define LUA_GCPHATOMIC		1  /* atomic phase (incremental mode) */
+#define LUA_GCPHSWEEP		2  /* sweeping (incremental mode) */
+#define LUA_GCPHCALLFIN		3  /* calling finalizers (incremental mode) */
+#define LUA_GCPHMINOR		4  /* young collections */
+#define LUA_GCPHMAJOR		5  /* major collections (generational mode) */
+
+#define LUA_GCPHN		6
+
+/* number of buckets in the histogram of pauses */
+#define LUA_GCHISTN		16
+
+typedef struct lua_GCStats {
+  size_t time[LUA_GCPHN];  /* microseconds spent in each phase */
+  size_t pauses[LUA_GCHISTN];  /* number of pauses by duration */
+  size_t traversed[LUA_NUMTYPES + 1];  /* by type; protos in the last */
+  size_t freed;  /* bytes freed */
+  size_t ncycles;  /* number of complete cycles */
+  size_t nminor;  /* number of young collections */
+} lua_GCStats;
+
+
+/*
+** Kinds of blocks in the census of the heap (see 'lua_gc')
+*/
+#define LUA_MKTABLE	0  /* table headers */
+#define LUA_MKARRAY	1  /* array parts of tables */
+#define LUA_MKNODE	2  /* hash parts of tables */
+#define LUA_MKSHAPE	3  /* table shapes */
+#define LUA_MKSHRSTR	4  /* short strings */
+#define LUA_MKLNGSTR	5  /* long strings */
+#define LUA_MKLCL	6  /* Lua closures */
+#define LUA_MKCCL	7  /* C closures */
+#define LUA_MKUPVAL	8  /* upvalues */
+#define LUA_MKPROTO	9  /* function prototypes, with all their parts */
+#define LUA_MKUDATA	10  /* full userdata */
+#define LUA_MKTHREAD	11  /* threads */
+#define LUA_MKSTACK	12  /* stacks of threads */
+#define LUA_MKCI	13  /* call records of threads */
+
+#define LUA_MKN		14
+
+typedef struct lua_Census {
+  size_t bytes[LUA_MKN];  /* bytes in use by each kind */
+  size_t nlive[LUA_MKN];  /* number of blocks in use */
+  size_t nalloc[LUA_MKN];  /* number of blocks ever allocated */
+  size_t total;  /* bytes in use by everything, including other kinds */
+} lua_Census;
+
+
+
 /*
 ** RCS ident string
 */
@@ -166,6 +258,8 @@ extern const char lua_ident[];
 ** state manipulation
 */
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud, unsigned seed);
+LUA_API lua_State *(lua_newstatex) (lua_Alloc f, void *ud, unsigned seed,
+                                    int opts);
 LUA_API void       (lua_close) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
 LUA_API int        (lua_closethread) (lua_State *L, lua_State *from);
@@ -252,6 +346,7 @@ LUA_API const char *(lua_pushlstring) (lua_State *L, const char *s, size_t len);
 LUA_API const char *(lua_pushexternalstring) (lua_State *L,
 		const char *s, size_t len, lua_Alloc falloc, void *ud);
 LUA_API const char *(lua_pushstring) (lua_State *L, const char *s);
+LUA_API const char *(lua_pushkey) (lua_State *L, const lua_Key *k);
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
 LUA_API const char *(lua_pushfstring) (lua_State *L, const char *fmt, ...);
@@ -271,11 +366,16 @@ LUA_API int (lua_geti) (lua_State *L, int idx, lua_Integer n);
 LUA_API int (lua_rawget) (lua_State *L, int idx);
 LUA_API int (lua_rawgeti) (lua_State *L, int idx, lua_Integer n);
 LUA_API int (lua_rawgetp) (lua_State *L, int idx, const void *p);
+LUA_API int (lua_rawgetarray) (lua_State *L, int idx, lua_Integer i,
+                               lua_Number *v, int n);
+LUA_API int (lua_getfieldk) (lua_State *L, int idx, const lua_Key *k);
 
 LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
+LUA_API void  (lua_createarray) (lua_State *L, const lua_Number *v, int n);
 LUA_API void *(lua_newuserdatauv) (lua_State *L, size_t sz, int nuvalue);
 LUA_API int   (lua_getmetatable) (lua_State *L, int objindex);
 LUA_API int  (lua_getiuservalue) (lua_State *L, int idx, int n);
+LUA_API int  (lua_getfenv) (lua_State *L, int idx);
 
 
 /*
@@ -288,8 +388,12 @@ LUA_API void  (lua_seti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawsetp) (lua_State *L, int idx, const void *p);
+LUA_API void  (lua_rawsetarray) (lua_State *L, int idx, lua_Integer i,
+                                 const lua_Number *v, int n);
+LUA_API void  (lua_setfieldk) (lua_State *L, int idx, const lua_Key *k);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API int   (lua_setiuservalue) (lua_State *L, int idx, int n);
+LUA_API int   (lua_setfenv) (lua_State *L, int idx);
 
 
 /*
@@ -305,6 +409,9 @@ LUA_API int   (lua_pcallk) (lua_State *L, int nargs, int nresults, int errfunc,
 
 LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                           const char *chunkname, const char *mode);
+LUA_API int   (lua_loadfixed) (lua_State *L, const char *buff, size_t sz,
+                               const char *chunkname, lua_Alloc falloc,
+                               void *ud);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
 
@@ -329,6 +436,17 @@ LUA_API void (lua_setwarnf) (lua_State *L, lua_WarnFunction f, void *ud);
 LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 
 
+/*
+** Events of the garbage collector
+*/
+#define LUA_GCEVSTART		0
+#define LUA_GCEVEND		1
+#define LUA_GCEVMINORSTART	2
+#define LUA_GCEVMINOREND	3
+
+LUA_API void (lua_setgcf) (lua_State *L, lua_GCFunction f, void *ud);
+
+
 /*
 ** garbage-collection options
 */
@@ -343,6 +461,12 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCGEN		7
 #define LUA_GCINC		8
 #define LUA_GCPARAM		9
+#define LUA_GCDEADLINE		10
+#define LUA_GCPOOL		11
+#define LUA_GCBGFREE		12
+#define LUA_GCTARGET		13
+#define LUA_GCSTATS		14
+#define LUA_GCCENSUS		15
 
 
 /*
@@ -380,6 +504,8 @@ LUA_API void  (lua_len)    (lua_State *L, int idx);
 LUA_API unsigned  (lua_numbertocstring) (lua_State *L, int idx, char *buff);
 LUA_API size_t  (lua_stringtonumber) (lua_State *L, const char *s);
 
+LUA_API const lua_Key *(lua_newkey) (lua_State *L, const char *name);
+
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
 
@@ -511,6 +637,68 @@ struct lua_Debug {
   struct CallInfo *i_ci;  /* active function */
 };
 
+
+/*
+** Tracer
+*/
+#define LUA_TRACESTOP		0
+#define LUA_TRACESTART		1
+#define LUA_TRACERESET		2
+#define LUA_TRACECOUNT		3
+#define LUA_TRACEISRUNNING	4
+
+LUA_API int (lua_trace) (lua_State *L, int what);
+LUA_API int (lua_gettracestat) (lua_State *L, int n, lua_TraceStat *ts);
+
+struct lua_TraceStat {
+  const char *what;	/* 'Lua', 'C', 'main' */
+  int linedefined;
+  lua_CFunction func;	/* the C function (NULL for Lua functions) */
+  lua_Unsigned calls;	/* number of calls */
+  lua_Number total;	/* inclusive time, in seconds */
+  lua_Number self;	/* exclusive time, in seconds */
+  char short_src[LUA_IDSIZE];
+};
+
+
+/*
+** Quickening
+*/
+#define LUA_QUICKSTOP		0
+#define LUA_QUICKSTART		1
+#define LUA_QUICKRESET		2
+#define LUA_QUICKISRUNNING	3
+#define LUA_QUICKREWRITES	4
+#define LUA_QUICKHITS		5
+#define LUA_QUICKDEOPTS		6
+
+LUA_API lua_Unsigned (lua_quicken) (lua_State *L, int what);
+
+
+/*
+** Compiler of hot loops
+*/
+#define LUA_JITOFF		0
+#define LUA_JITON		1
+#define LUA_JITISON		2
+#define LUA_JITCOUNT		3
+
+LUA_API int (lua_jit) (lua_State *L, int what);
+
+
+/*
+** Pairs of instructions (counted only when built with LUAI_OPPAIRS)
+*/
+LUA_API int (lua_getoppair) (lua_State *L, int n, const char **first,
+                             const char **second, lua_Unsigned *count);
+LUA_API void (lua_resetoppairs) (lua_State *L);
+
+
+/*
+** Heap snapshots
+*/
+LUA_API int (lua_heapsnapshot) (lua_State *L, lua_Writer writer, void *data);
+
 /* }====================================================================== */
 
 
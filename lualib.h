@@ -54,6 +54,14 @@ LUAMOD_API int (luaopen_table) (lua_State *L);
 #define LUA_UTF8LIBK	(LUA_TABLIBK << 1)
 LUAMOD_API int (luaopen_utf8) (lua_State *L);
 
+#define LUA_JITLIBNAME	"jit"
+#define LUA_JITLIBK	(LUA_UTF8LIBK << 1)
+LUAMOD_API int (luaopen_jit) (lua_State *L);
+
+/* not a standard library: it must be opened explicitly by the host */
+#define LUA_PROFLIBNAME	"profiler"
+LUAMOD_API int (luaopen_profiler) (lua_State *L);
+
 
 /* open selected libraries */
 LUALIB_API void (luaL_openselectedlibs) (lua_State *L, int load, int preload);
@@ -40,6 +40,7 @@ typedef struct {
   size_t offset;  /* current position relative to beginning of dump */
   lua_Unsigned nstr;  /* number of strings in the list */
   lu_byte fixed;  /* dump is fixed in memory */
+  FixedBuff *fb;  /* owner of the dump, if any */
 } LoadState;
 
 
@@ -137,6 +138,16 @@ static lua_Integer loadInteger (LoadState *S) {
 }
 
 
+/*
+** Deallocation function for the strings that keep a fixed buffer
+*/
+static void *releasestr (void *ud, void *ptr, size_t osize, size_t nsize) {
+  UNUSED(ptr); UNUSED(osize); UNUSED(nsize);
+  luaF_releasefixed(cast(FixedBuff *, ud));
+  return NULL;
+}
+
+
 /*
 ** Load a nullable string into slot 'sl' from prototype 'p'. The
 ** assignment to the slot and the barrier must be performed before any
@@ -169,7 +180,12 @@ static void loadString (LoadState *S, Proto *p, TString **sl) {
   }
   else if (S->fixed) {  /* for a fixed buffer, use a fixed string */
     const char *s = getaddr(S, size + 1, char);  /* get content address */
-    *sl = ts = luaS_newextlstr(L, s, size, NULL, NULL);
+    if (S->fb == NULL)
+      *sl = ts = luaS_newextlstr(L, s, size, NULL, NULL);
+    else {  /* string keeps the buffer */
+      S->fb->nrefs++;
+      *sl = ts = luaS_newextlstr(L, s, size, releasestr, S->fb);
+    }
     luaC_objbarrier(L, p, ts);
   }
   else {  /* create internal copy */
@@ -203,6 +219,74 @@ static void loadCode (LoadState *S, Proto *f) {
 static void loadFunction(LoadState *S, Proto *f);
 
 
+/*
+** Load a constant other than a table into 'o'. A string stays anchored
+** in 'f->source' until the caller clears it.
+*/
+static void loadValue (LoadState *S, Proto *f, TValue *o, int t) {
+  switch (t) {
+    case LUA_VNIL:
+      setnilvalue(o);
+      break;
+    case LUA_VFALSE:
+      setbfvalue(o);
+      break;
+    case LUA_VTRUE:
+      setbtvalue(o);
+      break;
+    case LUA_VNUMFLT:
+      setfltvalue(o, loadNumber(S));
+      break;
+    case LUA_VNUMINT:
+      setivalue(o, loadInteger(S));
+      break;
+    case LUA_VSHRSTR:
+    case LUA_VLNGSTR: {
+      lua_assert(f->source == NULL);
+      loadString(S, f, &f->source);  /* use 'source' to anchor string */
+      if (f->source == NULL)
+        error(S, "bad format for constant string");
+      setsvalue2n(S->L, o, f->source);  /* save it in the right place */
+      break;
+    }
+    default: error(S, "invalid constant");
+  }
+}
+
+
+/*
+** Load a template for a table constructor into 'o'. Each key is
+** anchored in the table (with a dummy value) before its value is
+** loaded.
+*/
+static void loadTemplate (LoadState *S, Proto *f, TValue *o) {
+  lua_State *L = S->L;
+  Table *t;
+  unsigned asize = cast_uint(loadInt(S));
+  unsigned hsize = cast_uint(loadInt(S));
+  int i;
+  int n = loadInt(S);
+  t = luaH_new(L);
+  sethvalue(L, o, t);  /* anchor it */
+  luaC_objbarrier(L, f, t);
+  luaH_resize(L, t, asize, hsize);
+  for (i = 0; i < n; i++) {
+    TValue key, val;
+    loadValue(S, f, &key, loadByte(S));
+    if (ttisnil(&key) || (ttisfloat(&key) && luai_numisnan(fltvalue(&key))))
+      error(S, "invalid key in constant table");
+    setbtvalue(&val);
+    luaH_set(L, t, &key, &val);
+    luaC_barrierback(L, obj2gco(t), &key);
+    f->source = NULL;
+    loadValue(S, f, &val, loadByte(S));
+    luaH_set(L, t, &key, &val);
+    luaC_barrierback(L, obj2gco(t), &val);
+    f->source = NULL;
+  }
+}
+
+
 static void loadConstants (LoadState *S, Proto *f) {
   int i;
   int n = loadInt(S);
@@ -213,33 +297,11 @@ static void loadConstants (LoadState *S, Proto *f) {
   for (i = 0; i < n; i++) {
     TValue *o = &f->k[i];
     int t = loadByte(S);
-    switch (t) {
-      case LUA_VNIL:
-        setnilvalue(o);
-        break;
-      case LUA_VFALSE:
-        setbfvalue(o);
-        break;
-      case LUA_VTRUE:
-        setbtvalue(o);
-        break;
-      case LUA_VNUMFLT:
-        setfltvalue(o, loadNumber(S));
-        break;
-      case LUA_VNUMINT:
-        setivalue(o, loadInteger(S));
-        break;
-      case LUA_VSHRSTR:
-      case LUA_VLNGSTR: {
-        lua_assert(f->source == NULL);
-        loadString(S, f, &f->source);  /* use 'source' to anchor string */
-        if (f->source == NULL)
-          error(S, "bad format for constant string");
-        setsvalue2n(S->L, o, f->source);  /* save it in the right place */
-        f->source = NULL;
-        break;
-      }
-      default: error(S, "invalid constant");
+    if (t == LUA_VTABLE)
+      loadTemplate(S, f, o);
+    else {
+      loadValue(S, f, o, t);
+      f->source = NULL;
     }
   }
 }
@@ -329,9 +391,14 @@ static void loadFunction (LoadState *S, Proto *f) {
   f->lastlinedefined = loadInt(S);
   f->numparams = loadByte(S);
   /* get only the meaningful flags */
-  f->flag = cast_byte(loadByte(S) & ~PF_FIXED);
-  if (S->fixed)
+  f->flag = cast_byte(loadByte(S) & ~(PF_FIXED | PF_QUICK | PF_CENSUS));
+  if (S->fixed) {
     f->flag |= PF_FIXED;  /* signal that code is fixed */
+    if (S->fb != NULL) {  /* prototype keeps the buffer */
+      f->fixed = S->fb;
+      S->fb->nrefs++;
+    }
+  }
   f->maxstacksize = loadByte(S);
   loadCode(S, f);
   loadConstants(S, f);
@@ -339,6 +406,7 @@ static void loadFunction (LoadState *S, Proto *f) {
   loadProtos(S, f);
   loadString(S, f, &f->source);
   loadDebug(S, f);
+  luaF_newicache(S->L, f);
 }
 
 
@@ -393,7 +461,8 @@ static void checkHeader (LoadState *S) {
 /*
 ** Load precompiled chunk.
 */
-LClosure *luaU_undump (lua_State *L, ZIO *Z, const char *name, int fixed) {
+LClosure *luaU_undump (lua_State *L, ZIO *Z, const char *name, int fixed,
+                                                   FixedBuff *fb) {
   LoadState S;
   LClosure *cl;
   if (*name == '@' || *name == '=')
@@ -404,6 +473,8 @@ LClosure *luaU_undump (lua_State *L, ZIO *Z, const char *name, int fixed) {
   S.L = L;
   S.Z = Z;
   S.fixed = cast_byte(fixed);
+  S.fb = fb;
+  lua_assert(fixed || fb == NULL);
   S.offset = 1;  /* fist byte was already read */
   checkHeader(&S);
   cl = luaF_newLclosure(L, loadByte(&S));
@@ -23,6 +23,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -323,6 +324,72 @@ lu_byte luaV_finishget (lua_State *L, const TValue *t, TValue *key,
 }
 
 
+/*
+** {==================================================================
+** Inline caches for OP_GETFIELD, OP_SELF, and OP_GETTABUP
+** ===================================================================
+*/
+
+/*
+** Search short string 'key' in table 'h', trying first the slot given
+** by '*hint' (a node or, in a table with a shape, a position in that
+** shape). After a successful search elsewhere, '*hint' is updated.
+*/
+static const TValue *icgetshortstr (Table *h, TString *key,
+                                    unsigned int *hint) {
+  const TValue *slot;
+  if (slotkeyis(h, *hint, key))
+    return gslot(h, *hint);
+  slot = luaH_Hgetshortstr(h, key);
+  if (!isabstkey(slot))
+    *hint = slotindex(h, slot);
+  return slot;
+}
+
+
+/*
+** Access 't[key]' for a constant short string 'key' using its inline
+** cache 'ic'. Besides the table itself, it handles one level of a
+** table '__index' in the metatable of a table or a full userdata (the
+** usual layout of objects and actor bindings). Returns the tag of the
+** result; an empty tag means that 'luaV_finishget' must complete the
+** access, starting again from the metatable of 't'.
+*/
+static lu_byte getfieldic (lua_State *L, const TValue *t, TString *key,
+                           StkId val, ICache *ic) {
+  const TValue *slot;
+  Table *mt;
+  lu_byte tag;
+  if (ttistable(t)) {
+    slot = icgetshortstr(hvalue(t), key, &ic->node);
+    if (!isempty(slot)) {
+      setobj2s(L, val, slot);
+      return ttypetag(slot);
+    }
+    mt = hvalue(t)->metatable;
+    tag = ttypetag(slot);
+  }
+  else if (ttisfulluserdata(t)) {
+    mt = uvalue(t)->metatable;
+    tag = LUA_VNOTABLE;
+  }
+  else
+    return LUA_VNOTABLE;
+  if (checknoTM(mt, TM_INDEX))
+    return tag;  /* no '__index'; let 'luaV_finishget' handle it */
+  slot = icgetshortstr(mt, G(L)->tmname[TM_INDEX], &ic->tm);
+  if (!ttistable(slot))
+    return tag;  /* absent or not a table */
+  slot = icgetshortstr(hvalue(slot), key, &ic->index);
+  if (isempty(slot))
+    return tag;  /* may go on through other metatables */
+  setobj2s(L, val, slot);
+  return ttypetag(slot);
+}
+
+/* }================================================================== */
+
+
 /*
 ** Finish a table assignment 't[key] = val'.
 ** About anchoring the table before the call to 'luaH_finishset':
@@ -827,16 +894,67 @@ lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y) {
 }
 
 
+/*
+** Whether two upvalue values are the same value. Raw equality is not
+** enough, as it does not tell 1 from 1.0 or 0.0 from -0.0, so floats
+** are compared bit by bit.
+*/
+static int samevalue (const TValue *v1, const TValue *v2) {
+  if (rawtt(v1) != rawtt(v2))
+    return 0;
+  else if (ttisfloat(v1)) {
+    lua_Number n1 = fltvalue(v1);
+    lua_Number n2 = fltvalue(v2);
+    return (memcmp(&n1, &n2, sizeof(lua_Number)) == 0);
+  }
+  else
+    return luaV_rawequalobj(v1, v2);
+}
+
+
+/*
+** Check whether the cached closure of prototype 'p' can be reused,
+** that is, whether its upvalues have the same values that the new
+** closure would have. The compiler sets PF_CACHE only for prototypes
+** whose upvalues are all read-only, so these values cannot change and
+** the two closures cannot be told apart.
+*/
+static LClosure *getcached (Proto *p, UpVal **encup, StkId base) {
+  LClosure *c = p->cache;
+  if (c != NULL) {  /* is there a cached closure? */
+    int nup = p->sizeupvalues;
+    Upvaldesc *uv = p->upvalues;
+    int i;
+    for (i = 0; i < nup; i++) {  /* check whether it has right upvalues */
+      TValue *v = uv[i].instack ? s2v(base + uv[i].idx)
+                                : encup[uv[i].idx]->v.p;
+      if (!samevalue(c->upvals[i]->v.p, v))
+        return NULL;  /* wrong upvalue; cannot reuse closure */
+    }
+  }
+  return c;  /* return cached closure (or NULL if no cached closure) */
+}
+
+
 /*
 ** create a new Lua closure, push it in the stack, and initialize
-** its upvalues.
+** its upvalues. Prototypes marked PF_CACHE reuse their last closure
+** when they can (see 'getcached'), keeping the new one otherwise.
 */
 static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
                          StkId ra) {
   int nup = p->sizeupvalues;
   Upvaldesc *uv = p->upvalues;
   int i;
-  LClosure *ncl = luaF_newLclosure(L, nup);
+  LClosure *ncl;
+  if (p->flag & PF_CACHE) {
+    ncl = getcached(p, encup, base);
+    if (ncl != NULL) {  /* can reuse cached closure? */
+      setclLvalue2s(L, ra, ncl);
+      return;
+    }
+  }
+  ncl = luaF_newLclosure(L, nup);
   ncl->p = p;
   setclLvalue2s(L, ra, ncl);  /* anchor new closure in stack */
   for (i = 0; i < nup; i++) {  /* fill in its upvalues */
@@ -846,6 +964,30 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
       ncl->upvals[i] = encup[uv[i].idx];
     luaC_objbarrier(L, ncl, ncl->upvals[i]);
   }
+  if (p->flag & PF_CACHE) {
+    p->cache = ncl;  /* save it in cache for reuse */
+    luaC_objbarrier(L, p, ncl);
+  }
+}
+
+
+/*
+** Finish an OP_CMD interrupted by a yield while getting its method
+** (from an '__index' metamethod): do the rest of the command, which
+** is calling the method with the arguments that follow the OP_CMD.
+** (The call may yield too; then the instruction seen by a new
+** 'luaV_finishOp' is the OP_CMD or its last argument, with CIST_CMD
+** off, and there is nothing left to finish.)
+*/
+static void finishcmd (lua_State *L, CallInfo *ci, StkId ra) {
+  const TValue *k = clLvalue(s2v(ci->func.p))->p->k;
+  StkId arg = ra + 2;
+  ci->callstatus &= ~CIST_CMD;
+  setobjs2s(L, ra, --L->top.p);  /* method */
+  for (; GET_OPCODE(*ci->u.l.savedpc) == OP_EXTRAARG; ci->u.l.savedpc++)
+    setobj2s(L, arg++, k + GETARG_Ax(*ci->u.l.savedpc));
+  L->top.p = arg;
+  luaD_call(L, ra, 0);
 }
 
 
@@ -856,7 +998,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->func.p + 1;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = GET_GENOPCODE(inst);  /* (may have been quickened since) */
   switch (op) {  /* finish its execution */
     case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
       setobjs2s(L, base + GETARG_A(*(ci->u.l.savedpc - 2)), --L->top.p);
@@ -888,6 +1030,11 @@ void luaV_finishOp (lua_State *L) {
       luaV_concat(L, total);  /* concat them (may yield again) */
       break;
     }
+    case OP_CMD: {
+      if (ci->callstatus & CIST_CMD)  /* yielded getting the method? */
+        finishcmd(L, ci, base + GETARG_A(inst));
+      break;
+    }
     case OP_CLOSE: {  /* yielded closing variables */
       ci->u.l.savedpc--;  /* repeat instruction to close other vars. */
       break;
@@ -903,7 +1050,7 @@ void luaV_finishOp (lua_State *L) {
     }
     default: {
       /* only these other opcodes can yield */
-      lua_assert(op == OP_TFORCALL || op == OP_CALL ||
+      lua_assert(op == OP_TFORCALL || op == OP_CALL || op == OP_EXTRAARG ||
            op == OP_TAILCALL || op == OP_SETTABUP || op == OP_SETTABLE ||
            op == OP_SETI || op == OP_SETFIELD);
       break;
@@ -1088,6 +1235,163 @@ void luaV_finishOp (lua_State *L) {
 /* }================================================================== */
 
 
+/*
+** {==================================================================
+** Quickening
+** ===================================================================
+*/
+
+/*
+** When quickening is on, some generic instructions rewrite themselves
+** into variants specialized for the types of the operands they see
+** (integers, floats, or the array part of a table). A variant that
+** finds other types (a "deoptimization") rewrites itself back into its
+** generic form and executes it, and its function stops being quickened
+** after LUAI_MAXDEOPT deoptimizations. (That limit is checked again at
+** each rewrite, as running activations computed 'quick' on entry.) Code
+** in fixed memory is never quickened.
+*/
+#if !defined(LUAI_MAXDEOPT)
+#define LUAI_MAXDEOPT	16
+#endif
+
+#define canquicken(L,p)  \
+	(G(L)->quickening && (p)->ndeopt < LUAI_MAXDEOPT &&  \
+	 !((p)->flag & PF_FIXED))
+
+/* rewrite the opcode of the instruction being executed */
+#define setcurop(o)	SET_OPCODE(*cast(Instruction *, pc - 1), o)
+
+#define quicken(o)  \
+	{ if (cl->p->ndeopt < LUAI_MAXDEOPT) {  \
+	    setcurop(o); cl->p->flag |= PF_QUICK; G(L)->qrewrites++; } }
+
+#define deopt(o)  \
+	{ setcurop(o); G(L)->qdeopts++;  \
+	  if (cl->p->ndeopt < LUAI_MAXDEOPT) cl->p->ndeopt++;  \
+	  if (cl->p->ndeopt == LUAI_MAXDEOPT) quick = 0; }
+
+#define quickhit()	(G(L)->qhits++)
+
+
+/*
+** With the JIT on, backward jumps of integer 'for' loops count towards
+** compiling the loop whose OP_FORLOOP is at 'fpc' (see 'ljit.c'). Code
+** in fixed memory cannot be rewritten, so it is never compiled.
+*/
+#define jitcount(L,fpc)  \
+	{ Proto *p_ = cl->p;  \
+	  if (l_unlikely(G(L)->jiton) && !(p_->flag & PF_FIXED) &&  \
+	      ++p_->jitcount >= LUAI_JITHOT) {  \
+	    p_->jitcount = 0;  \
+	    Protect(luaJ_hotloop(L, p_, cast_int((fpc) - p_->code)));  \
+	  } }
+
+
+/* quicken an instruction with two numeric operands 'v1' and 'v2' */
+#define quicknum(v1,v2,ii,ff)  \
+	{ if (ttisinteger(v1) && ttisinteger(v2)) quicken(ii)  \
+	  else if (ttisfloat(v1) && ttisfloat(v2)) quicken(ff) }
+
+
+/* test whether integer 'k' indexes a non-empty slot in array of 't' */
+#define inarray(t,k)  \
+	(l_castS2U(k) - 1u < (t)->asize &&  \
+	 !tagisempty(*getArrTag(t, l_castS2U(k) - 1u)))
+
+
+/*
+** Arithmetic operations with register operands, specialized for
+** integers ('op_arithII') and for floats ('op_arithFF'). 'o' is the
+** generic opcode.
+*/
+#define op_arithII(L,iop,fop,o) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisinteger(v1) && ttisinteger(v2))) {  \
+    lua_Integer i1 = ivalue(v1); lua_Integer i2 = ivalue(v2);  \
+    pc++; setivalue(vRA(i), iop(L, i1, i2));  \
+    quickhit();  \
+  }  \
+  else {  \
+    deopt(o);  \
+    op_arith_aux(L, v1, v2, iop, fop);  \
+  }}
+
+#define op_arithFF(L,iop,fop,o) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisfloat(v1) && ttisfloat(v2))) {  \
+    lua_Number n1 = fltvalue(v1); lua_Number n2 = fltvalue(v2);  \
+    pc++; setfltvalue(vRA(i), fop(L, n1, n2));  \
+    quickhit();  \
+  }  \
+  else {  \
+    deopt(o);  \
+    op_arith_aux(L, v1, v2, iop, fop);  \
+  }}
+
+
+/*
+** Order operations with register operands, specialized for integers
+** ('op_orderII') and for floats ('op_orderFF').
+*/
+#define op_orderII(L,opi,opn,other,o) {  \
+  TValue *v1 = vRA(i);  \
+  TValue *v2 = vRB(i);  \
+  if (l_likely(ttisinteger(v1) && ttisinteger(v2))) {  \
+    int cond = opi(ivalue(v1), ivalue(v2));  \
+    quickhit();  \
+    docondjump();  \
+  }  \
+  else {  \
+    deopt(o);  \
+    op_order(L, opi, opn, other);  \
+  }}
+
+#define op_orderFF(L,opi,opf,opn,other,o) {  \
+  TValue *v1 = vRA(i);  \
+  TValue *v2 = vRB(i);  \
+  if (l_likely(ttisfloat(v1) && ttisfloat(v2))) {  \
+    int cond = opf(fltvalue(v1), fltvalue(v2));  \
+    quickhit();  \
+    docondjump();  \
+  }  \
+  else {  \
+    deopt(o);  \
+    op_order(L, opi, opn, other);  \
+  }}
+
+
+/* 'ra = rb[rc]', for OP_GETTABLE */
+#define op_gettable(L,ra,rb,rc) {  \
+  lu_byte tag;  \
+  if (ttisinteger(rc)) {  /* fast track for integers? */  \
+    luaV_fastgeti(rb, ivalue(rc), s2v(ra), tag);  \
+  }  \
+  else  \
+    luaV_fastget(rb, rc, s2v(ra), luaH_get, tag);  \
+  if (tagisempty(tag))  \
+    Protect(luaV_finishget(L, rb, rc, ra, tag)); }
+
+
+/* 'ra[rb] = rc', for OP_SETTABLE */
+#define op_settable(L,ra,rb,rc) {  \
+  int hres;  \
+  if (ttisinteger(rb)) {  /* fast track for integers? */  \
+    luaV_fastseti(s2v(ra), ivalue(rb), rc, hres);  \
+  }  \
+  else {  \
+    luaV_fastset(s2v(ra), rb, rc, hres, luaH_pset);  \
+  }  \
+  if (hres == HOK)  \
+    luaV_finishfastset(L, s2v(ra), rc);  \
+  else  \
+    Protect(luaV_finishset(L, s2v(ra), rb, rc, hres)); }
+
+/* }================================================================== */
+
+
 /*
 ** {==================================================================
 ** Function 'luaV_execute': main interpreter loop
@@ -1181,6 +1485,42 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+/*
+** 'ra = t[key]' for OP_GETFIELD/OP_SELF/OP_GETTABUP, with 'rc' the
+** constant 'key' and 'ic' its inline cache. A cache hit in the table
+** itself is done in place; everything else goes through 'getfieldic'.
+*/
+#define op_getfield(L,t,key,ra,ic,rc) {  \
+  Table *h_; unsigned int n_;  \
+  if (ttistable(t) && (h_ = hvalue(t), n_ = (ic)->node,  \
+                       slotkeyis(h_, n_, key)) &&  \
+      !isempty(gslot(h_, n_))) {  \
+    setobj2s(L, ra, gslot(h_, n_));  \
+  }  \
+  else {  \
+    lu_byte tag = getfieldic(L, t, key, ra, ic);  \
+    if (tagisempty(tag))  \
+      Protect(luaV_finishget(L, t, rc, ra, tag));  \
+  }}
+
+
+/*
+** With LUAI_OPPAIRS defined, the interpreter counts how many times each
+** pair of (generic) opcodes is dispatched one right after the other in
+** the same function, to find candidates for fused instructions (see
+** 'lua_getoppair'). 'lastop' is -1 at the first instruction of a
+** function and after a return to it.
+*/
+#if defined(LUAI_OPPAIRS)
+#define countpair(L)  \
+	{ int op_ = genericop(GET_OPCODE(i));  \
+	  if (lastop >= 0) G(L)->oppairs[lastop][op_]++;  \
+	  lastop = op_; }
+#else
+#define countpair(L)	((void)0)
+#endif
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   if (l_unlikely(trap)) {  /* stack reallocation or hooks? */ \
@@ -1188,6 +1528,7 @@ void luaV_finishOp (lua_State *L) {
     updatebase(ci);  /* correct stack */ \
   } \
   i = *(pc++); \
+  countpair(L); \
 }
 
 #define vmdispatch(o)	switch(o)
@@ -1201,15 +1542,23 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
   StkId base;
   const Instruction *pc;
   int trap;
+  int quick;  /* true if instructions can be quickened */
+#if defined(LUAI_OPPAIRS)
+  int lastop;  /* previous opcode dispatched in this function */
+#endif
 #if LUA_USE_JUMPTABLE
 #include "ljumptab.h"
 #endif
  startfunc:
   trap = L->hookmask;
  returning:  /* trap already set */
+#if defined(LUAI_OPPAIRS)
+  lastop = -1;
+#endif
   cl = ci_func(ci);
   k = cl->p->k;
   pc = ci->u.l.savedpc;
+  quick = canquicken(L, cl->p);
   if (l_unlikely(trap))
     trap = luaG_tracecall(L);
   base = ci->func.p + 1;
@@ -1302,24 +1651,18 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        luaV_fastget(upval, key, s2v(ra), luaH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(luaV_finishget(L, upval, rc, ra, tag));
+        ICache *ic = &cl->p->icache[GETARG_C(i)];
+        op_getfield(L, upval, key, ra, ic, rc);
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
         StkId ra = RA(i);
         TValue *rb = vRB(i);
         TValue *rc = vRC(i);
-        lu_byte tag;
-        if (ttisinteger(rc)) {  /* fast track for integers? */
-          luaV_fastgeti(rb, ivalue(rc), s2v(ra), tag);
-        }
-        else
-          luaV_fastget(rb, rc, s2v(ra), luaH_get, tag);
-        if (tagisempty(tag))
-          Protect(luaV_finishget(L, rb, rc, ra, tag));
+        if (l_unlikely(quick) && ttistable(rb) && ttisinteger(rc) &&
+            inarray(hvalue(rb), ivalue(rc)))
+          quicken(OP_GETTABLE_A);
+        op_gettable(L, ra, rb, rc);
         vmbreak;
       }
       vmcase(OP_GETI) {
@@ -1340,10 +1683,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = vRB(i);
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        luaV_fastget(rb, key, s2v(ra), luaH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(luaV_finishget(L, rb, rc, ra, tag));
+        ICache *ic = &cl->p->icache[GETARG_C(i)];
+        op_getfield(L, rb, key, ra, ic, rc);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -1361,19 +1702,12 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_SETTABLE) {
         StkId ra = RA(i);
-        int hres;
         TValue *rb = vRB(i);  /* key (table is in 'ra') */
         TValue *rc = RKC(i);  /* value */
-        if (ttisinteger(rb)) {  /* fast track for integers? */
-          luaV_fastseti(s2v(ra), ivalue(rb), rc, hres);
-        }
-        else {
-          luaV_fastset(s2v(ra), rb, rc, hres, luaH_pset);
-        }
-        if (hres == HOK)
-          luaV_finishfastset(L, s2v(ra), rc);
-        else
-          Protect(luaV_finishset(L, s2v(ra), rb, rc, hres));
+        if (l_unlikely(quick) && ttistable(s2v(ra)) && ttisinteger(rb) &&
+            inarray(hvalue(s2v(ra)), ivalue(rb)))
+          quicken(OP_SETTABLE_A);
+        op_settable(L, ra, rb, rc);
         vmbreak;
       }
       vmcase(OP_SETI) {
@@ -1425,16 +1759,25 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         checkGC(L, ra + 1);
         vmbreak;
       }
+      vmcase(OP_NEWTABLEK) {
+        StkId ra = RA(i);
+        TValue *rb = k + GETARG_Bx(i);
+        Table *t;
+        L->top.p = ra + 1;  /* correct top in case of emergency GC */
+        t = luaH_new(L);  /* memory allocation */
+        sethvalue2s(L, ra, t);
+        luaH_clone(L, t, hvalue(rb));  /* idem */
+        checkGC(L, ra + 1);
+        vmbreak;
+      }
       vmcase(OP_SELF) {
         StkId ra = RA(i);
-        lu_byte tag;
         TValue *rb = vRB(i);
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
+        ICache *ic = &cl->p->icache[GETARG_C(i)];
         setobj2s(L, ra + 1, rb);
-        luaV_fastget(rb, key, s2v(ra), luaH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(luaV_finishget(L, rb, rc, ra, tag));
+        op_getfield(L, rb, key, ra, ic, rc);
         vmbreak;
       }
       vmcase(OP_ADDI) {
@@ -1504,14 +1847,20 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_ADD) {
+        if (l_unlikely(quick))
+          quicknum(vRB(i), vRC(i), OP_ADD_II, OP_ADD_FF);
         op_arith(L, l_addi, luai_numadd);
         vmbreak;
       }
       vmcase(OP_SUB) {
+        if (l_unlikely(quick))
+          quicknum(vRB(i), vRC(i), OP_SUB_II, OP_SUB_FF);
         op_arith(L, l_subi, luai_numsub);
         vmbreak;
       }
       vmcase(OP_MUL) {
+        if (l_unlikely(quick))
+          quicknum(vRB(i), vRC(i), OP_MUL_II, OP_MUL_FF);
         op_arith(L, l_muli, luai_nummul);
         vmbreak;
       }
@@ -1525,6 +1874,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_DIV) {  /* float division (always with floats) */
+        if (l_unlikely(quick) && ttisfloat(vRB(i)) && ttisfloat(vRC(i)))
+          quicken(OP_DIV_FF);
         op_arithf(L, luai_numdiv);
         vmbreak;
       }
@@ -1559,7 +1910,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = vRB(i);
         TMS tm = (TMS)GETARG_C(i);
         StkId result = RA(pi);
-        lua_assert(OP_ADD <= GET_OPCODE(pi) && GET_OPCODE(pi) <= OP_SHR);
+        lua_assert(OP_ADD <= GET_GENOPCODE(pi) && GET_GENOPCODE(pi) <= OP_SHR);
         Protect(luaT_trybinTM(L, s2v(ra), rb, result, tm));
         vmbreak;
       }
@@ -1656,10 +2007,14 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_LT) {
+        if (l_unlikely(quick))
+          quicknum(vRA(i), vRB(i), OP_LT_II, OP_LT_FF);
         op_order(L, l_lti, LTnum, lessthanothers);
         vmbreak;
       }
       vmcase(OP_LE) {
+        if (l_unlikely(quick))
+          quicknum(vRA(i), vRB(i), OP_LE_II, OP_LE_FF);
         op_order(L, l_lei, LEnum, lessequalothers);
         vmbreak;
       }
@@ -1828,7 +2183,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           goto returning;  /* continue running caller in this frame */
         }
       }
-      vmcase(OP_FORLOOP) {
+      vmcase(OP_FORLOOP)
+      l_forloop: {
         StkId ra = RA(i);
         if (ttisinteger(s2v(ra + 1))) {  /* integer loop? */
           lua_Unsigned count = l_castS2U(ivalue(s2v(ra)));
@@ -1838,6 +2194,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
             chgivalue(s2v(ra), l_castU2S(count - 1));  /* update counter */
             idx = intop(+, idx, step);  /* add step to index */
             chgivalue(s2v(ra + 2), idx);  /* update control variable */
+            jitcount(L, pc - 1);
             pc -= GETARG_Bx(i);  /* jump back */
           }
         }
@@ -1965,6 +2322,138 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_CMD) {
+        for (;;) {  /* run a list of commands */
+          StkId ra = RA(i);
+          CallInfo *newci;
+          TValue *rb = vRB(i);
+          TValue *rc = KC(i);
+          TString *key = tsvalue(rc);  /* key must be a short string */
+          ICache *ic = &cl->p->icache[GETARG_C(i)];
+          StkId arg;
+          setobj2s(L, ra + 1, rb);
+          ci->callstatus |= CIST_CMD;  /* (see 'finishcmd') */
+          op_getfield(L, rb, key, ra, ic, rc);
+          ci->callstatus &= ~CIST_CMD;
+          updatebase(ci);  /* stack may have been reallocated */
+          ra = RA(i);
+          arg = ra + 2;
+          for (; GET_OPCODE(*pc) == OP_EXTRAARG; pc++)  /* constant args. */
+            setobj2s(L, arg++, k + GETARG_Ax(*pc));
+          L->top.p = arg;  /* top signals number of arguments */
+          savepc(ci);  /* call returns (or resumes) after the arguments */
+          if ((newci = luaD_precall(L, ra, 0)) != NULL) {
+            ci = newci;  /* Lua call: run function in this same C frame */
+            goto startfunc;  /* (next command will be a new dispatch) */
+          }
+          updatetrap(ci);  /* C call; go on with the list */
+          updatebase(ci);
+          if (trap || GET_OPCODE(*pc) != OP_CMD)
+            break;
+          i = *(pc++);  /* next command */
+        }
+        vmbreak;
+      }
+      vmcase(OP_ADD_II) {
+        op_arithII(L, l_addi, luai_numadd, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_ADD_FF) {
+        op_arithFF(L, l_addi, luai_numadd, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUB_II) {
+        op_arithII(L, l_subi, luai_numsub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_SUB_FF) {
+        op_arithFF(L, l_subi, luai_numsub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MUL_II) {
+        op_arithII(L, l_muli, luai_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_MUL_FF) {
+        op_arithFF(L, l_muli, luai_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_DIV_FF) {
+        TValue *v1 = vRB(i);
+        TValue *v2 = vRC(i);
+        if (l_likely(ttisfloat(v1) && ttisfloat(v2))) {
+          lua_Number n1 = fltvalue(v1); lua_Number n2 = fltvalue(v2);
+          pc++; setfltvalue(vRA(i), luai_numdiv(L, n1, n2));
+          quickhit();
+        }
+        else {
+          deopt(OP_DIV);
+          op_arithf_aux(L, v1, v2, luai_numdiv);
+        }
+        vmbreak;
+      }
+      vmcase(OP_LT_II) {
+        op_orderII(L, l_lti, LTnum, lessthanothers, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LT_FF) {
+        op_orderFF(L, l_lti, luai_numlt, LTnum, lessthanothers, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LE_II) {
+        op_orderII(L, l_lei, LEnum, lessequalothers, OP_LE);
+        vmbreak;
+      }
+      vmcase(OP_LE_FF) {
+        op_orderFF(L, l_lei, luai_numle, LEnum, lessequalothers, OP_LE);
+        vmbreak;
+      }
+      vmcase(OP_GETTABLE_A) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);
+        TValue *rc = vRC(i);
+        if (l_likely(ttistable(rb) && ttisinteger(rc) &&
+                     inarray(hvalue(rb), ivalue(rc)))) {
+          Table *t = hvalue(rb);
+          lua_Unsigned u = l_castS2U(ivalue(rc)) - 1u;
+          farr2val(t, u, *getArrTag(t, u), s2v(ra));
+          quickhit();
+        }
+        else {
+          deopt(OP_GETTABLE);
+          op_gettable(L, ra, rb, rc);
+        }
+        vmbreak;
+      }
+      vmcase(OP_SETTABLE_A) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);  /* key (table is in 'ra') */
+        TValue *rc = RKC(i);  /* value */
+        if (l_likely(ttistable(s2v(ra)) && ttisinteger(rb) &&
+                     inarray(hvalue(s2v(ra)), ivalue(rb)))) {
+          Table *t = hvalue(s2v(ra));
+          lua_Unsigned u = l_castS2U(ivalue(rb)) - 1u;
+          fval2arr(t, u, getArrTag(t, u), rc);
+          luaV_finishfastset(L, s2v(ra), rc);
+          quickhit();
+        }
+        else {
+          deopt(OP_SETTABLE);
+          op_settable(L, ra, rb, rc);
+        }
+        vmbreak;
+      }
+      vmcase(OP_FORLOOP_JIT) {
+        if (l_likely(!trap)) {
+          const Instruction *npc = luaJ_run(L, ci, pc - 1);
+          if (npc != pc - 1) {  /* did the compiled loop run? */
+            pc = npc;
+            updatetrap(ci);
+            vmbreak;
+          }
+        }
+        goto l_forloop;  /* no compiled code; run the generic loop */
+      }
     }
   }
 }
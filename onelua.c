@@ -89,6 +89,7 @@
 #include "ldump.c"
 #include "lstate.c"
 #include "lgc.c"
+#include "lheap.c"
 #include "llex.c"
 #include "lcode.c"
 #include "lparser.c"
@@ -96,10 +97,12 @@
 #include "lfunc.c"
 #include "lobject.c"
 #include "ltm.c"
+#include "ltrace.c"
 #include "lstring.c"
 #include "ltable.c"
 #include "ldo.c"
 #include "lvm.c"
+#include "ljit.c"
 #include "lapi.c"
 
 /* auxiliary library -- used by all */
@@ -117,6 +120,8 @@
 #include "lstrlib.c"
 #include "ltablib.c"
 #include "lutf8lib.c"
+#include "ljitlib.c"
+#include "lproflib.c"
 #include "linit.c"
 #endif
 
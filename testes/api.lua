@@ -29,6 +29,70 @@ local a = T.testC("pushvalue R; return 1")
 assert(a == debug.getregistry())
 
 
+-- pseudo-indices of Lua 5.1
+do
+  assert(T.testC("pushvalue G; return 1") == _G)
+  assert(T.testC("pushvalue E; return 1") == _G)
+  assert(T.testC("getfield G print; return 1") == print)
+  T.testC("pushint 10; setfield G _XX")
+  assert(_G._XX == 10)
+  T.testC("pushstring _XX; pushint 20; settable G")
+  assert(_G._XX == 20)
+  assert(T.testC("pushstring _XX; rawget G; return 1") == 20)
+  T.testC("pushstring _XX; pushnil; rawset E")
+  assert(_G._XX == nil)
+  -- replacing the global table
+  local t = {}
+  T.testC("pushvalue 2; replace G", t)
+  assert(debug.getregistry()[2] == t)
+  T.testC("pushvalue 2; replace G", _G)
+  assert(debug.getregistry()[2] == _G)
+  -- a C function replacing its own environment (as 5.1 modules do)
+  local main = coroutine.running()
+  local env = T.testC([[newtable; replace E; pushint 10; setfield E x;
+                        getfield G print; setfield E print;
+                        pushvalue E; return 1]])
+  assert(env.x == 10 and env.print == print)
+  assert(debug.getregistry()[2] == _G and _G.x == nil)
+  print('print still there')
+  assert(T.testC("pushvalue E; return 1") == env)   -- it is the thread's
+  assert(T.testC("pushvalue G; return 1") == _G)
+  assert(T.testC("getfenv 2; return 1", main) == env)
+  collectgarbage()
+  assert(T.testC("getfield E x; return 1") == 10)
+  T.testC("pushvalue G; replace E")
+  assert(T.testC("getfenv 2; return 1", main) == _G)
+  T.testC("pushnil; setfenv 2", main)
+end
+
+-- environments of Lua 5.1
+do
+  local env = {x = 10}
+  local f = load("return x")
+  local function nf () return 1 end   -- no environment
+  assert(T.testC("getfenv 2; return 1", f) == _G)
+  assert(T.testC("pushvalue 3; setfenv 2; return 1", f, env) == 1)
+  assert(f() == 10 and T.testC("getfenv 2; return 1", f) == env)
+  assert(T.testC("getfenv 2; return 1", nf) == _G)
+  assert(T.testC("pushvalue 3; setfenv 2; return 1", nf, env) == 0)
+  assert(T.testC("pushvalue 3; setfenv 2; return 1", print, env) == 0)
+  assert(T.testC("getfenv 2; return 1", print) == _G)
+  -- stripped main chunks keep their environment
+  f = load(string.dump(load("return x"), true))
+  T.testC("pushvalue 3; setfenv 2", f, env)
+  assert(f() == 10)
+  -- threads
+  local co = coroutine.create(print)
+  assert(T.testC("getfenv 2; return 1", co) == _G)
+  assert(T.testC("pushvalue 3; setfenv 2; return 1", co, env) == 1)
+  env = nil
+  collectgarbage()   -- thread keeps its environment
+  assert(T.testC("getfenv 2; return 1", co).x == 10)
+  T.testC("pushnil; setfenv 2", co)
+  assert(T.testC("getfenv 2; return 1", co) == _G)
+end
+
+
 -- absindex
 assert(T.testC("settop 10; absindex -1; return 1") == 10)
 assert(T.testC("settop 5; absindex -5; return 1") == 1)
@@ -542,6 +606,126 @@ end
 check3(":1:", T.testC("loadstring 2 name t; return *", "x="))
 check3("%.", T.testC("loadfile 2; return *", "."))
 check3("xxxx", T.testC("loadfile 2; return *", "xxxx"))
+check3("xxxx", T.testC("loadfilemapped 2 bt; return *", "xxxx"))
+
+do   -- loading mapped files
+  local fname = os.tmpname()
+  local function write (code)
+    local f = assert(io.open(fname, "wb"))
+    f:write(code); f:close()
+  end
+  local long = string.rep("x", 100)   -- a long string constant
+  write(string.dump(load("return {..., 'xuxu', '" .. long .. "'}")))
+  local f = T.testC("loadfilemapped 2 bt; return 1", fname)
+  collectgarbage()
+  local t = f(10)
+  assert(t[1] == 10 and t[2] == "xuxu" and t[3] == long)
+  check3("binary", T.testC("loadfilemapped 2 t; return *", fname))
+  -- code and long strings stay in the mapping
+  write(string.dump(load("local x = 0\n" ..
+     string.rep("x = x + 1000\n", 2000) .. "return '" .. long:rep(50) .. "'")))
+  collectgarbage(); local m0 = collectgarbage("count")
+  local f1 = T.testC("loadfile 2; return 1", fname)
+  collectgarbage(); local m1 = collectgarbage("count")
+  f = T.testC("loadfilemapped 2 b; return 1", fname)
+  collectgarbage(); local m2 = collectgarbage("count")
+  assert(f() == f1() and m2 - m1 < (m1 - m0) / 2)
+  -- the mapping lives while anything loaded from it is in use
+  local function mapped ()   -- is file mapped? (nil if unknown)
+    local maps = io.open("/proc/self/maps")
+    if not maps then return nil end
+    local s = maps:read("a"); maps:close()
+    return string.find(s, fname, 1, true) ~= nil
+  end
+  f, f1, t = nil; collectgarbage()
+  if mapped() ~= nil then
+    assert(not mapped())
+    for i = 1, 10 do   -- reloading does not keep old mappings
+      f = T.testC("loadfilemapped 2 b; return 1", fname)
+      assert(mapped())
+      f = nil; collectgarbage()
+      assert(not mapped())
+    end
+    write(string.dump(load("return function () return '" .. long .. "' end")))
+    f = T.testC("loadfilemapped 2 b; return 1", fname)()   -- inner function
+    collectgarbage(); assert(mapped())   -- (outer one was collected)
+    local s = f(); f = nil
+    collectgarbage(); assert(mapped())   -- string still uses the mapping
+    assert(s == long)
+    s = nil; collectgarbage(); assert(not mapped())
+    -- a failed load does not keep the mapping
+    write(string.dump(load("return 1")):sub(1, -2))
+    check3("truncated", T.testC("loadfilemapped 2 b; return *", fname))
+    collectgarbage(); assert(not mapped())
+  end
+  write("# comment\nreturn debug.getinfo(1, 'l').currentline")
+  f = T.testC("loadfilemapped 2 bt; return 1", fname)
+  assert(f() == 2)
+  write("")   -- empty file cannot be mapped
+  f = T.testC("loadfilemapped 2 bt; return 1", fname)
+  assert(f() == nil)
+  os.remove(fname)
+end
+
+do   -- cache of compiled chunks
+  local fname = os.tmpname()
+  local dir = string.match(fname, "^(.*)[/\\]") or "."
+  local function hash (s)   -- FNV-1a, as used by the cache
+    local h = 2166136261
+    for i = 1, #s do h = (h ~ string.byte(s, i)) * 16777619 end
+    return h & math.maxinteger
+  end
+  local cname = string.format("%s/%d.luac", dir, hash(fname))
+  local function write (code)
+    local f = assert(io.open(fname, "wb"))
+    f:write(code); f:close()
+  end
+  local function load (strip)
+    return T.testC("chunkcache 3 " .. strip .. "; loadfile 2; return 1",
+                   fname, dir)
+  end
+  write("# comment\nlocal x = ...; return x, debug.getinfo(1, 'l').currentline")
+  local f = load(0)
+  local cache = debug.getregistry()._CHUNKCACHE
+  assert(cache.misses == 1 and cache.hits == 0)
+  local a, b = f(10); assert(a == 10 and b == 2)
+  assert(io.open(cname)):close()   -- cache file was created
+  f = T.testC("loadfile 2; return 1", fname)   -- reuse cached chunk
+  assert(cache.misses == 1 and cache.hits == 1 and cache.saved)
+  a, b = f(20); assert(a == 20 and b == 2)
+  -- stripping is part of the key
+  f = load(1)
+  cache = debug.getregistry()._CHUNKCACHE
+  assert(cache.misses == 1 and cache.hits == 0)
+  a, b = f(30); assert(a == 30 and b == 2)
+  f = T.testC("loadfile 2; return 1", fname)
+  assert(cache.misses == 1 and cache.hits == 1)
+  a, b = f(40); assert(a == 40 and b == -1)   -- cached code was stripped
+  -- changed source invalidates the entry
+  write("return 'new'")
+  f = T.testC("loadfile 2; return 1", fname)
+  assert(cache.misses == 2 and f() == "new")
+  -- errors are not cached
+  write("return +")
+  check3("near '%+'", T.testC("loadfile 2; return *", fname))
+  assert(cache.misses == 3)
+  -- corrupted cache file is ignored
+  write("return 'new'")
+  local f = assert(io.open(cname, "rb"))
+  local header = f:read("L"); f:close()
+  f = assert(io.open(cname, "wb"))
+  f:write(header, "\27Lua garbage"); f:close()
+  f = T.testC("loadfile 2; return 1", fname)
+  assert(cache.misses == 4 and f() == "new")
+  -- binary chunks are not cached
+  write(string.dump(function () return 'bin' end))
+  f = T.testC("loadfile 2; return 1", fname)
+  assert(cache.misses == 4 and cache.hits == 1 and f() == "bin")
+  T.testC("chunkcache 2 0", nil)   -- disable cache
+  assert(debug.getregistry()._CHUNKCACHE == nil)
+  os.remove(fname)
+  os.remove(cname)
+end
 
 -- test errors in non protected threads
 local function checkerrnopro (code, msg)
@@ -712,6 +896,72 @@ do   -- testing getfield/setfield with long keys
   _012345678901234567890123456789012345678901234567890123456789 = nil
 end
 
+do   -- pre-interned keys
+  T.testC("newkey 1 x; newkey 2 y")
+  local t = {x = 10}
+  local a, b = T.testC("getfieldk 2 1; getfieldk 2 2; return 2", t)
+  assert(a == 10 and b == nil)
+  T.testC("pushint 20; setfieldk 2 2", t)
+  assert(t.y == 20)
+  assert(T.testC("pushkey 1; return 1") == "x")
+  -- keys go through metamethods
+  local p = setmetatable({}, {__index = t,
+                              __newindex = function (t, k, v)
+                                             rawset(t, k, v * 2)
+                                           end})
+  assert(T.testC("getfieldk 2 2; return 1", p) == 20)
+  T.testC("pushint 5; setfieldk 2 1", p)
+  assert(rawget(p, "x") == 10 and t.x == 10)
+  -- the same name gives the same key
+  T.testC("newkey 3 x")
+  assert(T.testC("pushkey 3; return 1") == "x")
+  -- keys are never collected
+  local name = string.format("key_%p", {})   -- a fresh string
+  local len = #name
+  T.testC("newkey 4 " .. name)
+  name = nil
+  collectgarbage(); collectgarbage()
+  name = T.testC("pushkey 4; return 1")
+  assert(#name == len and string.find(name, "^key_"))
+  t[name] = 30
+  assert(T.testC("getfieldk 2 4; return 1", t) == 30)
+end
+
+do   -- bulk access to arrays of numbers
+  local a = T.testC("createarray 5; return 1")
+  assert(#a == 5 and a[1] == 0.5 and a[5] == 4.5 and math.type(a[2]) == "float")
+  assert(T.querytab(a) == 5)    -- all elements in the array part
+  a = T.testC("createarray 0; return 1")
+  assert(next(a) == nil)
+
+  -- range inside and after the array part
+  a = {10, 20, 30}
+  T.testC("rawsetarray 2 3 4", a)
+  assert(#a == 6 and a[2] == 20 and a[3] == 0.5 and a[6] == 3.5)
+  assert(T.querytab(a) == 6)
+  -- range away from the array part
+  a = {}
+  T.testC("rawsetarray 2 -1 3", a)
+  assert(a[-1] == 0.5 and a[0] == 1.5 and a[1] == 2.5)
+  T.testC("rawsetarray 2 100 2", a)
+  assert(a[100] == 0.5 and a[101] == 1.5)
+  -- no metamethods
+  a = setmetatable({}, {__newindex = error, __index = error})
+  T.testC("rawsetarray 2 1 3", a)
+  assert(rawlen(a) == 3 and rawget(a, 3) == 2.5)
+
+  -- copy stops at the first value that is not a number
+  a = {1, 2.5, 3, "4", 5}
+  local t = pack(T.testC("rawgetarray 2 1 5; return *", a))
+  tcheck(t, {n = 5, a, 3, 1.0, 2.5, 3.0})
+  assert(math.type(t[4]) == "float")
+  t = pack(T.testC("rawgetarray 2 4 2; return *", a))
+  tcheck(t, {n = 2, a, 0})
+  a = {[-1] = 7, [0] = 8}
+  t = pack(T.testC("rawgetarray 2 -1 3; return *", a))
+  tcheck(t, {n = 4, a, 2, 7.0, 8.0})
+end
+
 -- testing next
 a = {}
 t = pack(T.testC("next; return *", a, nil))
@@ -1178,6 +1428,51 @@ assert(T.doremote(L1, "return a.x") == "1")
 
 T.closestate(L1)
 
+
+-- state using a pool for small blocks (option LUA_NSPOOL)
+assert(collectgarbage("pool") == nil)   -- main state does not use one
+L1 = T.newstate(1)
+T.loadlib(L1, ~0, 0)
+a, b, c = T.doremote(L1, [[
+  local a = {}
+  for i = 1, 1000 do a[i] = {i, tostring(i), function () return i end} end
+  local s1 = collectgarbage("pool")
+  a = nil
+  collectgarbage()
+  local s2 = collectgarbage("pool")
+  assert(s1.nalloc > 4000 and s2.nfree - s1.nfree > 4000)
+  assert(s2.inuse < s1.inuse and s1.inuse <= s1.reserved)
+  a = {}   -- reuse freed blocks
+  for i = 1, 1000 do a[i] = {i, tostring(i), function () return i end} end
+  return tostring(collectgarbage("pool").reserved == s1.reserved)
+]])
+assert(a == "true")
+T.closestate(L1)
+
+-- state freeing dead objects in the background (option LUA_NSBGFREE)
+assert(collectgarbage("bgfree") == 0)   -- main state has no thread
+L1 = T.newstate(2)
+T.loadlib(L1, ~0, 0)
+a = T.doremote(L1, [[
+  local limit = collectgarbage("bgfree")
+  if limit > 0 then   -- platform has threads?
+    assert(collectgarbage("bgfree", 16) == limit)
+    assert(collectgarbage("bgfree") == 16)
+  end
+  collectgarbage()
+  local m = collectgarbage("count")
+  for i = 1, 50 do
+    local t = {}
+    for j = 1, 1000 do t[j] = j end
+    local s = string.rep("x", 10000 + i)
+  end
+  collectgarbage()
+  -- freed blocks are accounted when queued
+  return tostring(collectgarbage("count") < m + 100)
+]])
+assert(a == "true")
+T.closestate(L1)
+
 L1 = nil
 
 print('+')
@@ -0,0 +1,60 @@
+/*
+** Allocation throughput: the same object churn run in a state using
+** the libc allocator and in a state using the pool for small blocks.
+** Usage: allocbench [rounds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static const char churn[] =
+  "local n = ...\n"
+  "for r = 1, n do\n"
+  "  local a = {}\n"
+  "  for i = 1, 1000 do\n"
+  "    a[i] = {i, 'k' .. i % 64, function () return i end}\n"
+  "  end\n"
+  "end\n";
+
+
+static double run (const char *name, lua_State *L, int rounds) {
+  clock_t t0;
+  double secs;
+  if (L == NULL) {
+    fprintf(stderr, "%s: cannot create state\n", name);
+    exit(EXIT_FAILURE);
+  }
+  luaL_openlibs(L);
+  if (luaL_loadstring(L, churn) != LUA_OK) {
+    fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  lua_pushinteger(L, rounds);
+  t0 = clock();
+  if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+    fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  lua_gc(L, LUA_GCCOLLECT);
+  secs = (double)(clock() - t0) / CLOCKS_PER_SEC;
+  printf("%-6s %8.3f s  %10.0f objects/s\n", name, secs,
+         (rounds * 4000.0) / secs);
+  lua_close(L);
+  return secs;
+}
+
+
+int main (int argc, char **argv) {
+  int rounds = (argc > 1) ? atoi(argv[1]) : 2000;
+  double libc, pool;
+  libc = run("libc", lua_newstate(luaL_alloc, NULL, 0), rounds);
+  pool = run("pool", lua_newstatex(luaL_alloc, NULL, 0, LUA_NSPOOL), rounds);
+  printf("speedup %.2fx\n", libc / pool);
+  return 0;
+}
@@ -0,0 +1,71 @@
+/*
+** Cost of freeing garbage on the thread running Lua: the same churn of
+** objects with large blocks (arrays, hash parts, long strings) run in
+** a state that frees synchronously and in a state with a background
+** freeing thread (option LUA_NSBGFREE). Reports wall-clock times.
+** Usage: bgfreebench [rounds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static const char churn[] =
+  "local n = ...\n"
+  "local s = string.rep('x', 300)\n"
+  "for r = 1, n do\n"
+  "  local a = {}\n"
+  "  for i = 1, 1000 do\n"
+  "    local t = table.create and table.create(64) or {}\n"
+  "    for j = 1, 64 do t[j] = j end\n"
+  "    a[i] = {t, s .. i, {x = i, y = i, z = i, w = i, v = i}}\n"
+  "  end\n"
+  "end\n";
+
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+static double run (const char *name, lua_State *L, int rounds) {
+  double t0, secs;
+  if (L == NULL) {
+    fprintf(stderr, "%s: cannot create state\n", name);
+    exit(EXIT_FAILURE);
+  }
+  luaL_openlibs(L);
+  if (luaL_loadstring(L, churn) != LUA_OK) {
+    fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  lua_pushinteger(L, rounds);
+  t0 = now();
+  if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+    fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  lua_gc(L, LUA_GCCOLLECT);
+  secs = now() - t0;
+  printf("%-6s %8.3f s  (limit %d KB)\n", name, secs,
+         lua_gc(L, LUA_GCBGFREE, -1));
+  lua_close(L);
+  return secs;
+}
+
+
+int main (int argc, char **argv) {
+  int rounds = (argc > 1) ? atoi(argv[1]) : 500;
+  double sync, bg;
+  sync = run("sync", lua_newstate(luaL_alloc, NULL, 0), rounds);
+  bg = run("bg", lua_newstatex(luaL_alloc, NULL, 0, LUA_NSBGFREE), rounds);
+  printf("speedup %.2fx\n", sync / bg);
+  return 0;
+}
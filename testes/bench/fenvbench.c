@@ -0,0 +1,155 @@
+/*
+** Cost of 'setfenv'/'getfenv' on functions and threads: the native
+** API ('lua_setfenv'/'lua_getfenv') against the former emulation
+** through the debug interface, which rewrote the first upvalue and kept
+** thread environments in the registry.
+** Usage: fenvbench [rounds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static const char loop[] =
+  "local setfenv, getfenv, n = ...\n"
+  "local f = load('return x')\n"
+  "local env = {x = 1}\n"
+  "for i = 1, n do\n"
+  "  setfenv(f, env); assert(getfenv(f) == env)\n"
+  "  setfenv(0, env); assert(getfenv(0) == env)\n"
+  "end\n";
+
+
+/*
+** {======================================================
+** Emulation through the debug interface
+** =======================================================
+*/
+
+static int dbg_setfenv (lua_State *L) {
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 2);
+  if (lua_isfunction(L, 1)) {
+    if (lua_setupvalue(L, 1, 1) == NULL)
+      return luaL_error(L, "unable to set environment");
+  }
+  else {
+    int level = (int)luaL_checkinteger(L, 1);
+    if (level == 0) {
+      lua_pushthread(L);
+      lua_pushvalue(L, 2);
+      lua_rawset(L, LUA_REGISTRYINDEX);
+    }
+    else {
+      lua_Debug ar;
+      if (lua_getstack(L, level, &ar) == 0 ||
+          lua_getinfo(L, "f", &ar) == 0 || lua_iscfunction(L, -1))
+        return luaL_error(L, "invalid level");
+      lua_pushvalue(L, 2);
+      lua_setupvalue(L, -2, 1);
+      lua_pop(L, 1);
+    }
+  }
+  lua_pushvalue(L, 1);
+  return 1;
+}
+
+
+static int dbg_getfenv (lua_State *L) {
+  if (lua_isfunction(L, 1)) {
+    const char *name = lua_getupvalue(L, 1, 1);
+    if (name == NULL || strcmp(name, "_ENV") != 0) {
+      lua_pop(L, 1);
+      lua_pushglobaltable(L);
+    }
+  }
+  else {  /* level 0: the thread */
+    lua_pushthread(L);
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    if (lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      lua_pushglobaltable(L);
+    }
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Native environments
+** =======================================================
+*/
+
+static int api_setfenv (lua_State *L) {
+  luaL_checktype(L, 2, LUA_TTABLE);
+  if (lua_isfunction(L, 1))
+    lua_pushvalue(L, 1);
+  else {
+    luaL_argcheck(L, luaL_checkinteger(L, 1) == 0, 1, "level 0 expected");
+    lua_pushthread(L);
+  }
+  lua_pushvalue(L, 2);
+  if (!lua_setfenv(L, -2))
+    return luaL_error(L, "unable to set environment");
+  lua_pushvalue(L, 1);
+  return 1;
+}
+
+
+static int api_getfenv (lua_State *L) {
+  if (!lua_isfunction(L, 1))
+    lua_pushthread(L);
+  lua_getfenv(L, -1);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static double run (const char *name, lua_CFunction set, lua_CFunction get,
+                   int rounds) {
+  lua_State *L = luaL_newstate();
+  clock_t t0;
+  double secs;
+  if (L == NULL) {
+    fprintf(stderr, "%s: cannot create state\n", name);
+    exit(EXIT_FAILURE);
+  }
+  luaL_openlibs(L);
+  if (luaL_loadstring(L, loop) != LUA_OK) {
+    fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  lua_pushcfunction(L, set);
+  lua_pushcfunction(L, get);
+  lua_pushinteger(L, rounds);
+  t0 = clock();
+  if (lua_pcall(L, 3, 0, 0) != LUA_OK) {
+    fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  secs = (double)(clock() - t0) / CLOCKS_PER_SEC;
+  printf("%-6s %8.3f s  %10.0f calls/s\n", name, secs,
+         (rounds * 4.0) / secs);
+  lua_close(L);
+  return secs;
+}
+
+
+int main (int argc, char **argv) {
+  int rounds = (argc > 1) ? atoi(argv[1]) : 2000000;
+  double dbg, api;
+  dbg = run("debug", dbg_setfenv, dbg_getfenv, rounds);
+  api = run("native", api_setfenv, api_getfenv, rounds);
+  printf("speedup %.2fx\n", dbg / api);
+  return 0;
+}
@@ -0,0 +1,77 @@
+/*
+** Numeric loops run by the interpreter and with the compiler of hot
+** loops ('lua_jit') on: integer and float arithmetic, comparisons, and
+** reads and writes of the array part of a table.
+** Usage: jitbench [rounds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static const char loops[] =
+  "local n = ...\n"
+  "local t, s, x = {}, 0, 0.0\n"
+  "for i = 1, 1000 do t[i] = i end\n"
+  "for r = 1, n do\n"
+  "  for i = 1, 1000 do\n"
+  "    s = s + t[i] * 3 - i % 7\n"
+  "    x = x + i * 0.5\n"
+  "    if s > 1000000 then s = s - 1000000 end\n"
+  "    t[i] = s\n"
+  "  end\n"
+  "end\n"
+  "return s + x\n";
+
+
+static double run (const char *name, int jit, int rounds,
+                   lua_Number *res) {
+  lua_State *L = luaL_newstate();
+  clock_t t0;
+  double secs;
+  if (L == NULL) {
+    fprintf(stderr, "%s: cannot create state\n", name);
+    exit(EXIT_FAILURE);
+  }
+  luaL_openlibs(L);
+  if (jit && !lua_jit(L, LUA_JITON)) {
+    fprintf(stderr, "%s: compiler not available\n", name);
+    exit(EXIT_FAILURE);
+  }
+  if (luaL_loadstring(L, loops) != LUA_OK) {
+    fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  lua_pushinteger(L, rounds);
+  t0 = clock();
+  if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+    fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  secs = (double)(clock() - t0) / CLOCKS_PER_SEC;
+  *res = lua_tonumber(L, -1);
+  printf("%-6s %8.3f s  %10.0f iterations/s  (%d loops compiled)\n",
+         name, secs, (rounds * 1000.0) / secs, lua_jit(L, LUA_JITCOUNT));
+  lua_close(L);
+  return secs;
+}
+
+
+int main (int argc, char **argv) {
+  int rounds = (argc > 1) ? atoi(argv[1]) : 20000;
+  double interp, jit;
+  lua_Number r1, r2;
+  interp = run("interp", 0, rounds, &r1);
+  jit = run("jit", 1, rounds, &r2);
+  if (r1 != r2) {
+    fprintf(stderr, "different results: %.14g x %.14g\n", r1, r2);
+    return EXIT_FAILURE;
+  }
+  printf("speedup %.2fx\n", interp / jit);
+  return 0;
+}
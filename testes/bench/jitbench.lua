@@ -0,0 +1,103 @@
+-- $Id: testes/bench/jitbench.lua $
+-- See Copyright Notice in file lua.h
+
+-- Times some loops run by the interpreter ('luaV_execute') and with the
+-- compiler of hot loops on, checking that both give the same results.
+-- Usage: lua jitbench.lua [rounds]
+
+local rounds = tonumber(arg and arg[1]) or 20000
+
+local loops = {}
+
+loops["integer arithmetic"] = function (n)
+  local s = 0
+  for r = 1, n do
+    for i = 1, 1000 do
+      s = s + i * 3 - i % 7
+      if s > 1000000 then s = s - 1000000 end
+    end
+  end
+  return s
+end
+
+loops["float arithmetic"] = function (n)
+  local x, y = 0.0, 1.5
+  for r = 1, n do
+    for i = 1, 1000 do x = x * 0.5 + y; y = y + i * 0.25 end
+  end
+  return x + y
+end
+
+loops["array access"] = function (n)
+  local t, s = {}, 0
+  for i = 1, 1000 do t[i] = i end
+  for r = 1, n do
+    for i = 1, 1000 do
+      s = s + t[i]
+      if s > 1000000 then s = s - 1000000 end
+      t[i] = s
+    end
+  end
+  return s
+end
+
+loops["while inside for"] = function (n)
+  local s = 0
+  for r = 1, n do
+    local i = 0
+    while i < 1000 do i = i + 1; s = s + i % 4 end
+  end
+  return s
+end
+
+-- loops with other instructions are not compiled: both columns
+-- should be about the same
+loops["bitwise (not compiled)"] = function (n)
+  local s = 0
+  for r = 1, n do
+    for i = 1, 1000 do s = (s + i) & 0xffff end
+  end
+  return s
+end
+
+loops["calls (not compiled)"] = function (n)
+  local function f (x) return x + 1 end
+  local s = 0
+  for r = 1, n // 10 do
+    for i = 1, 1000 do s = f(s) end
+  end
+  return s
+end
+
+local function time (f)
+  local t0 = os.clock()
+  local res = f(rounds)
+  return os.clock() - t0, res
+end
+
+if not jit.on() then
+  print("compiler of hot loops not available in this platform")
+  os.exit(1)
+end
+
+local names = {}
+for name in pairs(loops) do names[#names + 1] = name end
+table.sort(names)
+
+print(string.format("%-24s %12s %12s %8s", "loop", "interpreter",
+                    "compiled", "speedup"))
+local ti, tc = 0, 0
+for _, name in ipairs(names) do
+  -- a fresh closure for each run, as compiled code stays in the prototype
+  local src = string.dump(loops[name])
+  jit.off()
+  local t1, r1 = time(load(src))
+  jit.on()
+  local t2, r2 = time(load(src))
+  jit.off()
+  assert(r1 == r2, name)
+  ti, tc = ti + t1, tc + t2
+  print(string.format("%-24s %11.3fs %11.3fs %7.2fx", name, t1, t2, t1 / t2))
+end
+print(string.format("%-24s %11.3fs %11.3fs %7.2fx", "total", ti, tc, ti / tc))
+print("loops compiled: " .. select(2, jit.status()))
@@ -67,6 +67,30 @@ do
 end
 
 
+do  -- closures with read-only upvalues are reused
+  local function f () return function () return 1 end end
+  assert(f() == f())   -- no upvalues
+  local function g (x) local y <const> = x; return function () return y end end
+  assert(g(1) == g(1) and g(1) ~= g(2) and g(2)() == 2)
+  -- values that are equal but not the same
+  assert(math.type(g(1)()) == "integer" and math.type(g(1.0)()) == "float")
+  assert(1/g(0.0)() == math.huge and 1/g(-0.0)() == -math.huge)
+  local function h (x) return function () return x end end
+  assert(h(1) ~= h(1))   -- regular upvalue
+  local t = {}
+  for i = 1, 4 do
+    local c <const> = i // 2
+    t[i] = function () return c end
+  end
+  assert(t[1] ~= t[2] and t[2] == t[3] and t[3] ~= t[4] and t[4]() == 2)
+  -- a reused closure does not keep its upvalues alive
+  local w = setmetatable({}, {__mode = "k"})
+  do local o = {}; w[o] = true; g(o) end
+  collectgarbage()
+  assert(next(w) == nil)
+end
+
+
 -- testing closures with 'for' control variable
 a = {}
 for i=1,10 do
@@ -132,6 +132,15 @@ check(function (x)   -- function creates upvalues
 end, 'CLOSURE', 'NEWTABLE', 'EXTRAARG', 'GETTABUP', 'CALL',
      'SETLIST', 'CALL', 'RETURN')
 
+-- constructors with only constants clone a template
+check(function ()
+  local a = {0, 0, 0, 1}
+  local b = {Name = "x", Type = "y", [10] = true, 1.5}
+  local c = {x = nil}
+  local d = {1, a}
+end, 'NEWTABLEK', 'NEWTABLEK', 'NEWTABLE', 'EXTRAARG', 'LOADK', 'LOADNIL',
+     'SETTABLE', 'NEWTABLE', 'EXTRAARG', 'LOADI', 'MOVE', 'SETLIST', 'RETURN0')
+
 
 -- sequence of LOADNILs
 check(function ()
@@ -483,10 +492,25 @@ do   -- basic check for SETLIST
 end
 
 
+do   -- commands with constant arguments use OP_CMD
+  local mk = load("return cmd(zoom,2;zoom,1.5,'s';zoom), cmd(zoom,X)")
+  if mk then   -- 'cmd' lists are enabled
+    local f, g = mk()
+    check(f, 'CMD', 'EXTRAARG', 'CMD', 'EXTRAARG', 'EXTRAARG', 'CMD',
+             'RETURN0')
+    check(g, 'SELF', 'GETTABUP', 'CALL', 'RETURN0')
+    local t = {}
+    local o = {zoom = function (self, ...) t[#t + 1] = {...} end}
+    f(o)
+    assert(#t == 3 and t[1][1] == 2 and t[2][2] == 's' and #t[3] == 0)
+  end
+end
+
+
 do   print("testing code for integer limits")
   local function checkints (n)
     local source = string.format(
-      "local a = {[true] = 0X%x}; return a[true]", n)
+      "local a = {}; a[true] = 0X%x; return a[true]", n)
     local f = assert(load(source))
     checkKlist(f, {n})
     assert(f() == n)
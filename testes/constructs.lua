@@ -399,6 +399,86 @@ IX = nil
 _G.GLOB1 = nil
 ------------------------------------------------------------------
 
+-- testing 'cmd' lists
+if load("return cmd(x)") then
+  print("testing 'cmd' lists")
+  local log = {}
+  local class = {}
+  function class:a (...) log[#log + 1] = select('#', ...) .. ":" .. (... or "") end
+  function class:y (n) coroutine.yield(n) end
+  local o = setmetatable({}, {__index = class})
+  local f = load([[local u = ...; return
+    cmd(a,1;a,"x",false,nil;a;y,10;a,u;y,20;a,-2.5)]])
+  f = f(3)
+  local co = coroutine.wrap(f)
+  assert(co(o) == 10 and co() == 20); co()
+  assert(table.concat(log, " ") == "1:1 3:x 0: 1:3 1:-2.5")
+  -- '__index' can yield while getting a method
+  local p = setmetatable({}, {__index = function (_, k)
+    return class[coroutine.yield(k)]
+  end})
+  log = {}
+  co = coroutine.wrap(f)
+  assert(co(p) == "a" and co("a") == "a" and co("a") == "a" and
+         co("a") == "y" and co("y") == 10 and co() == "a" and
+         co("a") == "y" and co("y") == 20 and co() == "a")
+  co("a")
+  assert(table.concat(log, " ") == "1:1 3:x 0: 1:3 1:-2.5")
+  f = load("return cmd(a;nope,1)")()
+  local st, msg = pcall(f, o)
+  assert(not st and string.find(msg, "method 'nope'"))
+  -- long lists do not exhaust registers
+  f = load("return cmd(" .. string.rep("a,1;", 500) .. ")")()
+  log = {}; f(o); assert(#log == 500)
+end
+------------------------------------------------------------------
+
+do  print("testing constructors with only constants")
+  local function f ()
+    return {0, 0, 0, 1}, {Name = "x", Type = "y"},
+           {1, 2, x = 3, [10] = "a", [1.5] = true, [2] = 7, [3.0] = 4},
+           {__mode = "k"}
+  end
+  local function check (f)
+    local a, b, c, d = f()
+    local a1, b1 = f()
+    assert(a ~= a1 and b ~= b1)
+    assert(#a == 4 and a[1] == 0 and a[4] == 1)
+    assert(b.Name == "x" and b.Type == "y" and next(b, next(b, next(b))) == nil)
+    assert(c[1] == 1 and c[2] == 2 and c[3] == 4 and math.type(next({[3.0] = 4})) == "integer")
+    assert(c.x == 3 and c[10] == "a" and c[1.5] == true)
+    -- changing a table does not change the next ones
+    a[1] = 10; b.Name = nil; b.z = 1; c[11] = 0
+    a, b, c = f()
+    assert(a[1] == 0 and b.Name == "x" and b.z == nil and c[11] == nil)
+    -- metamethod fields are seen in a copy
+    local t = setmetatable({}, d)
+    d.__index = function () return 10 end
+    assert(t.x == 10 and getmetatable(t).__mode == "k")
+  end
+  check(f)
+  check(load(string.dump(f)))
+  check(load(string.dump(f, true)))
+  -- large constructors
+  local s = {}
+  for i = 1, 300 do s[#s + 1] = i .. ", k" .. i .. " = " .. i .. ".5" end
+  f = load("return {" .. table.concat(s, ",\n") .. "}")
+  for _, g in ipairs{f, load(string.dump(f))} do
+    local t = g(); t[1] = 0; t = g()
+    assert(#t == 300 and t[1] == 1 and t.k300 == 300.5)
+  end
+  -- more items than fit in a SETLIST without an extra argument
+  s = {}
+  for i = 1, 3000 do s[i] = i end
+  f = load("return {" .. table.concat(s, ", ") .. "}")
+  for _, g in ipairs{f, load(string.dump(f))} do
+    local t = g()
+    assert(#t == 3000)
+    for i = 1, 3000 do assert(t[i] == i) end
+  end
+end
+------------------------------------------------------------------
+
 -- testing some syntax errors (chosen through 'gcov')
 checkload("for x do", "expected")
 checkload("x:call", "expected")
@@ -504,6 +504,62 @@ child = setmetatable({}, parent)
 child.foo = 10      --> CRASH (on some machines)
 assert(T == parent and K == "foo" and V == 10)
 
+
+do  print("testing inline caches for constant keys")
+  local function get (o) return o.x end
+  local function call (o) return o:m() end
+  local class = {x = "cx", m = function (self) return self.y end}
+  local obj = setmetatable({y = 1}, {__index = class})
+  for i = 1, 3 do
+    assert(get(obj) == "cx" and call(obj) == 1)
+  end
+  obj.x = "ox"   -- field now in the object itself
+  assert(get(obj) == "ox")
+  for i = 1, 100 do obj["k" .. i] = i end   -- rehash object
+  assert(get(obj) == "ox")
+  obj.x = nil
+  assert(get(obj) == "cx")
+  class.x = nil; class.z = 1   -- 'x' gone from the class
+  assert(get(obj) == nil)
+  getmetatable(obj).__index = {x = "nx", m = function () return 2 end}
+  assert(get(obj) == "nx" and call(obj) == 2)
+  getmetatable(obj).__index = function (_, k) return k end
+  assert(get(obj) == "x")
+  setmetatable(obj, nil)
+  assert(get(obj) == nil)
+  assert(not pcall(get, 10) and not pcall(call, obj))
+
+  if _ENV.T then   -- userdata with a class
+    local u = _ENV.T.newuserdata(0)
+    local mt = {__index = class}
+    debug.setmetatable(u, mt)
+    class.x = "ux"
+    for i = 1, 3 do assert(get(u) == "ux") end
+    mt.__index = {x = "vx", m = function () return 3 end}
+    assert(get(u) == "vx" and call(u) == 3)
+    mt.__index = nil
+    assert(not pcall(get, u))
+  end
+end
+
+
+do  print("testing inline caches for globals")
+  local env = {W = 1}
+  local get = load("return W", "=get", "t", env)
+  for i = 1, 3 do assert(get() == 1) end
+  for i = 1, 100 do env["k" .. i] = i end   -- rehash environment
+  assert(get() == 1)
+  env.W = nil
+  assert(get() == nil)
+  setmetatable(env, {__index = {W = 2}})   -- environment with a parent
+  for i = 1, 3 do assert(get() == 2) end
+  env.W = 3
+  assert(get() == 3)
+  env.W = nil
+  getmetatable(env).__index = function (_, k) return k end
+  assert(get() == "W")
+end
+
 print 'OK'
 
 return 12
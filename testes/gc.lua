@@ -75,6 +75,174 @@ do  print("steps")
 end
 
 
+--
+-- time-limited steps
+--
+do  print("deadline steps")
+  collectgarbage()
+  collectgarbage"stop"
+  local a = {}
+  for i=1,1000 do a[i] = {{}} end
+  a = nil
+  local x = gcinfo()
+  local atomic = false
+  local i = 0
+  repeat   -- do steps until it completes a collection cycle
+    i = i + 1
+    local finished, pastatomic = collectgarbage("deadline", 10)
+    assert(not finished or pastatomic)
+    assert(not (atomic and not pastatomic))  -- cannot go back to marking
+    atomic = pastatomic
+  until finished
+  assert(atomic and gcinfo() < x)
+  -- steps should not unblock the collector
+  assert(not collectgarbage("isrunning"))
+  -- a zero deadline still makes progress
+  i = 0
+  repeat i = i + 1 until collectgarbage("deadline", 0)
+  assert(i > 1)
+  collectgarbage"restart"
+  assert(not pcall(collectgarbage, "deadline", -1))
+end
+
+
+--
+-- pause-time controller
+--
+do  print("pause-time controller")
+  local function churn (n)
+    local a = {}
+    for i = 1, n do a[i % 1000 + 1] = {i} end
+  end
+  collectgarbage()
+  collectgarbage("incremental")
+  local opause = collectgarbage("param", "pause")
+  local ostepmul = collectgarbage("param", "stepmul")
+  local ostepsize = collectgarbage("param", "stepsize")
+  local ominormul = collectgarbage("param", "minormul")
+  local p, h = collectgarbage("target")
+  assert(p == 0 and h == 0)    -- no target by default
+  assert(collectgarbage("target", 1, 100) == 0)   -- unreachable target
+  assert(collectgarbage("param", "pause") == 150)  -- half the overhead
+  churn(200000)
+  local small = collectgarbage("param", "stepsize")
+  assert(small < ostepsize)
+  collectgarbage("target", 1000000)   -- very loose target
+  churn(200000)
+  assert(collectgarbage("param", "stepsize") > small)
+  -- young collections cannot be split; controller leaves minor mode
+  collectgarbage("generational")
+  collectgarbage("target", 1)
+  churn(1000000)
+  assert(collectgarbage("incremental") == "incremental")
+  p, h = collectgarbage("target", 0)   -- turn controller off
+  assert(p == 1 and h == 100)
+  assert(collectgarbage("target") == 0)
+  assert(not pcall(collectgarbage, "target", 10, -1))
+  collectgarbage("param", "pause", opause)
+  collectgarbage("param", "stepmul", ostepmul)
+  collectgarbage("param", "stepsize", ostepsize)
+  collectgarbage("param", "minormul", ominormul)
+end
+
+
+--
+-- statistics of the collector
+--
+do  print("statistics")
+  local function sum (t)
+    local s = 0
+    for _, v in pairs(t) do s = s + v end
+    return s
+  end
+  collectgarbage("incremental")
+  collectgarbage()
+  collectgarbage("stop")
+  collectgarbage("stats", true)   -- reset statistics
+  local s = collectgarbage("stats")
+  assert(s.cycles == 0 and s.freed == 0 and sum(s.pauses) == 0)
+  assert(#s.pauses == 16 and sum(s.traversed) == 0)
+  local a = {}
+  for i = 1, 1000 do a[i] = {{}} end
+  a = nil
+  if T then T.gcevents(true) end
+  collectgarbage()   -- one pause with one complete cycle
+  if T then
+    local start, finish, ministart, minifinish = T.gcevents(false)
+    assert(start == 1 and finish == 1 and ministart == 0 and minifinish == 0)
+  end
+  s = collectgarbage("stats", true)
+  assert(s.cycles == 1 and s.minors == 0 and sum(s.pauses) == 1)
+  assert(s.freed > 2000 * 32)
+  assert(s.traversed.table > 0 and s.traversed["function"] > 0 and
+         s.traversed.thread > 0 and s.traversed.userdata == 0)
+  assert(s.time.minor == 0 and s.time.major == 0)
+  collectgarbage("generational")
+  collectgarbage("restart")
+  if T then T.gcevents(true) end
+  a = {}
+  for i = 1, 100000 do a[i % 100 + 1] = {i} end
+  a = nil
+  if T then
+    local _, _, ministart, minifinish = T.gcevents(false)
+    assert(ministart > 0 and ministart == minifinish)
+  end
+  s = collectgarbage("stats")
+  assert(s.minors > 0 and sum(s.pauses) >= s.minors)
+  assert(s.time.propagate == 0)   -- no incremental cycles
+  collectgarbage("incremental")
+end
+
+
+--
+-- census of the heap
+--
+do  print("census")
+  local function check (c)
+    local s = c.other
+    for _, v in pairs(c) do
+      if type(v) == "table" then
+        assert(v.bytes >= 0 and v.count >= 0 and v.allocs >= v.count)
+        s = s + v.bytes
+      end
+    end
+    assert(s == c.total)
+  end
+  collectgarbage()
+  collectgarbage("stop")
+  local c0 = collectgarbage("census")
+  check(c0)
+  local a = {}
+  for i = 1, 1000 do
+    a[i] = {string.rep("x", 100 + i) .. i, function () return i end}
+  end
+  local c1 = collectgarbage("census")
+  check(c1)
+  assert(c1.table.count >= c0.table.count + 1000)
+  assert(c1.array.bytes > c0.array.bytes)
+  local function strings (c)
+    return c.shortstring.count + c.longstring.count,
+           c.shortstring.bytes + c.longstring.bytes
+  end
+  local n0, b0 = strings(c0)
+  local n1, b1 = strings(c1)
+  assert(n1 >= n0 + 1000 and b1 > b0 + 100 * 1000)
+  assert(c1.lclosure.count >= c0.lclosure.count + 1000)
+  assert(c1.upvalue.count >= c0.upvalue.count + 1000)
+  a = nil
+  collectgarbage("restart")
+  collectgarbage()
+  local c2 = collectgarbage("census")
+  check(c2)
+  assert(c2.table.count < c1.table.count - 900)
+  assert(strings(c2) < n1 - 900)
+  assert(c2.lclosure.count < c1.lclosure.count - 900)
+  for k, v in pairs(c2) do   -- allocation counts never decrease
+    if type(v) == "table" then assert(v.allocs >= c1[k].allocs) end
+  end
+end
+
+
 _G["while"] = 234
 
 
@@ -304,6 +472,31 @@ if T then   -- bug since 5.3: all-weak tables are not being revisited
 end
 
 
+if T then   -- ephemerons converge incrementally, before the atomic phase
+  collectgarbage("stop")
+  T.gcstate("pause")
+  local k = {}
+  local e = setmetatable({}, {__mode = "k"})
+  local function chain ()   -- build chain k -> {} -> {} -> {} -> {}
+    local key = k
+    for i = 1, 4 do local nk = {}; e[key] = nk; key = nk end
+  end
+  local function last ()
+    local key = k
+    for i = 1, 3 do key = e[key] end
+    return e[key]
+  end
+  chain()
+  T.gcstate("propagate")
+  T.gcstate("remark")
+  T.gcstate("enteratomic")
+  assert(T.gccolor(last()) ~= "white")   -- whole chain was already marked
+  T.gcstate("pause")
+  assert(last() ~= nil)
+  collectgarbage("restart")
+end
+
+
 -- 'bug' in 5.1
 a = {}
 local t = {x = 10}
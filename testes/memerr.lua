@@ -127,6 +127,7 @@ end)
 
 do  -- vararg tables
   local function pack (...t) return t end
+  local keep = pack()   -- keeps alive the shape of vararg tables
   local b = testamem("vararg table", function ()
     return pack(10, 20, 30, 40, "hello")
   end)
@@ -318,6 +318,79 @@ end
 local a = {}
 for i=1,lim do a[i] = true; foo(i, table.unpack(a)) end
 
+
+-- testing shapes
+local function nkeys (t) return select(4, T.querytab(t)) end
+if not nkeys({x = 1}) then
+  (Message or print)('\n >>> shapes not active: skipping their tests <<<\n')
+else
+  print("testing shapes")
+  local function keys (t)
+    local res = {}
+    for k in pairs(t) do res[#res + 1] = k end
+    return table.concat(res, " ")
+  end
+
+  local p = {x = 1, y = 2}
+  assert(nkeys(p) == 2); check(p, 0, 2)
+  p.z = 3
+  assert(nkeys(p) == 3 and p.x + p.y + p.z == 6); check(p, 0, 4)
+
+  -- traversal follows insertion order
+  local t = {}
+  t.c = 1; t.a = 2; t.b = 3
+  assert(keys(t) == "c a b")
+  t.a = undef    -- deleted key keeps its place in the shape
+  assert(nkeys(t) == 3 and keys(t) == "c b" and t.a == nil)
+  t.a = 4
+  assert(nkeys(t) == 3 and keys(t) == "c a b" and t.a == 4)
+
+  -- integer keys go to the array part, keeping the shape
+  t[1] = 10; t[2] = 20
+  assert(nkeys(t) == 3 and #t == 2 and t[2] == 20)
+  -- other keys change the table to the usual layout
+  t[100] = 1
+  assert(not nkeys(t) and t[100] == 1 and t.c == 1 and t.a == 4 and t.b == 3)
+  t = {a = 1}; t[true] = 2
+  assert(not nkeys(t) and t.a == 1 and t[true] == 2)
+  t = {a = 1}; t[string.rep("x", 100)] = 2
+  assert(not nkeys(t) and t.a == 1 and t[string.rep("x", 100)] == 2)
+
+  -- too many keys
+  t = {}
+  local i = 0
+  repeat
+    i = i + 1
+    t["k" .. i] = i
+  until not nkeys(t)
+  assert(i > 1 and countentries(t) == i)
+  for j = 1, i do assert(t["k" .. j] == j) end
+
+  -- inline caches with tables with and without shapes
+  local function getx (o) return o.x end
+  local objs = {{x = 1}, {y = 0, x = 2}, {[1.5] = 0, x = 3}, {y = 0, x = 4}}
+  for k = 1, 3 do
+    for j, o in ipairs(objs) do assert(getx(o) == j) end
+  end
+
+  -- tables with weak values
+  t = setmetatable({a = {}, b = 1, c = "x"}, {__mode = "v"})
+  collectgarbage()
+  assert(nkeys(t) == 3 and t.a == nil and keys(t) == "b c")
+
+  -- unused shapes are collected
+  collectgarbage()
+  local m = collectgarbage("count")
+  for j = 1, 200 do
+    local o = {}
+    for k = 1, 10 do o["f" .. j .. "_" .. k] = k end
+  end
+  collectgarbage()
+  assert(collectgarbage("count") <= m + 1)
+  t = {f1_1 = 1}; t.f1_2 = 2
+  assert(nkeys(t) == 2 and keys(t) == "f1_1 f1_2")
+end
+
 end  --]
 
 
@@ -0,0 +1,483 @@
+-- $Id: testes/profiler.lua $
+-- See Copyright Notice in file lua.h
+
+global <const> *
+
+print "testing sampling profiler"
+
+local profiler = require'profiler'
+
+
+local function checkerror (msg, f, ...)
+  local s, err = pcall(f, ...)
+  assert(not s and string.find(err, msg))
+end
+
+
+do  print("quickening")
+  local function stats ()
+    local s = profiler.quicken("stats")
+    return s.rewrites, s.hits, s.deopts
+  end
+  local function f (a, b, t, k)
+    local s = 0
+    for i = 1, 10 do
+      s = s + a * b - i
+      if a < b then s = s + t[k] end
+      t[k] = s
+    end
+    return s
+  end
+  local function code (f)   -- list of opcodes of 'f', if available
+    if not T then return "" end
+    local l = {}
+    for _, i in ipairs(T.listcode(f)) do
+      l[#l + 1] = string.match(i, "%u[%u_]*")
+    end
+    return " " .. table.concat(l, " ") .. " "
+  end
+  local d = string.dump(f)
+  local res = f(1, 2, {0}, 1)
+  assert(not profiler.quicken("isrunning"))
+  profiler.quicken("reset")
+  profiler.quicken("start")
+  assert(profiler.quicken("isrunning"))
+  assert(f(1, 2, {0}, 1) == res)
+  local r, h, o = stats()
+  assert(r > 0 and h > 0 and o == 0)
+  if T then
+    local c = code(f)
+    assert(string.find(c, " MUL_II ") and string.find(c, " LT_II ") and
+           string.find(c, " GETTABLE_A ") and string.find(c, " SETTABLE_A "))
+  end
+  -- quickened code dumps its generic instructions
+  assert(string.dump(f) == d)
+  -- other types deoptimize the instructions, with the same results
+  assert(f(1.0, 2.0, {0.0}, 1) == res)   -- requickened as floats
+  if T then
+    assert(string.find(code(f), " MUL_FF "))
+  end
+  assert(f(1, 2, {[2] = 0}, 2) == res)
+  assert(f(1, 2, setmetatable({}, {__index = function () return 0 end}),
+           1) == res)
+  local _, h1, o1 = stats()
+  assert(h1 > h and o1 > 0)
+  assert(f(1.0, 2.0, {0.0}, 1) == res)
+  -- a function with too many deoptimizations is not quickened anymore
+  for i = 1, 100 do f(i % 2 == 0 and i or i + 0.0, 2, {0}, 1) end
+  r = stats()
+  f(1, 2, {0}, 1); f(1.0, 2.0, {0.0}, 1)
+  assert(stats() == r)
+  -- ... also while it keeps running
+  local function poly (n)
+    local s = 0
+    for i = 1, n do
+      local x = (i % 2 == 0) and i or i + 0.0
+      s = s + x * x
+    end
+    return s
+  end
+  local r0, _, o0 = stats()
+  poly(1000)
+  local r1, _, o2 = stats()
+  assert(r1 - r0 < 50 and o2 - o0 < 50)
+  r = stats()
+  -- errors in quickened instructions are reported as usual
+  local function g (a, b) return a + b end
+  g(1, 2)
+  checkerror("arithmetic on a nil value %(local 'b'%)", g, 1)
+  profiler.quicken("stop")
+  assert(not profiler.quicken("isrunning"))
+  local function h2 (a, b) return a + b end
+  h2(1, 2)
+  assert(stats() == r + 1)   -- 'g' was quickened; 'h2' was not
+  profiler.quicken("reset")
+  assert(stats() == 0)
+end
+
+
+do  print("pairs of instructions")
+  local l, msg = profiler.oppairs()
+  if not l then   -- not counted in this build
+    assert(string.find(msg, "not counted"))
+  else
+    local function find (l, first, second)
+      for _, p in ipairs(l) do
+        assert(p.count > 0 and not string.find(p.first, "_"))
+        if p.first == first and p.second == second then return p.count end
+      end
+      return 0
+    end
+    local t = {a = {b = 1}}
+    local function f (t) return t.a.b end
+    profiler.oppairs("reset")
+    for i = 1, 100 do f(t) end
+    l = profiler.oppairs(math.maxinteger)
+    assert(find(l, "GETFIELD", "GETFIELD") == 100)
+    assert(find(l, "GETFIELD", "RETURN1") == 100)
+    assert(find(l, "CALL", "GETFIELD") == 0)  -- not in the same function
+    l = profiler.oppairs(2)
+    assert(#l == 2 and l[1].count >= l[2].count)
+    profiler.oppairs("reset")
+    l = profiler.oppairs(math.maxinteger)
+    assert(find(l, "GETFIELD", "GETFIELD") == 0)
+  end
+end
+
+
+do  print("compiler of hot loops")
+  -- (the 'jit' library is opened with the standard ones)
+  assert(package.loaded.jit == jit)
+  assert(not jit.status())
+  -- results must be the same with and without compiled loops
+  local function same (src, ...)
+    local r1 = table.pack(pcall(load(src), ...))
+    assert(jit.on() ~= nil)
+    local f = load(src)
+    local r2
+    for i = 1, 3 do r2 = table.pack(pcall(f, ...)) end
+    jit.off()
+    assert(r1.n == r2.n)
+    for i = 1, r1.n do
+      assert(r1[i] == r2[i] or (r1[i] ~= r1[i] and r2[i] ~= r2[i]))
+    end
+    return r2[2]
+  end
+  same[[local s = math.maxinteger - 5 for i = 1, 200 do s = s + i end
+        return s]]
+  same[[local s = 0 for i = 1, 200 do s = s + (i % 7) - (-i % 5) end
+        return s]]
+  same[[local s = 0 for i = 1, 200 do s = s * 3 - i end return s]]
+  same[[local s = 0.5 for i = 1, 200 do s = -s + i / 3 end return s]]
+  -- other types exit the compiled code
+  same[[local s = 0 for i = 1, 200 do if i == 150 then s = 0.5 end
+          s = s + i end return s]]
+  assert(string.find(same[[local s = 0 for i = 1, 200 do
+          if i == 150 then s = {} end s = s + i end return s]],
+         "arithmetic on a table value %(local 's'%)"))
+  -- comparisons, with NaN
+  same[[local c, n = 0, 0/0 for i = 1, 200 do local x = i / 7
+          if x < 10 then c = c + 1 elseif x <= 20 then c = c + 2 end
+          if x > 25 then c = c + 3 end if x >= 27.5 then c = c + 4 end
+          if n < i then c = c + 5 end if not (n >= i) then c = c + 6 end
+          if i ~= 7 then c = c + 7 end end return c]]
+  -- tables: holes, metamethods, and values of other types
+  same[[local t = {} for i = 1, 100 do t[i] = i end local s = 0
+        for i = 1, 300 do s = s + (t[i] or 1) end return s]]
+  same[[local t = setmetatable({1, 2, 3}, {__index = function (_, k)
+          return k * 2 end}) local s = 0 for i = 1, 300 do s = s + t[i] end
+        return s]]
+  same[[local t = {1, 2, 3, 4} for i = 1, 300 do
+          t[1] = t[1] + i; t[2] = i % 2 == 0 and "s" or 3.5; t[3] = nil;
+          t[4] = i > 100 end return t[1], t[2], t[3], t[4], #t]]
+  -- upvalues and nested loops
+  same[[local u = 5 local function f () local s = 0
+          for i = 1, 300 do s = s + u end return s end return f()]]
+  same[[local s = 0 for i = 1, 100 do for j = 1, i do s = s + j end
+          for j = 10, 1, -1 do s = s + j end end return s]]
+  same[[local s = 0 for i = 1.0, 100 do s = s + i end return s]]
+
+  -- a compiled loop stops for hooks
+  local function f (n) local s = 0 for i = 1, n do s = s + i end return s end
+  local count = 0
+  local function hook () count = count + 1 end
+  debug.sethook(hook, "", 1)
+  f(1000)
+  debug.sethook()
+  local c1 = count
+  if jit.on() then
+    assert(jit.status())
+    local _, n = jit.status()
+    for i = 1, 100 do f(10) end
+    assert(select(2, jit.status()) == n + 1)   -- one more loop compiled
+    count = 0
+    debug.sethook(hook, "", 1)
+    f(1000)
+    debug.sethook()
+    assert(count == c1)   -- every instruction was counted
+    -- compiled code dumps its generic instructions
+    assert(load(string.dump(f))(1000) == 500500)
+    if T then
+      local ok = false
+      for _, i in ipairs(T.listcode(f)) do
+        ok = ok or string.find(i, "FORLOOP_JIT")
+      end
+      assert(ok)
+    end
+  end
+  jit.off()
+  assert(not jit.status())
+end
+
+
+do  print("heap snapshots")
+  local f1, f2 = os.tmpname(), os.tmpname()
+  package.loaded.leaky = {cache = {}, other = {}}
+  local function add (t, n)
+    for i = 1, n do t[#t + 1] = {i, tostring(i) .. "x"} end
+  end
+  add(package.loaded.leaky.other, 10)
+  assert(profiler.snapshot(f1))
+  add(package.loaded.leaky.cache, 1000)
+  -- growth retained through an upvalue
+  local f = (function () local up = {}; return function () return up end end)()
+  package.loaded.leaky.f = f
+  assert(profiler.snapshot(f2))
+  add(f(), 100)
+  local f3 = os.tmpname()
+  assert(profiler.snapshot(f3))
+
+  local d = profiler.heapdiff(f1, f2)
+  assert(d[1].path == "registry._LOADED.leaky.cache")
+  assert(d[1].count == 2000 and d[1].growth > 1000 * 32)
+  assert(d[1].size >= d[1].growth)
+  for i = 2, #d do assert(d[i - 1].growth >= d[i].growth) end
+  assert(#profiler.heapdiff(f1, f2, 1) == 1)
+  assert(#profiler.heapdiff(f2, f2) == 0)   -- no growth
+  d = profiler.heapdiff(f2, f3)
+  assert(d[1].path == "registry._LOADED.leaky.f.<upvalue up>")
+  assert(d[1].count == 100)   -- (its strings are already in 'cache')
+  -- stacks only keep what nothing else does
+  local t = {}
+  local co = coroutine.create(function (t, u) coroutine.yield() end)
+  local u = {}
+  coroutine.resume(co, t, u)
+  package.loaded.leaky.co = co
+  package.loaded.leaky.t = t
+  assert(profiler.snapshot(f1))
+  add(t, 100); add(u, 50)
+  assert(profiler.snapshot(f2))
+  d = profiler.heapdiff(f1, f2)
+  assert(d[1].path == "registry._LOADED.leaky.t" and d[1].count == 100)
+  assert(string.find(d[2].path, "^mainthread%.<stack %d+>$") and
+         d[2].count == 50)   -- (only in stacks)
+
+  checkerror("valid heap snapshot", profiler.heapdiff, f1, "profiler.lua")
+  checkerror("cannot open", profiler.heapdiff, f1, "nonexistent file")
+  local ok, msg = profiler.snapshot("/nonexistent/dir/file")
+  assert(not ok and type(msg) == "string")
+  package.loaded.leaky = nil
+  os.remove(f1); os.remove(f2); os.remove(f3)
+end
+
+
+checkerror("interval must be positive", profiler.start, 0)
+checkerror("invalid number of samples", profiler.start, 100, 0)
+
+if not pcall(profiler.start, 100) then
+  (Message or print)('\n >>> profiler not available <<<\n')
+  print'OK'
+  return
+end
+
+checkerror("already running", profiler.start)
+
+
+-- burn 'secs' seconds of CPU time
+local function spin (secs, f, ...)
+  local t = os.clock()
+  while os.clock() - t < secs do f(...) end
+end
+
+local function busy (n)
+  local s = 0
+  for i = 1, n do s = s + i % 7 end
+  return s
+end
+
+
+-- returns a table mapping stacks to counts, and the total count
+local function parse (out)
+  local t, total = {}, 0
+  for stack, n in string.gmatch(out, "([^\n]*) (%d+)\n") do
+    assert(not t[stack])   -- each stack appears only once
+    t[stack] = tonumber(n)
+    total = total + t[stack]
+  end
+  return t, total
+end
+
+
+do  print("basic sampling")
+  spin(0.2, busy, 1000)
+  local n, lost = profiler.stop()
+  assert(n > 0 and lost >= 0)
+  assert(profiler.stop() == n)   -- stopping again does nothing
+  local out = profiler.dump()
+  local t, total = parse(out)
+  assert(total == n)
+  -- frames are named after the call that first sampled them
+  local leaf = "@profiler.lua:" .. debug.getinfo(busy, "S").linedefined
+  local found = 0
+  for stack, c in pairs(t) do
+    if string.find(stack, ";f" .. leaf .. "$") then   -- 'busy' is the leaf
+      assert(string.find(stack,
+               "main chunk@profiler.lua;spin@profiler.lua:%d+;f@"))
+      found = found + c
+    end
+  end
+  assert(found > 0)
+  assert(profiler.dump() == out)   -- dump does not change samples
+end
+
+
+do  print("ring buffer")
+  profiler.start(100, 5)
+  spin(0.1, busy, 1000)
+  local n = profiler.stop()
+  assert(n > 5)
+  local _, total = parse(profiler.dump())
+  assert(total == 5)   -- only the last samples are kept
+end
+
+
+if jit.on() then  print("sampling compiled loops")
+  -- the inner loop runs only in compiled iterations of the outer one
+  local function loop (m, n)
+    local s = 0
+    for i = 1, m do
+      local j = 0
+      while j < n * (i - 1) do j = j + 1 end
+      s = s + j
+    end
+    return s
+  end
+  local _, c = jit.status()
+  loop(100, 0)
+  assert(select(2, jit.status()) == c + 1)   -- compiled
+  profiler.start(100)
+  assert(loop(2, 10000000) == 10000000)
+  local n = profiler.stop()
+  jit.off()
+  assert(n > 5)   -- samples were taken inside the inner loop
+end
+
+
+do  print("deep stacks")
+  local function deep (n)
+    if n == 0 then return busy(1000)
+    else return (deep(n - 1)) end   -- not a tail call
+  end
+  profiler.start(100)
+  spin(0.1, deep, 100)
+  local n = profiler.stop()
+  assert(n > 0)
+  local t = parse(profiler.dump())
+  for stack in pairs(t) do
+    if string.find(stack, "busy@") then   -- a sample at the bottom?
+      assert(string.find(stack, "^%.%.%.;deep@"))   -- truncated
+    end
+  end
+end
+
+
+do  print("hooks")
+  -- samples are not taken while another hook is active
+  local count = 0
+  debug.sethook(function () count = count + 1 end, "", 1000)
+  profiler.start(100)
+  spin(0.1, busy, 1000)
+  local n, lost = profiler.stop()
+  debug.sethook()
+  assert(n == 0 and lost > 0 and count > 0)
+  -- the profiler leaves no hook behind
+  profiler.start(100)
+  spin(0.05, busy, 1000)
+  profiler.stop()
+  assert(debug.gethook() == nil)
+end
+
+
+do  print("tracer")
+  local function leaf ()
+    local s = 0
+    for i = 1, 100 do s = s + i end
+    return s
+  end
+  local function mid ()
+    for i = 1, 10 do leaf() end
+    return string.rep("x", 3)
+  end
+  local function rec (n)
+    if n > 0 then return (rec(n - 1)) end
+  end
+  local function tail (n) return leaf() end
+
+  local function find (r, f)
+    local line = debug.getinfo(f, "S").linedefined
+    for _, e in ipairs(r) do
+      if e.what == "Lua" and e.line == line then return e end
+    end
+  end
+
+  profiler.trace("reset")
+  assert(#profiler.report() == 0 and not profiler.trace("isrunning"))
+  profiler.trace("start")
+  assert(profiler.trace("isrunning"))
+  for i = 1, 50 do mid() end
+  rec(10)
+  -- errors and tail calls end calls without a return event
+  for i = 1, 10 do assert(not pcall(error, "x")) end
+  for i = 1, 10 do tail() end
+  -- hooks do not disturb the tracer
+  debug.sethook(function () end, "c")
+  assert(debug.gethook() and select(2, debug.gethook()) == "c")
+  debug.sethook()
+  -- coroutines created while tracing are traced too
+  local co = coroutine.wrap(function () leaf(); coroutine.yield(); leaf() end)
+  co(); co()
+  profiler.trace("stop")
+  assert(not profiler.trace("isrunning"))
+  leaf()   -- not traced
+
+  local r = profiler.report("calls")
+  for i = 2, #r do assert(r[i - 1].calls >= r[i].calls) end
+  r = profiler.report()
+  for i = 2, #r do assert(r[i - 1].self >= r[i].self) end
+  for _, e in ipairs(r) do
+    assert(e.calls > 0 and e.self >= 0 and e.total >= e.self - 1e-9)
+  end
+  local eleaf, emid = find(r, leaf), find(r, mid)
+  assert(eleaf.calls == 50 * 10 + 10 + 2 and emid.calls == 50)
+  assert(string.find(emid.name, "^function <profiler.lua:%d+>$"))
+  assert(find(r, rec).calls == 11 and find(r, tail).calls == 10)
+  -- recursive calls are counted once in inclusive time
+  assert(math.abs(find(r, rec).total - find(r, rec).self) < 1e-6)
+  local names = {}
+  for _, e in ipairs(r) do names[e.name] = e end
+  assert(names["string.rep"].calls == 50 and names["string.rep"].what == "C")
+  assert(names["error"].calls == 10 and names["pcall"].calls == 10)
+  assert(names["coroutine.yield"].calls == 1)
+
+  -- time running in a coroutine is not self time of its resume
+  profiler.trace("reset")
+  profiler.trace("start")
+  local function body () for i = 1, 50 do leaf() end coroutine.yield() end
+  co = coroutine.create(body)
+  coroutine.resume(co); coroutine.resume(co)
+  profiler.trace("stop")
+  r = profiler.report()
+  names = {}
+  for _, e in ipairs(r) do names[e.name] = e end
+  local res = names["coroutine.resume"]
+  assert(res.calls == 2 and res.total >= find(r, body).total)
+  assert(res.self < find(r, leaf).self)
+
+  -- tracer keeps its functions alive
+  profiler.trace("start")
+  load("return 1")()
+  collectgarbage()
+  profiler.trace("stop")
+  collectgarbage()
+  local found
+  for _, e in ipairs(profiler.report()) do
+    if e.what == "main" and e.source == '[string "return 1"]' then
+      found = e
+    end
+  end
+  assert(found and found.calls == 1)
+  profiler.trace("reset")
+  assert(#profiler.report() == 0)
+end
+
+print'OK'